@@ -1,39 +1,332 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2001 - 2006 Simon Goodall
+// Copyright (C) 2001 - 2009 Simon Goodall
 
 // $Id: Log.cpp,v 1.11 2006-04-26 15:26:22 simon Exp $
 
 #include "Log.h"
 
 #include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include <SDL/SDL.h>
 
 /* LOG AIMS
  * Will provide  ability to log each type to a different file
  * FREQUENT LOG ACTIONS SHOULD BE IN A #if #endif BLOCK and
  * only included in debug mode
- */ 
+ */
 
 #ifdef DEBUG
   static const bool debug = true;
 #else
   static const bool debug = false;
 #endif
-  
+
 namespace Sear {
-  
+
+// Messages that can be waiting for the log thread. Further messages are
+// dropped rather than making the caller wait, except errors and warnings.
+static const unsigned int QUEUE_SIZE = 1024;
+
+static const char *CATEGORY_NAMES[Log::NUM_CATEGORIES] = {
+  "general",
+  "system",
+  "model",
+  "texture",
+  "terrain",
+  "render",
+  "network",
+  "script",
+  "sound"
+};
+
+typedef struct {
+  Log::LogCategory category;
+  Log::LogLevel type;
+  time_t time;
+  std::string entry;
+} LogRecord;
+
+// Ring of queued messages. Callers only hold s_queue_mutex long enough to
+// swap their message into a free slot; the strings are preallocated so the
+// log thread can swap them back out the same way. This is not a lock free
+// ring: errors and warnings wait for a free slot rather than being dropped,
+// which needs the condition variable and so the mutex anyway, and the
+// __sync builtins are not available on every compiler Sear is built with.
+static LogRecord s_queue[QUEUE_SIZE];
+static unsigned int s_head = 0; // Next record for the log thread
+static unsigned int s_count = 0;
+// Created by the first start and never destroyed, so a writer can not be
+// left holding one after stop.
+static SDL_mutex *s_queue_mutex = NULL;
+static SDL_cond *s_queue_cond = NULL;
+// Messages are only queued while this is set. Only changed with
+// s_queue_mutex held.
+static bool s_running = false;
+// Only used from the thread that calls start and stop
+static SDL_Thread *s_thread = NULL;
+
+// Output, only touched with s_sink_mutex held once started
+static SDL_mutex *s_sink_mutex = NULL;
+static FILE *s_file = NULL;
+static std::string s_filename;
+static unsigned long s_file_bytes = 0;
+static unsigned long s_max_bytes = 0;
+static unsigned int s_max_files = 0;
+
+static unsigned int s_written = 0;
+static unsigned int s_dropped = 0;
+
+int Log::s_verbosity[NUM_CATEGORIES] = { 3, 3, 3, 3, 3, 3, 3, 3, 3 };
+
+static std::string rotatedName(unsigned int i) {
+  if (i == 0) return s_filename;
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%u", i);
+  return s_filename + suffix;
+}
+
+static void rotateLogFile() {
+  fclose(s_file);
+  s_file = NULL;
+  for (unsigned int i = s_max_files; i > 0; --i) {
+    remove(rotatedName(i).c_str());
+    rename(rotatedName(i - 1).c_str(), rotatedName(i).c_str());
+  }
+  // With no old files kept, the log just starts again
+  s_file = fopen(s_filename.c_str(), "w");
+  s_file_bytes = 0;
+}
+
+// Called with s_sink_mutex held, or before the thread is started
+static void outputRecord(const LogRecord &record) {
+  const char *level = Log::getLevelName(record.type);
+  if (record.category == Log::CAT_GENERAL) {
+    printf("[%s] %s\n", level, record.entry.c_str());
+  } else {
+    printf("[%s:%s] %s\n", level, Log::getCategoryName(record.category), record.entry.c_str());
+  }
+
+  if (s_file != NULL) {
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&record.time));
+    const int len = fprintf(s_file, "%s %s %s %s\n", stamp, level,
+                            Log::getCategoryName(record.category), record.entry.c_str());
+    if (len > 0) s_file_bytes += len;
+    if (s_max_bytes > 0 && s_file_bytes >= s_max_bytes) rotateLogFile();
+  }
+  ++s_written;
+}
+
+static int logThread(void *) {
+  std::vector<LogRecord> batch(QUEUE_SIZE);
+  SDL_LockMutex(s_queue_mutex);
+  while (true) {
+    while (s_count == 0 && s_running) SDL_CondWait(s_queue_cond, s_queue_mutex);
+    // Nothing more can be queued once stopped
+    if (s_count == 0) break;
+
+    // Take everything queued in one go
+    const unsigned int n = s_count;
+    for (unsigned int i = 0; i < n; ++i) {
+      LogRecord &record = s_queue[(s_head + i) % QUEUE_SIZE];
+      batch[i].category = record.category;
+      batch[i].type = record.type;
+      batch[i].time = record.time;
+      batch[i].entry.swap(record.entry);
+    }
+    s_head = (s_head + n) % QUEUE_SIZE;
+    s_count -= n;
+    SDL_CondBroadcast(s_queue_cond);
+    SDL_UnlockMutex(s_queue_mutex);
+
+    SDL_LockMutex(s_sink_mutex);
+    for (unsigned int i = 0; i < n; ++i) {
+      outputRecord(batch[i]);
+    }
+    fflush(stdout);
+    if (s_file != NULL) fflush(s_file);
+    SDL_UnlockMutex(s_sink_mutex);
+
+    SDL_LockMutex(s_queue_mutex);
+  }
+  SDL_UnlockMutex(s_queue_mutex);
+  return 0;
+}
+
 void Log::writeLog(const std::string &msg, LogLevel level) {
-  std::string type;
+  if (isEnabled(CAT_GENERAL, level)) writeLog(CAT_GENERAL, level, msg);
+}
+
+void Log::writeLog(LogCategory category, LogLevel level, const std::string &msg, const LogFields &fields) {
+  writeLog(category, level, msg + fields.str());
+}
+
+// Write a message from the calling thread
+static void writeNow(Log::LogCategory category, Log::LogLevel level, const std::string &msg) {
+  LogRecord record;
+  record.category = category;
+  record.type = level;
+  record.time = time(NULL);
+  record.entry = msg;
+  if (s_sink_mutex) SDL_LockMutex(s_sink_mutex);
+  outputRecord(record);
+  if (s_sink_mutex) SDL_UnlockMutex(s_sink_mutex);
+}
+
+void Log::writeLog(LogCategory category, LogLevel level, const std::string &msg) {
+  // Never started, so there are no other threads yet
+  if (s_queue_mutex == NULL) {
+    writeNow(category, level, msg);
+    return;
+  }
+
+  // Copy the message before taking the lock
+  std::string entry(msg);
+  const time_t now = time(NULL);
+
+  SDL_LockMutex(s_queue_mutex);
+  if (s_running && s_count == QUEUE_SIZE && getVerbosity(level) > getVerbosity(LOG_WARNING)) {
+    ++s_dropped;
+    SDL_UnlockMutex(s_queue_mutex);
+    return;
+  }
+  while (s_running && s_count == QUEUE_SIZE) SDL_CondWait(s_queue_cond, s_queue_mutex);
+  if (!s_running) {
+    // Stopped, possibly while waiting for room
+    SDL_UnlockMutex(s_queue_mutex);
+    writeNow(category, level, entry);
+    return;
+  }
+  LogRecord &record = s_queue[(s_head + s_count) % QUEUE_SIZE];
+  record.category = category;
+  record.type = level;
+  record.time = now;
+  record.entry.swap(entry);
+  ++s_count;
+  SDL_CondBroadcast(s_queue_cond);
+  SDL_UnlockMutex(s_queue_mutex);
+}
+
+const char *Log::getCategoryName(LogCategory category) {
+  if (category < 0 || category >= NUM_CATEGORIES) return "unknown";
+  return CATEGORY_NAMES[category];
+}
+
+const char *Log::getLevelName(LogLevel level) {
   switch (level) {
-    case LOG_DEFAULT: type = "Default"; break;
-    case LOG_ERROR: type = "Error"; break;
-    case LOG_WARNING: type = "Warning"; break;
-    case LOG_ERIS: type = "Eris"; break;		
-    case LOG_INFO: type = "Info"; break;
-    default: type="Unknown";
+    case LOG_DEFAULT: return "Default";
+    case LOG_ERROR: return "Error";
+    case LOG_WARNING: return "Warning";
+    case LOG_ERIS: return "Eris";
+    case LOG_INFO: return "Info";
+    case LOG_DEBUG: return "Debug";
+    default: return "Unknown";
   }
-  printf("[%s] %s\n", type.c_str(), msg.c_str());
 }
 
-} /* namespace Sear */
+bool Log::findCategory(const std::string &name, LogCategory &category) {
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    if (name == CATEGORY_NAMES[i]) {
+      category = (LogCategory)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Log::findLevel(const std::string &name, LogLevel &level) {
+  if (name == "error") level = LOG_ERROR;
+  else if (name == "warning") level = LOG_WARNING;
+  else if (name == "default") level = LOG_DEFAULT;
+  else if (name == "info") level = LOG_INFO;
+  else if (name == "debug") level = LOG_DEBUG;
+  else return false;
+  return true;
+}
+
+bool Log::start() {
+  if (s_thread != NULL) return true;
+
+  if (s_queue_mutex == NULL) {
+    s_sink_mutex = SDL_CreateMutex();
+    s_queue_cond = SDL_CreateCond();
+    s_queue_mutex = SDL_CreateMutex();
+  }
+
+  SDL_LockMutex(s_queue_mutex);
+  s_running = true;
+  SDL_UnlockMutex(s_queue_mutex);
+
+  s_thread = SDL_CreateThread(logThread, NULL);
+  if (s_thread == NULL) {
+    fprintf(stderr, "[Log] Error creating log thread: %s\n", SDL_GetError());
+    SDL_LockMutex(s_queue_mutex);
+    s_running = false;
+    SDL_UnlockMutex(s_queue_mutex);
+    return false;
+  }
+  if (debug) printf("[Log] Writing log from background thread\n");
+  return true;
+}
+
+void Log::stop() {
+  if (s_thread == NULL) return;
+
+  // The thread empties the queue before it exits. Messages logged after
+  // this are written by the caller.
+  SDL_LockMutex(s_queue_mutex);
+  s_running = false;
+  SDL_CondBroadcast(s_queue_cond);
+  SDL_UnlockMutex(s_queue_mutex);
+  SDL_WaitThread(s_thread, NULL);
+  s_thread = NULL;
+
+  fflush(stdout);
+  if (s_dropped > 0) {
+    fprintf(stderr, "[Log] %u messages were dropped\n", s_dropped);
+  }
+}
+
+bool Log::setLogFile(const std::string &filename, unsigned long max_bytes, unsigned int max_files) {
+  FILE *file = fopen(filename.c_str(), "a");
+  if (file == NULL) {
+    fprintf(stderr, "[Log] Error opening %s\n", filename.c_str());
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
 
+  if (s_sink_mutex) SDL_LockMutex(s_sink_mutex);
+  if (s_file != NULL) fclose(s_file);
+  s_file = file;
+  s_filename = filename;
+  s_file_bytes = (size > 0) ? size : 0;
+  s_max_bytes = max_bytes;
+  s_max_files = max_files;
+  if (s_sink_mutex) SDL_UnlockMutex(s_sink_mutex);
+  return true;
+}
+
+void Log::closeLogFile() {
+  if (s_sink_mutex) SDL_LockMutex(s_sink_mutex);
+  if (s_file != NULL) fclose(s_file);
+  s_file = NULL;
+  s_filename.clear();
+  if (s_sink_mutex) SDL_UnlockMutex(s_sink_mutex);
+}
+
+void Log::printStats() {
+  if (s_sink_mutex) SDL_LockMutex(s_sink_mutex);
+  printf("Log - Written: %u Dropped: %u Background: %s File: %s\n", s_written,
+         s_dropped, (s_thread != NULL) ? "yes" : "no",
+         (s_file != NULL) ? s_filename.c_str() : "none");
+  if (s_sink_mutex) SDL_UnlockMutex(s_sink_mutex);
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    printf("  %-10s verbosity %d\n", CATEGORY_NAMES[i], s_verbosity[i]);
+  }
+}
+
+} /* namespace Sear */
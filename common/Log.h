@@ -1,6 +1,6 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2001 - 2006 Simon Goodall
+// Copyright (C) 2001 - 2009 Simon Goodall
 
 // $Id: Log.h,v 1.4 2006-04-26 14:38:59 simon Exp $
 
@@ -9,15 +9,58 @@
 
 /*
  * This class handles all text i/o
- * Currently only a basic implementation, future
- * work should build on this base and be able to 
- * distinguish between Log types
- */ 
+ * Messages belong to a category, each with its own level, so that verbose
+ * output from one part of the client can be turned on without the rest.
+ * Once started, messages are queued and written out by a background thread
+ * so that logging does not hold up the frame.
+ */
 
 #include <string>
+#include <sstream>
+
+/*
+ * Messages more verbose than this are compiled out when written through
+ * SEAR_LOG. 0 is errors only, 4 includes debug messages.
+ */
+#ifndef SEAR_LOG_MAX_VERBOSITY
+#ifdef DEBUG
+#define SEAR_LOG_MAX_VERBOSITY 4
+#else
+#define SEAR_LOG_MAX_VERBOSITY 3
+#endif
+#endif
+
+/*
+ * Write a message only if its category is logging at that level. The
+ * message is not built otherwise.
+ */
+#define SEAR_LOG(category, level, message) \
+  do { \
+    if (Sear::Log::isEnabled(category, level)) { \
+      Sear::Log::writeLog(category, level, (message)); \
+    } \
+  } while (0)
 
 namespace Sear {
-	
+
+/*
+ * Extra key=value pairs to go with a log message.
+ * e.g. LogFields().add("model", id).add("ms", time)
+ */
+class LogFields {
+public:
+  template <class T>
+  LogFields &add(const std::string &key, const T &value) {
+    m_fields << ' ' << key << '=' << value;
+    return *this;
+  }
+
+  std::string str() const { return m_fields.str(); }
+
+private:
+  std::ostringstream m_fields;
+};
+
 class Log {
 public:
   /*
@@ -28,16 +71,94 @@ public:
     LOG_ERROR,
     LOG_WARNING,
     LOG_ERIS,
-    LOG_INFO
+    LOG_INFO,
+    LOG_DEBUG
   } LogLevel;
 
+  /*
+   * Parts of the client that can be logged at their own level
+   */
+  typedef enum {
+    CAT_GENERAL = 0,
+    CAT_SYSTEM,
+    CAT_MODEL,
+    CAT_TEXTURE,
+    CAT_TERRAIN,
+    CAT_RENDER,
+    CAT_NETWORK,
+    CAT_SCRIPT,
+    CAT_SOUND,
+    NUM_CATEGORIES
+  } LogCategory;
+
   /*
    * This method records an entry into the relevant log location
-   */ 
+   */
   static void writeLog(const std::string &log_entry, LogLevel type);
-  
-  // TODO: add ability to redirect each Log type to a different file
-  
+
+  static void writeLog(LogCategory category, LogLevel type, const std::string &log_entry);
+  static void writeLog(LogCategory category, LogLevel type, const std::string &log_entry, const LogFields &fields);
+
+  /*
+   * How much detail a level is. Errors are 0, debug messages 4.
+   */
+  static int getVerbosity(LogLevel type) {
+    switch (type) {
+      case LOG_ERROR: return 0;
+      case LOG_WARNING: return 1;
+      case LOG_INFO: return 3;
+      case LOG_DEBUG: return 4;
+      default: return 2;
+    }
+  }
+
+  /*
+   * Cheap check to call before building an expensive message
+   */
+  static bool isEnabled(LogCategory category, LogLevel type) {
+    const int verbosity = getVerbosity(type);
+    return verbosity <= SEAR_LOG_MAX_VERBOSITY && verbosity <= s_verbosity[category];
+  }
+
+  /*
+   * Log messages in a category up to and including the given level
+   */
+  static void setLevel(LogCategory category, LogLevel type) {
+    s_verbosity[category] = getVerbosity(type);
+  }
+
+  static const char *getCategoryName(LogCategory category);
+  static const char *getLevelName(LogLevel type);
+  static bool findCategory(const std::string &name, LogCategory &category);
+  static bool findLevel(const std::string &name, LogLevel &type);
+
+  /*
+   * Start writing messages from a background thread. Until this is called,
+   * and after stop, messages are written as they are logged.
+   */
+  static bool start();
+
+  /*
+   * Write out all queued messages and stop the background thread.
+   */
+  static void stop();
+
+  /*
+   * Copy messages to a file as well as stdout. When the file grows past
+   * max_bytes it is renamed to filename.1, the old filename.1 to
+   * filename.2 and so on, keeping max_files old logs.
+   */
+  static bool setLogFile(const std::string &filename, unsigned long max_bytes, unsigned int max_files);
+  static void closeLogFile();
+
+  /*
+   * Print the number of messages written and dropped, and the level of
+   * each category.
+   */
+  static void printStats();
+
+private:
+  static int s_verbosity[NUM_CATEGORIES];
 };
 
 } /* namespace Sear */
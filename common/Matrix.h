@@ -1,6 +1,6 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2001 - 2006 Simon Goodall
+// Copyright (C) 2001 - 2009 Simon Goodall
 
 // $Id: Matrix.h,v 1.4 2007-02-12 22:41:47 simon Exp $
 
@@ -8,25 +8,36 @@
 #define SEAR_MATRIX_H 1
 
 #include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) && !defined(SEAR_NO_SSE)
+#define SEAR_MATRIX_SSE 1
+#include <xmmintrin.h>
+#endif
 
 namespace Sear {
 
+/**
+ * 4x4 float matrix stored in the same order as OpenGL expects, so
+ * getMatrix() can be handed straight to glMultMatrixf.
+ *
+ * multMatrix and the rotate/translate/scale methods apply the new transform
+ * after the existing one. The apply methods instead multiply in the order
+ * the OpenGL call of the same name does on the current matrix, so a chain
+ * of glTranslatef/glRotatef/glScalef can be built here without the GL
+ * matrix stack and a glGetFloatv readback.
+ *
+ * Rows are loaded unaligned as Matrix objects are stored in std::vectors,
+ * which do not promise 16 byte alignment on all platforms.
+ */
 class Matrix {
 public:
-  void setMatrix(float m[4][4]) {
-    for (int i = 0; i < 4; ++i) {
-      for (int j = 0; j < 4; ++j) {
-        m_matrix[i][j] = m[i][j];
-      }
-    }
+  void setMatrix(const float m[4][4]) {
+    memcpy(m_matrix, m, sizeof(m_matrix));
   }
 
   void getMatrix(float m[4][4]) const {
-    for (int i = 0; i < 4; ++i) {
-      for (int j = 0; j < 4; ++j) {
-        m[i][j] = m_matrix[i][j];
-      }
-    }
+    memcpy(m, m_matrix, sizeof(m_matrix));
   }
 
   const float *getMatrix() const { return &m_matrix[0][0]; }
@@ -91,29 +102,135 @@ public:
     multMatrix(m);
   }
 
-  void multMatrix(float n[4][4]) {
+  void multMatrix(const float n[4][4]) {
+#ifdef SEAR_MATRIX_SSE
+    // Each row of the result is a sum of the rows of n weighted by the
+    // same row of this matrix.
+    const __m128 n0 = _mm_loadu_ps(n[0]);
+    const __m128 n1 = _mm_loadu_ps(n[1]);
+    const __m128 n2 = _mm_loadu_ps(n[2]);
+    const __m128 n3 = _mm_loadu_ps(n[3]);
+    for (int i = 0; i < 4; ++i) {
+      __m128 r = _mm_mul_ps(_mm_set1_ps(m_matrix[i][0]), n0);
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][1]), n1));
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][2]), n2));
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][3]), n3));
+      _mm_storeu_ps(m_matrix[i], r);
+    }
+#else
     float m[4][4];
     // Copy orignal matrix so we can put new values directly into member var.
     getMatrix(m);
-    m_matrix[0][0] = m[0][0] * n[0][0] + m[0][1] * n[1][0] + m[0][2] * n[2][0] + m[0][3] * n[3][0];
-    m_matrix[0][1] = m[0][0] * n[0][1] + m[0][1] * n[1][1] + m[0][2] * n[2][1] + m[0][3] * n[3][1];
-    m_matrix[0][2] = m[0][0] * n[0][2] + m[0][1] * n[1][2] + m[0][2] * n[2][2] + m[0][3] * n[3][2];
-    m_matrix[0][3] = m[0][0] * n[0][3] + m[0][1] * n[1][3] + m[0][2] * n[2][3] + m[0][3] * n[3][3];
-
-    m_matrix[1][0] = m[1][0] * n[0][0] + m[1][1] * n[1][0] + m[1][2] * n[2][0] + m[1][3] * n[3][0];
-    m_matrix[1][1] = m[1][0] * n[0][1] + m[1][1] * n[1][1] + m[1][2] * n[2][1] + m[1][3] * n[3][1];
-    m_matrix[1][2] = m[1][0] * n[0][2] + m[1][1] * n[1][2] + m[1][2] * n[2][2] + m[1][3] * n[3][2];
-    m_matrix[1][3] = m[1][0] * n[0][3] + m[1][1] * n[1][3] + m[1][2] * n[2][3] + m[1][3] * n[3][3];
-
-    m_matrix[2][0] = m[2][0] * n[0][0] + m[2][1] * n[1][0] + m[2][2] * n[2][0] + m[2][3] * n[3][0];
-    m_matrix[2][1] = m[2][0] * n[0][1] + m[2][1] * n[1][1] + m[2][2] * n[2][1] + m[2][3] * n[3][1];
-    m_matrix[2][2] = m[2][0] * n[0][2] + m[2][1] * n[1][2] + m[2][2] * n[2][2] + m[2][3] * n[3][2];
-    m_matrix[2][3] = m[2][0] * n[0][3] + m[2][1] * n[1][3] + m[2][2] * n[2][3] + m[2][3] * n[3][3];
-
-    m_matrix[3][0] = m[3][0] * n[0][0] + m[3][1] * n[1][0] + m[3][2] * n[2][0] + m[3][3] * n[3][0];
-    m_matrix[3][1] = m[3][0] * n[0][1] + m[3][1] * n[1][1] + m[3][2] * n[2][1] + m[3][3] * n[3][1];
-    m_matrix[3][2] = m[3][0] * n[0][2] + m[3][1] * n[1][2] + m[3][2] * n[2][2] + m[3][3] * n[3][2];
-    m_matrix[3][3] = m[3][0] * n[0][3] + m[3][1] * n[1][3] + m[3][2] * n[2][3] + m[3][3] * n[3][3];
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m_matrix[i][j] = m[i][0] * n[0][j] + m[i][1] * n[1][j] + m[i][2] * n[2][j] + m[i][3] * n[3][j];
+      }
+    }
+#endif
+  }
+
+  /**
+   * Multiply by n as glMultMatrixf would.
+   */
+  void applyMatrix(const float n[4][4]) {
+#ifdef SEAR_MATRIX_SSE
+    // Each row of the result is a sum of the rows of this matrix weighted
+    // by the same row of n.
+    const __m128 m0 = _mm_loadu_ps(m_matrix[0]);
+    const __m128 m1 = _mm_loadu_ps(m_matrix[1]);
+    const __m128 m2 = _mm_loadu_ps(m_matrix[2]);
+    const __m128 m3 = _mm_loadu_ps(m_matrix[3]);
+    for (int i = 0; i < 4; ++i) {
+      __m128 r = _mm_mul_ps(_mm_set1_ps(n[i][0]), m0);
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(n[i][1]), m1));
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(n[i][2]), m2));
+      r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(n[i][3]), m3));
+      _mm_storeu_ps(m_matrix[i], r);
+    }
+#else
+    float m[4][4];
+    getMatrix(m);
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m_matrix[i][j] = n[i][0] * m[0][j] + n[i][1] * m[1][j] + n[i][2] * m[2][j] + n[i][3] * m[3][j];
+      }
+    }
+#endif
+  }
+
+  /**
+   * Translate as glTranslatef would.
+   */
+  void applyTranslate(float x, float y, float z) {
+#ifdef SEAR_MATRIX_SSE
+    __m128 r = _mm_loadu_ps(m_matrix[3]);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(x), _mm_loadu_ps(m_matrix[0])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(y), _mm_loadu_ps(m_matrix[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(z), _mm_loadu_ps(m_matrix[2])));
+    _mm_storeu_ps(m_matrix[3], r);
+#else
+    for (int j = 0; j < 4; ++j) {
+      m_matrix[3][j] += x * m_matrix[0][j] + y * m_matrix[1][j] + z * m_matrix[2][j];
+    }
+#endif
+  }
+
+  /**
+   * Scale as glScalef would.
+   */
+  void applyScale(float x, float y, float z) {
+#ifdef SEAR_MATRIX_SSE
+    _mm_storeu_ps(m_matrix[0], _mm_mul_ps(_mm_set1_ps(x), _mm_loadu_ps(m_matrix[0])));
+    _mm_storeu_ps(m_matrix[1], _mm_mul_ps(_mm_set1_ps(y), _mm_loadu_ps(m_matrix[1])));
+    _mm_storeu_ps(m_matrix[2], _mm_mul_ps(_mm_set1_ps(z), _mm_loadu_ps(m_matrix[2])));
+#else
+    for (int j = 0; j < 4; ++j) {
+      m_matrix[0][j] *= x;
+      m_matrix[1][j] *= y;
+      m_matrix[2][j] *= z;
+    }
+#endif
+  }
+
+  /**
+   * Rotate as glRotatef would. The angle is in degrees.
+   */
+  void applyRotate(float angle, float x, float y, float z) {
+    const float len = sqrt(x * x + y * y + z * z);
+    if (len == 0.0f) return;
+    x /= len; y /= len; z /= len;
+
+    const float rad = angle * (M_PI / 180.0f);
+    const float c = cos(rad);
+    const float s = sin(rad);
+    const float t = 1.0f - c;
+
+    float m[4][4];
+    m[0][0] = x * x * t + c;     m[0][1] = y * x * t + z * s; m[0][2] = x * z * t - y * s; m[0][3] = 0.0f;
+    m[1][0] = x * y * t - z * s; m[1][1] = y * y * t + c;     m[1][2] = y * z * t + x * s; m[1][3] = 0.0f;
+    m[2][0] = x * z * t + y * s; m[2][1] = y * z * t - x * s; m[2][2] = z * z * t + c;     m[2][3] = 0.0f;
+    m[3][0] = 0.0f;              m[3][1] = 0.0f;              m[3][2] = 0.0f;              m[3][3] = 1.0f;
+
+    applyMatrix(m);
+  }
+
+  /**
+   * Transform a point, as OpenGL would with this as the modelview matrix.
+   */
+  void transformPoint(const float in[3], float out[3]) const {
+#ifdef SEAR_MATRIX_SSE
+    __m128 r = _mm_loadu_ps(m_matrix[3]);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[0]), _mm_loadu_ps(m_matrix[0])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[1]), _mm_loadu_ps(m_matrix[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[2]), _mm_loadu_ps(m_matrix[2])));
+    float v[4];
+    _mm_storeu_ps(v, r);
+    out[0] = v[0]; out[1] = v[1]; out[2] = v[2];
+#else
+    for (int j = 0; j < 3; ++j) {
+      out[j] = in[0] * m_matrix[0][j] + in[1] * m_matrix[1][j] + in[2] * m_matrix[2][j] + m_matrix[3][j];
+    }
+#endif
   }
 
 protected:
@@ -124,4 +241,4 @@ protected:
 
 } // namespace Sear
 
-#endif // SEAR_MATRIX_H 
+#endif // SEAR_MATRIX_H
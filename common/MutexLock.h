@@ -0,0 +1,39 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_COMMON_MUTEXLOCK_H
+#define SEAR_COMMON_MUTEXLOCK_H 1
+
+#include <SDL/SDL.h>
+
+namespace Sear {
+
+/**
+ * Holds an SDL mutex for the life of the object, so every return path of
+ * a function unlocks it. SDL mutexes are recursive, so a locked function
+ * may call another that takes the same lock.
+ */
+class MutexLock {
+public:
+  explicit MutexLock(SDL_mutex *mutex) :
+    m_mutex(mutex)
+  {
+    SDL_LockMutex(m_mutex);
+  }
+
+  ~MutexLock() {
+    SDL_UnlockMutex(m_mutex);
+  }
+
+private:
+  // Not copyable
+  MutexLock(const MutexLock &);
+  MutexLock &operator=(const MutexLock &);
+
+  SDL_mutex *m_mutex;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_COMMON_MUTEXLOCK_H */
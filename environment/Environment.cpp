@@ -6,6 +6,8 @@
 
 #include <Atlas/Objects/Operation.h>
 
+#include <Mercator/Area.h>
+
 #include "renderers/RenderSystem.h"
 
 #include "src/System.h"
@@ -123,12 +125,14 @@ void Environment::removeArea(Mercator::Area* ar)
   assert(m_initialised == true);
   assert(ar);
   m_terrain->m_terrain.removeArea(ar);
+  m_terrain->invalidateRegion(ar->bbox());
 }
 void Environment::addArea(Mercator::Area* ar)
 {
   assert(m_initialised == true);
   assert(ar);
   m_terrain->m_terrain.addArea(ar);
+  m_terrain->invalidateRegion(ar->bbox());
 }
 
 void Environment::deregisterTerrainShader(Mercator::Shader* shade)
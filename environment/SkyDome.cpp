@@ -11,6 +11,7 @@
 #include "src/Calendar.h"
 
 #include "renderers/RenderSystem.h"
+#include "renderers/TextureManager.h"
 
 #define SQR(X) ((X))
 
@@ -183,6 +184,12 @@ void SkyDome::domeInit(float radius, int levels, int segments) {
     m_textures[0] = RenderSystem::getInstance().requestTexture("atmosphere");
     m_textures[1] = RenderSystem::getInstance().requestTexture("cloud_layer_1");
     m_textures[2] = RenderSystem::getInstance().requestTexture("cloud_layer_2");
+
+    // Keep the first row of the sky gradient for the fog colour, rather
+    // than reading the texture back from GL.
+    if (!RenderSystem::getInstance().getTextureManager()->readImageRow("atmosphere", 0, m_horizonColors)) {
+      std::cerr << "unable to read atmosphere texels" << std::endl;
+    }
   }
 
   if (m_verts) delete [] m_verts;
@@ -237,73 +244,46 @@ void SkyDome::contextCreated() {
   domeInit(m_radius, m_levels, m_segments);
 }
 
-void SkyDome::getHorizonColors()
-{
-    m_horizonColors.clear();
-    
-    RenderSystem::getInstance().switchTexture(m_textures[0]); // atmosphere tex
-    GLint width, height;
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
-    
-    GLubyte* skyTexels = new GLubyte[width * height * 4];
-
-//    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, skyTexels);
-    int glerr = glGetError();
-    if (glerr != GL_NO_ERROR) {
-        std::cerr << "got error while trying to read atmosphere texels" << std::endl;
-        return;
-    }
-
-    GLubyte* texel = skyTexels;
-    for (int S=0; S < width; ++S) {
-        Color_4 c;
-        c.r = *texel++;
-        c.g = *texel++;
-        c.b = *texel++;
-        c.a = *texel++;
-        m_horizonColors.push_back(c);
-    }
-
-    delete[] skyTexels;
-}
-
-void SkyDome::updateFogColor(float t)
+bool SkyDome::interpolateHorizonColor(const std::vector<Color_4> &colours, float t, float color[4])
 {
-    if (m_horizonColors.empty()) getHorizonColors();
-
-    //assert (m_horizonColors.empty() == false);
-    if (m_horizonColors.empty()) return;
+    if (colours.empty()) return false;
 
     // ensure t is in the range [0.0 .. 1.0)
     if (t < 0.0f) t = 0.0f;
     if (t >= 1.0f) t = 0.0f;
        
-    t *= m_horizonColors.size(); // t is now in [0.0 ... num_colors)
+    t *= colours.size(); // t is now in [0.0 ... num_colors)
     
     // offset so integral values map to half way between two pixels
     t -= 0.5f;
-    if (t < 0.0) t+= m_horizonColors.size();
+    if (t < 0.0) t+= colours.size();
     
 // compute I and J indices into horizon colors, then interpolate
 // note this code uses lots of local variables, for clarity, and we only
 // run this once per frame
     unsigned int I = static_cast<unsigned int>(t); // truncation is desired here
-    unsigned int J = (I == (m_horizonColors.size() - 1)? 0 : I + 1);
+    if (I >= colours.size()) I = colours.size() - 1;
+    unsigned int J = (I == (colours.size() - 1)? 0 : I + 1);
     
-    Color_4 lower = m_horizonColors[I],
-        upper = m_horizonColors[J];
+    const Color_4 &lower = colours[I],
+        &upper = colours[J];
     
     const float interp = t - I, // get the fractional part of t
         invInterp = 1.0f - interp;
                 
-    float color[4];
     color[0] = ((lower.r * invInterp) + (upper.r * interp)) / 255.0f;
     color[1] = ((lower.g * invInterp) + (upper.g * interp)) / 255.0f;
     color[2] = ((lower.b * invInterp) + (upper.b * interp)) / 255.0f;
     color[3] = 1.0f;
-    glFogfv(GL_FOG_COLOR, color);
+    return true;
+}
+
+void SkyDome::updateFogColor(float t)
+{
+    float color[4];
+    if (interpolateHorizonColor(m_horizonColors, t, color)) {
+        glFogfv(GL_FOG_COLOR, color);
+    }
 }
 
 void SkyDome::render() {
@@ -22,6 +22,18 @@ public:
   void render();
   void contextCreated();
   void contextDestroyed(bool check);
+
+  /**
+   * Interpolate the horizon colour for a time of day from the colours
+   * along the sky gradient.
+   * @param colours Horizon colours across the day, from the sky texture
+   * @param t Time of day in the range [0.0 .. 1.0)
+   * @param color Filled in with the RGBA colour
+   * @return False if there are no colours to interpolate
+   */
+  static bool interpolateHorizonColor(const std::vector<Color_4> &colours, float t, float color[4]);
+
+  const std::vector<Color_4> &getHorizonColors() const { return m_horizonColors; }
     
 private:
     float* genVerts(float radius, int levels, int segments);
@@ -32,7 +44,6 @@ private:
   void domeInit(float radius, int levels, int segments);
   
   void updateFogColor(float t);
-  void getHorizonColors();
   
   float *m_verts, *m_texCoords;
   int m_size;
@@ -10,6 +10,8 @@
 
 #include "renderers/Render.h"
 
+#include "common/Log.h"
+
 #include <sage/sage.h>
 #include <sage/GLU.h>
 #include <sage/GL.h>
@@ -30,6 +32,7 @@
 #include <Mercator/AreaShader.h>
 #include <Mercator/Area.h>
 #include <Mercator/Surface.h>
+#include <Mercator/TerrainMod.h>
 
 #include <limits>
 #include <iostream>
@@ -96,9 +99,32 @@ void TerrainRenderer::DataSeg::contextDestroyed(bool check) {
   
   m_alphaTextures.clear();
 
+  m_dirty = false;
+
   m_context_no = -1;
 }
 
+void TerrainRenderer::DataSeg::addDirtyRect(int x0, int y0, int x1, int y1) {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, segSize);
+  y1 = std::min(y1, segSize);
+  if (x0 > x1 || y0 > y1) return;
+
+  if (m_dirty) {
+    m_dirty_x0 = std::min(m_dirty_x0, x0);
+    m_dirty_y0 = std::min(m_dirty_y0, y0);
+    m_dirty_x1 = std::max(m_dirty_x1, x1);
+    m_dirty_y1 = std::max(m_dirty_y1, y1);
+  } else {
+    m_dirty_x0 = x0;
+    m_dirty_y0 = y0;
+    m_dirty_x1 = x1;
+    m_dirty_y1 = y1;
+    m_dirty = true;
+  }
+}
+
 void TerrainRenderer::enableRendererState() {
   static const float ambient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
   static const float diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
@@ -276,6 +302,116 @@ void TerrainRenderer::drawRegion (Mercator::Segment * map,
   glActiveTexture (GL_TEXTURE0);
 }
 
+void TerrainRenderer::updateSegment(Mercator::Segment *s, DataSeg &seg) {
+  // Mercator regenerates the whole segment, but only the dirty region
+  // needs to be sent to the card again. Without a dirty region, e.g. when
+  // a base point has moved, the whole segment is refilled.
+  int x0 = 0, y0 = 0, x1 = segSize, y1 = segSize;
+  if (seg.m_dirty) {
+    x0 = seg.m_dirty_x0;
+    y0 = seg.m_dirty_y0;
+    x1 = seg.m_dirty_x1;
+    y1 = seg.m_dirty_y1;
+  }
+
+  s->populate();
+  if (s->getNormals() == 0) {
+    s->populateNormals();
+  }
+  float *normals = s->getNormals();
+
+  const int width = x1 - x0 + 1;
+
+  if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
+    // Rows are contiguous in the buffers, so patch one row at a time
+    float *row = new float[width * 3];
+
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, seg.vb_harray);
+    for (int j = y0; j <= y1; ++j) {
+      int idx = -1;
+      for (int i = x0; i <= x1; ++i) {
+        row[++idx] = i;
+        row[++idx] = j;
+        row[++idx] = s->get(i, j);
+      }
+      glBufferSubDataARB(GL_ARRAY_BUFFER_ARB,
+                         (j * (segSize + 1) + x0) * 3 * sizeof(float),
+                         width * 3 * sizeof(float), row);
+    }
+
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, seg.vb_narray);
+    for (int j = y0; j <= y1; ++j) {
+      const int offset = (j * (segSize + 1) + x0) * 3;
+      glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, offset * sizeof(float),
+                         width * 3 * sizeof(float), normals + offset);
+    }
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    delete [] row;
+  } else {
+    // The normals belong to the segment and have been replaced.
+    seg.narray = normals;
+    for (int j = y0; j <= y1; ++j) {
+      for (int i = x0; i <= x1; ++i) {
+        seg.harray[(j * (segSize + 1) + i) * 3 + 2] = s->get(i, j);
+      }
+    }
+    // The display list holds a copy of the old data
+    if (glIsList(seg.disp)) {
+      glDeleteLists(seg.disp, 1);
+    }
+    seg.disp = 0;
+  }
+
+  // The surfaces were invalidated along with the heights, so the alpha
+  // textures get refilled by generateAlphaTextures. They are resampled to
+  // 64x64 on upload, so there is no sub-region that maps onto the changed
+  // vertices; the existing texture objects are reused instead.
+}
+
+void TerrainRenderer::invalidateRegion(const WFMath::AxisBox<2> &box) {
+  // Normals depend on neighbouring heights, so grow the region by a vertex.
+  const int x0 = (int)floor(box.lowCorner().x()) - 1;
+  const int y0 = (int)floor(box.lowCorner().y()) - 1;
+  const int x1 = (int)ceil(box.highCorner().x()) + 1;
+  const int y1 = (int)ceil(box.highCorner().y()) + 1;
+
+  // Edge vertices are shared between neighbouring segments
+  const int sx0 = (int)floor((float)(x0 - segSize) / segSize);
+  const int sy0 = (int)floor((float)(y0 - segSize) / segSize);
+  const int sx1 = (int)floor((float)x1 / segSize);
+  const int sy1 = (int)floor((float)y1 / segSize);
+
+  DisplayListStore::iterator I = m_displayLists.lower_bound(sx0);
+  DisplayListStore::iterator Iend = m_displayLists.upper_bound(sx1);
+  for (; I != Iend; ++I) {
+    DisplayListColumn &dcol = I->second;
+    DisplayListColumn::iterator J = dcol.lower_bound(sy0);
+    DisplayListColumn::iterator Jend = dcol.upper_bound(sy1);
+    for (; J != Jend; ++J) {
+      const int ox = I->first * segSize;
+      const int oy = J->first * segSize;
+      J->second.addDirtyRect(x0 - ox, y0 - oy, x1 - ox, y1 - oy);
+    }
+  }
+}
+
+void TerrainRenderer::invalidateMod(const Mercator::TerrainMod *mod, bool removed) {
+  ModBoxMap::iterator I = m_mod_boxes.find(mod);
+  if (I != m_mod_boxes.end()) {
+    invalidateRegion(I->second);
+    if (removed) {
+      m_mod_boxes.erase(I);
+      return;
+    }
+  }
+  if (removed) return;
+
+  WFMath::AxisBox<2> box = mod->bbox();
+  invalidateRegion(box);
+  m_mod_boxes[mod] = box;
+}
+
 using Mercator::Terrain;
 
 void TerrainRenderer::drawMap(Mercator::Terrain & t,
@@ -287,8 +423,6 @@ void TerrainRenderer::drawMap(Mercator::Terrain & t,
        upYBound = lrintf (camPos[1]) / (long)segSize + 2;
 
   RenderSystem &rs = RenderSystem::getInstance();
-//  float frustum[6][4];
-//  r->getFrustum (frustum);
 
   const Terrain::Segmentstore & segs = t.getTerrain ();
   Terrain::Segmentstore::const_iterator I = segs.lower_bound (lowXBound);
@@ -310,9 +444,16 @@ void TerrainRenderer::drawMap(Mercator::Terrain & t,
   }
 
 
+  // Gather the segments in range, then test them against the frustum as a
+  // single batch.
+  float frustum[6][4];
+  rs.getFrustum(frustum);
+  m_culler.setFrustum(frustum);
+  m_culler.clear();
+  m_segment_candidates.clear();
+
   for (; I != K; ++I) {
     const Terrain::Segmentcolumn & col = I->second;
-    TerrainRenderer::DisplayListStore::iterator M = m_displayLists.find (I->first);
 
     Terrain::Segmentcolumn::const_iterator J = col.lower_bound (lowYBound);
     Terrain::Segmentcolumn::const_iterator L = col.upper_bound (upYBound);
@@ -341,101 +482,116 @@ void TerrainRenderer::drawMap(Mercator::Terrain & t,
         }
       }
 
-      WFMath::AxisBox<3> box (WFMath::Point <3> (I->first * segSize, J->first * segSize, min), WFMath::Point < 3 > ((I->first + 1) * segSize, (J->first + 1) * segSize, max));
+      m_culler.addBox(I->first * segSize, J->first * segSize, min,
+                      (I->first + 1) * segSize, (J->first + 1) * segSize, max);
 
-      if (!rs.axisBoxInFrustum (box)) {
-        continue;
-      }
+      SegmentCandidate candidate;
+      candidate.x = I->first;
+      candidate.y = J->first;
+      candidate.segment = s;
+      m_segment_candidates.push_back(candidate);
+    }
+  }
 
-      // Do the Frustum test.
-      DisplayListColumn & dcol = (M == m_displayLists.end ())? m_displayLists[I->first] : M->second;
-      DisplayListColumn::iterator N = dcol.find (J->first);
+  m_culler.cull();
 
-      // TerrainSegment invalidated -- lets get rid of it.
-      if (!s->isValid () && N != dcol.end()) {
-        N->second.contextDestroyed(true);
-        dcol.erase(N);
-        N  = dcol.end();
-      }
-      if (N == dcol.end ()) {
+  for (size_t c = 0; c < m_segment_candidates.size(); ++c) {
+    if (!m_culler.isVisible(c)) continue;
 
-        if (!s->isValid ()) {
-          s->populate ();
-        }
+    const int seg_x = m_segment_candidates[c].x;
+    const int seg_y = m_segment_candidates[c].y;
+    Mercator::Segment * s = m_segment_candidates[c].segment;
+    TerrainRenderer::DisplayListStore::iterator M = m_displayLists.find (seg_x);
 
-        DataSeg seg;
-        seg.contextCreated();
-        
-        // Generate normals
-        seg.narray = s->getNormals(); 
-        if (seg.narray == 0) {
-          s->populateNormals ();
-          seg.narray = s->getNormals();
-        }
+    DisplayListColumn & dcol = (M == m_displayLists.end ())? m_displayLists[seg_x] : M->second;
+    DisplayListColumn::iterator N = dcol.find (seg_y);
 
-        // Generate normal VBO
-        if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
-          glGenBuffersARB (1, &seg.vb_narray);
-          glBindBufferARB (GL_ARRAY_BUFFER_ARB, seg.vb_narray);
-          glBufferDataARB (GL_ARRAY_BUFFER_ARB, (segSize + 1) * (segSize + 1) * 3 * sizeof (float), seg.narray, GL_STATIC_DRAW_ARB);
-          seg.narray = NULL;
-          glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-        }
+    // TerrainSegment invalidated -- refill the parts that changed.
+    if (!s->isValid () && N != dcol.end()) {
+      updateSegment(s, N->second);
+    }
+    if (N == dcol.end ()) {
 
-        // Fill in the vertex Z coord, which varies
-        seg.harray = new float[(segSize + 1) * (segSize + 1) * 3];
-        int idx = -1;
-        for (int j = 0; j < (segSize + 1); ++j) {
-          for (int i = 0; i < (segSize + 1); ++i) {
-            float h = s->get (i, j);
-            seg.harray[++idx] = i;
-            seg.harray[++idx] = j;
-            seg.harray[++idx] = h;
-          }
-        }
+      if (!s->isValid ()) {
+        s->populate ();
+      }
 
-       // General vertices VBO
-        if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
-          glGenBuffersARB (1, &seg.vb_harray);
-          glBindBufferARB (GL_ARRAY_BUFFER_ARB, seg.vb_harray);
-          glBufferDataARB (GL_ARRAY_BUFFER_ARB, (segSize + 1) * (segSize +1) * 3 * sizeof (float),  seg.harray, GL_STATIC_DRAW_ARB);
-          delete [] seg.harray;
-          seg.harray = NULL;
-          glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-        }
+      DataSeg seg;
+      seg.contextCreated();
+      
+      // Generate normals
+      seg.narray = s->getNormals(); 
+      if (seg.narray == 0) {
+        s->populateNormals ();
+        seg.narray = s->getNormals();
+      }
 
-        dcol[J->first] = seg;
-        N = dcol.find(J->first);
+      // Generate normal VBO
+      if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
+        glGenBuffersARB (1, &seg.vb_narray);
+        glBindBufferARB (GL_ARRAY_BUFFER_ARB, seg.vb_narray);
+        glBufferDataARB (GL_ARRAY_BUFFER_ARB, (segSize + 1) * (segSize + 1) * 3 * sizeof (float), seg.narray, GL_STATIC_DRAW_ARB);
+        seg.narray = NULL;
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
       }
-      
-      DataSeg & seg = N->second;
 
-      generateAlphaTextures (s, seg);
-      
-      // If we don't have VBO's fall back on display lists
-      bool end = false;
-      if (!sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
-        if (glIsList(seg.disp)) {
-          glCallList(seg.disp);
-          continue;
-        } else {
-          seg.disp = glGenLists(1);
-          dcol[J->first] = seg; // Need to re-copy updated data
-          glNewList(seg.disp, GL_COMPILE);
-          end = true;
+      // Fill in the vertex Z coord, which varies
+      seg.harray = new float[(segSize + 1) * (segSize + 1) * 3];
+      int idx = -1;
+      for (int j = 0; j < (segSize + 1); ++j) {
+        for (int i = 0; i < (segSize + 1); ++i) {
+          float h = s->get (i, j);
+          seg.harray[++idx] = i;
+          seg.harray[++idx] = j;
+          seg.harray[++idx] = h;
         }
       }
 
-      glPushMatrix ();
-      glTranslatef (I->first * segSize, J->first * segSize, 0.0f);
-      drawRegion (s, seg, select_mode);
-      glPopMatrix ();
+     // General vertices VBO
+      if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
+        glGenBuffersARB (1, &seg.vb_harray);
+        glBindBufferARB (GL_ARRAY_BUFFER_ARB, seg.vb_harray);
+        glBufferDataARB (GL_ARRAY_BUFFER_ARB, (segSize + 1) * (segSize +1) * 3 * sizeof (float),  seg.harray, GL_STATIC_DRAW_ARB);
+        delete [] seg.harray;
+        seg.harray = NULL;
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+      }
+
+      dcol[seg_y] = seg;
+      N = dcol.find(seg_y);
+    }
+    
+    DataSeg & seg = N->second;
+
+    // Anything dirty is now up to date. Areas only invalidate the surfaces,
+    // which generateAlphaTextures picks up below.
+    seg.m_dirty = false;
 
-      if (end) {
-        glEndList();
-          glCallList(seg.disp);
+    generateAlphaTextures (s, seg);
+    
+    // If we don't have VBO's fall back on display lists
+    bool end = false;
+    if (!sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
+      if (glIsList(seg.disp)) {
+        glCallList(seg.disp);
+        continue;
+      } else {
+        seg.disp = glGenLists(1);
+        dcol[seg_y] = seg; // Need to re-copy updated data
+        glNewList(seg.disp, GL_COMPILE);
+        end = true;
       }
     }
+
+    glPushMatrix ();
+    glTranslatef (seg_x * segSize, seg_y * segSize, 0.0f);
+    drawRegion (s, seg, select_mode);
+    glPopMatrix ();
+
+    if (end) {
+      glEndList();
+        glCallList(seg.disp);
+    }
   }
   if (sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
     glBindBufferARB (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
@@ -491,12 +647,14 @@ static void onTerrainModChanged(Eris::Entity *e, Mercator::TerrainMod *mod, Terr
     tr->m_terrain.removeMod(mod);
     // TODO: This returns a ptr too?
     tr->m_terrain.addMod(*mod);
+    tr->invalidateMod(mod, false);
   }
 }
 
 static void onTerrainModDeleted(Eris::Entity *e, Mercator::TerrainMod *mod, TerrainRenderer *tr) {
   if (mod != 0) {
     tr->m_terrain.removeMod(mod);
+    tr->invalidateMod(mod, true);
   }
 }
 
@@ -766,7 +924,7 @@ void TerrainRenderer::setSurface(const std::string &name, const std::string &pat
   } else if (pattern == "high") {
     registerShader(new Mercator::HighShader (params), "terrain_" + name);
   } else {
-    printf("Unknown pattern (%s) for surface %s\n", pattern.c_str(), name.c_str());
+    SEAR_LOG(Log::CAT_TERRAIN, Log::LOG_WARNING, "Unknown pattern (" + pattern + ") for surface " + name);
   }
 }
 
@@ -7,6 +7,7 @@
 #define SEAR_TERRAIN_RENDERER_H
 
 #include <vector>
+#include <map>
 
 #include <sage/sage.h>
 #include <sage/GL.h>
@@ -14,13 +15,19 @@
 #include <Mercator/Terrain.h>
 #include <Mercator/Shader.h>
 #include <wfmath/point.h>
+#include <wfmath/axisbox.h>
 
 #include "renderers/RenderTypes.h"
+#include "renderers/FrustumCuller.h"
 
 namespace Eris {
   class TerrainModHandler;
 }
 
+namespace Mercator {
+  class TerrainMod;
+}
+
 namespace Sear {
 
 class Character;
@@ -40,7 +47,12 @@ public:
         harray(NULL),
         narray(NULL),
         m_context_no(-1),
-        m_list_set(false)
+        m_list_set(false),
+        m_dirty(false),
+        m_dirty_x0(0),
+        m_dirty_y0(0),
+        m_dirty_x1(0),
+        m_dirty_y1(0)
       {
       }
       
@@ -56,9 +68,20 @@ public:
       int m_context_no;
       bool m_list_set;
 
+      // Vertices changed since the buffers were last filled. Changes are
+      // accumulated here until the segment is next drawn.
+      bool m_dirty;
+      int m_dirty_x0, m_dirty_y0, m_dirty_x1, m_dirty_y1;
+
       void contextCreated();
       void contextDestroyed(bool check);
 
+      /**
+       * Add a rectangle of vertices, inclusive and in segment coordinates,
+       * to the dirty region. It is clipped to the segment.
+       */
+      void addDirtyRect(int x0, int y0, int x1, int y1);
+
     };
     typedef std::map<int, DataSeg> DisplayListColumn;
     typedef std::map<int, DisplayListColumn> DisplayListStore;
@@ -85,6 +108,19 @@ public:
     void contextDestroyed(bool check);
 
     void reset();
+
+    /**
+     * Record that the terrain inside the box has changed. Segments which
+     * have already been uploaded only have this region refilled when they
+     * are next drawn.
+     */
+    void invalidateRegion(const WFMath::AxisBox<2> &box);
+
+    /**
+     * Invalidate the region covered by a terrain mod, both where it was last
+     * seen and, unless it has been removed, where it is now.
+     */
+    void invalidateMod(const Mercator::TerrainMod *mod, bool removed);
   protected:
     DisplayListStore m_displayLists;
     int m_numLineIndeces;
@@ -97,10 +133,24 @@ public:
     bool m_haveTerrain;
     Eris::TerrainModHandler *m_tmh;
 
+    typedef std::map<const Mercator::TerrainMod*, WFMath::AxisBox<2> > ModBoxMap;
+    ModBoxMap m_mod_boxes; ///< Area each terrain mod covered when last applied
+
+    // Segments in range of the camera, tested against the frustum as a batch
+    typedef struct {
+      int x;
+      int y;
+      Mercator::Segment *segment;
+    } SegmentCandidate;
+
+    std::vector<SegmentCandidate> m_segment_candidates;
+    FrustumCuller m_culler;
+
     void enableRendererState();
     void disableRendererState();
 
     void generateAlphaTextures(Mercator::Segment *, DataSeg &);
+    void updateSegment(Mercator::Segment *, DataSeg &);
     void drawRegion(Mercator::Segment *, DataSeg&, bool select_mode);
     void drawMap(Mercator::Terrain &, const PosType & camPos, bool select_mode);
     void drawSea( Mercator::Terrain &);
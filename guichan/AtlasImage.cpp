@@ -0,0 +1,106 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cassert>
+
+#include <SDL_image.h>
+
+#include <guichan/exception.hpp>
+#include <guichan/opengl/openglimage.hpp>
+
+#include "AtlasImage.h"
+
+namespace Sear {
+
+AtlasImage::AtlasImage(TextureAtlas &atlas, const unsigned int *pixels,
+                       int width, int height, bool convertToDisplayFormat) :
+  m_atlas(atlas),
+  m_pixels(pixels, pixels + width * height),
+  m_width(width),
+  m_height(height)
+{
+  m_region.page = -1;
+
+  // Magenta is guichan's colour key
+  for (size_t i = 0; i < m_pixels.size(); ++i) {
+    const unsigned char *c = (const unsigned char*)&m_pixels[i];
+    if (c[0] == 255 && c[1] == 0 && c[2] == 255 && c[3] == 255) {
+      m_pixels[i] = 0;
+    }
+  }
+
+  if (convertToDisplayFormat) {
+    AtlasImage::convertToDisplayFormat();
+  }
+}
+
+AtlasImage::~AtlasImage() {
+  free();
+}
+
+void AtlasImage::free() {
+  m_atlas.release(m_region);
+}
+
+gcn::Color AtlasImage::getPixel(int x, int y) {
+  if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+    throw GCN_EXCEPTION("Coordinates outside of the image.");
+  }
+  const unsigned char *c = (const unsigned char*)&m_pixels[y * m_width + x];
+  return gcn::Color(c[0], c[1], c[2], c[3]);
+}
+
+void AtlasImage::putPixel(int x, int y, const gcn::Color &color) {
+  if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+    throw GCN_EXCEPTION("Coordinates outside of the image.");
+  }
+  unsigned char *c = (unsigned char*)&m_pixels[y * m_width + x];
+  c[0] = color.r;
+  c[1] = color.g;
+  c[2] = color.b;
+  c[3] = color.a;
+
+  if (m_region.page >= 0) {
+    m_atlas.update(m_region, (const unsigned char*)&m_pixels[0], m_width * 4);
+  }
+}
+
+void AtlasImage::convertToDisplayFormat() {
+  if (m_region.page >= 0) return;
+  if (!m_atlas.add((const unsigned char*)&m_pixels[0], m_width, m_height,
+                   m_width * 4, m_region)) {
+    throw GCN_EXCEPTION("Image is too large for the texture atlas.");
+  }
+}
+
+gcn::Image *AtlasImageLoader::load(const std::string &filename,
+                                   bool convertToDisplayFormat) {
+  SDL_Surface *loaded = IMG_Load(filename.c_str());
+  if (loaded == NULL) {
+    throw GCN_EXCEPTION(std::string("Unable to load image file: ") + filename);
+  }
+
+  SDL_Surface *surface = convertToStandardFormat(loaded);
+  SDL_FreeSurface(loaded);
+  if (surface == NULL) {
+    throw GCN_EXCEPTION(std::string("Not enough memory to load: ") + filename);
+  }
+
+  gcn::Image *image = create((const unsigned int*)surface->pixels,
+                             surface->w, surface->h, convertToDisplayFormat);
+  SDL_FreeSurface(surface);
+  return image;
+}
+
+gcn::Image *AtlasImageLoader::create(const unsigned int *pixels,
+                                     int width, int height,
+                                     bool convertToDisplayFormat) {
+  if (m_atlas.fits(width, height)) {
+    return new AtlasImage(m_atlas, pixels, width, height,
+                          convertToDisplayFormat);
+  }
+  return new gcn::OpenGLImage(pixels, width, height, convertToDisplayFormat);
+}
+
+} // namespace Sear
@@ -0,0 +1,76 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_GUICHAN_ATLASIMAGE_H
+#define SEAR_GUICHAN_ATLASIMAGE_H 1
+
+#include <vector>
+
+#include <guichan.hpp>
+#include <guichan/opengl/openglsdlimageloader.hpp>
+
+#include "renderers/TextureAtlas.h"
+
+namespace Sear {
+
+/**
+ * A guichan image kept in the texture atlas, so that it can be drawn by
+ * BatchGraphics together with other images on the same page. A copy of the
+ * pixels is kept for getPixel and putPixel.
+ */
+class AtlasImage : public gcn::Image {
+public:
+  /**
+   * @param pixels 32 bit RGBA pixels, as produced by the SDL image loader.
+   *               Magenta pixels become transparent, as with OpenGLImage.
+   */
+  AtlasImage(TextureAtlas &atlas, const unsigned int *pixels,
+             int width, int height, bool convertToDisplayFormat = true);
+  virtual ~AtlasImage();
+
+  virtual void free();
+  virtual int getWidth() const { return m_width; }
+  virtual int getHeight() const { return m_height; }
+  virtual gcn::Color getPixel(int x, int y);
+  virtual void putPixel(int x, int y, const gcn::Color &color);
+  virtual void convertToDisplayFormat();
+
+  /**
+   * Place of the image in the atlas. The page is -1 until
+   * convertToDisplayFormat has been called.
+   */
+  const TextureAtlas::Region &getRegion() const { return m_region; }
+
+private:
+  TextureAtlas &m_atlas;
+  std::vector<unsigned int> m_pixels;
+  int m_width, m_height;
+  TextureAtlas::Region m_region;
+};
+
+/**
+ * Image loader that puts images small enough to share an atlas page into
+ * the texture atlas. Larger images are left to guichan's OpenGL loader.
+ */
+class AtlasImageLoader : public gcn::OpenGLSDLImageLoader {
+public:
+  AtlasImageLoader(TextureAtlas &atlas) : m_atlas(atlas) {}
+  virtual ~AtlasImageLoader() {}
+
+  virtual gcn::Image *load(const std::string &filename,
+                           bool convertToDisplayFormat = true);
+
+  /**
+   * Create an image from 32 bit RGBA pixels, in the atlas if it fits.
+   */
+  gcn::Image *create(const unsigned int *pixels, int width, int height,
+                     bool convertToDisplayFormat);
+
+private:
+  TextureAtlas &m_atlas;
+};
+
+} // namespace Sear
+
+#endif // SEAR_GUICHAN_ATLASIMAGE_H
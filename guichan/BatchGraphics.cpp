@@ -0,0 +1,380 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <SDL/SDL.h>
+
+#include <sage/GL.h>
+
+#include <guichan/exception.hpp>
+#include <guichan/opengl/openglimage.hpp>
+
+#include "BatchGraphics.h"
+#include "AtlasImage.h"
+
+namespace Sear {
+
+BatchGraphics::BatchGraphics(TextureAtlas &atlas) :
+  gcn::OpenGLGraphics(),
+  m_atlas(atlas),
+  m_batch(atlas),
+  m_record(atlas),
+  m_recording(false),
+  m_segment_key(0),
+  m_frame(0),
+  m_frame_draws(0),
+  m_last_frame_draws(0),
+  m_rebuilds(0),
+  m_second_rebuilds(0),
+  m_rebuilds_per_second(0),
+  m_second_start(0)
+{
+}
+
+BatchGraphics::~BatchGraphics() {
+  // The GUI is deleted before the render system, so the context is
+  // still there to delete the segments' buffers
+  clearSegments(true);
+}
+
+void BatchGraphics::_endDraw() {
+  assert(!m_recording);
+  flush();
+
+  // Forget segments that were not drawn, e.g. closed windows
+  SegmentMap::iterator I = m_segments.begin();
+  while (I != m_segments.end()) {
+    if (I->second.frame != m_frame) {
+      // Deletes its buffer object
+      delete I->second.batch;
+      m_segments.erase(I++);
+    } else {
+      ++I;
+    }
+  }
+  ++m_frame;
+
+  m_last_frame_draws = m_frame_draws;
+  m_frame_draws = 0;
+
+  const unsigned int now = SDL_GetTicks();
+  if (now - m_second_start >= 1000) {
+    m_rebuilds_per_second = m_second_rebuilds;
+    m_second_rebuilds = 0;
+    m_second_start = now;
+  }
+
+  gcn::OpenGLGraphics::_endDraw();
+}
+
+void BatchGraphics::setBatchColour() {
+  current().setColour((unsigned char)mColor.r, (unsigned char)mColor.g,
+                      (unsigned char)mColor.b, (unsigned char)mColor.a);
+}
+
+void BatchGraphics::getWhiteTexel(int &page, float &s, float &t) {
+  // Stay on the page already in use so no new draw call is needed
+  page = current().getLastPage();
+  if (page < 0 && m_atlas.getNumPages() > 0) page = 0;
+  if (page >= 0) {
+    m_atlas.getWhiteTexel(page, s, t);
+  } else {
+    s = t = 0.0f;
+  }
+}
+
+void BatchGraphics::addQuad(int page, GLuint texture,
+                            float x0, float y0, float x1, float y1,
+                            float s0, float t0, float s1, float t1) {
+  // Clip against the current clip area, moving the texture coordinates
+  // with the edges.
+  const gcn::ClipRectangle &clip = mClipStack.top();
+  const float cx0 = clip.x;
+  const float cy0 = clip.y;
+  const float cx1 = clip.x + clip.width;
+  const float cy1 = clip.y + clip.height;
+
+  if (x0 >= cx1 || x1 <= cx0 || y0 >= cy1 || y1 <= cy0) return;
+
+  const float ds = (s1 - s0) / (x1 - x0);
+  const float dt = (t1 - t0) / (y1 - y0);
+  if (x0 < cx0) { s0 += (cx0 - x0) * ds; x0 = cx0; }
+  if (x1 > cx1) { s1 -= (x1 - cx1) * ds; x1 = cx1; }
+  if (y0 < cy0) { t0 += (cy0 - y0) * dt; y0 = cy0; }
+  if (y1 > cy1) { t1 -= (y1 - cy1) * dt; y1 = cy1; }
+
+  const float vertices[] = { x0, y0,  x1, y0,  x1, y1,  x0, y1 };
+  const float texcoords[] = { s0, t0,  s1, t0,  s1, t1,  s0, t1 };
+  setBatchColour();
+  current().addQuad(page, texture, vertices, texcoords);
+}
+
+void BatchGraphics::addShape(float x0, float y0, float x1, float y1) {
+  int page;
+  float s, t;
+  getWhiteTexel(page, s, t);
+  addQuad(page, 0, x0, y0, x1, y1, s, t, s, t);
+}
+
+void BatchGraphics::addRotatedQuad(int page, GLuint texture, int dstX, int dstY,
+                                   int width, int height, float s0, float t0,
+                                   float s1, float t1, float angle) {
+  const gcn::ClipRectangle &top = mClipStack.top();
+  dstX += top.xOffset;
+  dstY += top.yOffset;
+
+  if (angle == 0.0f) {
+    addQuad(page, texture, dstX, dstY, dstX + width, dstY + height,
+            s0, t0, s1, t1);
+    return;
+  }
+
+  // Rotated quads can not be clipped on the CPU, so use the scissor
+  const float rad = angle * M_PI / 180.0f;
+  const float c = cos(rad), s = sin(rad);
+  const float cx = dstX + width / 2.0f;
+  const float cy = dstY + height / 2.0f;
+  const float hw = width / 2.0f;
+  const float hh = height / 2.0f;
+  const float corners[] = { -hw, -hh,  hw, -hh,  hw, hh,  -hw, hh };
+  float vertices[8];
+  for (int i = 0; i < 8; i += 2) {
+    vertices[i] = cx + corners[i] * c - corners[i + 1] * s;
+    vertices[i + 1] = cy + corners[i] * s + corners[i + 1] * c;
+  }
+  const float texcoords[] = { s0, t0,  s1, t0,  s1, t1,  s0, t1 };
+
+  setBatchColour();
+  current().setScissor(top.x, mHeight - top.y - top.height, top.width, top.height);
+  current().addQuad(page, texture, vertices, texcoords);
+  current().clearScissor();
+}
+
+void BatchGraphics::drawImage(const gcn::Image *image, int srcX, int srcY,
+                              int dstX, int dstY, int width, int height) {
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+  if (width <= 0 || height <= 0) return;
+
+  const gcn::ClipRectangle &top = mClipStack.top();
+  dstX += top.xOffset;
+  dstY += top.yOffset;
+
+  const AtlasImage *atlas_image = dynamic_cast<const AtlasImage*>(image);
+  if (atlas_image != 0 && atlas_image->getRegion().page >= 0) {
+    const TextureAtlas::Region &region = atlas_image->getRegion();
+    const float scale_s = (region.s1 - region.s0) / region.width;
+    const float scale_t = (region.t1 - region.t0) / region.height;
+    addQuad(region.page, 0, dstX, dstY, dstX + width, dstY + height,
+            region.s0 + srcX * scale_s, region.t0 + srcY * scale_t,
+            region.s0 + (srcX + width) * scale_s,
+            region.t0 + (srcY + height) * scale_t);
+    return;
+  }
+
+  const gcn::OpenGLImage *gl_image = dynamic_cast<const gcn::OpenGLImage*>(image);
+  if (gl_image == 0) {
+    throw GCN_EXCEPTION("Trying to draw an image of unknown format, must be an OpenGLImage.");
+  }
+  const float tw = gl_image->getTextureWidth();
+  const float th = gl_image->getTextureHeight();
+  addQuad(-1, gl_image->getTextureHandle(),
+          dstX, dstY, dstX + width, dstY + height,
+          srcX / tw, srcY / th, (srcX + width) / tw, (srcY + height) / th);
+}
+
+void BatchGraphics::drawAtlasRegion(const TextureAtlas::Region &region,
+                                    int dstX, int dstY, int width, int height,
+                                    bool flip, float angle) {
+  if (region.page < 0 || width <= 0 || height <= 0) return;
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+
+  addRotatedQuad(region.page, 0, dstX, dstY, width, height,
+                 region.s0, flip ? region.t1 : region.t0,
+                 region.s1, flip ? region.t0 : region.t1, angle);
+}
+
+void BatchGraphics::drawTexture(GLuint texture, int dstX, int dstY,
+                                int width, int height, bool flip, float angle) {
+  if (width <= 0 || height <= 0) return;
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+
+  addRotatedQuad(-1, texture, dstX, dstY, width, height,
+                 0.0f, flip ? 1.0f : 0.0f, 1.0f, flip ? 0.0f : 1.0f, angle);
+}
+
+void BatchGraphics::drawPoint(int x, int y) {
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+  const gcn::ClipRectangle &top = mClipStack.top();
+  x += top.xOffset;
+  y += top.yOffset;
+  addShape(x, y, x + 1, y + 1);
+}
+
+void BatchGraphics::drawLine(int x1, int y1, int x2, int y2) {
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+  const gcn::ClipRectangle &top = mClipStack.top();
+  x1 += top.xOffset;
+  y1 += top.yOffset;
+  x2 += top.xOffset;
+  y2 += top.yOffset;
+
+  // Most GUI lines are horizontal or vertical, and those are drawn as
+  // quads covering both end pixels.
+  if (x1 == x2 || y1 == y2) {
+    addShape(std::min(x1, x2), std::min(y1, y2),
+             std::max(x1, x2) + 1, std::max(y1, y2) + 1);
+    return;
+  }
+
+  // Clip the line to the clip area (Liang-Barsky), offset into the pixel
+  // as OpenGLGraphics does.
+  float ax = x1 + 0.375f, ay = y1 + 0.375f;
+  float bx = x2 + 1.0f - 0.375f, by = y2 + 1.0f - 0.375f;
+  const float dx = bx - ax, dy = by - ay;
+  const float p[] = { -dx, dx, -dy, dy };
+  const float q[] = { ax - top.x, top.x + top.width - ax,
+                      ay - top.y, top.y + top.height - ay };
+  float u0 = 0.0f, u1 = 1.0f;
+  for (int i = 0; i < 4; ++i) {
+    if (p[i] == 0.0f) {
+      if (q[i] < 0.0f) return;
+    } else {
+      const float u = q[i] / p[i];
+      if (p[i] < 0.0f) {
+        if (u > u1) return;
+        if (u > u0) u0 = u;
+      } else {
+        if (u < u0) return;
+        if (u < u1) u1 = u;
+      }
+    }
+  }
+  bx = ax + u1 * dx;
+  by = ay + u1 * dy;
+  ax = ax + u0 * dx;
+  ay = ay + u0 * dy;
+
+  int page;
+  float s, t;
+  getWhiteTexel(page, s, t);
+  setBatchColour();
+  current().addLine(page, 0, ax, ay, bx, by, s, t);
+}
+
+void BatchGraphics::drawRectangle(const gcn::Rectangle &rectangle) {
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+  const gcn::ClipRectangle &top = mClipStack.top();
+  const int x0 = rectangle.x + top.xOffset;
+  const int y0 = rectangle.y + top.yOffset;
+  const int x1 = x0 + rectangle.width;
+  const int y1 = y0 + rectangle.height;
+  if (rectangle.width <= 0 || rectangle.height <= 0) return;
+
+  addShape(x0, y0, x1, y0 + 1);
+  addShape(x0, y1 - 1, x1, y1);
+  addShape(x0, y0 + 1, x0 + 1, y1 - 1);
+  addShape(x1 - 1, y0 + 1, x1, y1 - 1);
+}
+
+void BatchGraphics::fillRectangle(const gcn::Rectangle &rectangle) {
+  if (mClipStack.empty()) {
+    throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw funtion outside of _beginDraw() and _endDraw()?");
+  }
+  const gcn::ClipRectangle &top = mClipStack.top();
+  const int x0 = rectangle.x + top.xOffset;
+  const int y0 = rectangle.y + top.yOffset;
+  if (rectangle.width <= 0 || rectangle.height <= 0) return;
+
+  addShape(x0, y0, x0 + rectangle.width, y0 + rectangle.height);
+}
+
+void BatchGraphics::beginSegment(const void *key) {
+  assert(!m_recording);
+  m_recording = true;
+  m_segment_key = key;
+  m_record.clear();
+}
+
+void BatchGraphics::endSegment() {
+  assert(m_recording);
+  m_recording = false;
+
+  Segment &segment = m_segments[m_segment_key];
+  if (segment.batch == 0) {
+    segment.batch = new SpriteBatch(m_atlas);
+  }
+  segment.frame = m_frame;
+
+  if (!segment.batch->equals(m_record)) {
+    segment.batch->swap(m_record);
+    segment.batch->upload();
+    ++m_rebuilds;
+    ++m_second_rebuilds;
+  }
+  m_record.clear();
+
+  // Anything queued before the segment has to be drawn first
+  flush();
+  drawBatch(*segment.batch);
+}
+
+void BatchGraphics::drawBatch(SpriteBatch &batch) {
+  if (batch.empty()) return;
+
+  // Primitives have already been clipped, and those that could not be
+  // carry their own scissor rectangle.
+  glDisable(GL_SCISSOR_TEST);
+  glEnable(GL_BLEND);
+
+  const unsigned int draws = batch.getNumDraws();
+  batch.draw();
+  m_frame_draws += batch.getNumDraws() - draws;
+
+  glDisable(GL_TEXTURE_2D);
+  if (!mAlpha) glDisable(GL_BLEND);
+  glEnable(GL_SCISSOR_TEST);
+
+  // The colour array leaves the current colour undefined
+  glColor4ub(mColor.r, mColor.g, mColor.b, mColor.a);
+}
+
+void BatchGraphics::flush() {
+  if (m_batch.empty()) return;
+  drawBatch(m_batch);
+  m_batch.clear();
+}
+
+void BatchGraphics::clearSegments(bool check) {
+  SegmentMap::iterator I = m_segments.begin();
+  for (; I != m_segments.end(); ++I) {
+    I->second.batch->contextDestroyed(check);
+    delete I->second.batch;
+  }
+  m_segments.clear();
+}
+
+void BatchGraphics::contextDestroyed(bool check) {
+  // Segments are rebuilt on the next frame
+  clearSegments(check);
+  m_batch.clear();
+  m_batch.contextDestroyed(check);
+  m_record.contextDestroyed(check);
+}
+
+} // namespace Sear
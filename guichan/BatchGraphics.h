@@ -0,0 +1,120 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_GUICHAN_BATCHGRAPHICS_H
+#define SEAR_GUICHAN_BATCHGRAPHICS_H 1
+
+#include <map>
+
+#include <guichan.hpp>
+#include <guichan/opengl/openglgraphics.hpp>
+
+#include "renderers/SpriteBatch.h"
+
+namespace Sear {
+
+/**
+ * Guichan graphics driver that turns everything drawn into 2D primitives in
+ * a SpriteBatch instead of issuing each with its own OpenGL calls. Images
+ * come from the texture atlas. Untextured shapes use the atlas white texel,
+ * so they share draw calls with images. Primitives are clipped to the clip
+ * area on the CPU, so a batch can span widgets, and the drawing order is
+ * unchanged.
+ *
+ * Drawing can also be retained. Between beginSegment and endSegment the
+ * primitives are recorded and compared with those recorded for the same key
+ * in the last frame. An unchanged segment is drawn from its vertex buffer.
+ * A changed one is rebuilt first.
+ */
+class BatchGraphics : public gcn::OpenGLGraphics {
+public:
+  BatchGraphics(TextureAtlas &atlas);
+  virtual ~BatchGraphics();
+
+  virtual void _endDraw();
+
+  using gcn::OpenGLGraphics::drawImage;
+  virtual void drawImage(const gcn::Image *image, int srcX, int srcY,
+                         int dstX, int dstY, int width, int height);
+  virtual void drawPoint(int x, int y);
+  virtual void drawLine(int x1, int y1, int x2, int y2);
+  virtual void drawRectangle(const gcn::Rectangle &rectangle);
+  virtual void fillRectangle(const gcn::Rectangle &rectangle);
+
+  /**
+   * Draw an atlas image stretched over a rectangle of the current clip
+   * area.
+   * @param flip True if the first row of the image is its bottom, as for
+   *             textures loaded by the TextureManager
+   * @param angle Rotation about the centre of the rectangle, in degrees
+   */
+  void drawAtlasRegion(const TextureAtlas::Region &region, int dstX, int dstY,
+                       int width, int height, bool flip, float angle = 0.0f);
+
+  /**
+   * Draw all of a texture object stretched over a rectangle, as
+   * drawAtlasRegion.
+   */
+  void drawTexture(GLuint texture, int dstX, int dstY, int width, int height,
+                   bool flip, float angle = 0.0f);
+
+  /**
+   * Start recording a retained segment, such as one window.
+   * @param key Identifies the segment from frame to frame
+   */
+  void beginSegment(const void *key);
+
+  /**
+   * Finish recording, rebuild the segment if it has changed and draw it.
+   */
+  void endSegment();
+
+  /**
+   * Draw everything queued outside of segments so far.
+   */
+  void flush();
+
+  void contextDestroyed(bool check);
+
+  unsigned int getNumSegments() const { return m_segments.size(); }
+  unsigned int getNumRebuilds() const { return m_rebuilds; }
+  unsigned int getRebuildsPerSecond() const { return m_rebuilds_per_second; }
+  unsigned int getLastFrameDraws() const { return m_last_frame_draws; }
+
+private:
+  typedef struct {
+    SpriteBatch *batch;
+    unsigned int frame; ///< Frame the segment was last drawn
+  } Segment;
+  typedef std::map<const void*, Segment> SegmentMap;
+
+  SpriteBatch &current() { return m_recording ? m_record : m_batch; }
+
+  void setBatchColour();
+  void getWhiteTexel(int &page, float &s, float &t);
+  void addQuad(int page, GLuint texture, float x0, float y0, float x1, float y1,
+               float s0, float t0, float s1, float t1);
+  void addShape(float x0, float y0, float x1, float y1);
+  void addRotatedQuad(int page, GLuint texture, int dstX, int dstY,
+                      int width, int height, float s0, float t0,
+                      float s1, float t1, float angle);
+  void drawBatch(SpriteBatch &batch);
+  void clearSegments(bool check);
+
+  TextureAtlas &m_atlas;
+  SpriteBatch m_batch; ///< Primitives drawn outside of segments
+  SpriteBatch m_record; ///< Segment being recorded
+  bool m_recording;
+  const void *m_segment_key;
+  SegmentMap m_segments;
+
+  unsigned int m_frame;
+  unsigned int m_frame_draws, m_last_frame_draws;
+  unsigned int m_rebuilds, m_second_rebuilds, m_rebuilds_per_second;
+  unsigned int m_second_start;
+};
+
+} // namespace Sear
+
+#endif // SEAR_GUICHAN_BATCHGRAPHICS_H
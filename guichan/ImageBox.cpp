@@ -3,8 +3,10 @@
 // Copyright (C) 2009 Simon Goodall
 
 #include "ImageBox.h"
+#include "BatchGraphics.h"
 #include "renderers/RenderSystem.h"
 #include "renderers/Render.h"
+#include "renderers/TextureManager.h"
 
 namespace Sear {
 
@@ -44,6 +46,27 @@ void ImageBox::logic()
 
 void ImageBox::draw(gcn::Graphics *graphics)
 {
+  BatchGraphics *batch = dynamic_cast<BatchGraphics*>(graphics);
+  if (batch != 0) {
+    // Images small enough come from the texture atlas, the rest are drawn
+    // from their own texture. Either way they are drawn along with the rest
+    // of the GUI and kept with the window they are in.
+    TextureAtlas::Region region;
+    TextureManager *tm = RenderSystem::getInstance().getTextureManager();
+    if (tm->getAtlasRegion(m_texture_name, region)) {
+      batch->drawAtlasRegion(region, 0, 0, getWidth(), getHeight(), true, m_angle);
+    } else {
+      // Make sure the texture is loaded
+      tm->switchTexture(m_texture_id);
+      batch->drawTexture(tm->getTextureObject(m_texture_id), 0, 0,
+                         getWidth(), getHeight(), true, m_angle);
+    }
+    if (m_text.size() > 0) {
+      graphics->drawText(m_text, 0, 0);
+    }
+    return;
+  }
+
   Render *r = RenderSystem::getInstance().getRenderer();
 
   glEnable(GL_TEXTURE_2D);
@@ -4,6 +4,7 @@
 // Copyright (C) 2007 - 2009 Simon Goodall
 
 #include "guichan/RootWidget.h"
+#include "guichan/BatchGraphics.h"
 #include "guichan/CommandLine.h"
 #include "guichan/Overlay.h"
 
@@ -96,6 +97,42 @@ void RootWidget::logic()
   gcn::Container::logic();
 }
 
+void RootWidget::drawChildren(gcn::Graphics *graphics)
+{
+  BatchGraphics *batch = dynamic_cast<BatchGraphics *>(graphics);
+  if (batch == 0) {
+    gcn::Container::drawChildren(graphics);
+    return;
+  }
+
+  // As gcn::BasicContainer::drawChildren, with a segment per widget
+  graphics->pushClipArea(getChildrenArea());
+  std::list<gcn::Widget*>::const_iterator I = mWidgets.begin();
+  std::list<gcn::Widget*>::const_iterator Iend = mWidgets.end();
+  for (; I != Iend; ++I) {
+    gcn::Widget *w = *I;
+    if (!w->isVisible()) continue;
+
+    batch->beginSegment(w);
+    if (w->getFrameSize() > 0) {
+      gcn::Rectangle rec = w->getDimension();
+      const int frameSize = w->getFrameSize();
+      rec.x -= frameSize;
+      rec.y -= frameSize;
+      rec.width += 2 * frameSize;
+      rec.height += 2 * frameSize;
+      graphics->pushClipArea(rec);
+      w->drawFrame(graphics);
+      graphics->popClipArea();
+    }
+    graphics->pushClipArea(w->getDimension());
+    w->draw(graphics);
+    graphics->popClipArea();
+    batch->endSegment();
+  }
+  graphics->popClipArea();
+}
+
 void RootWidget::contextCreated() {
   Overlay::instance()->contextCreated();
 }
@@ -28,6 +28,13 @@ class RootWidget : public gcn::Container
     void closeWindow(gcn::Window *);
 
     virtual void logic();
+
+    /**
+     * Draw each top level widget as a retained segment when the graphics
+     * driver supports it, so unchanged windows are not rebuilt.
+     */
+    virtual void drawChildren(gcn::Graphics *graphics);
+
     void contextCreated();
     void contextDestroyed(bool check);
 };
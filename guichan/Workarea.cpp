@@ -18,11 +18,14 @@
 #include "guichan/SpeechBubble.h"
 #include "guichan/Alert.h"
 #include "guichan/WFUTWindow.h"
+#include "guichan/AtlasImage.h"
+#include "guichan/BatchGraphics.h"
 
 #include "guichan/box.hpp"
 
 #include "renderers/Render.h"
 #include "renderers/RenderSystem.h"
+#include "renderers/TextureManager.h"
 
 #include "src/ActionHandler.h"
 #include "src/FileHandler.h"
@@ -50,6 +53,7 @@ static const std::string WORKAREA_TOGGLE = "workarea_toggle";
 static const std::string WORKAREA_OPEN = "workarea_open";
 static const std::string WORKAREA_CLOSE = "workarea_close";
 static const std::string WORKAREA_ALERT = "workarea_alert";
+static const std::string WORKAREA_STATS = "workarea_stats";
 
 static const std::string WORKAREA = "workarea";
 
@@ -83,7 +87,9 @@ Workarea::Workarea(System * s) :
 
 void Workarea::init()
 {
-  m_imageLoader = new gcn::OpenGLSDLImageLoader();
+  // Small images go into the texture atlas, so they can be drawn in batches
+  TextureAtlas &atlas = RenderSystem::getInstance().getTextureManager()->getTextureAtlas();
+  m_imageLoader = new AtlasImageLoader(atlas);
 
   // Set the loader that the OpenGLImageLoader should use to load images from
   // disk, as it can't do it itself, and then install the image loader into
@@ -91,7 +97,7 @@ void Workarea::init()
   gcn::Image::setImageLoader(m_imageLoader);
 
   // Create the handler for OpenGL graphics.
-  m_graphics = new gcn::OpenGLGraphics();
+  m_graphics = new BatchGraphics(atlas);
 
   // Tell it the size of our screen.
   Render * render = RenderSystem::getInstance().getRenderer();
@@ -174,6 +180,7 @@ void Workarea::registerCommands(Console * console)
   console->registerCommand(WORKAREA_OPEN, this);
   console->registerCommand(WORKAREA_CLOSE, this);
   console->registerCommand(WORKAREA_ALERT, this);
+  console->registerCommand(WORKAREA_STATS, this);
 }
 
 void Workarea::runCommand(const std::string & command, const std::string & args)
@@ -228,6 +235,18 @@ void Workarea::runCommand(const std::string & command, const std::string & args)
     m_widgets.push_back(al);
     // m_top->openWindow(al);
   }
+  else if (command == WORKAREA_STATS) {
+    BatchGraphics *batch = dynamic_cast<BatchGraphics*>(m_graphics);
+    if (batch != 0) {
+      std::cout << "GUI windows cached: " << batch->getNumSegments()
+                << std::endl;
+      std::cout << "GUI rebuilds: " << batch->getRebuildsPerSecond()
+                << " per second, " << batch->getNumRebuilds() << " in total"
+                << std::endl;
+      std::cout << "GUI draw calls last frame: " << batch->getLastFrameDraws()
+                << std::endl << std::flush;
+    }
+  }
 }
 
 void Workarea::readConfig(varconf::Config & config)
@@ -364,6 +383,8 @@ void Workarea::contextCreated() {
 
 void Workarea::contextDestroyed(bool check) {
   m_top->contextDestroyed(check);
+  BatchGraphics *batch = dynamic_cast<BatchGraphics*>(m_graphics);
+  if (batch != 0) batch->contextDestroyed(check);
   /*
   // Clean up global font
   m_top->setFont(NULL);
@@ -59,6 +59,7 @@
  */
 
 #include "imagefontxpm.h"
+#include "AtlasImage.h"
 
 #include <sstream>
 
@@ -82,10 +83,17 @@ ImageFontXPM::ImageFontXPM(const std::string &name, const char **array, const st
   SDL_Surface *surface = convertToStandardFormat(s);
   SDL_FreeSurface(s);
 
-  mImage = new OpenGLImage((unsigned int*)surface->pixels,
+  // Use the texture atlas if it is in use, so glyphs can be batched
+  Sear::AtlasImageLoader *atlas_loader = dynamic_cast<Sear::AtlasImageLoader*>(Image::getImageLoader());
+  if (atlas_loader != 0) {
+    mImage = atlas_loader->create((unsigned int*)surface->pixels,
+                                  surface->w, surface->h, false);
+  } else {
+    mImage = new OpenGLImage((unsigned int*)surface->pixels,
                                                  surface->w,
                                                  surface->h,
                                                  false);
+  }
   SDL_FreeSurface(surface);
 
   Color separator = mImage->getPixel(0, 0);
@@ -37,6 +37,7 @@
 
 #include "src/System.h"
 #include "src/FileHandler.h"
+#include "src/CacheManager.h"
 #include "renderers/Graphics.h"
 //#include "renderers/Render.h"
 #include "renderers/RenderSystem.h"
@@ -53,6 +54,9 @@
 #endif
 namespace Sear {
 
+// Bump when the mesh processing below changes
+static const unsigned int MESH_CACHE_VERSION = 1;
+
 static const std::string SECTION_model = "model";
 
 static const std::string KEY_filename = "filename";
@@ -84,10 +88,16 @@ ThreeDS::~ThreeDS() {
 }
 
 int ThreeDS::init(const std::string &file_name) {
+  if (decode(file_name)) return 1;
+  finish();
+  return 0;
+}
+
+int ThreeDS::decode(const std::string &file_name) {
   assert(m_initialised == false);
  
   std::string object;
-  if (m_config.readFromFile(file_name)) {
+  if (System::instance()->getFileHandler()->readConfigFile(m_config, file_name)) {
     if (m_config.findItem(SECTION_model, KEY_filename)) {
       object = (std::string)m_config.getItem(SECTION_model, KEY_filename);
     } else {
@@ -101,6 +111,20 @@ int ThreeDS::init(const std::string &file_name) {
 
   System::instance()->getFileHandler()->getFilePath(object);
 
+  // The processed meshes depend on the model config and the 3ds file
+  CacheManager &cache = CacheManager::getInstance();
+  CacheManager::Key key = CacheManager::makeKey("3ds", MESH_CACHE_VERSION);
+  bool use_cache = CacheManager::addFileToKey(key, file_name)
+                && CacheManager::addFileToKey(key, object);
+  std::vector<char> cached;
+  if (use_cache && cache.get(key, cached)) {
+    if (deserialise_objects(cached, m_render_objects)) {
+      m_initialised = true;
+      return 0;
+    }
+    cache.remove(key);
+  }
+
   // Load 3ds file
 //  if (debug) printf("[3ds] Loading: %s\n", object.c_str());
 
@@ -197,12 +221,31 @@ int ThreeDS::init(const std::string &file_name) {
     scale_object(m_render_objects, scale, align, ignore_minus_z);
   }
 
-  contextCreated();
+  if (use_cache) {
+    serialise_objects(m_render_objects, cached);
+    cache.put(key, cached);
+  }
 
   m_initialised = true;
   return 0;
 }
 
+void ThreeDS::finish() {
+  assert(m_initialised == true);
+
+  StaticObjectList::const_iterator I = m_render_objects.begin();
+  StaticObjectList::const_iterator Iend = m_render_objects.end();
+  for (; I != Iend; ++I) {
+    (*I)->requestTextures();
+  }
+
+  contextCreated();
+
+  for (I = m_render_objects.begin(); I != Iend; ++I) {
+    (*I)->upload();
+  }
+}
+
 int ThreeDS::shutdown() {
   assert(m_initialised == true);
 
@@ -390,8 +433,7 @@ void ThreeDS::render_mesh(Lib3dsMesh *mesh, Lib3dsFile *file, Lib3dsObjectData *
     Material *cm = m_material_map[material_name];
     assert(cm);
 
-    int texture_id = NO_TEXTURE_ID;
-    int texture_mask_id = NO_TEXTURE_ID;
+    std::string texture_name;
 
     // If a material is set get texture map names.
     Matrix tex_matrix;
@@ -411,35 +453,19 @@ void ThreeDS::render_mesh(Lib3dsMesh *mesh, Lib3dsFile *file, Lib3dsObjectData *
     }
 
     if (current_material_name != material_name) {
+      // Textures are requested by finish
       if (mesh->texels) {
         if (m_config.findItem(material_name,KEY_texture_map_0)) {
-          const std::string &name = (std::string)m_config.getItem(material_name,
-                                                         KEY_texture_map_0);
-          texture_id = RenderSystem::getInstance().requestTexture(name);
-          texture_mask_id = RenderSystem::getInstance().requestTexture(name, true);
-          assert(texture_id > NO_TEXTURE_ID);
-          assert(texture_mask_id > NO_TEXTURE_ID);
+          texture_name = (std::string)m_config.getItem(material_name,
+                                                       KEY_texture_map_0);
         } else if (mat && mat->texture1_map.name[0]) {
-          texture_id = RenderSystem::getInstance().requestTexture(
-                                                          mat->texture1_map.name);
-          texture_mask_id = RenderSystem::getInstance().requestTexture(
-                                                  mat->texture1_map.name, true);
-          assert(texture_id > NO_TEXTURE_ID);
-          assert(texture_mask_id > NO_TEXTURE_ID);
+          texture_name = mat->texture1_map.name;
         } else { 
-          // Do nothing, use default vals
+          // Use the default texture to keep the reference counting happy.
+          texture_name = "default_texture";
         }
       }
 
-      // Request default texture to keep the reference counting happy.
-      if (mesh->texels && texture_id < 1) {
-        texture_id = RenderSystem::getInstance().requestTexture("default_texture");
-        texture_mask_id = RenderSystem::getInstance().requestTexture("default_texture", true);
-      }
-
-      assert(texture_id > 0);
-      assert(texture_mask_id > 0);
-
       current_material_name = material_name;
       // Create new render object for change in texture
       // Set correct num of points in old render object
@@ -461,7 +487,7 @@ void ThreeDS::render_mesh(Lib3dsMesh *mesh, Lib3dsFile *file, Lib3dsObjectData *
       ro->createNormalData(ro->getNumPoints() * 3);
       if (mesh->texels) {
         ro->createTextureData(ro->getNumPoints() * 2);
-        ro->setTexture(0, texture_id, texture_mask_id);
+        ro->setTextureName(0, texture_name);
       }
 
       ro->setAmbient(cm->ambient);
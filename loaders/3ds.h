@@ -43,6 +43,18 @@ public:
    */ 
   int init(const std::string &file_name);
 
+  /*
+   * The first part of init. Reads the model without using GL or the
+   * RenderSystem, so it can run on the model loader thread.
+   */
+  int decode(const std::string &file_name);
+
+  /*
+   * The rest of init, on the main thread. Requests the textures and
+   * uploads the meshes.
+   */
+  void finish();
+
   /*
    * Called when model is to be removed from memory. It cleans up its children.
    */
@@ -38,16 +38,34 @@ SPtr<ModelRecord> ThreeDS_Loader::loadModel(WorldEntity *we, const std::string &
 
   System::instance()->getFileHandler()->getFilePath(file_name);
 
+  return finishModel(model_record, decodeModel(file_name));
+}
+
+Model *ThreeDS_Loader::decodeModel(const std::string &file_name) {
   // Create new ThreeDS model
   ThreeDS *model = new ThreeDS();
 
   // Load 3ds model
-  if (model->init(file_name)) {
+  if (model->decode(file_name)) {
 //    model->shutdown();
     std::cerr << "Error: Failed to load \"" << file_name << "\"" << std::endl;
     delete model;
-    return SPtr<ModelRecord>();
+    return NULL;
   }
+  return model;
+}
+
+SPtr<ModelRecord> ThreeDS_Loader::loadDecodedModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config, Model *model) {
+  SPtr<ModelRecord> model_record = ModelLoader::loadModel(we, model_id, model_config);
+  assert(model_record);
+  return finishModel(model_record, model);
+}
+
+SPtr<ModelRecord> ThreeDS_Loader::finishModel(SPtr<ModelRecord> model_record, Model *decoded) {
+  if (decoded == NULL) return SPtr<ModelRecord>();
+
+  ThreeDS *model = static_cast<ThreeDS*>(decoded);
+  model->finish();
 
   bool use_stencil = RenderSystem::getInstance().getState(RenderSystem::RENDER_STENCIL) && model_record->outline;
   StaticObjectList &sol = model->getStaticObjects();
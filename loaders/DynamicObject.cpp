@@ -182,6 +182,25 @@ void DynamicObject::contextDestroyed(bool check) {
   m_context_no = -1;
 }
 
+void DynamicObject::getMemoryUsage(size_t &cpu, size_t &gpu) const {
+  const size_t vertices = m_num_points * 3 * sizeof(float);
+  const size_t colours = m_num_points * 4 * sizeof(unsigned char);
+  const size_t normals = m_num_points * 3 * sizeof(float);
+  const size_t texcoords = m_num_points * 2 * sizeof(float);
+  const size_t indices = m_num_faces * 3 * sizeof(int);
+
+  if (m_vb_vertex_data) gpu += vertices;
+  else if (m_vertex_data) cpu += vertices;
+  if (m_vb_colour_data) gpu += colours;
+  else if (m_colour_data) cpu += colours;
+  if (m_vb_normal_data) gpu += normals;
+  else if (m_normal_data) cpu += normals;
+  if (m_vb_texture_data) gpu += texcoords;
+  else if (m_texture_data) cpu += texcoords;
+  if (m_vb_indices) gpu += indices;
+  else if (m_indices) cpu += indices;
+}
+
 void DynamicObject::render(bool select_mode) const {
   assert(m_initialised == true);
 
@@ -33,6 +33,13 @@ public:
   int contextCreated();
   void contextDestroyed(bool check);
 
+  /** Estimate the memory held by this object. Data is kept in buffer
+   * objects when they are supported, and in vertex arrays otherwise.
+   * @param cpu Incremented by the size of the vertex arrays, in bytes
+   * @param gpu Incremented by the size of any buffer objects, in bytes
+   */
+  void getMemoryUsage(size_t &cpu, size_t &gpu) const;
+
   void setTexture(unsigned int num, int texture, int texture_mask) {
     if (m_textures.size() <= num) {
       m_textures.resize(num + 1);
@@ -1,6 +1,6 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2007 - 2008  Simon Goodall
+// Copyright (C) 2007 - 2009  Simon Goodall
 
 /** The EntityMapper class aims to provide a mapping between an entity and it's
  *  state to an object record. 
@@ -11,28 +11,62 @@
  * This to some extend will need to interact with the cal3d loader, e.g. for
  * face/head mesh selection.
  * Returns nothing if no entry available
+ *
+ * Match rows pick a record from the entity's attributes. They are tried in
+ * order of their number, before the type's rule, e.g.
+ *
+ * [oak]
+ * match_1 = "mode == felled : oak_stump"
+ * match_2 = "status < 0.5 && size > 4 : oak_damaged"
+ * rule = "random"
+ * options = "oak_1 oak_2"
+ *
+ * Each condition is "attribute op value" with op one of == != < <= > >=,
+ * "attribute" if it must be set, or "!attribute" if it must not be. The
+ * size and height of the bounding box can be tested as attributes.
  */
 
 #include <inttypes.h>
 #include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <Atlas/Message/Element.h>
 
 #include "EntityMapper.h"
 
+#include "common/Log.h"
 #include "common/Utility.h"
 
+#include "renderers/RenderSystem.h"
+#include "src/Character.h"
+#include "src/CharacterManager.h"
 #include "src/Console.h"
 #include "src/FileHandler.h"
 #include "src/System.h"
 #include "src/WorldEntity.h"
 #include "IEntityMapperRule.h"
 
+#include <Eris/Avatar.h>
+#include <Eris/View.h>
+
 static const std::string CMD_load_entity_mappings = "load_entity_mappings";
+static const std::string CMD_explain_entity_mapping = "explain_entity_mapping";
 
 static const std::string KEY_rule = "rule";
 static const std::string KEY_options = "options";
+static const std::string KEY_match = "match";
 
 static const std::string RULE_random = "random";
 
+// Worked out from the bounding box rather than read from an attribute
+static const std::string ATTR_size = "size";
+static const std::string ATTR_height = "height";
+static const std::string ATTR_bbox = "bbox";
+
+static const char *OPERATOR_NAMES[] = { "", "!", "==", "!=", "<", "<=", ">", ">=" };
+
 namespace Sear {
 
 EntityMapper::EntityMapper() :
@@ -58,12 +92,16 @@ void EntityMapper::shutdown() {
 
   m_type_rule_map.clear();
   m_options_map.clear();
+  m_match_sources.clear();
+  m_match_tables.clear();
+  m_entity_mappings.clear();
 
   m_initialised = false;
 }
 
 void EntityMapper::registerCommands(Console *console) {
   console->registerCommand(CMD_load_entity_mappings, this);
+  console->registerCommand(CMD_explain_entity_mapping, this);
 }
 
 void EntityMapper::runCommand(const std::string &command, const std::string &args) {
@@ -73,13 +111,44 @@ void EntityMapper::runCommand(const std::string &command, const std::string &arg
     config.sige.connect(sigc::mem_fun(this, &EntityMapper::varconf_error_callback));
     std::string filename = args;
     System::instance()->getFileHandler()->getFilePath(filename);
-    config.readFromFile(filename);
+    System::instance()->getFileHandler()->readConfigFile(config, filename);
+    compileTables();
+  }
+  else if (command == CMD_explain_entity_mapping) {
+    // Use the entity under the cursor unless an id is given
+    WorldEntity *we = RenderSystem::getInstance().getActiveEntity();
+    if (!args.empty()) {
+      we = 0;
+      Character *c = System::instance()->getCharacterManager()->getActiveCharacter();
+      if (c && c->getAvatar() && c->getAvatar()->getView()) {
+        we = dynamic_cast<WorldEntity*>(c->getAvatar()->getView()->getEntity(args));
+      }
+    }
+    if (we == 0) {
+      printf("Usage: %s [entity id] (defaults to the entity under the cursor)\n", CMD_explain_entity_mapping.c_str());
+    } else {
+      explainEntityMapping(we);
+    }
   }
 }
 
 std::string EntityMapper::getEntityMapping(const WorldEntity *we) {
   assert(we != 0);
 
+  MatchTableMap::const_iterator T = m_match_tables.find(we->type());
+  if (T == m_match_tables.end()) return applyRule(we);
+
+  AttributeValueList values;
+  readAttributes(we, T->second, values);
+  const int row = findMatch(T->second, values);
+  const std::string mapping = (row >= 0) ? T->second.rows[row].mapping : applyRule(we);
+
+  // Kept so a change to a matched attribute can tell if the record changes
+  m_entity_mappings[we->getViewId()] = mapping;
+  return mapping;
+}
+
+std::string EntityMapper::applyRule(const WorldEntity *we) const {
   //const std::string &id = we->getId();
   const std::string &type = we->type();
 
@@ -102,10 +171,262 @@ std::string EntityMapper::getEntityMapping(const WorldEntity *we) {
   return "";
 }
 
+bool EntityMapper::usesAttribute(const std::string &type, const std::string &attr) const {
+  MatchTableMap::const_iterator T = m_match_tables.find(type);
+  if (T == m_match_tables.end()) return false;
+  const StringList &columns = T->second.columns;
+  for (StringList::const_iterator I = columns.begin(); I != columns.end(); ++I) {
+    if (*I == attr) return true;
+    if (attr == ATTR_bbox && (*I == ATTR_size || *I == ATTR_height)) return true;
+  }
+  return false;
+}
+
+bool EntityMapper::updateEntityMapping(const WorldEntity *we) {
+  // Entities that have not been mapped yet will be when they are drawn
+  StringMap::const_iterator I = m_entity_mappings.find(we->getViewId());
+  if (I == m_entity_mappings.end()) return false;
+  const std::string old_mapping = I->second;
+  return getEntityMapping(we) != old_mapping;
+}
+
+void EntityMapper::readAttributes(const WorldEntity *we, const MatchTable &table, AttributeValueList &values) const {
+  values.resize(table.columns.size());
+  for (size_t i = 0; i < table.columns.size(); ++i) {
+    const std::string &name = table.columns[i];
+    AttributeValue &value = values[i];
+    value.present = false;
+    value.is_number = false;
+    value.number = 0.0;
+    value.text.clear();
+
+    if (name == ATTR_size || name == ATTR_height) {
+      if (!we->hasBBox()) continue;
+      const WFMath::AxisBox<3> &bbox = we->getBBox();
+      const WFMath::Vector<3> extent = bbox.highCorner() - bbox.lowCorner();
+      value.present = true;
+      value.is_number = true;
+      value.number = (name == ATTR_height) ? extent.z() : std::max(extent.x(), std::max(extent.y(), extent.z()));
+      value.text = string_fmt(value.number);
+      continue;
+    }
+
+    if (!we->hasAttr(name)) continue;
+    const Atlas::Message::Element &element = we->valueOfAttr(name);
+    value.present = true;
+    if (element.isNum()) {
+      value.is_number = true;
+      value.number = element.asNum();
+      value.text = string_fmt(value.number);
+    } else if (element.isString()) {
+      value.text = element.asString();
+      char *end = 0;
+      value.number = strtod(value.text.c_str(), &end);
+      value.is_number = !value.text.empty() && *end == '\0';
+    }
+  }
+}
+
+bool EntityMapper::testCondition(const Condition &condition, const AttributeValue &value) {
+  if (condition.op == OP_EXISTS) return value.present;
+  if (condition.op == OP_MISSING) return !value.present;
+  if (!value.present) return false;
+
+  // Compare as numbers if both sides are, otherwise only equality works
+  if (condition.is_number && value.is_number) {
+    switch (condition.op) {
+      case OP_EQUAL: return value.number == condition.number;
+      case OP_NOT_EQUAL: return value.number != condition.number;
+      case OP_LESS: return value.number < condition.number;
+      case OP_LESS_EQUAL: return value.number <= condition.number;
+      case OP_GREATER: return value.number > condition.number;
+      case OP_GREATER_EQUAL: return value.number >= condition.number;
+      default: return false;
+    }
+  }
+  if (condition.op == OP_EQUAL) return value.text == condition.text;
+  if (condition.op == OP_NOT_EQUAL) return value.text != condition.text;
+  return false;
+}
+
+int EntityMapper::findMatch(const MatchTable &table, const AttributeValueList &values) {
+  for (size_t r = 0; r < table.rows.size(); ++r) {
+    const std::vector<Condition> &conditions = table.rows[r].conditions;
+    size_t c = 0;
+    while (c < conditions.size() && testCondition(conditions[c], values[conditions[c].column])) ++c;
+    if (c == conditions.size()) return r;
+  }
+  return -1;
+}
+
+static std::string trim(const std::string &str) {
+  const std::string::size_type start = str.find_first_not_of(" \t");
+  if (start == std::string::npos) return "";
+  const std::string::size_type end = str.find_last_not_of(" \t");
+  return str.substr(start, end - start + 1);
+}
+
+bool EntityMapper::compileCondition(const std::string &text, MatchTable &table, Condition &condition) {
+  std::string attr;
+  std::string value;
+
+  // Split at the first operator in the text, so the value may contain
+  // operators. Two character operators first so "<=" is not read as "<".
+  static const Operator ops[] = { OP_EQUAL, OP_NOT_EQUAL, OP_LESS_EQUAL, OP_GREATER_EQUAL, OP_LESS, OP_GREATER };
+  std::string::size_type pos = text.find_first_of("=!<>");
+  while (pos != std::string::npos) {
+    unsigned int i = 0;
+    while (i < sizeof(ops) / sizeof(ops[0]) && text.compare(pos, strlen(OPERATOR_NAMES[ops[i]]), OPERATOR_NAMES[ops[i]]) != 0) ++i;
+    if (i < sizeof(ops) / sizeof(ops[0])) {
+      condition.op = ops[i];
+      attr = trim(text.substr(0, pos));
+      value = trim(text.substr(pos + strlen(OPERATOR_NAMES[ops[i]])));
+      break;
+    }
+    // A "!" on its own, as in "!attribute"
+    pos = text.find_first_of("=!<>", pos + 1);
+  }
+  if (pos == std::string::npos) {
+    attr = trim(text);
+    condition.op = OP_EXISTS;
+    if (!attr.empty() && attr[0] == '!') {
+      condition.op = OP_MISSING;
+      attr = trim(attr.substr(1));
+    }
+  }
+  if (attr.empty()) return false;
+
+  // Allow quoted values so they can contain spaces
+  if (value.size() >= 2 && value[0] == '\'' && value[value.size() - 1] == '\'') {
+    value = value.substr(1, value.size() - 2);
+  }
+  condition.text = value;
+  char *end = 0;
+  condition.number = strtod(value.c_str(), &end);
+  condition.is_number = !value.empty() && *end == '\0';
+
+  // Ordering only makes sense for numbers
+  if (!condition.is_number && condition.op >= OP_LESS) return false;
+
+  // Share a column with other rows testing the same attribute
+  unsigned int column = 0;
+  while (column < table.columns.size() && table.columns[column] != attr) ++column;
+  if (column == table.columns.size()) table.columns.push_back(attr);
+  condition.column = column;
+  return true;
+}
+
+bool EntityMapper::compileRow(const std::string &name, const std::string &source, MatchTable &table, MatchRow &row) {
+  row.name = name;
+  row.source = source;
+
+  const std::string::size_type colon = source.rfind(':');
+  if (colon == std::string::npos) return false;
+  row.mapping = trim(source.substr(colon + 1));
+  if (row.mapping.empty()) return false;
+
+  // A row without conditions always matches
+  const std::string conditions = source.substr(0, colon);
+  if (trim(conditions).empty()) return true;
+
+  std::string::size_type start = 0;
+  while (start <= conditions.size()) {
+    std::string::size_type end = conditions.find("&&", start);
+    if (end == std::string::npos) end = conditions.size();
+    Condition condition;
+    if (!compileCondition(conditions.substr(start, end - start), table, condition)) return false;
+    row.conditions.push_back(condition);
+    start = end + 2;
+  }
+  return true;
+}
+
+void EntityMapper::compileTables() {
+  m_match_tables.clear();
+  TypeMatchSourceMap::const_iterator I = m_match_sources.begin();
+  for (; I != m_match_sources.end(); ++I) {
+    MatchTable &table = m_match_tables[I->first];
+    MatchSourceMap::const_iterator J = I->second.begin();
+    for (; J != I->second.end(); ++J) {
+      MatchRow row;
+      if (compileRow(J->second.first, J->second.second, table, row)) {
+        table.rows.push_back(row);
+      } else {
+        SEAR_LOG(Log::CAT_MODEL, Log::LOG_ERROR, "Bad entity mapping " + I->first + "." + J->second.first + ": " + J->second.second);
+      }
+    }
+  }
+  // Chosen mappings may no longer be right, but entities keep their records
+  // until a matched attribute changes or the models are reset.
+  m_entity_mappings.clear();
+}
+
+void EntityMapper::explainEntityMapping(const WorldEntity *we) {
+  const std::string &type = we->type();
+  printf("Entity %s (%s) of type %s\n", we->getId().c_str(), we->getName().c_str(), type.c_str());
+
+  MatchTableMap::const_iterator T = m_match_tables.find(type);
+  if (T == m_match_tables.end()) {
+    printf("  No match rows\n");
+  } else {
+    const MatchTable &table = T->second;
+    AttributeValueList values;
+    readAttributes(we, table, values);
+    for (size_t i = 0; i < table.columns.size(); ++i) {
+      printf("  %s = %s\n", table.columns[i].c_str(),
+             values[i].present ? values[i].text.c_str() : "(not set)");
+    }
+    const int match = findMatch(table, values);
+    for (size_t r = 0; r < table.rows.size(); ++r) {
+      const MatchRow &row = table.rows[r];
+      printf("  %s %s: %s\n", ((int)r == match) ? "*" : " ", row.name.c_str(), row.source.c_str());
+      for (size_t c = 0; c < row.conditions.size(); ++c) {
+        const Condition &condition = row.conditions[c];
+        const char *result = testCondition(condition, values[condition.column]) ? "true" : "false";
+        if (condition.op == OP_EXISTS || condition.op == OP_MISSING) {
+          printf("      %s%s: %s\n", OPERATOR_NAMES[condition.op],
+                 table.columns[condition.column].c_str(), result);
+        } else {
+          printf("      %s %s %s: %s\n", table.columns[condition.column].c_str(),
+                 OPERATOR_NAMES[condition.op], condition.text.c_str(), result);
+        }
+      }
+    }
+    if (match >= 0) {
+      printf("  Matched %s: %s\n", table.rows[match].name.c_str(), table.rows[match].mapping.c_str());
+      return;
+    }
+  }
+
+  StringMap::const_iterator I = m_type_rule_map.find(type);
+  if (I == m_type_rule_map.end()) {
+    printf("  No rule, the type hierarchy is searched\n");
+  } else {
+    const std::string mapping = applyRule(we);
+    printf("  Rule %s chose: %s\n", I->second.c_str(), mapping.empty() ? "(nothing)" : mapping.c_str());
+  }
+}
+
 void EntityMapper::varconf_callback(const std::string &section, const std::string &key, varconf::Config &config) {
   const std::string &value = (std::string)config.getItem(section, key);
   if (key == KEY_rule) {
     m_type_rule_map[section] = value;
+  } else if (key.compare(0, KEY_match.size(), KEY_match) == 0) {
+    // match_<n>, tried in order of n
+    const std::string digits = key.substr(std::min(key.size(), KEY_match.size() + 1));
+    if (key.size() <= KEY_match.size() + 1 || key[KEY_match.size()] != '_' ||
+        digits.find_first_not_of("0123456789") != std::string::npos) {
+      SEAR_LOG(Log::CAT_MODEL, Log::LOG_WARNING, "Ignoring entity mapping " + section + "." + key + ", match rows are named match_<number>");
+      return;
+    }
+    const int order = atoi(digits.c_str());
+    MatchSourceMap &sources = m_match_sources[section];
+    MatchSourceMap::const_iterator I = sources.find(order);
+    // The same key again, e.g. from a later file, replaces the row quietly
+    if (I != sources.end() && I->second.first != key) {
+      SEAR_LOG(Log::CAT_MODEL, Log::LOG_WARNING, "Entity mapping " + section + "." + key + " replaces " + I->second.first);
+    }
+    sources[order] = std::make_pair(key, value);
   } else if (key == KEY_options) {
     Tokeniser tok(value, ' ');
     while (tok.hasRemainingTokens()) {
@@ -1,11 +1,13 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2007 - 2008 Simon Goodall
+// Copyright (C) 2007 - 2009 Simon Goodall
 
 #ifndef SEAR_LOADERS_ENTITYMAPPER_H
 #define SEAR_LOADERS_ENTITYMAPPER_H 1
 
 #include <string>
+#include <vector>
+#include <map>
 
 #include <sigc++/trackable.h>
 
@@ -34,13 +36,39 @@ public:
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
 
+  /** Choose the object record for an entity. The match rows for its type are
+   * tried in order, then the type's rule.
+   * @return The record name, or an empty string if there is no mapping.
+   */
   std::string getEntityMapping(const WorldEntity *we);
 
   void registerEntityMapperRule(const std::string &rule, SPtr<IEntityMapperRule> impl) {
     m_rules_map[rule] = impl;
   }
 
+  /** Whether the match rows for a type read the given attribute.
+   */
+  bool usesAttribute(const std::string &type, const std::string &attr) const;
+
+  /** Choose the mapping for an entity again after an attribute it is
+   * matched on has changed.
+   * @return True if the entity had a mapping and it is now different.
+   */
+  bool updateEntityMapping(const WorldEntity *we);
+
+  /** Forget the mapping chosen for an entity that has gone.
+   */
+  void forgetEntity(const std::string &view_id) { m_entity_mappings.erase(view_id); }
+
+  /** Print each match row for the entity's type, whether it matched, and
+   * the mapping chosen.
+   */
+  void explainEntityMapping(const WorldEntity *we);
+
 private:
+  // tools/entity_mapper_test feeds in config and attribute values directly
+  friend class EntityMapperTest;
+
   void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
   void varconf_error_callback(const char *message);
 
@@ -51,11 +79,75 @@ private:
 
   typedef std::map<std::string, SPtr<IEntityMapperRule> > RuleMap;
 
+  typedef enum {
+    OP_EXISTS = 0,
+    OP_MISSING,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL
+  } Operator;
+
+  // One "attribute op value" test. column indexes the attributes read by
+  // the table, so each is only fetched once per entity.
+  typedef struct {
+    unsigned int column;
+    Operator op;
+    std::string text;
+    double number;
+    bool is_number;
+  } Condition;
+
+  // All conditions must hold for the row to choose its mapping
+  typedef struct {
+    std::string name;
+    std::string source;
+    std::vector<Condition> conditions;
+    std::string mapping;
+  } MatchRow;
+
+  typedef struct {
+    StringList columns;
+    std::vector<MatchRow> rows;
+  } MatchTable;
+
+  typedef struct {
+    bool present;
+    bool is_number;
+    double number;
+    std::string text;
+  } AttributeValue;
+
+  typedef std::vector<AttributeValue> AttributeValueList;
+
+  // Match rows as written in the config, by type then row number
+  typedef std::map<int, std::pair<std::string, std::string> > MatchSourceMap;
+  typedef std::map<std::string, MatchSourceMap> TypeMatchSourceMap;
+  typedef std::map<std::string, MatchTable> MatchTableMap;
+
+  void compileTables();
+  bool compileRow(const std::string &name, const std::string &source, MatchTable &table, MatchRow &row);
+  bool compileCondition(const std::string &text, MatchTable &table, Condition &condition);
+
+  void readAttributes(const WorldEntity *we, const MatchTable &table, AttributeValueList &values) const;
+  static bool testCondition(const Condition &condition, const AttributeValue &value);
+  static int findMatch(const MatchTable &table, const AttributeValueList &values);
+
+  std::string applyRule(const WorldEntity *we) const;
+
   bool m_initialised;
 
   StringMap     m_type_rule_map;
   StringListMap m_options_map;
   RuleMap m_rules_map;
+
+  TypeMatchSourceMap m_match_sources;
+  MatchTableMap m_match_tables;
+
+  // Last mapping chosen for each entity with match rows, by view id
+  StringMap m_entity_mappings;
 };
 
 } /* namespace Sear */
@@ -79,7 +79,7 @@ int LibModelFile::init(const std::string &filename) {
   assert(m_initialised == false);
 
   std::string object;
-  if (m_config.readFromFile(filename)) {
+  if (System::instance()->getFileHandler()->readConfigFile(m_config, filename)) {
     if (m_config.findItem(SECTION_model, KEY_filename)) {
       object = (std::string)m_config.getItem(SECTION_model, KEY_filename);
     } else {
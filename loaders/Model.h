@@ -138,6 +138,14 @@ public:
   virtual bool hasDynamicObjects() const { return false; }
   virtual DynamicObjectList &getDynamicObjects() { return m_dynamic_objects; }
 
+  /** The getMemoryUsage function estimates the memory held by this model,
+   * used to keep loaded models within a memory budget. The default sums the
+   * static and dynamic objects.
+   * @param cpu Incremented by the bytes held in main memory
+   * @param gpu Incremented by the bytes held by the graphics driver
+   */
+  virtual void getMemoryUsage(size_t &cpu, size_t &gpu);
+
   virtual void clearOutfit() {} 
   virtual void entityWorn(const std::string &where, WorldEntity *we) {}
   virtual void entityWorn(WorldEntity *we) {}
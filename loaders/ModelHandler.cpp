@@ -2,9 +2,13 @@
 // the GNU General Public License (See COPYING for details).
 // Copyright (C) 2001 - 2008 Simon Goodall, University of Southampton
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
+#include <algorithm>
+
 #include <sigc++/object_slot.h>
 
 #include <Atlas/Message/Element.h>
@@ -13,6 +17,9 @@
 
 #include <Eris/Timeout.h>
 
+#include <SDL/SDL.h>
+
+#include "common/Log.h"
 #include "common/Utility.h"
 
 #include "renderers/RenderSystem.h"
@@ -45,6 +52,27 @@ static const std::string CMD_LOAD_MODEL_RECORDS = "load_model_records";
 static const std::string CMD_dump_object = "dump_object";
 static const std::string CMD_reload_config_models = "reload_config_models";
 static const std::string CMD_unload_models = "unload_models";
+static const std::string CMD_model_load_budget = "model_load_budget";
+static const std::string CMD_model_load_stats = "model_load_stats";
+static const std::string CMD_model_memory_budget = "model_memory_budget";
+static const std::string CMD_model_residency = "model_residency";
+
+// Record drawn while a model without a proxy is loading
+static const std::string RECORD_placeholder = "placeholder";
+static const std::string KEY_proxy = "proxy";
+
+// Default time per frame spent loading models, in milliseconds
+static const unsigned int DEFAULT_load_budget = 5;
+
+// Default memory budgets for loaded models, in megabytes
+static const unsigned int DEFAULT_cpu_budget = 128;
+static const unsigned int DEFAULT_gpu_budget = 64;
+// Models drawn more recently than this, in seconds, are never evicted
+static const float MIN_idle_time = 5.0f;
+// Milliseconds between memory budget checks
+static const unsigned int BUDGET_check_interval = 1000;
+// Number of models listed by the residency report
+static const unsigned int RESIDENCY_report_size = 10;
 
 static const std::string ATTR_GUISE= "guise";
 static const std::string ATTR_MODE = "mode";
@@ -56,7 +84,22 @@ static const std::string KEY_SELECT_STATE_NUM = "select_state_num";
 
 ModelHandler::ModelHandler() :
   m_initialised(false),
-  m_timeout(NULL)
+  m_timeout(NULL),
+  m_load_budget(DEFAULT_load_budget),
+  m_async_loading(true),
+  m_models_loaded(0),
+  m_placeholders_used(0),
+  m_last_load_time(0),
+  m_generation(0),
+  m_models_decoded(0),
+  m_thread(NULL),
+  m_mutex(NULL),
+  m_cond(NULL),
+  m_quit(false),
+  m_cpu_budget(DEFAULT_cpu_budget * 1024 * 1024),
+  m_gpu_budget(DEFAULT_gpu_budget * 1024 * 1024),
+  m_last_budget_check(0),
+  m_models_evicted(0)
 {}
 
 ModelHandler::~ModelHandler() {
@@ -78,6 +121,21 @@ void ModelHandler::init() {
   m_model_records.setItem("default", ModelRecord::SELECT_STATE, "select");
   m_model_records.setItem("default", ModelRecord::OUTLINE, false);
 
+  // Add placeholder record
+  m_model_records.setItem(RECORD_placeholder, ModelRecord::MODEL_LOADER, "boundbox");
+  m_model_records.setItem(RECORD_placeholder, ModelRecord::STATE, "default");
+  m_model_records.setItem(RECORD_placeholder, ModelRecord::SELECT_STATE, "select");
+  m_model_records.setItem(RECORD_placeholder, ModelRecord::OUTLINE, false);
+
+  m_mutex = SDL_CreateMutex();
+  m_cond = SDL_CreateCond();
+  m_quit = false;
+  m_thread = SDL_CreateThread(&ModelHandler::loaderThread, this);
+  if (m_thread == NULL) {
+    // Models are then read on the main thread
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_ERROR, std::string("Error creating model loader thread: ") + SDL_GetError());
+  }
+
   m_initialised = true;
 }
 
@@ -86,6 +144,31 @@ void ModelHandler::shutdown() {
 
   delete m_timeout;
 
+  // Stop the loader thread
+  if (m_thread != NULL) {
+    SDL_LockMutex(m_mutex);
+    m_quit = true;
+    m_decode_queue.clear();
+    SDL_CondSignal(m_cond);
+    SDL_UnlockMutex(m_mutex);
+    SDL_WaitThread(m_thread, NULL);
+    m_thread = NULL;
+  }
+
+  // Free models that were never collected
+  while (!m_decoded_queue.empty()) {
+    delete m_decoded_queue.front().model;
+    m_decoded_queue.pop_front();
+  }
+  clearPending();
+
+  SDL_DestroyCond(m_cond);
+  SDL_DestroyMutex(m_mutex);
+  m_cond = NULL;
+  m_mutex = NULL;
+
+  m_retired_loaders.clear();
+
   // Clean up model loaders
   m_model_loaders.clear();
   // Delete all unique records
@@ -124,39 +207,101 @@ SPtr<ModelRecord> ModelHandler::getModel(const std::string &model_id, WorldEntit
     return J->second;
   }
 
-  // Need to create a new model
-  std::string model_loader = (std::string)m_model_records.getItem(model_id, ModelRecord::MODEL_LOADER);
+  const std::string &model_loader = (std::string)m_model_records.getItem(model_id, ModelRecord::MODEL_LOADER);
+  if (m_async_loading && isDeferred(model_loader)) {
+    // Queue the real model and draw a placeholder until it is ready
+    if (m_pending_ids.find(id) == m_pending_ids.end()) {
+      PendingModel pm;
+      pm.id = id;
+      pm.model_id = model_id;
+      pm.decode_key = startDecode(id, model_id, model_loader);
+      pm.entity = Eris::EntityRef(we);
+      m_pending.push_back(pm);
+      m_pending_ids.insert(id);
+    }
+    SPtr<ModelRecord> placeholder = loadPlaceholder(model_id, we);
+    m_object_map[id] = placeholder;
+    ++m_placeholders_used;
+    return placeholder;
+  }
+
+  SPtr<ModelRecord> model = loadModel(model_id, we);
+
+  // Store per entity model
+  m_object_map[id] = model;
+
+  return model; 
+}
+
+bool ModelHandler::isDeferred(const std::string &model_loader) const {
+  // These are cheap enough to create straight away, and are what
+  // placeholders are made of. loadModel uses a bound box when no loader
+  // is given.
+  if (model_loader.empty()) return false;
+  return model_loader != "boundbox" && model_loader != "wireframe";
+}
+
+ModelHandler::ModelLoaderMap::iterator ModelHandler::findModelLoader(const std::string &model_id, std::string &model_loader) {
+  model_loader = (std::string)m_model_records.getItem(model_id, ModelRecord::MODEL_LOADER);
 
   // We are assuming that the boundbox loader is always available
 
   if (model_loader.empty()) {
-    fprintf(stderr, "Model Loader not defined for %s. Using BoundBox.\n", model_id.c_str());
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_WARNING, "Model Loader not defined for " + model_id + ". Using BoundBox.");
     model_loader = "boundbox";
   }
 
   ModelLoaderMap::iterator K = m_model_loaders.find(model_loader);
   ModelLoaderMap::const_iterator Kend = m_model_loaders.end();
   if (K == Kend) {
-    fprintf(stderr, "Unknown Model Loader for %s. Using BoundBox.\n", model_id.c_str());
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_WARNING, "Unknown Model Loader " + model_loader + " for " + model_id + ". Using BoundBox.");
     model_loader = "boundbox";
     K = m_model_loaders.find(model_loader);
   }
+  return K;
+}
+
+SPtr<ModelRecord> ModelHandler::loadModel(const std::string &model_id, WorldEntity *we) {
+  // Need to create a new model
+  std::string model_loader;
+  ModelLoaderMap::iterator K = findModelLoader(model_id, model_loader);
 
   SPtr<ModelRecord> model;
-  if (K != Kend) {
+  if (K != m_model_loaders.end()) {
     model = K->second->loadModel(we, model_id, m_model_records);
   } else {
-    fprintf(stderr, "No loader found (%s) for %s\n ", model_loader.c_str(), model_id.c_str());
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_ERROR, "No loader found (" + model_loader + ") for " + model_id);
 //    return model;
   }
-  
+  return setupModel(model_id, model_loader, we, model);
+}
+
+SPtr<ModelRecord> ModelHandler::loadDecodedModel(const std::string &model_id, WorldEntity *we, Model *decoded) {
+  std::string model_loader;
+  ModelLoaderMap::iterator K = findModelLoader(model_id, model_loader);
+
+  SPtr<ModelRecord> model;
+  if (K != m_model_loaders.end()) {
+    model = K->second->loadDecodedModel(we, model_id, m_model_records, decoded);
+  } else {
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_ERROR, "No loader found (" + model_loader + ") for " + model_id);
+    delete decoded;
+  }
+  return setupModel(model_id, model_loader, we, model);
+}
+
+SPtr<ModelRecord> ModelHandler::setupModel(const std::string &model_id, const std::string &model_loader, WorldEntity *we, SPtr<ModelRecord> model) {
   // Check model was loaded, and fall back to a NullModel on error
   if (!model) {
-    fprintf(stderr, "Error loading model of type %s for %s\n", model_loader.c_str(), model_id.c_str());
+    SEAR_LOG(Log::CAT_MODEL, Log::LOG_ERROR, "Error loading model of type " + model_loader + " for " + model_id);
     model = SPtr<ModelRecord>(new ModelRecord);
     model->model = SPtr<Model>(new NullModel());
   }
 
+  // Count as used now so the memory budget check does not unload the model
+  // before it is first drawn.
+  model->model->setLastTime(System::instance()->getTimef());
+
   // Set initial animation
   if (we->hasAttr(ATTR_MODE)) {
     model->model->animate(we->valueOfAttr(ATTR_MODE).asString());
@@ -165,10 +310,206 @@ SPtr<ModelRecord> ModelHandler::getModel(const std::string &model_id, WorldEntit
   // If model is a generic one, add it to the generic list
   if (model->model_by_type) m_model_records_map[model_id] = model;
 
-  // Store per entity model
-  m_object_map[id] = model;
+  return model;
+}
 
-  return model; 
+SPtr<ModelRecord> ModelHandler::loadPlaceholder(const std::string &model_id, WorldEntity *we) {
+  std::string proxy = RECORD_placeholder;
+  if (m_model_records.findItem(model_id, KEY_proxy)) {
+    proxy = (std::string)m_model_records.getItem(model_id, KEY_proxy);
+  }
+
+  // Proxies that would themselves be deferred fall back to the placeholder
+  if (proxy != RECORD_placeholder) {
+    const std::string &loader = (std::string)m_model_records.getItem(proxy, ModelRecord::MODEL_LOADER);
+    if (isDeferred(loader)) {
+      SEAR_LOG(Log::CAT_MODEL, Log::LOG_WARNING, "Proxy " + proxy + " for " + model_id + " is not a simple model.");
+      proxy = RECORD_placeholder;
+    }
+  }
+
+  ModelRecordMap::const_iterator I = m_model_records_map.find(proxy);
+  if (I != m_model_records_map.end()) return I->second;
+
+  return loadModel(proxy, we);
+}
+
+void ModelHandler::loadPendingModels() {
+  assert (m_initialised == true);
+  collectDecodedModels();
+  if (m_pending.empty()) return;
+
+  const unsigned int start = SDL_GetTicks();
+  bool first = true;
+  bool unused = false;
+  PendingList::iterator I = m_pending.begin();
+  while (I != m_pending.end()) {
+    // Always make some progress, then stop once the budget is used
+    if (!first && SDL_GetTicks() - start >= m_load_budget) break;
+
+    WorldEntity *we = dynamic_cast<WorldEntity*>(I->entity.get());
+    if (we == NULL) {
+      // Entity has gone away
+      m_pending_ids.erase(I->id);
+      I = m_pending.erase(I);
+      unused = true;
+      continue;
+    }
+
+    SPtr<ModelRecord> model;
+    ModelRecordMap::const_iterator J = m_model_records_map.find(I->model_id);
+    if (J != m_model_records_map.end()) {
+      // Another entity of the same type got here first
+      model = J->second;
+      if (!I->decode_key.empty()) unused = true;
+    } else if (m_decoding.find(I->decode_key) != m_decoding.end()) {
+      // Still being read by the loader thread
+      ++I;
+      continue;
+    } else {
+      DecodedMap::iterator K = m_decoded.find(I->decode_key);
+      if (K != m_decoded.end()) {
+        Model *decoded = K->second;
+        m_decoded.erase(K);
+        model = loadDecodedModel(I->model_id, we, decoded);
+      } else {
+        model = loadModel(I->model_id, we);
+      }
+      ++m_models_loaded;
+      first = false;
+    }
+
+    m_object_map[I->id] = model;
+    we->startFadeIn();
+    m_pending_ids.erase(I->id);
+    I = m_pending.erase(I);
+  }
+  if (unused) dropUnusedDecodes();
+  m_last_load_time = SDL_GetTicks() - start;
+}
+
+int ModelHandler::loaderThread(void *data) {
+  static_cast<ModelHandler*>(data)->loaderLoop();
+  return 0;
+}
+
+void ModelHandler::loaderLoop() {
+  SDL_LockMutex(m_mutex);
+  while (!m_quit) {
+    if (m_decode_queue.empty()) {
+      SDL_CondWait(m_cond, m_mutex);
+      continue;
+    }
+    DecodeRequest request = m_decode_queue.front();
+    m_decode_queue.pop_front();
+
+    // Decode without holding the lock
+    SDL_UnlockMutex(m_mutex);
+    Model *model = request.loader->decodeModel(request.file_name);
+    SDL_LockMutex(m_mutex);
+
+    DecodedModel dm;
+    dm.key = request.key;
+    dm.model = model;
+    dm.generation = request.generation;
+    m_decoded_queue.push_back(dm);
+  }
+  SDL_UnlockMutex(m_mutex);
+}
+
+std::string ModelHandler::startDecode(const std::string &id, const std::string &model_id, const std::string &model_loader) {
+  if (m_thread == NULL) return "";
+
+  ModelLoaderMap::iterator I = m_model_loaders.find(model_loader);
+  if (I == m_model_loaders.end() || !I->second->canDecode()) return "";
+  if (!m_model_records.findItem(model_id, ModelRecord::DATA_FILE_PATH)) return "";
+
+  bool by_type = false;
+  if (m_model_records.findItem(model_id, ModelRecord::MODEL_BY_TYPE)) {
+    by_type = (bool)m_model_records.getItem(model_id, ModelRecord::MODEL_BY_TYPE);
+  }
+  const std::string &key = (by_type) ? (model_id) : (id);
+  if (m_decoding.find(key) != m_decoding.end()) return key;
+  if (m_decoded.find(key) != m_decoded.end()) return key;
+
+  DecodeRequest request;
+  request.key = key;
+  request.file_name = (std::string)m_model_records.getItem(model_id, ModelRecord::DATA_FILE_PATH);
+  System::instance()->getFileHandler()->getFilePath(request.file_name);
+  request.loader = I->second.get();
+  request.generation = m_generation;
+
+  SDL_LockMutex(m_mutex);
+  m_decode_queue.push_back(request);
+  SDL_CondSignal(m_cond);
+  SDL_UnlockMutex(m_mutex);
+
+  m_decoding.insert(key);
+  return key;
+}
+
+void ModelHandler::collectDecodedModels() {
+  if (m_thread == NULL) return;
+
+  std::deque<DecodedModel> decoded;
+  SDL_LockMutex(m_mutex);
+  decoded.swap(m_decoded_queue);
+  SDL_UnlockMutex(m_mutex);
+
+  while (!decoded.empty()) {
+    const DecodedModel &dm = decoded.front();
+    // Dropped while it was being read
+    if (dm.generation != m_generation || m_decoding.erase(dm.key) == 0) {
+      delete dm.model;
+    } else {
+      m_decoded[dm.key] = dm.model;
+      ++m_models_decoded;
+    }
+    decoded.pop_front();
+  }
+}
+
+void ModelHandler::dropUnusedDecodes() {
+  std::set<std::string> used;
+  for (PendingList::const_iterator I = m_pending.begin(); I != m_pending.end(); ++I) {
+    used.insert(I->decode_key);
+  }
+
+  DecodedMap::iterator J = m_decoded.begin();
+  while (J != m_decoded.end()) {
+    if (used.find(J->first) != used.end()) {
+      ++J;
+      continue;
+    }
+    delete J->second;
+    m_decoded.erase(J++);
+  }
+
+  // These are deleted when they are collected
+  std::set<std::string>::iterator K = m_decoding.begin();
+  while (K != m_decoding.end()) {
+    if (used.find(*K) == used.end()) m_decoding.erase(K++);
+    else ++K;
+  }
+}
+
+void ModelHandler::clearPending() {
+  m_pending.clear();
+  m_pending_ids.clear();
+
+  // Decodes already started are thrown away when they are collected
+  if (m_thread != NULL) {
+    SDL_LockMutex(m_mutex);
+    m_decode_queue.clear();
+    SDL_UnlockMutex(m_mutex);
+  }
+  ++m_generation;
+  m_decoding.clear();
+
+  for (DecodedMap::iterator I = m_decoded.begin(); I != m_decoded.end(); ++I) {
+    delete I->second;
+  }
+  m_decoded.clear();
 }
 
 void ModelHandler::registerModelLoader(SPtr<ModelLoader> model_loader) {
@@ -187,6 +528,8 @@ void ModelHandler::unregisterModelLoader(const std::string &model_type) {
   // Only unregister a model laoder if it is properly registered
   ModelLoaderMap::iterator I = m_model_loaders.find(model_type);
   if (I != m_model_loaders.end()) {
+    // The loader thread may still be using it
+    if (m_thread != NULL) m_retired_loaders.push_back(I->second);
     m_model_loaders.erase(I);
   }
 }
@@ -197,7 +540,7 @@ void ModelHandler::checkModelTimeouts(bool forceUnload) {
   // If the time has been longer than a threshold, we unload the model record 
   // and associated models.
 
-  if (debug) printf("[ModelHandler] Checking Timeouts\n");
+  SEAR_LOG(Log::CAT_MODEL, Log::LOG_DEBUG, "Checking Timeouts");
 
   // Do the same again for the object map
   ModelRecordMap::iterator Jend = m_object_map.end();
@@ -232,6 +575,89 @@ void ModelHandler::checkModelTimeouts(bool forceUnload) {
   }
 }
 
+void ModelHandler::getResidentModels(ResidentList &models, size_t &cpu, size_t &gpu) {
+  // Records are shared between the type and object maps, so only count
+  // each one once.
+  std::set<ModelRecord*> seen;
+  ObjectRecordMap *maps[2] = { &m_model_records_map, &m_object_map };
+  for (int i = 0; i < 2; ++i) {
+    for (ObjectRecordMap::iterator I = maps[i]->begin(); I != maps[i]->end(); ++I) {
+      SPtr<ModelRecord> record = I->second;
+      if (!record || !record->model) continue;
+      if (!seen.insert(record.get()).second) continue;
+
+      ResidentModel rm;
+      rm.record = record;
+      rm.cpu = rm.gpu = 0;
+      record->model->getMemoryUsage(rm.cpu, rm.gpu);
+      cpu += rm.cpu;
+      gpu += rm.gpu;
+      models.push_back(rm);
+    }
+  }
+}
+
+bool ModelHandler::drawnEarlier(const ResidentModel &a, const ResidentModel &b) {
+  return a.record->model->getLastTime() < b.record->model->getLastTime();
+}
+
+bool ModelHandler::largerModel(const ResidentModel &a, const ResidentModel &b) {
+  return a.cpu + a.gpu > b.cpu + b.gpu;
+}
+
+void ModelHandler::checkMemoryBudget() {
+  assert (m_initialised == true);
+  if (m_cpu_budget == 0 && m_gpu_budget == 0) return;
+
+  const unsigned int ticks = SDL_GetTicks();
+  if (ticks - m_last_budget_check < BUDGET_check_interval) return;
+  m_last_budget_check = ticks;
+
+  ResidentList models;
+  size_t cpu = 0, gpu = 0;
+  getResidentModels(models, cpu, gpu);
+
+  bool over_cpu = m_cpu_budget > 0 && cpu > m_cpu_budget;
+  bool over_gpu = m_gpu_budget > 0 && gpu > m_gpu_budget;
+  if (!over_cpu && !over_gpu) return;
+
+  std::sort(models.begin(), models.end(), &ModelHandler::drawnEarlier);
+
+  const float now = System::instance()->getTimef();
+  std::set<const ModelRecord*> victims;
+  for (ResidentList::const_iterator I = models.begin(); I != models.end(); ++I) {
+    if (!over_cpu && !over_gpu) break;
+    // Everything after this is in use too
+    if (now - I->record->model->getLastTime() < MIN_idle_time) break;
+    // Only evict models that help with the budget that is exceeded
+    if ((over_cpu && I->cpu > 0) || (over_gpu && I->gpu > 0)) {
+      victims.insert(I->record.get());
+      cpu -= I->cpu;
+      gpu -= I->gpu;
+      over_cpu = m_cpu_budget > 0 && cpu > m_cpu_budget;
+      over_gpu = m_gpu_budget > 0 && gpu > m_gpu_budget;
+    }
+  }
+  if (victims.empty()) return;
+
+  if (Log::isEnabled(Log::CAT_MODEL, Log::LOG_DEBUG)) {
+    Log::writeLog(Log::CAT_MODEL, Log::LOG_DEBUG, "Evicting models",
+                  LogFields().add("count", victims.size()).add("cpu_left", cpu).add("gpu_left", gpu));
+  }
+
+  // Removing the records from both maps releases the models. Entities that
+  // are drawn again will load them through getModel.
+  ObjectRecordMap *maps[2] = { &m_model_records_map, &m_object_map };
+  for (int i = 0; i < 2; ++i) {
+    ObjectRecordMap::iterator I = maps[i]->begin();
+    while (I != maps[i]->end()) {
+      if (victims.find(I->second.get()) != victims.end()) maps[i]->erase(I++);
+      else ++I;
+    }
+  }
+  m_models_evicted += victims.size();
+}
+
 void ModelHandler::TimeoutExpired() {
   assert (m_initialised == true);
   checkModelTimeouts(false);
@@ -240,7 +666,7 @@ void ModelHandler::TimeoutExpired() {
 
 void ModelHandler::loadModelRecords(const std::string &filename) {
   assert (m_initialised == true);
-  m_model_records.readFromFile(filename);
+  System::instance()->getFileHandler()->readConfigFile(m_model_records, filename);
 }
 
 void ModelHandler::varconf_callback(const std::string &section, const std::string &key, varconf::Config &config) {
@@ -258,7 +684,7 @@ void ModelHandler::varconf_callback(const std::string &section, const std::strin
 }
 
 void ModelHandler::varconf_error_callback(const char *message) {
-  fprintf(stderr, "[ModelHandler] %s\n", message);
+  Log::writeLog(Log::CAT_MODEL, Log::LOG_ERROR, message);
 }
 
 void ModelHandler::registerCommands(Console *console) {
@@ -269,6 +695,10 @@ void ModelHandler::registerCommands(Console *console) {
   console->registerCommand(CMD_dump_object, this);
   console->registerCommand(CMD_reload_config_models, this);
   console->registerCommand(CMD_unload_models, this);
+  console->registerCommand(CMD_model_load_budget, this);
+  console->registerCommand(CMD_model_load_stats, this);
+  console->registerCommand(CMD_model_memory_budget, this);
+  console->registerCommand(CMD_model_residency, this);
 }
 
 void ModelHandler::runCommand(const std::string &command, const std::string &args) {
@@ -352,6 +782,9 @@ void ModelHandler::runCommand(const std::string &command, const std::string &arg
   }
   else
   if (command == CMD_reload_config_models) {
+    ModelSystem::getInstance().invalidateObjectRecords();
+    // Queued models may use the old records, so entities ask again
+    clearPending();
     // Force model unloading
     checkModelTimeouts(true);
     // Force a context cleanup
@@ -381,6 +814,54 @@ void ModelHandler::runCommand(const std::string &command, const std::string &arg
   if (command == CMD_unload_models) {
     checkModelTimeouts(false);
   }
+  else
+  if (command == CMD_model_load_budget) {
+    const int budget = atoi(args.c_str());
+    if (budget > 0) {
+      setLoadBudget(budget);
+    } else {
+      printf("Usage: %s <milliseconds per frame>\n", CMD_model_load_budget.c_str());
+    }
+  }
+  else
+  if (command == CMD_model_load_stats) {
+    printf("Models - Pending: %lu Decoding: %lu Decoded: %u Loaded: %u Placeholders drawn: %u Last frame: %ums Budget: %ums\n",
+           (unsigned long)m_pending.size(), (unsigned long)m_decoding.size(),
+           m_models_decoded, m_models_loaded, m_placeholders_used,
+           m_last_load_time, m_load_budget);
+  }
+  else
+  if (command == CMD_model_memory_budget) {
+    unsigned int cpu, gpu;
+    if (sscanf(args.c_str(), "%u %u", &cpu, &gpu) == 2) {
+      setMemoryBudget(cpu * 1024 * 1024, gpu * 1024 * 1024);
+      // Apply the new budget straight away
+      m_last_budget_check = SDL_GetTicks() - BUDGET_check_interval;
+    } else {
+      printf("Usage: %s <cpu megabytes> <gpu megabytes> (0 for no limit)\n", CMD_model_memory_budget.c_str());
+    }
+  }
+  else
+  if (command == CMD_model_residency) {
+    ResidentList models;
+    size_t cpu = 0, gpu = 0;
+    getResidentModels(models, cpu, gpu);
+    printf("Models - Loaded: %lu CPU: %luKB of %luKB GPU: %luKB of %luKB Evicted: %u\n",
+           (unsigned long)models.size(),
+           (unsigned long)(cpu / 1024), (unsigned long)(m_cpu_budget / 1024),
+           (unsigned long)(gpu / 1024), (unsigned long)(m_gpu_budget / 1024),
+           m_models_evicted);
+
+    std::sort(models.begin(), models.end(), &ModelHandler::largerModel);
+    const float now = System::instance()->getTimef();
+    for (size_t i = 0; i < models.size() && i < RESIDENCY_report_size; ++i) {
+      const ResidentModel &rm = models[i];
+      printf("  %s (%s) CPU: %luKB GPU: %luKB Last drawn: %.1fs ago\n",
+             rm.record->id.c_str(), rm.record->model_loader.c_str(),
+             (unsigned long)(rm.cpu / 1024), (unsigned long)(rm.gpu / 1024),
+             now - rm.record->model->getLastTime());
+    }
+  }
 }
 void ModelHandler::contextCreated() {
   assert (m_initialised == true);
@@ -410,6 +891,7 @@ void ModelHandler::contextDestroyed(bool check) {
 
 void ModelHandler::reset() {
   assert (m_initialised == true);
+  clearPending();
   checkModelTimeouts(true);
 }
 
@@ -421,5 +903,20 @@ PosAndOrient Model::getPositionForSubmodel(const std::string& submodelName) cons
   return po;
 }
 
+void Model::getMemoryUsage(size_t &cpu, size_t &gpu) {
+  if (hasStaticObjects()) {
+    StaticObjectList &objs = getStaticObjects();
+    for (StaticObjectList::const_iterator I = objs.begin(); I != objs.end(); ++I) {
+      if (*I) (*I)->getMemoryUsage(cpu, gpu);
+    }
+  }
+  if (hasDynamicObjects()) {
+    DynamicObjectList &objs = getDynamicObjects();
+    for (DynamicObjectList::const_iterator I = objs.begin(); I != objs.end(); ++I) {
+      if (*I) (*I)->getMemoryUsage(cpu, gpu);
+    }
+  }
+}
+
 
 } /* namespace Sear */
@@ -5,13 +5,21 @@
 #ifndef SEAR_LOADERS_MODELHANDLER_H
 #define SEAR_LOADERS_MODELHANDLER_H 1
 
+#include <deque>
 #include <map>
+#include <list>
+#include <set>
 #include <string>
+#include <vector>
+
+#include <SDL/SDL_thread.h>
 
 #include <varconf/config.h>
 
 #include <sigc++/trackable.h>
 
+#include <Eris/EntityRef.h>
+
 #include "interfaces/ConsoleObject.h"
 
 #include "common/SPtr.h"
@@ -24,6 +32,7 @@ namespace Sear {
 
 // Forward Declarations
 class Console;
+class Model;
 class ModelLoader;
 class ModelRecord;
 class ObjectRecord;
@@ -44,8 +53,46 @@ public:
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
  
+  /**
+   * Get the model for an entity. Models that are expensive to load are
+   * queued and a placeholder is returned until loadPendingModels gets to
+   * them. The placeholder is the record named by the model's "proxy" key,
+   * or the "placeholder" record, a bounding box by default. If the model's
+   * loader can decode off the main thread, its data file is queued for the
+   * loader thread straight away.
+   */
   SPtr<ModelRecord> getModel(const std::string &model_id, WorldEntity *we);
 
+  /**
+   * Load queued models until this frame's time budget is used. At least one
+   * model is loaded each call so the queue always drains. The entity fades
+   * in when its real model replaces the placeholder. Should be called once
+   * a frame.
+   *
+   * Models read by the loader thread only have their textures requested
+   * and their meshes uploaded here, and models still being read are
+   * skipped. Loaders without a decode stage, such as cal3d, whose core
+   * models and textures are shared, load entirely on the main thread.
+   */
+  void loadPendingModels();
+
+  /**
+   * Unload the least recently drawn models while the estimated memory used
+   * by loaded models is over the CPU or GPU budget. Models drawn within the
+   * last few seconds are kept. The check runs at most once a second, so this
+   * can be called every frame.
+   */
+  void checkMemoryBudget();
+
+  void setMemoryBudget(size_t cpu, size_t gpu) {
+    m_cpu_budget = cpu;
+    m_gpu_budget = gpu;
+  }
+
+  void setLoadBudget(unsigned int ms) { m_load_budget = ms; }
+  unsigned int getLoadBudget() const { return m_load_budget; }
+  void setAsyncLoading(bool b) { m_async_loading = b; }
+
   void registerModelLoader(SPtr<ModelLoader> model_loader);
   void unregisterModelLoader(const std::string &model_type);
 
@@ -58,14 +105,71 @@ public:
   void reset();
 
 protected:
-  void TimeoutExpired();
-  void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
-  void varconf_error_callback(const char *message);
-
   typedef std::map<std::string, SPtr<ModelLoader> > ModelLoaderMap;
   typedef std::map<std::string, SPtr<ModelRecord> > ModelRecordMap; 
   typedef std::map<std::string, SPtr<ModelRecord> > ObjectRecordMap;
 
+  typedef struct {
+    std::string id; ///< Key in m_object_map
+    std::string model_id;
+    std::string decode_key; ///< Key in m_decoded, empty if not decoded
+    Eris::EntityRef entity;
+  } PendingModel;
+  typedef std::list<PendingModel> PendingList;
+
+  typedef struct {
+    std::string key;
+    std::string file_name;
+    ModelLoader *loader; ///< Kept alive by m_model_loaders or m_retired_loaders
+    unsigned int generation;
+  } DecodeRequest;
+
+  typedef struct {
+    std::string key;
+    Model *model; ///< NULL if the file could not be read
+    unsigned int generation;
+  } DecodedModel;
+
+  typedef std::map<std::string, Model*> DecodedMap;
+
+  SPtr<ModelRecord> loadModel(const std::string &model_id, WorldEntity *we);
+  SPtr<ModelRecord> loadDecodedModel(const std::string &model_id, WorldEntity *we, Model *decoded);
+  SPtr<ModelRecord> loadPlaceholder(const std::string &model_id, WorldEntity *we);
+  ModelLoaderMap::iterator findModelLoader(const std::string &model_id, std::string &model_loader);
+  SPtr<ModelRecord> setupModel(const std::string &model_id, const std::string &model_loader, WorldEntity *we, SPtr<ModelRecord> model);
+  bool isDeferred(const std::string &model_loader) const;
+
+  static int loaderThread(void *data);
+  void loaderLoop();
+
+  /**
+   * Queue the model's data file for the loader thread, if its loader can
+   * decode it. model_by_type models are decoded once for all entities.
+   * @return The key the decoded model will be stored under, or an empty
+   * string if the model is to be loaded on the main thread
+   */
+  std::string startDecode(const std::string &id, const std::string &model_id, const std::string &model_loader);
+  void collectDecodedModels();
+  void dropUnusedDecodes();
+  void clearPending();
+
+  typedef struct {
+    SPtr<ModelRecord> record;
+    size_t cpu, gpu;
+  } ResidentModel;
+  typedef std::vector<ResidentModel> ResidentList;
+
+  /**
+   * List each loaded model once, with its estimated memory use.
+   */
+  void getResidentModels(ResidentList &models, size_t &cpu, size_t &gpu);
+  static bool drawnEarlier(const ResidentModel &a, const ResidentModel &b);
+  static bool largerModel(const ResidentModel &a, const ResidentModel &b);
+
+  void TimeoutExpired();
+  void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
+  void varconf_error_callback(const char *message);
+
   ModelLoaderMap m_model_loaders; // Stores all the model loaders
   ModelRecordMap m_model_records_map; // Stores all the model_by_type models
   ObjectRecordMap m_object_map; // Stores model for entity id and model_name
@@ -74,6 +178,30 @@ protected:
   varconf::Config m_model_records;
 
   std::list<std::string> m_model_configs;
+
+  PendingList m_pending;
+  std::set<std::string> m_pending_ids;
+  unsigned int m_load_budget; ///< Milliseconds per frame for loading models
+  bool m_async_loading;
+  unsigned int m_models_loaded, m_placeholders_used, m_last_load_time;
+
+  std::set<std::string> m_decoding; ///< Keys queued or being decoded
+  DecodedMap m_decoded; ///< Decoded models waiting for loadPendingModels
+  unsigned int m_generation; ///< Changed when queued decodes are dropped
+  std::list<SPtr<ModelLoader> > m_retired_loaders;
+  unsigned int m_models_decoded;
+
+  // Shared with the loader thread, protected by m_mutex
+  SDL_Thread *m_thread;
+  SDL_mutex *m_mutex;
+  SDL_cond *m_cond;
+  std::deque<DecodeRequest> m_decode_queue;
+  std::deque<DecodedModel> m_decoded_queue;
+  bool m_quit;
+
+  size_t m_cpu_budget, m_gpu_budget; ///< Bytes, zero for no limit
+  unsigned int m_last_budget_check;
+  unsigned int m_models_evicted;
 };
 
 } /* namespace Sear */
@@ -135,4 +135,14 @@ SPtr<ModelRecord> ModelLoader::loadModel(WorldEntity *we,
     return model_record;
   }
 
+SPtr<ModelRecord> ModelLoader::loadDecodedModel(WorldEntity *we,
+        const std::string &model_id,
+        varconf::Config &model_config,
+        Model *model)
+{
+    // Loaders without a decode stage do all the work here
+    delete model;
+    return loadModel(we, model_id, model_config);
+  }
+
 }
@@ -16,6 +16,7 @@ namespace varconf {
 }
 
 namespace Sear {
+  class Model;
   class ModelRecord;
   class WorldEntity;
   	
@@ -28,6 +29,27 @@ public:
 
   virtual SPtr<ModelRecord> loadModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config);
 
+  /**
+   * Whether decodeModel can read this loader's models on the model loader
+   * thread.
+   */
+  virtual bool canDecode() const { return false; }
+
+  /**
+   * Read and parse a model's data file. This runs on the model loader
+   * thread, so it may use the FileHandler and CacheManager but not GL, the
+   * RenderSystem or the model config.
+   * @param file_name Data file path, as found by the FileHandler
+   * @return The model, or NULL on error
+   */
+  virtual Model *decodeModel(const std::string &file_name) { return NULL; }
+
+  /**
+   * Finish a model from decodeModel on the main thread, as loadModel would.
+   * Takes ownership of model, which may be NULL if decoding failed.
+   */
+  virtual SPtr<ModelRecord> loadDecodedModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config, Model *model);
+
 };
 
 } /* namespace Sear */
@@ -87,6 +87,7 @@ int ModelSystem::init() {
 }
 
 int ModelSystem::reinit() {
+  invalidateObjectRecords();
 
   m_model_handler->shutdown();
   m_model_handler->init();
@@ -126,6 +127,8 @@ int ModelSystem::shutdown() {
 
   m_entity_mapper.reset(0);
 
+  invalidateObjectRecords();
+
   // Cleanp signals
   notify_callbacks();
 
@@ -173,6 +176,19 @@ SPtr<ModelRecord> ModelSystem::getModel(const std::string &model_id, WorldEntity
 
 SPtr<ObjectRecord> ModelSystem::getObjectRecord(WorldEntity *we) {
   assert (we != NULL);
+
+  // Use the record cached by the entity if it is still current
+  if (we->m_object_record_generation == m_generation) {
+    SPtr<ObjectRecord> &object_record = we->m_object_record;
+    assert(object_record);
+    if (we->hasBBox()) {
+      object_record->bbox = we->getBBox();
+    }
+    object_record->position = we->getAbsPos();
+    object_record->orient = we->getAbsOrient();
+    return object_record;
+  }
+
   // Find object record from entity id
   const std::string &id = we->getViewId();
   SPtr<ObjectRecord> object_record = m_object_handler->getObjectRecord(id);
@@ -189,6 +205,19 @@ SPtr<ObjectRecord> ModelSystem::getObjectRecord(WorldEntity *we) {
       }
     }
   }
+  if (!object_record) {
+    // See if the type hierarchy has already been searched for this type
+    TypeRecordMap::const_iterator I = m_type_records.find(we->type());
+    if (I != m_type_records.end()) {
+      object_record = m_object_handler->instantiateRecord(I->second, id);
+      if (object_record) {
+        object_record->type = I->second;
+        object_record->name = we->getName();
+        object_record->id = we->getViewId();
+        object_record->entity = we;
+      }
+    }
+  }
   if (!object_record) {
     std::string type = DEFAULT;
     Eris::TypeInfo *ti = we->getType();
@@ -215,6 +244,8 @@ SPtr<ObjectRecord> ModelSystem::getObjectRecord(WorldEntity *we) {
       }
     }
 
+    m_type_records[we->type()] = type;
+
     // Set the values for the object record
     object_record->type = type;
     object_record->name = we->getName();
@@ -234,6 +265,9 @@ SPtr<ObjectRecord> ModelSystem::getObjectRecord(WorldEntity *we) {
 
   assert (object_record->type.empty() == false);
 
+  we->m_object_record = object_record;
+  we->m_object_record_generation = m_generation;
+
   return object_record;
 }
 
@@ -241,7 +275,23 @@ varconf::Config &ModelSystem::getModelRecords() {
   return m_model_handler->getModelRecords();
 }
 
+void ModelSystem::entityAttributeChanged(WorldEntity *we, const std::string &attr) {
+  if (!m_initialised) return;
+  if (!m_entity_mapper->usesAttribute(we->type(), attr)) return;
+  if (!m_entity_mapper->updateEntityMapping(we)) return;
+
+  // Drop the old record so the next getObjectRecord uses the new mapping
+  m_object_handler->removeObjectRecord(we->getViewId());
+  we->m_object_record_generation = 0;
+}
+
+void ModelSystem::entityDeleted(WorldEntity *we) {
+  if (!m_initialised) return;
+  m_entity_mapper->forgetEntity(we->getViewId());
+}
+
 void ModelSystem::resetModels() {
+  invalidateObjectRecords();
   m_object_handler->reset();
   m_model_handler->reset();
 }
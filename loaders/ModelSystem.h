@@ -5,6 +5,7 @@
 #ifndef SEAR_LOADERS_MODELSYSTEM_H
 #define SEAR_LOADERS_MODELSYSTEM_H 1
 
+#include <map>
 #include <string>
 #include <memory>
 
@@ -34,7 +35,8 @@ public:
   static ModelSystem &getInstance() { return m_instance; }
 
   ModelSystem() :
-    m_initialised(false)
+    m_initialised(false),
+    m_generation(1)
   { }
 
   virtual ~ModelSystem();
@@ -80,11 +82,32 @@ public:
   SPtr<ObjectRecord> getObjectRecord(WorldEntity *we);
 
 
+  /** The entityAttributeChanged method replaces the entity's object record
+   * if the attribute changes which record the entity mapper chooses.
+   */
+  void entityAttributeChanged(WorldEntity *we, const std::string &attr);
+
+  /** The entityDeleted method forgets anything stored for the entity.
+   */
+  void entityDeleted(WorldEntity *we);
+
   /** The resetModels method removes all entity based information stored.
    */
   void resetModels();
 
+  /** The invalidateObjectRecords method must be called whenever object
+   * records are removed or the records a type resolves to may have changed.
+   * Records cached by entities and the type resolution cache are then
+   * looked up again.
+   */
+  void invalidateObjectRecords() {
+    ++m_generation;
+    m_type_records.clear();
+  }
+
 private:
+  // tools/record_cache_test checks the caches are dropped
+  friend class ModelSystemTest;
 
   void loadModels(const std::string &filename);
 
@@ -96,6 +119,12 @@ private:
   std::auto_ptr<ObjectHandler> m_object_handler;
   std::auto_ptr<EntityMapper> m_entity_mapper;
 
+  // Object record name resolved for each entity type by searching the type
+  // hierarchy.
+  typedef std::map<std::string, std::string> TypeRecordMap;
+  TypeRecordMap m_type_records;
+  unsigned int m_generation; ///< Changes whenever cached records become invalid
+
 };
 
 } // namespace Sear
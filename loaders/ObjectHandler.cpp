@@ -12,6 +12,7 @@
 #include "src/Console.h"
 #include "src/FileHandler.h"
 #include "src/System.h"
+#include "ModelSystem.h"
 #include "ObjectHandler.h"
 #include "ObjectRecord.h"
 
@@ -79,7 +80,7 @@ void ObjectHandler::loadObjectRecords(const std::string &filename) {
   varconf::Config config;
   config.sigsv.connect(sigc::mem_fun(*this, &ObjectHandler::varconf_callback));
   config.sige.connect(sigc::mem_fun(*this, &ObjectHandler::varconf_error_callback));
-  config.readFromFile(filename);
+  System::instance()->getFileHandler()->readConfigFile(config, filename);
 }
 
 SPtr<ObjectRecord> ObjectHandler::getObjectRecord(const std::string &id) {
@@ -125,8 +126,11 @@ void ObjectHandler::runCommand(const std::string &command, const std::string &ar
     m_object_configs.push_back(args);
     System::instance()->getFileHandler()->getFilePath(args_cpy);
     loadObjectRecords(args_cpy);
+    // New types may change the record an entity type resolves to
+    ModelSystem::getInstance().invalidateObjectRecords();
   }
   else if (command == CMD_reload_config_objects) {
+    ModelSystem::getInstance().invalidateObjectRecords();
     m_id_map.clear();
     m_type_map.clear();
 
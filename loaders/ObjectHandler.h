@@ -37,6 +37,7 @@ public:
 
   SPtr<ObjectRecord> getObjectRecord(const std::string &id);
   SPtr<ObjectRecord> instantiateRecord(const std::string &type, const std::string &id);
+  void removeObjectRecord(const std::string &id) { m_id_map.erase(id); }
 
   void contextCreated() {}
   void contextDestroyed(bool check) {}
@@ -94,10 +94,16 @@ SearObject::~SearObject() {
 }
 
 int SearObject::init(const std::string &file_name) {
+  if (decode(file_name)) return 1;
+  finish();
+  return 0;
+}
+
+int SearObject::decode(const std::string &file_name) {
   assert(m_initialised == false);
  
   std::string object;
-  if (m_config.readFromFile(file_name)) {
+  if (System::instance()->getFileHandler()->readConfigFile(m_config, file_name)) {
     if (m_config.findItem(SECTION_model, KEY_filename)) {
       object = (std::string)m_config.getItem(SECTION_model, KEY_filename);
     } else {
@@ -223,14 +229,27 @@ int SearObject::init(const std::string &file_name) {
     scale_object(m_static_objects, scale, align, ignore_minus_z);
   }
 
-
-  contextCreated();
-
   m_initialised = true;
 
   return 0;
 }
 
+void SearObject::finish() {
+  assert(m_initialised == true);
+
+  StaticObjectList::const_iterator I = m_static_objects.begin();
+  StaticObjectList::const_iterator Iend = m_static_objects.end();
+  for (; I != Iend; ++I) {
+    (*I)->requestTextures();
+  }
+
+  contextCreated();
+
+  for (I = m_static_objects.begin(); I != Iend; ++I) {
+    (*I)->upload();
+  }
+}
+
 int SearObject::shutdown() {
   assert(m_initialised == true);
 
@@ -295,7 +314,7 @@ void SearObject::varconf_error_callback(const char *message) {
 int SearObject::load(const std::string &filename) {
   bool big_endian = false;
 
-  FILE *fp = fopen(filename.c_str(), "rb");
+  FILE *fp = System::instance()->getFileHandler()->openFile(filename);
   if (fp == 0) {
     fprintf(stderr, "[SearObject] Error opening %s for reading\n", filename.c_str());
     return 1;
@@ -333,8 +352,6 @@ int SearObject::load(const std::string &filename) {
   } 
 
   SearObjectMesh som;
-  TextureID tex_id = NO_TEXTURE_ID;
-  TextureID tex_mask_id = NO_TEXTURE_ID;
   uint32_t *uptr;
   float *fptr;
   int c,x,y;
@@ -381,10 +398,8 @@ int SearObject::load(const std::string &filename) {
       tex_name = (std::string)m_config.getItem(tex_name, KEY_texture_map_0);
     }
 
-    // Get texture ids
-    tex_id =  RenderSystem::getInstance().requestTexture(tex_name);
-    tex_mask_id =  RenderSystem::getInstance().requestTexture(tex_name, true);
-    so->setTexture(0, tex_id, tex_mask_id);   
+    // Requested by finish
+    so->setTextureName(0, tex_name);
 
     // Set transform matrices
     so->getMatrix().setMatrix(som.mesh_transform);
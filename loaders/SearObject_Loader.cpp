@@ -42,11 +42,29 @@ SPtr<ModelRecord> SearObject_Loader::loadModel(WorldEntity *we, const std::strin
 
   System::instance()->getFileHandler()->getFilePath(file_name);
 
+  return finishModel(model_record, decodeModel(file_name));
+}
+
+Model *SearObject_Loader::decodeModel(const std::string &file_name) {
   SearObject *model = new SearObject();
-  if (model->init(file_name)) {
+  if (model->decode(file_name)) {
     delete model;
-    return SPtr<ModelRecord>();
+    return NULL;
   }
+  return model;
+}
+
+SPtr<ModelRecord> SearObject_Loader::loadDecodedModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config, Model *model) {
+  SPtr<ModelRecord> model_record = ModelLoader::loadModel(we, model_id, model_config);
+  assert(model_record);
+  return finishModel(model_record, model);
+}
+
+SPtr<ModelRecord> SearObject_Loader::finishModel(SPtr<ModelRecord> model_record, Model *decoded) {
+  if (decoded == NULL) return SPtr<ModelRecord>();
+
+  SearObject *model = static_cast<SearObject*>(decoded);
+  model->finish();
 
   bool use_stencil = RenderSystem::getInstance().getState(RenderSystem::RENDER_STENCIL) && model_record->outline;
 
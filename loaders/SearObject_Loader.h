@@ -12,6 +12,7 @@
 namespace Sear {
 
 // Forward Declarations
+class Model;
 	
 class SearObject_Loader : public ModelLoader {
 public:	
@@ -21,8 +22,14 @@ public:
   virtual std::string getType() const { return SEAROBJECT; }
 
   virtual SPtr<ModelRecord> loadModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config);
+
+  virtual bool canDecode() const { return true; }
+  virtual Model *decodeModel(const std::string &file_name);
+  virtual SPtr<ModelRecord> loadDecodedModel(WorldEntity *we, const std::string &model_id, varconf::Config &model_config, Model *model);
 	  
 protected:
+  SPtr<ModelRecord> finishModel(SPtr<ModelRecord> model_record, Model *model);
+
   static const std::string SEAROBJECT;
 };
 
@@ -112,6 +112,20 @@ void StaticObject::createVBOs() const {
   }
 }
 
+void StaticObject::upload() const {
+  assert(m_initialised == true);
+  assert(m_context_no == RenderSystem::getInstance().currentContextNo());
+  if (!sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) return;
+  if (!glIsBufferARB(m_vb_vertex_data)) createVBOs();
+}
+
+void StaticObject::requestTextures() {
+  for (unsigned int i = 0; i < m_texture_names.size(); ++i) {
+    setTexture(i, RenderSystem::getInstance().requestTexture(m_texture_names[i]),
+                  RenderSystem::getInstance().requestTexture(m_texture_names[i], true));
+  }
+}
+
 int StaticObject::contextCreated() {
   assert(RenderSystem::getInstance().contextValid());
   // We could have contextCreated called several times for a shared mesh
@@ -165,6 +179,23 @@ void StaticObject::contextDestroyed(bool check) {
   m_context_no = -1;
 }
 
+void StaticObject::getMemoryUsage(size_t &cpu, size_t &gpu) const {
+  const size_t vertices = (m_vertex_data) ? m_num_points * 3 * sizeof(float) : 0;
+  const size_t normals = (m_normal_data) ? m_num_points * 3 * sizeof(float) : 0;
+  const size_t texcoords = (m_texture_data) ? m_num_points * 2 * sizeof(float) : 0;
+  const size_t indices = (m_indices) ? m_num_faces * 3 * sizeof(int) : 0;
+
+  cpu += vertices + normals + texcoords + indices;
+
+  if (m_vb_vertex_data) gpu += vertices;
+  if (m_vb_normal_data) gpu += normals;
+  if (m_vb_texture_data) gpu += texcoords;
+  if (m_vb_indices) gpu += indices;
+
+  // The driver keeps its own copy of the geometry in a display list
+  if (m_disp_list_set) gpu += vertices + normals + texcoords + indices;
+}
+
 void StaticObject::render(bool select_mode) const {
   assert(m_initialised == true);
   assert(RenderSystem::getInstance().contextValid());
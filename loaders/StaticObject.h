@@ -5,6 +5,7 @@
 #ifndef SEAR_RENDERERS_STATICOBJECT_H
 #define SEAR_RENDERERS_STATICOBJECT_H 1
 
+#include <string>
 #include <vector>
 #include <cstring>
 
@@ -33,6 +34,19 @@ public:
   int contextCreated();
   void contextDestroyed(bool check);
 
+  /** Create the vertex buffers now rather than when the object is first
+   * drawn. Does nothing without vertex buffer objects, as display lists are
+   * compiled by render.
+   */
+  void upload() const;
+
+  /** Estimate the memory held by this object.
+   * @param cpu Incremented by the size of the vertex arrays, in bytes
+   * @param gpu Incremented by the size of any buffer objects and display
+   * lists, in bytes
+   */
+  void getMemoryUsage(size_t &cpu, size_t &gpu) const;
+
   void setTexture(unsigned int num, TextureID texture, TextureID texture_mask) {
     if (m_textures.size() <= num) {
       m_textures.resize(num + 1);
@@ -42,6 +56,25 @@ public:
     m_texture_masks[num] = texture_mask;
   }
 
+  /** Name the texture for a unit without requesting it, so the object can
+   * be built away from the main thread. requestTextures requests it later.
+   */
+  void setTextureName(unsigned int num, const std::string &name) {
+    if (m_texture_names.size() <= num) m_texture_names.resize(num + 1);
+    m_texture_names[num] = name;
+  }
+
+  bool getTextureName(unsigned int num, std::string &name) const {
+    if (num >= m_texture_names.size()) return false;
+    name = m_texture_names[num];
+    return true;
+  }
+
+  /** Request the textures named by setTextureName from the RenderSystem.
+   * Must be called from the main thread.
+   */
+  void requestTextures();
+
   int getTexture(unsigned int num, TextureID &texture, TextureID &texture_mask) {
     if (num >= m_textures.size()) return 1;
     texture      = m_textures[num];
@@ -228,6 +261,7 @@ private:
   unsigned int m_num_faces;
   std::vector<TextureID> m_textures;
   std::vector<TextureID> m_texture_masks;
+  std::vector<std::string> m_texture_names;
 
   float m_ambient[4];
   float m_diffuse[4];
@@ -3,10 +3,13 @@
 // Copyright (C) 2001 - 2007 Simon Goodall
 
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 #include <limits>
 
+#include "StaticObject.h"
 #include "StaticObjectFunctions.h"
+#include "SearObjectTypes.h"
 
 #ifdef DEBUG
   static const bool debug = true;
@@ -216,4 +219,135 @@ void scale_object(StaticObjectList &objs, Scaling scale, Alignment align, bool i
 }
   
 
+// Flags for each cached mesh
+static const uint32_t MESH_HAS_TEXTURE_DATA = 0x1;
+
+typedef struct {
+  SearObjectMesh mesh;
+  uint32_t flags;
+} CachedMesh;
+
+static void appendData(std::vector<char> &data, const void *ptr, size_t size) {
+  const char *p = static_cast<const char*>(ptr);
+  data.insert(data.end(), p, p + size);
+}
+
+void serialise_objects(const StaticObjectList &objs, std::vector<char> &data) {
+  data.clear();
+  const uint32_t num_meshes = objs.size();
+  appendData(data, &num_meshes, sizeof(num_meshes));
+
+  StaticObjectList::const_iterator I = objs.begin();
+  StaticObjectList::const_iterator Iend = objs.end();
+  for (; I != Iend; ++I) {
+    StaticObject* so = *I;
+    assert(so);
+
+    CachedMesh cm;
+    memset(&cm, 0, sizeof(cm));
+    SearObjectMesh &som = cm.mesh;
+    so->getMatrix().getMatrix(som.mesh_transform);
+    so->getTexMatrix().getMatrix(som.texture_transform);
+
+    std::string tex_name;
+    if (so->getTextureName(0, tex_name)) {
+      strncpy(som.texture_map, tex_name.c_str(), sizeof(som.texture_map) - 1);
+    }
+    som.num_vertices = so->getNumPoints();
+    som.num_faces = (so->getIndicesPtr()) ? (so->getNumFaces()) : (0);
+
+    so->getAmbient(som.ambient);
+    so->getDiffuse(som.diffuse);
+    so->getSpecular(som.specular);
+    so->getEmission(som.emissive);
+    som.shininess = so->getShininess();
+
+    if (so->getTextureDataPtr()) cm.flags |= MESH_HAS_TEXTURE_DATA;
+
+    appendData(data, &cm, sizeof(cm));
+    appendData(data, so->getVertexDataPtr(), som.num_vertices * 3 * sizeof(float));
+    appendData(data, so->getNormalDataPtr(), som.num_vertices * 3 * sizeof(float));
+    if (cm.flags & MESH_HAS_TEXTURE_DATA) {
+      appendData(data, so->getTextureDataPtr(), som.num_vertices * 2 * sizeof(float));
+    }
+    if (som.num_faces > 0) {
+      appendData(data, so->getIndicesPtr(), som.num_faces * 3 * sizeof(int));
+    }
+  }
+}
+
+bool deserialise_objects(const std::vector<char> &data, StaticObjectList &objs) {
+  assert(objs.empty());
+  size_t pos = 0;
+
+  uint32_t num_meshes;
+  if (data.size() < sizeof(num_meshes)) return false;
+  memcpy(&num_meshes, &data[pos], sizeof(num_meshes));
+  pos += sizeof(num_meshes);
+
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < num_meshes; ++i) {
+    CachedMesh cm;
+    if (data.size() - pos < sizeof(cm)) {
+      ok = false;
+      break;
+    }
+    memcpy(&cm, &data[pos], sizeof(cm));
+    pos += sizeof(cm);
+    SearObjectMesh &som = cm.mesh;
+
+    const size_t num_floats = som.num_vertices * ((cm.flags & MESH_HAS_TEXTURE_DATA) ? (8) : (6));
+    const size_t needed = num_floats * sizeof(float) + som.num_faces * 3 * sizeof(int);
+    if (data.size() - pos < needed) {
+      ok = false;
+      break;
+    }
+
+    StaticObject* so = new StaticObject();
+    so->init();
+    so->setNumPoints(som.num_vertices);
+    so->setNumFaces(som.num_faces);
+
+    so->getMatrix().setMatrix(som.mesh_transform);
+    so->getTexMatrix().setMatrix(som.texture_transform);
+
+    som.texture_map[sizeof(som.texture_map) - 1] = '\0';
+    const std::string tex_name(som.texture_map);
+    if (!tex_name.empty()) so->setTextureName(0, tex_name);
+
+    so->setAmbient(som.ambient);
+    so->setDiffuse(som.diffuse);
+    so->setSpecular(som.specular);
+    so->setEmission(som.emissive);
+    so->setShininess(som.shininess);
+
+    size_t size = som.num_vertices * 3 * sizeof(float);
+    memcpy(so->createVertexData(som.num_vertices * 3), &data[pos], size);
+    pos += size;
+    memcpy(so->createNormalData(som.num_vertices * 3), &data[pos], size);
+    pos += size;
+    if (cm.flags & MESH_HAS_TEXTURE_DATA) {
+      size = som.num_vertices * 2 * sizeof(float);
+      memcpy(so->createTextureData(som.num_vertices * 2), &data[pos], size);
+      pos += size;
+    }
+    if (som.num_faces > 0) {
+      size = som.num_faces * 3 * sizeof(int);
+      memcpy(so->createIndices(som.num_faces * 3), &data[pos], size);
+      pos += size;
+    }
+
+    objs.push_back(so);
+  }
+
+  if (!ok || pos != data.size()) {
+    while (!objs.empty()) {
+      delete objs.back();
+      objs.pop_back();
+    }
+    return false;
+  }
+  return true;
+}
+
 } /* namespace Sear */
@@ -5,6 +5,8 @@
 #ifndef SEAR_LOADERS_STATICOBJECTFUNCTIONS_H
 #define SEAR_LOADERS_STATICOBJECTFUNCTIONS_H 1
 
+#include <vector>
+
 #include "Model.h"
 
 namespace Sear {
@@ -30,6 +32,19 @@ typedef enum {
 extern void transform_object(StaticObjectList &objs, const float m[4][4]);
 extern void scale_object(StaticObjectList &objs, Scaling scale, Alignment align, bool ignore_minus_z);
 
+/**
+ * Pack objects into a buffer for the CacheManager. The layout follows the
+ * SearObject mesh records but is in native byte order, and textures are
+ * stored by the names given to StaticObject::setTextureName.
+ */
+extern void serialise_objects(const StaticObjectList &objs, std::vector<char> &data);
+/**
+ * Rebuild objects packed by serialise_objects. Textures are named but not
+ * requested, so this may be called from the model loader thread.
+ * @return True on success. objs is left empty on failure.
+ */
+extern bool deserialise_objects(const std::vector<char> &data, StaticObjectList &objs);
+
 } /* namespace Sear */
 
 #endif // SEAR_LOADERS_STATICOBJECTFUNCTIONS_H
@@ -112,7 +112,7 @@ int Cal3dCoreModel::readConfig(const std::string &filename) {
   varconf::Config config;
   config.sigsv.connect(sigc::mem_fun(this, &Cal3dCoreModel::varconf_callback));
   config.sige.connect(sigc::mem_fun(this, &Cal3dCoreModel::varconf_error_callback));
-  config.readFromFile(filename);
+  System::instance()->getFileHandler()->readConfigFile(config, filename);
   unsigned int part_counter = 1;
   unsigned int set_counter = 1;
   
@@ -132,7 +132,7 @@ int Cal3dCoreModel::readConfig(const std::string &filename) {
     std::string app = path + (std::string)config.getItem(SECTION_model, KEY_appearance);
     System::instance()->getFileHandler()->getFilePath(app);
     m_appearance_config.sige.connect(sigc::mem_fun(this, &Cal3dCoreModel::varconf_error_callback));
-    m_appearance_config.readFromFile(app);
+    System::instance()->getFileHandler()->readConfigFile(m_appearance_config, app);
   }
 
 
@@ -427,6 +427,18 @@ std::list<std::string> Cal3dModel::getMeshNames() const {
   return l;
 }
 
+void Cal3dModel::getMemoryUsage(size_t &cpu, size_t &gpu) {
+  Model::getMemoryUsage(cpu, gpu);
+
+  // Each instance has its own posed copy of the skeleton. The meshes and
+  // animations belong to the shared core model.
+  if (m_calModel.get() == 0) return;
+  CalSkeleton *cs = m_calModel->getSkeleton();
+  if (cs != 0) {
+    cpu += cs->getVectorBone().size() * sizeof(CalBone);
+  }
+}
+
 PosAndOrient Cal3dModel::getPositionForSubmodel(const std::string &bone) const {
   PosAndOrient po;
   po.orient.identity();
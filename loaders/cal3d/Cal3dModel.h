@@ -78,6 +78,8 @@ public:
   virtual bool hasDynamicObjects() const { return true; }
   virtual DynamicObjectList &getDynamicObjects() { return m_dos; }
 
+  virtual void getMemoryUsage(size_t &cpu, size_t &gpu);
+
   void setState(int s) { m_state = s; }
   int getState() const { return m_state; }
 
@@ -0,0 +1,152 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cmath>
+
+#if defined(__AVX__)
+  #include <immintrin.h>
+#elif defined(__SSE__)
+  #include <xmmintrin.h>
+#endif
+
+#include "FrustumCuller.h"
+
+namespace Sear {
+
+FrustumCuller::FrustumCuller() :
+  m_count(0)
+{
+  for (int i = 0; i < 4; ++i) {
+    for (int p = 0; p < 6; ++p) {
+      m_planes[i][p] = 0.0f;
+    }
+  }
+}
+
+void FrustumCuller::setFrustum(const float frustum[6][4]) {
+  for (int p = 0; p < 6; ++p) {
+    for (int i = 0; i < 4; ++i) {
+      m_planes[i][p] = frustum[p][i];
+    }
+  }
+}
+
+void FrustumCuller::clear() {
+  m_count = 0;
+  m_cx.clear(); m_cy.clear(); m_cz.clear();
+  m_ex.clear(); m_ey.clear(); m_ez.clear();
+  m_r.clear();
+}
+
+size_t FrustumCuller::addSphere(float x, float y, float z, float radius) {
+  m_cx.push_back(x);
+  m_cy.push_back(y);
+  m_cz.push_back(z);
+  m_ex.push_back(0.0f);
+  m_ey.push_back(0.0f);
+  m_ez.push_back(0.0f);
+  m_r.push_back(radius);
+  return m_count++;
+}
+
+size_t FrustumCuller::addBox(float lx, float ly, float lz, float hx, float hy, float hz) {
+  m_cx.push_back((lx + hx) * 0.5f);
+  m_cy.push_back((ly + hy) * 0.5f);
+  m_cz.push_back((lz + hz) * 0.5f);
+  m_ex.push_back(fabsf(hx - lx) * 0.5f);
+  m_ey.push_back(fabsf(hy - ly) * 0.5f);
+  m_ez.push_back(fabsf(hz - lz) * 0.5f);
+  m_r.push_back(0.0f);
+  return m_count++;
+}
+
+void FrustumCuller::setBits(size_t index, unsigned int bits, unsigned int num) {
+  // Groups are 4 or 8 aligned, so they never straddle a mask word
+  const unsigned int mask = (num >= 32) ? (~0u) : ((1u << num) - 1);
+  m_visible[index >> 5] |= (bits & mask) << (index & 31);
+}
+
+void FrustumCuller::cullScalar(size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    bool visible = true;
+    for (int p = 0; p < 6 && visible; ++p) {
+      const float nx = m_planes[0][p];
+      const float ny = m_planes[1][p];
+      const float nz = m_planes[2][p];
+      const float d = nx * m_cx[i] + ny * m_cy[i] + nz * m_cz[i] + m_planes[3][p];
+      const float r = fabsf(nx) * m_ex[i] + fabsf(ny) * m_ey[i] + fabsf(nz) * m_ez[i] + m_r[i];
+      if (d + r <= 0.0f) visible = false;
+    }
+    if (visible) setBits(i, 1, 1);
+  }
+}
+
+void FrustumCuller::cull() {
+  m_visible.assign((m_count + 31) >> 5, 0);
+
+  size_t i = 0;
+
+#if defined(__AVX__)
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= m_count; i += 8) {
+    const __m256 cx = _mm256_loadu_ps(&m_cx[i]);
+    const __m256 cy = _mm256_loadu_ps(&m_cy[i]);
+    const __m256 cz = _mm256_loadu_ps(&m_cz[i]);
+    const __m256 ex = _mm256_loadu_ps(&m_ex[i]);
+    const __m256 ey = _mm256_loadu_ps(&m_ey[i]);
+    const __m256 ez = _mm256_loadu_ps(&m_ez[i]);
+    const __m256 r  = _mm256_loadu_ps(&m_r[i]);
+    __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+    for (int p = 0; p < 6; ++p) {
+      const __m256 nx = _mm256_set1_ps(m_planes[0][p]);
+      const __m256 ny = _mm256_set1_ps(m_planes[1][p]);
+      const __m256 nz = _mm256_set1_ps(m_planes[2][p]);
+      const __m256 nw = _mm256_set1_ps(m_planes[3][p]);
+      __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+                               _mm256_add_ps(_mm256_mul_ps(nz, cz), nw));
+      const __m256 ax = _mm256_andnot_ps(sign, nx);
+      const __m256 ay = _mm256_andnot_ps(sign, ny);
+      const __m256 az = _mm256_andnot_ps(sign, nz);
+      d = _mm256_add_ps(d, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, ex), _mm256_mul_ps(ay, ey)),
+                                         _mm256_add_ps(_mm256_mul_ps(az, ez), r)));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, zero, _CMP_GT_OQ));
+    }
+    setBits(i, (unsigned int)_mm256_movemask_ps(inside), 8);
+  }
+#elif defined(__SSE__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= m_count; i += 4) {
+    const __m128 cx = _mm_loadu_ps(&m_cx[i]);
+    const __m128 cy = _mm_loadu_ps(&m_cy[i]);
+    const __m128 cz = _mm_loadu_ps(&m_cz[i]);
+    const __m128 ex = _mm_loadu_ps(&m_ex[i]);
+    const __m128 ey = _mm_loadu_ps(&m_ey[i]);
+    const __m128 ez = _mm_loadu_ps(&m_ez[i]);
+    const __m128 r  = _mm_loadu_ps(&m_r[i]);
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (int p = 0; p < 6; ++p) {
+      const __m128 nx = _mm_set1_ps(m_planes[0][p]);
+      const __m128 ny = _mm_set1_ps(m_planes[1][p]);
+      const __m128 nz = _mm_set1_ps(m_planes[2][p]);
+      const __m128 nw = _mm_set1_ps(m_planes[3][p]);
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                            _mm_add_ps(_mm_mul_ps(nz, cz), nw));
+      const __m128 ax = _mm_andnot_ps(sign, nx);
+      const __m128 ay = _mm_andnot_ps(sign, ny);
+      const __m128 az = _mm_andnot_ps(sign, nz);
+      d = _mm_add_ps(d, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ex), _mm_mul_ps(ay, ey)),
+                                   _mm_add_ps(_mm_mul_ps(az, ez), r)));
+      inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, zero));
+    }
+    setBits(i, (unsigned int)_mm_movemask_ps(inside), 4);
+  }
+#endif
+
+  // Remaining volumes, or all of them without SIMD support
+  cullScalar(i, m_count);
+}
+
+} /* namespace Sear */
@@ -0,0 +1,83 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_FRUSTUMCULLER_H
+#define SEAR_FRUSTUMCULLER_H 1
+
+#include <vector>
+#include <cstddef>
+
+namespace Sear {
+
+/**
+ * The FrustumCuller tests batches of bounding volumes against the view
+ * frustum. Volumes are stored as packed float arrays (centre and extents)
+ * so that four (SSE) or eight (AVX) of them can be tested against a plane
+ * at once. Results are returned as a bitmask with one bit per volume.
+ *
+ * Spheres and axis aligned boxes share the same test, the distance of the
+ * centre from each plane is compared against the projected box extents plus
+ * the sphere radius. A volume is visible unless it lies entirely behind one
+ * of the planes, which matches Frustum::ballInFrustum and
+ * Frustum::axisBoxInFrustum != 0.
+ */
+class FrustumCuller {
+public:
+  typedef std::vector<unsigned int> VisibilityMask;
+
+  FrustumCuller();
+  ~FrustumCuller() {}
+
+  /**
+   * Set the six frustum planes as produced by Frustum::getFrustum.
+   */
+  void setFrustum(const float frustum[6][4]);
+
+  /**
+   * Remove all volumes, ready to fill the batch again. Storage is kept.
+   */
+  void clear();
+
+  /**
+   * Add a bounding sphere. Returns the index of the volume.
+   */
+  size_t addSphere(float x, float y, float z, float radius);
+
+  /**
+   * Add an axis aligned box given by its low and high corners. Returns the
+   * index of the volume.
+   */
+  size_t addBox(float lx, float ly, float lz, float hx, float hy, float hz);
+
+  size_t size() const { return m_count; }
+
+  /**
+   * Test every volume in the batch and fill in the visibility mask.
+   */
+  void cull();
+
+  const VisibilityMask &getVisibility() const { return m_visible; }
+
+  bool isVisible(size_t index) const {
+    return (m_visible[index >> 5] & (1u << (index & 31))) != 0;
+  }
+
+private:
+  void cullScalar(size_t begin, size_t end);
+  void setBits(size_t index, unsigned int bits, unsigned int num);
+
+  // Planes are stored as four arrays, one per coefficient
+  float m_planes[4][6];
+
+  size_t m_count;
+  std::vector<float> m_cx, m_cy, m_cz;
+  std::vector<float> m_ex, m_ey, m_ez; ///< Box half extents, zero for spheres
+  std::vector<float> m_r; ///< Sphere radius, zero for boxes
+
+  VisibilityMask m_visible;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_FRUSTUMCULLER_H */
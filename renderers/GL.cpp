@@ -23,12 +23,16 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <cmath>
+
 #include <varconf/config.h>
 #include <wfmath/quaternion.h>
 #include <wfmath/vector.h>
 #include <Eris/Entity.h>
 
 #include "RenderSystem.h"
+#include "StateManager.h"
 
 #include "common/Log.h"
 #include "common/Utility.h"
@@ -39,6 +43,7 @@
 #include "src/Console.h"
 #include "Frustum.h"
 #include "Graphics.h"
+#include "LightManager.h"
 #include "loaders/ModelSystem.h"
 #include "loaders/Model.h"
 #include "loaders/ModelHandler.h"
@@ -618,6 +623,9 @@ GL::GL() :
   m_initialised(false),
   m_selection_counter(0)
 {
+  for (int i = 0; i < 16; ++i) {
+    m_proj_matrix[i] = m_modl_matrix[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+  }
 }
 
 
@@ -1108,6 +1116,14 @@ inline void GL::rotate(float angle, float x, float y, float z) const {
 }
 
 void GL::rotateObject(ObjectRecord* object_record, ModelRecord* model_record) const {
+  if (model_record->rotation_style == ROS_NONE) return;
+  Matrix mx;
+  mx.identity();
+  rotateObject(mx, object_record, model_record);
+  glMultMatrixf(mx.getMatrix());
+}
+
+void GL::rotateObject(Matrix &mx, ObjectRecord* object_record, ModelRecord* model_record) const {
   WorldEntity *we = dynamic_cast<WorldEntity*>(object_record->entity.get());
   assert(we != 0);
 
@@ -1116,11 +1132,13 @@ void GL::rotateObject(ObjectRecord* object_record, ModelRecord* model_record) co
     case ROS_POSITION: {
        const WFMath::Point<3> &pos = object_record->position;
        assert(pos.isValid());
-       glRotatef(pos.x() + pos.y() + pos.z(), 0.0f, 0.0f, 1.0f);
+       mx.applyRotate(pos.x() + pos.y() + pos.z(), 0.0f, 0.0f, 1.0f);
        break;
     }       
     case ROS_NORMAL: {
-      applyQuaternion(we->getAbsOrient().inverse());
+      float rotation_matrix[4][4];
+      QuatToMatrix(we->getAbsOrient().inverse(), rotation_matrix);
+      mx.applyMatrix(rotation_matrix);
       break;
     }
     case ROS_BILLBOARD: // Same as STATE_halo, but does not rotate with camera elevation
@@ -1129,12 +1147,56 @@ void GL::rotateObject(ObjectRecord* object_record, ModelRecord* model_record) co
       WFMath::Quaternion orient2(1.0f, 0.0f, 0.0f, 0.0f); // Initial Camera rotation
       orient2 *= m_graphics->getCameraOrientation();
       QuatToMatrix(orient2, rotation_matrix); //Get the rotation matrix for base rotation
-      glMultMatrixf(&rotation_matrix[0][0]); //Apply rotation matrix
+      mx.applyMatrix(rotation_matrix); //Apply rotation matrix
       break;
     }
   }
 }
 
+void GL::getObjectTransform(Matrix &mx, ObjectRecord* object_record, ModelRecord* model_record) const {
+  WorldEntity *we = dynamic_cast<WorldEntity*>(object_record->entity.get());
+  assert(we != 0);
+
+  mx.identity();
+
+  // 1) Apply Object transforms
+  const WFMath::Point<3> &pos = we->getAbsPos();
+  assert(pos.isValid());
+  mx.applyTranslate(pos.x(), pos.y(), pos.z());
+
+  rotateObject(mx, object_record, model_record);
+
+  // 2) Apply Model Transforms
+
+  // Do not perform scaling if it is to zero or has no effect
+  const float scale = model_record->scale;
+  if (scale != 0.0f && scale != 1.0f) mx.applyScale(scale, scale, scale);
+
+  if (model_record->offset_x != 0.0f || model_record->offset_y != 0.0f || model_record->offset_z != 0.0f) {
+    mx.applyTranslate(model_record->offset_x, model_record->offset_y, model_record->offset_z);
+  }
+
+  if (model_record->rotate_z != 0.0f) {
+    mx.applyRotate(model_record->rotate_z, 0.0f, 0.0f, 1.0f);
+  }
+
+  // 3) Apply final scaling once model is in place
+
+  // Scale model by all bounding box axis
+  if (model_record->scale_bbox && we->hasBBox()) {
+    const WFMath::AxisBox<3> &bbox = we->getBBox();
+    mx.applyScale(bbox.highCorner().x() - bbox.lowCorner().x(),
+                  bbox.highCorner().y() - bbox.lowCorner().y(),
+                  bbox.highCorner().z() - bbox.lowCorner().z());
+  }
+  // Scale model by bounding box height
+  else if (model_record->scaleByHeight && we->hasBBox()) {
+    const WFMath::AxisBox<3> &bbox = we->getBBox();
+    const float z_scale = fabs(bbox.highCorner().z() - bbox.lowCorner().z());
+    mx.applyScale(z_scale, z_scale, z_scale);
+  }
+}
+
 inline void GL::scaleObject(float scale) const {
   glScalef(scale, scale, scale);
 }
@@ -1267,44 +1329,20 @@ void GL::drawQueue(QueueMap &queue, bool select_mode) {
 
       WorldEntity *we = dynamic_cast<WorldEntity*>(object_record->entity.get());
 
-      glPushMatrix();
-
-      // 1) Apply Object transforms
       const WFMath::Point<3> &pos = we->getAbsPos();
       assert(pos.isValid());
-      glTranslatef(pos.x(), pos.y(), pos.z() );
-
-      rotateObject(object_record, model_record);
-
-      // 2) Apply Model Transforms
-
-      // Scale Object
-      float scale = model_record->scale;
-      // Do not perform scaling if it is to zero or has no effect
-      if (scale != 0.0f && scale != 1.0f) glScalef(scale, scale, scale);
 
-      glTranslatef(model_record->offset_x, model_record->offset_y, model_record->offset_z);
-
-      glRotatef(model_record->rotate_z, 0.0f, 0.0f, 1.0f);   
-
-      // 3) Apply final scaling once model is in place
-
-      // Scale model by all bounding box axis
-      if (model_record->scale_bbox && we->hasBBox()) {
-        const WFMath::AxisBox<3> &bbox = we->getBBox();
-        float x_scale = bbox.highCorner().x() - bbox.lowCorner().x();
-        float y_scale = bbox.highCorner().y() - bbox.lowCorner().y();
-        float z_scale = bbox.highCorner().z() - bbox.lowCorner().z();
-
-        glScalef(x_scale, y_scale, z_scale);
-      }
-      // Scale model by bounding box height
-      else if (model_record->scaleByHeight && we->hasBBox()) {
-        const WFMath::AxisBox<3> &bbox = we->getBBox();
-        float z_scale = fabs(bbox.highCorner().z() - bbox.lowCorner().z());
-        glScalef(z_scale, z_scale, z_scale);
+      // Pick the lights affecting this object before moving into its space
+      if (!select_mode) {
+        const float radius = (we->hasBBox()) ? ((we->getBBox().highCorner() - we->getBBox().lowCorner()).mag() / 2.0f) : (0.0f);
+        m_graphics->getLightManager()->selectLights(pos, radius);
       }
 
+      Matrix mx;
+      getObjectTransform(mx, object_record, model_record);
+      glPushMatrix();
+      glMultMatrixf(mx.getMatrix());
+
       // Draw Model
       if (select_mode) {
         nextColour(we, true);
@@ -1315,11 +1353,15 @@ void GL::drawQueue(QueueMap &queue, bool select_mode) {
           m_active_name = object_record->entity->getName();
           drawOutline(model_record);
         } else {
-          GLboolean blend_enabled = true;
-          GLboolean cmat_enabled = true;
+          bool blend_enabled = true;
+          bool cmat_enabled = true;
           if (we->getFade() < 1.0f) {
-            glGetBooleanv(GL_BLEND, &blend_enabled);
-            glGetBooleanv(GL_COLOR_MATERIAL, &cmat_enabled);
+            // Query the shadowed state rather than reading back from GL
+            SPtr<StateProperties> sp = RenderSystem::getInstance().getStateManager()->getStateProperties(RenderSystem::getInstance().getCurrentState());
+            if (sp) {
+              blend_enabled = sp->blend;
+              cmat_enabled = sp->colour_material;
+            }
             if (!blend_enabled) glEnable(GL_BLEND);
             if (!cmat_enabled) glEnable(GL_COLOR_MATERIAL);
           }
@@ -1337,47 +1379,135 @@ void GL::drawQueue(QueueMap &queue, bool select_mode) {
   }
 }
 
+/**
+ * Project a world space point through the camera matrices captured in
+ * getFrustum. Returns false if the point is behind the camera or outside
+ * the viewport, otherwise fills in the window coords and eye space depth.
+ */
+bool GL::projectPoint(const WFMath::Point<3> &pos, float z_offset, float &sx, float &sy, float &depth) const {
+  const float *m = m_modl_matrix;
+  const float *p = m_proj_matrix;
+  const float x = pos.x();
+  const float y = pos.y();
+  const float z = pos.z() + z_offset;
+
+  // Object to eye coords
+  const float ex = m[0] * x + m[4] * y + m[8]  * z + m[12];
+  const float ey = m[1] * x + m[5] * y + m[9]  * z + m[13];
+  const float ez = m[2] * x + m[6] * y + m[10] * z + m[14];
+  const float ew = m[3] * x + m[7] * y + m[11] * z + m[15];
+
+  // Eye to clip coords
+  const float cx = p[0] * ex + p[4] * ey + p[8]  * ez + p[12] * ew;
+  const float cy = p[1] * ex + p[5] * ey + p[9]  * ez + p[13] * ew;
+  const float cz = p[2] * ex + p[6] * ey + p[10] * ez + p[14] * ew;
+  const float cw = p[3] * ex + p[7] * ey + p[11] * ez + p[15] * ew;
+
+  // Behind the camera
+  if (cw <= 0.0001f) return false;
+
+  const float nx = cx / cw;
+  const float ny = cy / cw;
+  const float nz = cz / cw;
+
+  // Outside the view volume
+  if (nx < -1.0f || nx > 1.0f || ny < -1.0f || ny > 1.0f || nz > 1.0f) {
+    return false;
+  }
+
+  sx = (nx + 1.0f) * 0.5f * (float)m_width;
+  sy = (ny + 1.0f) * 0.5f * (float)m_height;
+  depth = cw;
+  return true;
+}
+
 /**
  * Render the list of entity names in the world.
+ * All anchor points are projected in a single pass, labels off screen are
+ * dropped and labels overlapping a nearer label are skipped before any text
+ * is drawn.
  */
 void GL::drawNameQueue(MessageList &list) {
-  glColor4fv(blue);
-  RenderSystem::getInstance().switchState(m_state_font);
+  m_labels.clear();
   MessageList::const_iterator I = list.begin();
   MessageList::const_iterator Iend = list.end();
   for (; I != Iend; ++I) {
     WorldEntity *we = *I;
-    glPushMatrix();
     const WFMath::Point<3> &pos = we->getAbsPos();
     assert(pos.isValid());
-    glTranslatef(pos.x(), pos.y(), pos.z());
-    WFMath::Quaternion orient2(1.0f, 0.0f, 0.0f, 0.0f); // Initial Camera rotation
-    orient2 *= m_graphics->getCameraOrientation(); 
-    applyQuaternion(orient2);
-    glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-    glScalef(0.025f, 0.025f, 0.025f);
-    glTranslatef(m_speech_offset_x, m_speech_offset_y, m_speech_offset_z);
-    print3D(we->getName().c_str(), 0);
-    glPopMatrix();
+    ScreenLabel label;
+    if (!projectPoint(pos, 0.0f, label.x, label.y, label.depth)) continue;
+    label.we = we;
+    // Font display lists advance 10 pixels per character
+    label.width = 10 * we->getName().size();
+    label.x += m_speech_offset_x - label.width / 2;
+    label.y += m_speech_offset_y;
+    m_labels.push_back(label);
   }
+
+  if (m_labels.empty()) return;
+
+  // Nearest labels win when two overlap
+  std::sort(m_labels.begin(), m_labels.end(), labelDepthLess);
+
+  m_placed_labels.clear();
+  std::vector<ScreenLabel>::const_iterator L = m_labels.begin();
+  std::vector<ScreenLabel>::const_iterator Lend = m_labels.end();
+  for (; L != Lend; ++L) {
+    bool overlaps = false;
+    std::vector<ScreenLabel>::const_iterator P = m_placed_labels.begin();
+    std::vector<ScreenLabel>::const_iterator Pend = m_placed_labels.end();
+    for (; P != Pend; ++P) {
+      if (L->x < P->x + P->width && P->x < L->x + L->width &&
+          L->y < P->y + FONT_HEIGHT && P->y < L->y + FONT_HEIGHT) {
+        overlaps = true;
+        break;
+      }
+    }
+    if (!overlaps) m_placed_labels.push_back(*L);
+  }
+
+  if (!m_fontInitialised) initFont();
+  glColor4fv(blue);
+  RenderSystem::getInstance().switchState(m_state_font);
+  RenderSystem::getInstance().switchTexture(m_font_id);
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, m_width, 0 , m_height, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glListBase(m_base - 32);
+  for (L = m_placed_labels.begin(); L != m_placed_labels.end(); ++L) {
+    const std::string &name = L->we->getName();
+    glLoadIdentity();
+    glTranslatef(floorf(L->x), floorf(L->y), 0.0f);
+    glCallLists(name.size(), GL_BYTE, name.c_str());
+  }
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
 }
 
 void GL::drawMessageQueue(MessageList &list) {
-  glColor4fv(yellow);
-  RenderSystem::getInstance().switchState(m_state_font);
   MessageList::const_iterator I = list.begin();
   MessageList::const_iterator Iend = list.end();
   for (; I != Iend; ++I) {
     WorldEntity *we = *I;
-    glPushMatrix();
-    const WFMath::Point<3> &pos = we->getAbsPos();
-    assert(pos.isValid());
-    glTranslatef(pos.x(), pos.y(), pos.z());
     if (we->screenCoordsRequest() > 0) {
-      double height = 2;
-      getScreenCoords(we->screenX(), we->screenY(), height);
+      const WFMath::Point<3> &pos = we->getAbsPos();
+      assert(pos.isValid());
+      float sx, sy, depth;
+      if (projectPoint(pos, 2.0f, sx, sy, depth)) {
+        we->screenX() = (int)sx;
+        we->screenY() = (int)sy;
+      } else {
+        we->screenX() = -1;
+        we->screenY() = -1;
+      }
     }
-    glPopMatrix();
   }
 }
  
@@ -1544,13 +1674,11 @@ inline void GL::renderActiveName() {
 }
 
 inline void GL::getFrustum(float frust[6][4]) {
-  static float  proj[16];
-  static float  modl[16];
   /* Get the current PROJECTION matrix from OpenGraphics */
-  glGetFloatv(GL_PROJECTION_MATRIX, proj );
+  glGetFloatv(GL_PROJECTION_MATRIX, m_proj_matrix);
   /* Get the current MODELVIEW matrix from OpenGraphics */
-  glGetFloatv(GL_MODELVIEW_MATRIX, modl );
-  Frustum::getFrustum(frust, proj, modl);
+  glGetFloatv(GL_MODELVIEW_MATRIX, m_modl_matrix);
+  Frustum::getFrustum(frust, m_proj_matrix, m_modl_matrix);
   // Copy m_frustum - local copy plus one from graphics object
   for (int i = 0; i < 6; ++i) {
     for (int j = 0; j < 4; ++j) {
@@ -1749,29 +1877,65 @@ void GL::drawQueue(const QueueStaticObjectMap &object_map,
                    const QueueStateMap &state_map,
                    bool select_mode) {
 
+  // Order the queue by state and texture set before drawing
+  m_sorted_queue.clear();
   QueueStaticObjectMap::const_iterator I = object_map.begin();
   QueueStaticObjectMap::const_iterator Iend = object_map.end();
-  while (I != Iend) {
+  for (; I != Iend; ++I) {
+    assert(state_map.find(I->first) != state_map.end());
+    SortedQueueItem item;
+    item.state = state_map.find(I->first)->second;
+    item.texture = NO_TEXTURE_ID;
+    if (!I->second.empty()) {
+      TextureID tex, mask;
+      if (I->second.front()->getTexture(0, tex, mask) == 0) {
+        item.texture = (select_mode) ? (mask) : (tex);
+      }
+    }
+    item.key = &I->first;
+    m_sorted_queue.push_back(item);
+  }
+  std::stable_sort(m_sorted_queue.begin(), m_sorted_queue.end(), sortedQueueLess);
+
+  std::vector<SortedQueueItem>::const_iterator S = m_sorted_queue.begin();
+  std::vector<SortedQueueItem>::const_iterator Send = m_sorted_queue.end();
+  while (S != Send) {
     // Get object id 
-    const std::string &key = I->first;
+    const std::string &key = *S->key;
 
     // Store ref to object list
-    const StaticObjectList &objects = I->second;
+    const StaticObjectList &objects = object_map.find(key)->second;
 
     // Get ref to matrix list
     assert(matrix_map.find(key) != matrix_map.end());
     const MatrixEntityList &matrices = matrix_map.find(key)->second;
 
     // Switch to the appropriate render list.
-    assert(state_map.find(key) != state_map.end());
-    RenderSystem::getInstance().switchState(state_map.find(key)->second);
+    RenderSystem::getInstance().switchState(S->state);
+
+    // The whole batch is drawn at once, so choose lights for a sphere
+    // around all of its instances.
+    if (!select_mode && !matrices.empty()) {
+      WFMath::Point<3> low = matrices.front().second->getAbsPos();
+      WFMath::Point<3> high = low;
+      MatrixEntityList::const_iterator K = matrices.begin();
+      MatrixEntityList::const_iterator Kend = matrices.end();
+      for (; K != Kend; ++K) {
+        const WFMath::Point<3> &p = K->second->getAbsPos();
+        for (int i = 0; i < 3; ++i) {
+          if (p[i] < low[i]) low[i] = p[i];
+          if (p[i] > high[i]) high[i] = p[i];
+        }
+      }
+      m_graphics->getLightManager()->selectLights(WFMath::Midpoint(low, high), (high - low).mag() / 2.0f);
+    }
 
     StaticObjectList::const_iterator J = objects.begin();
     StaticObjectList::const_iterator Jend = objects.end();
     while (J != Jend) {
       (*J++)->render(select_mode, matrices);
     }
-    ++I;
+    ++S;
   }
 }
 
@@ -1780,28 +1944,50 @@ void GL::drawQueue(const QueueDynamicObjectMap &object_map,
                    const QueueStateMap &state_map,
                    bool select_mode) {
 
+  // Order the queue by state and texture set before drawing
+  m_sorted_queue.clear();
   QueueDynamicObjectMap::const_iterator I = object_map.begin();
   QueueDynamicObjectMap::const_iterator Iend = object_map.end();
-  while (I != Iend) {
+  for (; I != Iend; ++I) {
+    assert(state_map.find(I->first) != state_map.end());
+    SortedQueueItem item;
+    item.state = state_map.find(I->first)->second;
+    item.texture = NO_TEXTURE_ID;
+    if (!I->second.empty()) {
+      int tex, mask;
+      if (I->second.front()->getTexture(0, tex, mask) == 0) {
+        item.texture = (select_mode) ? (mask) : (tex);
+      }
+    }
+    item.key = &I->first;
+    m_sorted_queue.push_back(item);
+  }
+  std::stable_sort(m_sorted_queue.begin(), m_sorted_queue.end(), sortedQueueLess);
+
+  std::vector<SortedQueueItem>::const_iterator S = m_sorted_queue.begin();
+  std::vector<SortedQueueItem>::const_iterator Send = m_sorted_queue.end();
+  while (S != Send) {
     // Get object id 
-    const std::string &key = I->first;
+    const std::string &key = *S->key;
 
     // Store ref to object list
-    const DynamicObjectList &objects = I->second;
+    const DynamicObjectList &objects = object_map.find(key)->second;
 
     // Get ref to matrix list
     assert(matrix_map.find(key) != matrix_map.end());
     const MatrixEntityList &matrices = matrix_map.find(key)->second;
 
     // Switch to the appropriate render list.
-    assert(state_map.find(key) != state_map.end());
-    RenderSystem::getInstance().switchState(state_map.find(key)->second);
+    RenderSystem::getInstance().switchState(S->state);
 
     MatrixEntityList::const_iterator K = matrices.begin();
     MatrixEntityList::const_iterator Kend = matrices.end();
     while (K != Kend) {
       const Matrix &mx = K->first;
       WorldEntity *we = K->second;
+      if (!select_mode) {
+        m_graphics->getLightManager()->selectLights(we->getAbsPos(), 0.0f);
+      }
       glPushMatrix();
       glMultMatrixf(mx.getMatrix());
 
@@ -1814,7 +2000,7 @@ void GL::drawQueue(const QueueDynamicObjectMap &object_map,
       glPopMatrix();
       ++K;
     }
-    ++I;
+    ++S;
   }
 }
 
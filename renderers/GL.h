@@ -108,6 +108,8 @@ public:
   void translateObject(float x, float y, float z) const;
   void rotate(float angle, float x, float y, float z) const;
   inline void rotateObject(ObjectRecord*, ModelRecord*) const;
+  void rotateObject(Matrix &mx, ObjectRecord*, ModelRecord*) const;
+  void getObjectTransform(Matrix &mx, ObjectRecord*, ModelRecord*) const;
   inline void scaleObject(float scale) const;
   void setViewMode(int type) const;
   void setMaterial(float *ambient, float *diffuse, float *specular, float shininess, float *emissive) const;
@@ -140,6 +142,13 @@ public:
   inline void renderActiveName();
   inline void applyCharacterLighting(float x, float y, float z);
   inline void getFrustum(float [6][4]);
+  void getCachedFrustum(float frust[6][4]) const {
+    for (int i = 0; i < 6; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        frust[i][j] = m_frustum[i][j];
+      }
+    }
+  }
   virtual void getModelviewMatrix(float m[4][4]);
 
   void selectTerrainColour(WorldEntity * we);
@@ -163,6 +172,42 @@ protected:
   StateID m_state_font, m_state_splash;
 
   float m_frustum[6][4];
+
+  // Camera matrices captured once per frame in getFrustum, used to project
+  // label anchor points on the CPU.
+  float m_proj_matrix[16];
+  float m_modl_matrix[16];
+
+  bool projectPoint(const WFMath::Point<3> &pos, float z_offset, float &sx, float &sy, float &depth) const;
+
+  typedef struct {
+    WorldEntity *we;
+    float x, y;
+    float depth;
+    int width;
+  } ScreenLabel;
+
+  static bool labelDepthLess(const ScreenLabel &a, const ScreenLabel &b) {
+    return a.depth < b.depth;
+  }
+
+  std::vector<ScreenLabel> m_labels;
+  std::vector<ScreenLabel> m_placed_labels;
+
+  // Render queue entries sorted by state and then texture so that each
+  // state is entered once per frame regardless of model naming.
+  typedef struct {
+    StateID state;
+    TextureID texture;
+    const std::string *key;
+  } SortedQueueItem;
+
+  static bool sortedQueueLess(const SortedQueueItem &a, const SortedQueueItem &b) {
+    if (a.state != b.state) return a.state < b.state;
+    return a.texture < b.texture;
+  }
+
+  std::vector<SortedQueueItem> m_sorted_queue;
   
   std::string m_active_name;
   Eris::EntityRef m_activeEntity;
@@ -124,6 +124,8 @@ static const std::string CMD_select_mode_on = "+select_mode";
 static const std::string CMD_select_mode_off = "-select_mode";
 static const std::string CMD_normalise_on = "normalise_on";
 static const std::string CMD_normalise_off = "normalise_off";
+static const std::string CMD_print_light_stats = "print_light_stats";
+static const std::string CMD_benchmark_transforms = "benchmark_transforms";
 
 namespace Sear {
 
@@ -301,6 +303,20 @@ void Graphics::setCameraTransform() {
 
 }
 
+void Graphics::getCameraFrame(WFMath::Point<3> &pos, WFMath::Vector<3> &forward, WFMath::Vector<3> &up) const {
+  // The rows of the rotation part are the camera axes in world space. GL
+  // matrices are column major, so row r is m[0][r], m[1][r], m[2][r].
+  const float (*m)[4] = m_modelview_matrix;
+  up = WFMath::Vector<3>(m[0][1], m[1][1], m[2][1]);
+  // The camera looks down its -z axis
+  forward = WFMath::Vector<3>(-m[0][2], -m[1][2], -m[2][2]);
+  // Undo the translation, which is in camera space
+  const float *t = m[3];
+  pos = WFMath::Point<3>(-(m[0][0] * t[0] + m[0][1] * t[1] + m[0][2] * t[2]),
+                         -(m[1][0] * t[0] + m[1][1] * t[1] + m[1][2] * t[2]),
+                         -(m[2][0] * t[0] + m[2][1] * t[1] + m[2][2] * t[2]));
+}
+
 void Graphics::drawWorld(bool select_mode, float time_elapsed) {
   if (c_select) select_mode = true;
   /*
@@ -416,7 +432,12 @@ void Graphics::drawWorld(bool select_mode, float time_elapsed) {
     m_matrix_map.clear();
     m_state_map.clear();
 
+    m_cull_candidates.clear();
+    m_culler.clear();
+    m_culler.setFrustum(m_frustum);
+
     buildQueues(root, 0, select_mode, m_render_queue, m_message_list, m_name_list, time_elapsed);
+    drawCandidates(select_mode, time_elapsed);
 
     if (select_mode ) {
       m_renderer->selectTerrainColour(root);
@@ -428,6 +449,8 @@ void Graphics::drawWorld(bool select_mode, float time_elapsed) {
       RenderSystem::getInstance().switchState(m_state_select);
     } else {
       RenderSystem::getInstance().switchState(m_state_terrain);
+      // Terrain is drawn as one batch, so use the lights nearest the camera
+      m_lm->selectLights(pos, 0.0f);
     }
 
     Environment::getInstance().renderTerrain(pos, select_mode);
@@ -500,7 +523,7 @@ void Graphics::buildQueues(WorldEntity *we,
     if ((cam->getType() == Camera::CAMERA_FIRST) && (we == self)) { 
       /* first person, don't draw self */
     } else {
-      drawObject(obj, select_mode, render_queue, message_list, name_list, time_elapsed);
+      queueCandidate(obj);
     }
   }
   
@@ -519,6 +542,52 @@ void Graphics::buildQueues(WorldEntity *we,
   } // of draw_members case
 }
 
+void Graphics::queueCandidate(ObjectRecord *obj) {
+  WorldEntity *obj_we = dynamic_cast<WorldEntity*>(obj->entity.get());
+  assert(obj_we);
+
+  CullCandidate c;
+  c.obj = obj;
+  c.volume = -1;
+
+  // Objects without bbox will be rendered regardless.
+  if (obj_we->hasBBox()) {
+    // Rotating the bbox and taking its bounding sphere only needs the
+    // rotated centre, the radius is unaffected by rotation.
+    const WFMath::AxisBox<3> &bbox = obj_we->getBBox();
+    WFMath::Vector<3> mid(
+      (bbox.lowCorner().x() + bbox.highCorner().x()) / 2.0f,
+      (bbox.lowCorner().y() + bbox.highCorner().y()) / 2.0f,
+      (bbox.lowCorner().z() + bbox.highCorner().z()) / 2.0f);
+    mid.rotate(obj_we->getAbsOrient());
+    const WFMath::Point<3> &pos = obj_we->getAbsPos();
+    const float radius = (bbox.highCorner() - bbox.lowCorner()).mag() / 2.0f;
+    c.volume = m_culler.addSphere(pos.x() + mid.x(), pos.y() + mid.y(), pos.z() + mid.z(), radius);
+  }
+  m_cull_candidates.push_back(c);
+}
+
+void Graphics::drawCandidates(bool select_mode, float time_elapsed) {
+  // Drawing an object can queue its attachments, so keep going until no
+  // new candidates have been added.
+  size_t next = 0;
+  while (next < m_cull_candidates.size()) {
+    m_culler.cull();
+    const size_t end = m_cull_candidates.size();
+    for (; next < end; ++next) {
+      // Copy, as drawObject may grow the candidate list
+      const CullCandidate c = m_cull_candidates[next];
+      if (c.volume >= 0 && !m_culler.isVisible(c.volume)) {
+        WorldEntity *obj_we = dynamic_cast<WorldEntity*>(c.obj->entity.get());
+        obj_we->screenX() = -1;
+        obj_we->screenY() = -1;
+        continue;
+      }
+      drawObject(c.obj, select_mode, m_render_queue, m_message_list, m_name_list, time_elapsed);
+    }
+  }
+}
+
 void Graphics::drawObject(ObjectRecord* obj, 
                         bool select_mode,
                         Render::QueueMap &render_queue,
@@ -530,20 +599,7 @@ void Graphics::drawObject(ObjectRecord* obj,
   WorldEntity *obj_we = dynamic_cast<WorldEntity*>(obj->entity.get());
   assert(obj_we); 
 
-  // TODO: The bounding box should be rotated and translated just like entity
-  // position. However, we can just translate and ignore rotation as we are 
-  // using a sphere test and not working on the bbox directly.
-
-
-  // TODO, Objects without bbox will be rendered regardless.
-  if (obj_we->hasBBox()) {
-    // reject for drawing if object bbox is outside frustum   
-    if (!Frustum::sphereInFrustum(m_frustum, obj_we->getBBox(), obj_we->getAbsPos(), obj_we->getAbsOrient())) {
-      obj_we->screenX() = -1;
-      obj_we->screenY() = -1;
-      return;
-    }
-  }
+  // Frustum culling has already been done in drawCandidates
 
   // Get world coord of object
   const WFMath::Point<3> &p = obj_we->getAbsPos();
@@ -659,60 +715,10 @@ void Graphics::drawObjectExt(const std::string &model_id,
  
 // Calculate Transform Matrix //////////////////////////////////////////////////
 
-    // Cheat and use the opengl matrix.
-    glPushMatrix();
-    glLoadIdentity();
-  
-    // 1) Apply Object transforms
-    const WFMath::Point<3> &pos = obj_we->getAbsPos();
-    assert(pos.isValid());
-    glTranslatef(pos.x(), pos.y(), pos.z() );
-  
-    m_renderer->rotateObject(obj, modelRec);
-    
-    // 2) Apply Model Transforms 
-     
-    // Scale Object
-    float scale = modelRec->scale;
-
-    // Do not perform scaling if it is to zero or has no effect
-    if (scale != 0.0f && scale != 1.0f) glScalef(scale, scale, scale);
- 
-    if (modelRec->offset_x != 0.0f || modelRec->offset_y != 0.0f || modelRec->offset_z != 0.0f) {
-      glTranslatef(modelRec->offset_x, modelRec->offset_y, modelRec->offset_z);
-    }
-
-    if (modelRec->rotate_z != 0.0f) { 
-      glRotatef(modelRec->rotate_z, 0.0f, 0.0f, 1.0f);
-    }
-
-    // 3) Apply final scaling once model is in place
-
-    // Scale model by all bounding box axis
-    if (modelRec->scale_bbox && obj_we->hasBBox()) { 
-      const WFMath::AxisBox<3> &bbox = obj_we->getBBox();
-      float x_scale = bbox.highCorner().x() - bbox.lowCorner().x();
-      float y_scale = bbox.highCorner().y() - bbox.lowCorner().y();
-      float z_scale = bbox.highCorner().z() - bbox.lowCorner().z();
-
-      glScalef(x_scale, y_scale, z_scale);
-    }
-
-    // Scale model by bounding box height
-    else if (modelRec->scaleByHeight && obj_we->hasBBox()) {
-      const WFMath::AxisBox<3> &bbox = obj_we->getBBox();
-      float z_scale = fabs(bbox.highCorner().z() - bbox.lowCorner().z());
-      glScalef(z_scale, z_scale, z_scale);
-    }
-
-    float m[4][4];
-    glGetFloatv(GL_MODELVIEW_MATRIX, &m[0][0]);
-
-     // Restore matrix
-    glPopMatrix();
-
+    // Built on the CPU rather than on the GL stack and read back, which
+    // would stall the pipeline once per object.
     Matrix mx;
-    mx.setMatrix(m);
+    m_renderer->getObjectTransform(mx, obj, modelRec);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -882,6 +888,60 @@ void Graphics::registerCommands(Console * console) {
   console->registerCommand(CMD_select_mode_off, this);
   console->registerCommand(CMD_normalise_on, this);
   console->registerCommand(CMD_normalise_off, this);
+  console->registerCommand(CMD_print_light_stats, this);
+  console->registerCommand(CMD_benchmark_transforms, this);
+}
+
+void Graphics::benchmarkTransforms(int count) {
+  if (count <= 0) return;
+
+  // The same chain of transforms drawObjectExt builds for a rotated,
+  // offset and scaled model.
+  float rotation[4][4];
+  QuatToMatrix(WFMath::Quaternion(WFMath::Vector<3>(0.0f, 0.0f, 1.0f), 0.5f), rotation);
+
+  Matrix mx;
+  float sum = 0.0f;
+  unsigned int start = SDL_GetTicks();
+  for (int i = 0; i < count; ++i) {
+    mx.identity();
+    mx.applyTranslate(i, 2.0f * i, 0.5f);
+    mx.applyMatrix(rotation);
+    mx.applyScale(1.5f, 1.5f, 1.5f);
+    mx.applyTranslate(0.1f, 0.2f, 0.3f);
+    mx.applyRotate(30.0f, 0.0f, 0.0f, 1.0f);
+    mx.applyScale(2.0f, 3.0f, 4.0f);
+    sum += mx.getMatrix()[12];
+  }
+  const unsigned int cpu_time = SDL_GetTicks() - start;
+
+  float m[4][4];
+  glPushMatrix();
+  start = SDL_GetTicks();
+  for (int i = 0; i < count; ++i) {
+    glLoadIdentity();
+    glTranslatef(i, 2.0f * i, 0.5f);
+    glMultMatrixf(&rotation[0][0]);
+    glScalef(1.5f, 1.5f, 1.5f);
+    glTranslatef(0.1f, 0.2f, 0.3f);
+    glRotatef(30.0f, 0.0f, 0.0f, 1.0f);
+    glScalef(2.0f, 3.0f, 4.0f);
+    glGetFloatv(GL_MODELVIEW_MATRIX, &m[0][0]);
+    sum -= m[3][0];
+  }
+  const unsigned int gl_time = SDL_GetTicks() - start;
+  glPopMatrix();
+
+  // Both should leave the same last matrix
+  float error = 0.0f;
+  for (int i = 0; i < 16; ++i) {
+    const float d = fabs(mx.getMatrix()[i] - (&m[0][0])[i]);
+    if (d > error) error = d;
+  }
+
+  printf("Built %d transforms. Largest difference: %g (checksum %g)\n", count, error, sum);
+  printf("Matrix: %.3f us per transform\n", cpu_time * 1000.0 / count);
+  printf("GL stack and readback: %.3f us per transform\n", gl_time * 1000.0 / count);
 }
 
 void Graphics::runCommand(const std::string &command, const std::string &args) {
@@ -903,6 +963,16 @@ void Graphics::runCommand(const std::string &command, const std::string &args) {
   }
   else if (command == CMD_normalise_on) glEnable(GL_NORMALIZE);
   else if (command == CMD_normalise_off) glDisable(GL_NORMALIZE);
+  else if (command == CMD_print_light_stats) {
+    printf("Lights: %u Queries: %u Candidates: %u Applied: %u\n",
+           m_lm->getLastFrameLights(), m_lm->getLastFrameQueries(),
+           m_lm->getLastFrameCandidates(), m_lm->getLastFrameApplied());
+  }
+  else if (command == CMD_benchmark_transforms) {
+    int count = 100000;
+    if (!args.empty()) cast_stream(args, count);
+    benchmarkTransforms(count);
+  }
 
 }
 
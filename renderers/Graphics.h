@@ -15,9 +15,12 @@
 #include <sigc++/trackable.h>
 
 #include <wfmath/axisbox.h>
+#include <wfmath/point.h>
+#include <wfmath/vector.h>
 #include <wfmath/quaternion.h>
 
 #include "Light.h"
+#include "FrustumCuller.h"
 #include "Render.h"
 #include "RenderTypes.h"
 #include "interfaces/ConsoleObject.h"
@@ -66,12 +69,19 @@ public:
   void setRenderer(Render *r) { m_renderer = r; }
   
   Render *getRender() { return m_renderer; }
+  LightManager *getLightManager() { return m_lm.get(); }
   void setupStates();
   void readConfig(varconf::Config &config);
   void writeConfig(varconf::Config &config);
 
   WFMath::Quaternion getCameraOrientation() { return m_orient; }
 
+  /**
+   * Get the camera position and axes in world space, as set by the last
+   * call to setCameraTransform.
+   */
+  void getCameraFrame(WFMath::Point<3> &pos, WFMath::Vector<3> &forward, WFMath::Vector<3> &up) const;
+
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
 
@@ -100,6 +110,12 @@ protected:
 
   float m_frustum[6][4];
   bool m_initialised;
+
+  /**
+   * Time building object transforms with Matrix against the GL matrix stack
+   * and a readback, and print the cost of each.
+   */
+  void benchmarkTransforms(int count);
   
   void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
 private:
@@ -114,6 +130,19 @@ private:
 
   StateID m_state_weather, m_state_terrain, m_state_select, m_state_cursor;
 
+  // Objects found by buildQueues, waiting for the batched frustum test.
+  // volume is the index into m_culler, or -1 if the entity has no bbox.
+  typedef struct {
+    ObjectRecord *obj;
+    int volume;
+  } CullCandidate;
+
+  std::vector<CullCandidate> m_cull_candidates;
+  FrustumCuller m_culler;
+
+  void queueCandidate(ObjectRecord *obj);
+  void drawCandidates(bool select_mode, float time_elapsed);
+
     /**
     Helper to qeueue the models for a single object record
     */
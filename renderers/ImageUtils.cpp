@@ -17,8 +17,12 @@
 #include <iostream>
 #include "common/Log.h"
 #include "common/Utility.h"
+#include "src/System.h"
+#include "src/FileHandler.h"
+#include "src/CacheManager.h"
 
 #include <cassert>
+#include <vector>
 
 namespace Sear
 {
@@ -30,9 +34,71 @@ static SDL_Surface* mipmapSurface8(SDL_Surface* src, SDL_Surface* dst);
 static SDL_Surface* mipmapSurfaceN1(SDL_Surface* src, SDL_Surface* dst);
 static SDL_Surface* mipmapSurface1N(SDL_Surface* src, SDL_Surface* dst);
 
+// Bump when the way images are decoded or stored in the cache changes
+static const unsigned int IMAGE_CACHE_VERSION = 1;
+
+typedef struct {
+  Uint32 width, height, pitch, bpp;
+  Uint32 rmask, gmask, bmask, amask;
+} CachedImageHeader;
+
+static SDL_Surface* surfaceFromCache(const std::vector<char> &data)
+{
+  if (data.size() < sizeof(CachedImageHeader)) return NULL;
+  CachedImageHeader header;
+  memcpy(&header, &data[0], sizeof(header));
+  if (data.size() != sizeof(header) + header.pitch * header.height) return NULL;
+
+  SDL_Surface *image = SDL_CreateRGBSurface(SDL_SWSURFACE, header.width, header.height, header.bpp, header.rmask, header.gmask, header.bmask, header.amask);
+  if (image == NULL) return NULL;
+  if ((Uint32)image->pitch != header.pitch) {
+    SDL_FreeSurface(image);
+    return NULL;
+  }
+  memcpy(image->pixels, &data[sizeof(header)], header.pitch * header.height);
+  return image;
+}
+
+static void surfaceToCache(SDL_Surface *image, std::vector<char> &data)
+{
+  CachedImageHeader header;
+  header.width = image->w;
+  header.height = image->h;
+  header.pitch = image->pitch;
+  header.bpp = image->format->BitsPerPixel;
+  header.rmask = image->format->Rmask;
+  header.gmask = image->format->Gmask;
+  header.bmask = image->format->Bmask;
+  header.amask = image->format->Amask;
+
+  const size_t size = image->pitch * image->h;
+  data.resize(sizeof(header) + size);
+  memcpy(&data[0], &header, sizeof(header));
+  memcpy(&data[sizeof(header)], image->pixels, size);
+}
+
 SDL_Surface* loadImageFromPath(const std::string& filename)
 {
-  SDL_Surface* image = IMG_Load(filename.c_str());
+  std::vector<char> source;
+  if (!System::instance()->getFileHandler()->readFile(filename, source) || source.empty()) {
+    Log::writeLog(std::string("Unable to load ") + filename, Log::LOG_ERROR);
+    return(NULL);
+  }
+
+  // Decoded images are cached by the contents of the source file
+  CacheManager &cache = CacheManager::getInstance();
+  CacheManager::Key key = CacheManager::makeKey("image", IMAGE_CACHE_VERSION);
+  key = CacheManager::addToKey(key, &source[0], source.size());
+
+  std::vector<char> cached;
+  if (cache.get(key, cached)) {
+    SDL_Surface *image = surfaceFromCache(cached);
+    if (image != NULL) return image;
+    cache.remove(key);
+  }
+
+  SDL_RWops *rw = SDL_RWFromConstMem(&source[0], source.size());
+  SDL_Surface* image = (rw) ? (IMG_Load_RW(rw, 1)) : (NULL);
   if ( image == NULL ) {
     Log::writeLog(std::string("Unable to load ") + filename + std::string(": ") + 
         string_fmt( SDL_GetError()), Log::LOG_ERROR);
@@ -55,6 +121,12 @@ SDL_Surface* loadImageFromPath(const std::string& filename)
   }
   
   free(tmpbuf);
+
+  // Paletted images would need their palette stored too, so skip them
+  if (image->format->BytesPerPixel >= 3 && SDL_MUSTLOCK(image) == 0) {
+    surfaceToCache(image, cached);
+    cache.put(key, cached);
+  }
   return image;
 }
 
@@ -11,20 +11,48 @@
 
 #include "src/System.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 
 namespace Sear {
 
+// Size of a grid cell in world units
+static const float cell_size = 16.0f;
+// Lights covering more cells than this in either axis are kept in a
+// separate list that is considered for every object.
+static const int max_cells = 8;
+// Intensity below which a light is considered to have no influence
+static const float intensity_threshold = 1.0f / 256.0f;
+// Range used for lights with no attenuation
+static const float infinite_range = 1.0e6f;
+
+static const GLenum light_numbers[] = {
+  GL_LIGHT2, GL_LIGHT3, GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7
+};
+
+static int toCell(float f) {
+  return (int)floorf(f / cell_size);
+}
+
 LightManager::LightManager() :
   m_initialised(false),
-  m_totalLights(0),
-  m_lightCounter(0)
-{}
+  m_query_counter(0),
+  m_frame_queries(0),
+  m_frame_candidates(0),
+  m_frame_applied(0),
+  m_last_frame_lights(0),
+  m_last_frame_queries(0),
+  m_last_frame_candidates(0),
+  m_last_frame_applied(0)
+{
+  for (int i = 0; i < MAX_LIGHTS; ++i) m_slots[i] = -1;
+}
 
 LightManager::~LightManager() {
   if (m_initialised) shutdown();
 }
-  
+
 int LightManager::init() {
   assert (m_initialised == false);
 
@@ -35,40 +63,170 @@ int LightManager::init() {
 void LightManager::shutdown() {
   assert (m_initialised == true);
 
+  m_lights.clear();
+  m_ranges.clear();
+  m_grid.clear();
+  m_global_lights.clear();
+
   m_initialised = false;
 }
 
 void LightManager::reset() {
-  // Reset counter
-  m_lightCounter = 0;
+  // Keep stats from the last frame
+  m_last_frame_lights = m_lights.size();
+  m_last_frame_queries = m_frame_queries;
+  m_last_frame_candidates = m_frame_candidates;
+  m_last_frame_applied = m_frame_applied;
+  m_frame_queries = 0;
+  m_frame_candidates = 0;
+  m_frame_applied = 0;
+
+  // Forget last frame's lights
+  m_lights.clear();
+  m_ranges.clear();
+  m_grid.clear();
+  m_global_lights.clear();
+  m_light_stamp.clear();
+  m_query_counter = 0;
+
   // Reset lights
-  glDisable(GL_LIGHT2);
-  glDisable(GL_LIGHT3);
-  glDisable(GL_LIGHT4);
-  glDisable(GL_LIGHT5);
-  glDisable(GL_LIGHT6);
-  glDisable(GL_LIGHT7);
+  for (int i = 0; i < MAX_LIGHTS; ++i) {
+    glDisable(light_numbers[i]);
+    m_slots[i] = -1;
+  }
+}
+
+float LightManager::brightness(const Light &light) {
+  return std::max(light.diffuse[Light::RED],
+           std::max(light.diffuse[Light::GREEN], light.diffuse[Light::BLUE]));
+}
+
+float LightManager::lightRange(const Light &light) {
+  // Solve brightness / (kc + kl.d + kq.d^2) = threshold for d
+  const float b = brightness(light) / intensity_threshold;
+  const float kc = light.attenuation_constant;
+  const float kl = light.attenuation_linear;
+  const float kq = light.attenuation_quadratic;
+  if (kq > 0.0f) {
+    const float disc = kl * kl - 4.0f * kq * (kc - b);
+    if (disc < 0.0f) return 0.0f;
+    return std::max(0.0f, (-kl + sqrtf(disc)) / (2.0f * kq));
+  }
+  if (kl > 0.0f) return std::max(0.0f, (b - kc) / kl);
+  return infinite_range;
 }
 
-void LightManager::applyLight(const Light &light) {
+void LightManager::addLight(const Light &light) {
   // Don't do anything if the light is disabled
   if (!light.enabled) return;
 
-  // Increment counter so we know how many lights we have used this frame
-  ++m_lightCounter;
-
-  // Select light number
-  GLenum lightNum = GL_LIGHT2;
-  switch (m_lightCounter) {
-    case (0) : lightNum = GL_LIGHT2; break;
-    case (1) : lightNum = GL_LIGHT3; break;
-    case (2) : lightNum = GL_LIGHT4; break;
-    case (3) : lightNum = GL_LIGHT5; break;
-    case (4) : lightNum = GL_LIGHT6; break;
-    case (5) : lightNum = GL_LIGHT7; break;
-    default: return; // Number out of allowed range
+  const unsigned int index = m_lights.size();
+  const float range = lightRange(light);
+  m_lights.push_back(light);
+  m_ranges.push_back(range);
+  m_light_stamp.push_back(0);
+
+  const int x0 = toCell(light.position.x() - range);
+  const int x1 = toCell(light.position.x() + range);
+  const int y0 = toCell(light.position.y() - range);
+  const int y1 = toCell(light.position.y() + range);
+
+  if (x1 - x0 >= max_cells || y1 - y0 >= max_cells) {
+    m_global_lights.push_back(index);
+    return;
   }
 
+  for (int x = x0; x <= x1; ++x) {
+    for (int y = y0; y <= y1; ++y) {
+      m_grid[CellKey(x, y)].push_back(index);
+    }
+  }
+}
+
+void LightManager::selectLights(const WFMath::Point<3> &centre, float radius) {
+  ++m_frame_queries;
+  if (m_lights.empty()) return;
+
+  ++m_query_counter;
+  m_scored.clear();
+
+  const int x0 = toCell(centre.x() - radius);
+  const int x1 = toCell(centre.x() + radius);
+  const int y0 = toCell(centre.y() - radius);
+  const int y1 = toCell(centre.y() + radius);
+
+  // Gather candidate lights from the covered cells, plus the global lights.
+  for (int x = x0; x <= x1; ++x) {
+    for (int y = y0; y <= y1; ++y) {
+      LightGrid::const_iterator I = m_grid.find(CellKey(x, y));
+      if (I != m_grid.end()) scoreLights(I->second, centre, radius);
+    }
+  }
+  scoreLights(m_global_lights, centre, radius);
+
+  // Keep the most influential lights
+  const size_t num = std::min((size_t)MAX_LIGHTS, m_scored.size());
+  std::partial_sort(m_scored.begin(), m_scored.begin() + num, m_scored.end(), scoredGreater);
+
+  // Lights that remain selected keep their slot, so nothing needs setting.
+  bool keep[MAX_LIGHTS];
+  bool placed[MAX_LIGHTS];
+  for (int s = 0; s < MAX_LIGHTS; ++s) keep[s] = false;
+  for (size_t i = 0; i < num; ++i) {
+    placed[i] = false;
+    for (int s = 0; s < MAX_LIGHTS; ++s) {
+      if (m_slots[s] == (int)m_scored[i].second) {
+        keep[s] = true;
+        placed[i] = true;
+        break;
+      }
+    }
+  }
+
+  // Put the remaining lights into free slots and turn off unused ones
+  size_t next = 0;
+  for (int s = 0; s < MAX_LIGHTS; ++s) {
+    if (keep[s]) continue;
+    while (next < num && placed[next]) ++next;
+    if (next < num) {
+      m_slots[s] = m_scored[next].second;
+      enableLight(s, m_lights[m_slots[s]]);
+      ++m_frame_applied;
+      ++next;
+    } else if (m_slots[s] != -1) {
+      glDisable(light_numbers[s]);
+      m_slots[s] = -1;
+    }
+  }
+}
+
+void LightManager::scoreLights(const std::vector<unsigned int> &lights, const WFMath::Point<3> &centre, float radius) {
+  for (size_t i = 0; i < lights.size(); ++i) {
+    const unsigned int index = lights[i];
+    // Lights may be in several cells, only score them once per query
+    if (m_light_stamp[index] == m_query_counter) continue;
+    m_light_stamp[index] = m_query_counter;
+    ++m_frame_candidates;
+
+    // Distance from the light to the surface of the bounding sphere
+    const Light &light = m_lights[index];
+    const float dx = light.position.x() - centre.x();
+    const float dy = light.position.y() - centre.y();
+    const float dz = light.position.z() - centre.z();
+    const float d = std::max(0.0f, sqrtf(dx * dx + dy * dy + dz * dz) - radius);
+    if (d >= m_ranges[index]) continue;
+
+    const float atten = light.attenuation_constant
+                      + light.attenuation_linear * d
+                      + light.attenuation_quadratic * d * d;
+    const float score = (atten > 0.0f) ? (brightness(light) / atten) : (brightness(light));
+    m_scored.push_back(ScoredLight(score, index));
+  }
+}
+
+void LightManager::enableLight(int slot, const Light &light) {
+  const GLenum lightNum = light_numbers[slot];
+
   // Turn on light
   glEnable(lightNum);
 
@@ -88,4 +246,3 @@ void LightManager::applyLight(const Light &light) {
 }
 
 } /* namespace Sear */
-
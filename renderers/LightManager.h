@@ -7,13 +7,24 @@
 #ifndef SEAR_LIGHTMANAGER_H
 #define SEAR_LIGHTMANAGER_H 1
 
-namespace Sear {
+#include <map>
+#include <vector>
+
+#include <wfmath/point.h>
 
-class Light;
+#include "Light.h"
 
+namespace Sear {
+
+/**
+ * The LightManager collects the scene lights submitted each frame and maps
+ * the most influential ones onto the available OpenGL lights (GL_LIGHT2 to
+ * GL_LIGHT7) for each object or batch being drawn. Lights are kept in a
+ * uniform grid over the x/y plane so only nearby lights are considered.
+ */
 class LightManager {
 public:
-	
+
   LightManager();
   ~LightManager();
 
@@ -21,15 +32,65 @@ public:
   void shutdown();
   bool isInitialised() const { return m_initialised; }
 
+  /**
+   * Remove all lights submitted for the last frame and turn off the GL
+   * lights we manage.
+   */
   void reset();
-  void applyLight(const Light &light); 
+
+  /**
+   * Submit a scene light for this frame. Disabled lights are ignored.
+   */
+  void addLight(const Light &light);
+  void applyLight(const Light &light) { addLight(light); }
+
+  /**
+   * Choose the lights with the highest attenuated intensity at the given
+   * bounding sphere and enable them. Must be called with the camera
+   * modelview matrix current, as light positions are transformed by it.
+   */
+  void selectLights(const WFMath::Point<3> &centre, float radius);
+
+  unsigned int getLastFrameLights() const { return m_last_frame_lights; }
+  unsigned int getLastFrameQueries() const { return m_last_frame_queries; }
+  unsigned int getLastFrameCandidates() const { return m_last_frame_candidates; }
+  unsigned int getLastFrameApplied() const { return m_last_frame_applied; }
 
 private:
+  static const int MAX_LIGHTS = 6;
+
+  typedef std::pair<int, int> CellKey;
+  typedef std::map<CellKey, std::vector<unsigned int> > LightGrid;
+  typedef std::pair<float, unsigned int> ScoredLight;
+
+  static bool scoredGreater(const ScoredLight &a, const ScoredLight &b) {
+    return a.first > b.first;
+  }
+
+  static float lightRange(const Light &light);
+  static float brightness(const Light &light);
+
+  void scoreLights(const std::vector<unsigned int> &lights, const WFMath::Point<3> &centre, float radius);
+  void enableLight(int slot, const Light &light);
+
   bool m_initialised;
-  int m_totalLights;
-  int m_lightCounter;
+
+  std::vector<Light> m_lights;
+  std::vector<float> m_ranges;
+  LightGrid m_grid;
+  std::vector<unsigned int> m_global_lights; ///< Lights too large for the grid
+
+  std::vector<unsigned int> m_light_stamp; ///< Last query each light was scored in
+  unsigned int m_query_counter;
+  std::vector<ScoredLight> m_scored;
+
+  int m_slots[MAX_LIGHTS]; ///< Light index in each GL light, or -1
+
+  unsigned int m_frame_queries, m_frame_candidates, m_frame_applied;
+  unsigned int m_last_frame_lights, m_last_frame_queries;
+  unsigned int m_last_frame_candidates, m_last_frame_applied;
 };
-	
+
 } /* namespace Sear */
 
 #endif /* SEAR_LIGHTMANAGER_H */
@@ -117,6 +117,8 @@ typedef std::map<std::string, std::vector<DynamicObject*> > QueueDynamicObjectMa
   virtual void translateObject(float x, float y, float z) const = 0;
   virtual void rotate(float angle, float x, float y, float z) const = 0;
   virtual void rotateObject(ObjectRecord*, ModelRecord*) const = 0;
+  // Work out the full object and model transform on the CPU
+  virtual void getObjectTransform(Matrix &mx, ObjectRecord*, ModelRecord*) const = 0;
   virtual void scaleObject(float scale) const = 0;
   virtual void setViewMode(int type) const = 0;
   virtual void setMaterial(float *ambient, float *diffuse, float *specular, float shininess, float *emissive) const = 0;
@@ -4,6 +4,8 @@
 
 // $Id: RenderSystem.cpp,v 1.27 2008-10-05 13:27:05 simon Exp $
 
+#include <cstdio>
+
 #include <SDL/SDL.h>
 
 #include <sigc++/object_slot.h>
@@ -33,6 +35,7 @@ namespace Sear {
 RenderSystem RenderSystem::m_instance;
 
 static const std::string CMD_TOGGLE_FULLSCREEN = "toggle_fullscreen";
+static const std::string CMD_print_render_stats = "print_render_stats";
 
 RenderSystem::RenderSystem() :
   m_initialised(false),
@@ -114,6 +117,7 @@ void RenderSystem::registerCommands(Console *con) {
   assert (con != NULL);
 
   con->registerCommand(CMD_TOGGLE_FULLSCREEN, this);
+  con->registerCommand(CMD_print_render_stats, this);
 
   dynamic_cast<GL*>(m_renderer.get())->registerCommands(con);
   m_textureManager->registerCommands(con);
@@ -125,6 +129,14 @@ void RenderSystem::registerCommands(Console *con) {
 void RenderSystem::runCommand(const std::string &command, const std::string &args) {
   assert(m_initialised);
   if (command == CMD_TOGGLE_FULLSCREEN) toggleFullscreen();
+  else if (command == CMD_print_render_stats) {
+    printf("State changes: %u (%u redundant requests)\n",
+      m_stateManager->getLastFrameChanges(),
+      m_stateManager->getLastFrameRedundant());
+    printf("Texture binds: %u (%u redundant requests)\n",
+      m_textureManager->getLastFrameBinds(),
+      m_textureManager->getLastFrameRedundant());
+  }
 }
 
 void RenderSystem::shutdown() {
@@ -221,6 +233,11 @@ void RenderSystem::toggleFullscreen() {
 
 void RenderSystem::drawScene(bool select_mode, float time_elapsed) {
   m_graphics->drawScene(select_mode, time_elapsed);
+  // Only count viewable frames
+  if (!select_mode) {
+    m_stateManager->endFrame();
+    m_textureManager->endFrame();
+  }
 }
 
 void RenderSystem::readConfig(varconf::Config &config) {
@@ -295,4 +312,9 @@ int RenderSystem::axisBoxInFrustum(const WFMath::AxisBox<3> &bbox) const {
   return m_renderer->axisBoxInFrustum(bbox);
 }
 
+void RenderSystem::getFrustum(float frustum[6][4]) const {
+  assert (m_initialised);
+  dynamic_cast<GL*>(m_renderer.get())->getCachedFrustum(frustum);
+}
+
 } // namespace Sear
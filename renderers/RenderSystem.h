@@ -77,7 +77,7 @@ public:
   void contextDestroyed(bool check);
 
   TextureManager *getTextureManager() { return m_textureManager.get(); }
-//  StateManager *getStateManager() { return m_stateManager.get(); }
+  StateManager *getStateManager() { return m_stateManager.get(); }
   Render *getRenderer() { return m_renderer.get(); }
   Graphics *getGraphics() { return m_graphics.get(); }
   CameraSystem *getCameraSystem() { return m_cameraSystem.get(); }
@@ -126,6 +126,8 @@ public:
   int currentContextNo() const;
 
   int axisBoxInFrustum(const WFMath::AxisBox<3> &) const;
+  /** Copy the frustum planes calculated for the current frame */
+  void getFrustum(float frustum[6][4]) const;
   
 
 private:
@@ -12,6 +12,8 @@
 
 #include <string>
 
+#include "TextureAtlas.h"
+
 namespace varconf {
 class Config;
 }
@@ -40,7 +42,8 @@ private:
  supported, this should become an abstract base, with derived versions
  of GLSpriteData, DX9SpriteData and so on.
  
- SpriteDatas are ref-counted.
+ SpriteDatas are ref-counted. The image is kept in the TextureManager's
+ texture atlas.
 */
 class SpriteData
 {
@@ -57,12 +60,11 @@ private:
     friend class Sprite;
     
     static varconf::Config& getSpriteConfig();
+    static TextureAtlas& getAtlas();
     
     void load();
     /** helper method invoked when the load fails for some reason */
     void loadFail();
-    
-    unsigned int twoN(unsigned int size);
 
     void addRef()
     { ++m_refCount; }
@@ -72,10 +74,10 @@ private:
     std::string m_name;
     unsigned int m_refCount;
     bool m_valid;
+    bool m_loaded; ///< load has been tried
     
     int m_width, m_height;
-    GLuint m_textureId;
-    float m_pw, m_ph;
+    TextureAtlas::Region m_region;
 };
 
 } // of namespace Sear
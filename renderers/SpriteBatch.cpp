@@ -0,0 +1,241 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cstring>
+
+#include "SpriteBatch.h"
+#include "RenderSystem.h"
+#include "TextureManager.h"
+
+namespace Sear {
+
+SpriteBatch::SpriteBatch(TextureAtlas &atlas) :
+  m_atlas(atlas),
+  m_vbo(0),
+  m_uploaded(false),
+  m_draws(0),
+  m_quads(0)
+{
+  m_colour[0] = m_colour[1] = m_colour[2] = m_colour[3] = 255;
+  m_scissor[0] = m_scissor[1] = m_scissor[3] = 0;
+  m_scissor[2] = -1;
+}
+
+SpriteBatch::~SpriteBatch() {
+  // Owners call contextDestroyed(false) once the context is lost, which
+  // forgets the buffer, so any buffer left here can still be deleted.
+  deleteBuffer();
+}
+
+void SpriteBatch::setColour(float r, float g, float b, float a) {
+  setColour((unsigned char)(r * 255.0f), (unsigned char)(g * 255.0f),
+            (unsigned char)(b * 255.0f), (unsigned char)(a * 255.0f));
+}
+
+void SpriteBatch::setColour(unsigned char r, unsigned char g,
+                            unsigned char b, unsigned char a) {
+  m_colour[0] = r;
+  m_colour[1] = g;
+  m_colour[2] = b;
+  m_colour[3] = a;
+}
+
+void SpriteBatch::setScissor(int x, int y, int width, int height) {
+  m_scissor[0] = x;
+  m_scissor[1] = y;
+  m_scissor[2] = width;
+  m_scissor[3] = height;
+}
+
+void SpriteBatch::addVertices(int page, GLuint texture, GLenum mode,
+                              const float *vertices, const float *texcoords,
+                              unsigned int count) {
+  if (page >= 0) texture = 0;
+
+  const unsigned int first = m_vertices.size() / 2;
+  if (m_runs.empty() || m_runs.back().page != page ||
+      m_runs.back().texture != texture || m_runs.back().mode != mode ||
+      memcmp(m_runs.back().scissor, m_scissor, sizeof(m_scissor)) != 0) {
+    Run run;
+    run.page = page;
+    run.texture = texture;
+    run.mode = mode;
+    memcpy(run.scissor, m_scissor, sizeof(m_scissor));
+    run.first = first;
+    run.count = 0;
+    m_runs.push_back(run);
+  }
+  m_runs.back().count += count;
+
+  m_vertices.insert(m_vertices.end(), vertices, vertices + count * 2);
+  m_texcoords.insert(m_texcoords.end(), texcoords, texcoords + count * 2);
+  for (unsigned int i = 0; i < count; ++i) {
+    m_colours.insert(m_colours.end(), m_colour, m_colour + 4);
+  }
+  m_uploaded = false;
+}
+
+void SpriteBatch::addQuad(int page, float x0, float y0, float x1, float y1,
+                          float s0, float t0, float s1, float t1) {
+  if (page < 0) return;
+
+  const float vertices[] = { x0, y0,  x1, y0,  x1, y1,  x0, y1 };
+  const float texcoords[] = { s0, t0,  s1, t0,  s1, t1,  s0, t1 };
+  addVertices(page, 0, GL_QUADS, vertices, texcoords, 4);
+}
+
+void SpriteBatch::addQuad(int page, GLuint texture, const float vertices[8],
+                          const float texcoords[8]) {
+  addVertices(page, texture, GL_QUADS, vertices, texcoords, 4);
+}
+
+void SpriteBatch::addLine(int page, GLuint texture, float x0, float y0,
+                          float x1, float y1, float s, float t) {
+  const float vertices[] = { x0, y0,  x1, y1 };
+  const float texcoords[] = { s, t,  s, t };
+  addVertices(page, texture, GL_LINES, vertices, texcoords, 2);
+}
+
+void SpriteBatch::draw() {
+  if (m_runs.empty()) return;
+
+  const bool use_vbo = m_uploaded && m_vbo != 0;
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  if (use_vbo) {
+    // Vertices, then texture coordinates, then colours
+    const size_t coords = m_vertices.size() * sizeof(float);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_vbo);
+    glVertexPointer(2, GL_FLOAT, 0, 0);
+    glTexCoordPointer(2, GL_FLOAT, 0, (const GLvoid*)coords);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, (const GLvoid*)(coords * 2));
+  } else {
+    glVertexPointer(2, GL_FLOAT, 0, &m_vertices[0]);
+    glTexCoordPointer(2, GL_FLOAT, 0, &m_texcoords[0]);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, &m_colours[0]);
+  }
+
+  bool scissor = false;
+  for (size_t i = 0; i < m_runs.size(); ++i) {
+    const Run &run = m_runs[i];
+
+    if (run.scissor[2] >= 0) {
+      if (!scissor) glEnable(GL_SCISSOR_TEST);
+      glScissor(run.scissor[0], run.scissor[1], run.scissor[2], run.scissor[3]);
+      scissor = true;
+    } else if (scissor) {
+      glDisable(GL_SCISSOR_TEST);
+      scissor = false;
+    }
+
+    if (run.page >= 0) {
+      glEnable(GL_TEXTURE_2D);
+      m_atlas.bindPage(run.page);
+    } else if (run.texture != 0) {
+      glEnable(GL_TEXTURE_2D);
+      glBindTexture(GL_TEXTURE_2D, run.texture);
+    } else {
+      glDisable(GL_TEXTURE_2D);
+    }
+
+    glDrawArrays(run.mode, run.first, run.count);
+    ++m_draws;
+  }
+  if (scissor) glDisable(GL_SCISSOR_TEST);
+
+  if (use_vbo) {
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+  }
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+  RenderSystem::getInstance().getTextureManager()->clearLastTexture(0);
+
+  m_quads += m_vertices.size() / 8;
+}
+
+void SpriteBatch::clear() {
+  m_runs.clear();
+  m_vertices.clear();
+  m_texcoords.clear();
+  m_colours.clear();
+  m_uploaded = false;
+}
+
+bool SpriteBatch::equals(const SpriteBatch &other) const {
+  if (m_runs.size() != other.m_runs.size()) return false;
+  if (m_vertices.size() != other.m_vertices.size()) return false;
+  if (m_runs.empty()) return true;
+
+  for (size_t i = 0; i < m_runs.size(); ++i) {
+    const Run &a = m_runs[i];
+    const Run &b = other.m_runs[i];
+    if (a.page != b.page || a.texture != b.texture || a.mode != b.mode ||
+        a.first != b.first || a.count != b.count ||
+        memcmp(a.scissor, b.scissor, sizeof(a.scissor)) != 0) {
+      return false;
+    }
+  }
+
+  return memcmp(&m_vertices[0], &other.m_vertices[0],
+                m_vertices.size() * sizeof(float)) == 0 &&
+         memcmp(&m_texcoords[0], &other.m_texcoords[0],
+                m_texcoords.size() * sizeof(float)) == 0 &&
+         memcmp(&m_colours[0], &other.m_colours[0], m_colours.size()) == 0;
+}
+
+void SpriteBatch::swap(SpriteBatch &other) {
+  m_runs.swap(other.m_runs);
+  m_vertices.swap(other.m_vertices);
+  m_texcoords.swap(other.m_texcoords);
+  m_colours.swap(other.m_colours);
+  m_uploaded = false;
+  other.m_uploaded = false;
+}
+
+void SpriteBatch::upload() {
+  if (!sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) return;
+  if (m_runs.empty()) return;
+
+  if (m_vbo == 0) {
+    glGenBuffersARB(1, &m_vbo);
+  }
+
+  const size_t coords = m_vertices.size() * sizeof(float);
+  const size_t colours = m_colours.size();
+  glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_vbo);
+  glBufferDataARB(GL_ARRAY_BUFFER_ARB, coords * 2 + colours, 0, GL_STATIC_DRAW_ARB);
+  glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, coords, &m_vertices[0]);
+  glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, coords, coords, &m_texcoords[0]);
+  glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, coords * 2, colours, &m_colours[0]);
+  glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+  m_uploaded = true;
+}
+
+void SpriteBatch::deleteBuffer() {
+  if (m_vbo != 0 && sage_ext[GL_ARB_VERTEX_BUFFER_OBJECT]) {
+    if (glIsBufferARB(m_vbo)) {
+      glDeleteBuffersARB(1, &m_vbo);
+    }
+  }
+  m_vbo = 0;
+  m_uploaded = false;
+}
+
+void SpriteBatch::contextDestroyed(bool check) {
+  if (check) {
+    deleteBuffer();
+  } else {
+    // The buffer went with the context
+    m_vbo = 0;
+    m_uploaded = false;
+  }
+}
+
+} /* namespace Sear */
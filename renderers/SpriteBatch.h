@@ -0,0 +1,163 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_RENDER_SPRITEBATCH_H
+#define SEAR_RENDER_SPRITEBATCH_H 1
+
+#include <vector>
+
+#include "TextureAtlas.h"
+
+namespace Sear {
+
+/**
+ * The SpriteBatch collects 2D primitives, mostly textured quads using images
+ * from a TextureAtlas, and draws them with as few draw calls as possible.
+ * Primitives are drawn in the order they were added; consecutive primitives
+ * of the same kind on the same texture share one bind and one glDrawArrays
+ * call. Anything drawn some other way must wait until the batch has been
+ * flushed, or it will end up below the batched primitives.
+ *
+ * A batch can also be kept and drawn again each frame. Once uploaded, it is
+ * drawn from a vertex buffer until its contents change.
+ */
+class SpriteBatch {
+public:
+  SpriteBatch(TextureAtlas &atlas);
+  ~SpriteBatch();
+
+  /**
+   * Set the colour for primitives added from now on. Textures are
+   * modulated by it.
+   */
+  void setColour(float r, float g, float b, float a);
+  void setColour(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+
+  /**
+   * Limit primitives added from now on to a rectangle in window
+   * coordinates, as given to glScissor.
+   */
+  void setScissor(int x, int y, int width, int height);
+  void clearScissor() { m_scissor[2] = -1; }
+
+  /**
+   * Add a quad showing all of an image. The first row of the image is
+   * placed at y0.
+   */
+  void addQuad(const TextureAtlas::Region &region,
+               float x0, float y0, float x1, float y1) {
+    addQuad(region.page, x0, y0, x1, y1,
+            region.s0, region.t0, region.s1, region.t1);
+  }
+
+  /**
+   * Add a quad with explicit texture coordinates on an atlas page.
+   * (s0, t0) is placed at (x0, y0) and (s1, t1) at (x1, y1).
+   */
+  void addQuad(int page, float x0, float y0, float x1, float y1,
+               float s0, float t0, float s1, float t1);
+
+  /**
+   * Add a quad with any four corners.
+   * @param page Atlas page, or -1 to use the texture object instead
+   * @param texture Texture object when page is -1, 0 for an untextured quad
+   */
+  void addQuad(int page, GLuint texture, const float vertices[8],
+               const float texcoords[8]);
+
+  /**
+   * Add a line. Both ends use the texture coordinate s, t.
+   */
+  void addLine(int page, GLuint texture, float x0, float y0,
+               float x1, float y1, float s, float t);
+
+  /**
+   * The atlas page of the last primitive, or -1.
+   */
+  int getLastPage() const { return m_runs.empty() ? -1 : m_runs.back().page; }
+
+  bool empty() const { return m_runs.empty(); }
+
+  /**
+   * Draw the queued primitives and keep them. Texture unit 0 must be
+   * active. Texturing is switched on or off as each run needs. Runs with a
+   * scissor rectangle switch the scissor test on, and it is switched off
+   * again for runs without one. The TextureManager's record of the texture
+   * bound to unit 0 is cleared.
+   */
+  void draw();
+
+  /**
+   * Draw and remove all queued primitives.
+   */
+  void flush() {
+    draw();
+    clear();
+  }
+
+  void clear();
+
+  /**
+   * Whether two batches hold exactly the same primitives.
+   */
+  bool equals(const SpriteBatch &other) const;
+
+  /**
+   * Exchange contents with another batch. Uploaded data is not exchanged.
+   */
+  void swap(SpriteBatch &other);
+
+  /**
+   * Copy the primitives into a vertex buffer, which is used by draw until
+   * the batch changes. Does nothing without vertex buffer support.
+   */
+  void upload();
+
+  /**
+   * Delete the vertex buffer if check is set, otherwise just forget it, as
+   * it went with the context. The destructor deletes any buffer left.
+   */
+  void contextDestroyed(bool check);
+
+  unsigned int getNumDraws() const { return m_draws; }
+  unsigned int getNumQuads() const { return m_quads; }
+  void resetStats() { m_draws = m_quads = 0; }
+
+private:
+  typedef struct {
+    int page;
+    GLuint texture;
+    GLenum mode;
+    int scissor[4]; ///< Width is -1 for no scissor
+    unsigned int first; ///< Index of the first vertex
+    unsigned int count; ///< Number of vertices
+  } Run;
+
+  void addVertices(int page, GLuint texture, GLenum mode,
+                   const float *vertices, const float *texcoords,
+                   unsigned int count);
+  void deleteBuffer();
+
+  TextureAtlas &m_atlas;
+
+  std::vector<Run> m_runs;
+  std::vector<float> m_vertices;
+  std::vector<float> m_texcoords;
+  std::vector<unsigned char> m_colours;
+  unsigned char m_colour[4];
+  int m_scissor[4];
+
+  GLuint m_vbo;
+  bool m_uploaded; ///< m_vbo holds the current contents
+
+  unsigned int m_draws, m_quads;
+
+  // Not copyable, owns a buffer object
+  SpriteBatch(const SpriteBatch&);
+  SpriteBatch &operator=(const SpriteBatch&);
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_RENDER_SPRITEBATCH_H */
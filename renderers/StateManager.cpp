@@ -86,7 +86,11 @@ static const std::string CMD_reload_config_states = "reload_config_states";
 StateManager::StateManager() :
   m_initialised(false),
   m_current_state(-1),
-  m_state_counter(1)
+  m_state_counter(1),
+  m_frame_changes(0),
+  m_frame_redundant(0),
+  m_last_frame_changes(0),
+  m_last_frame_redundant(0)
 {}
 
 StateManager::~StateManager() {
@@ -131,7 +135,7 @@ void StateManager::readFiles(const std::string &file_name) {
   varconf::Config config;
   config.sigsv.connect(sigc::mem_fun(*this, &StateManager::varconf_callback));
   config.sige.connect(sigc::mem_fun(*this, &StateManager::varconf_error_callback));
-  config.readFromFile(file_name);
+  System::instance()->getFileHandler()->readConfigFile(config, file_name);
 }
 
 void StateManager::varconf_callback(const std::string &section, const std::string &key, varconf::Config &config) {
@@ -266,7 +270,11 @@ int StateManager::getBlendFunction(const std::string &blend_function) {
 
 void StateManager::stateChange(StateID state) {
   assert(m_initialised == true);
-  if (m_current_state == state) return; // No need to do anything
+  if (m_current_state == state) { // No need to do anything
+    ++m_frame_redundant;
+    return;
+  }
+  ++m_frame_changes;
 
   assert (state < (int)m_states.size());
   SPtr<StateProperties> sp = m_states[state];
@@ -356,7 +364,7 @@ void StateManager::buildStateChange(unsigned int &list, SPtr<StateProperties> pr
   }
   if (previous_state->two_sided_lighting != next_state->two_sided_lighting) {
 //    if (next_state->lighting && checkState(RENDER_LIGHTING)) glLightModelf(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-    if (next_state->lighting) glLightModelf(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+    if (next_state->two_sided_lighting) glLightModelf(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
     else glLightModelf(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
   }
  
@@ -405,9 +413,14 @@ void StateManager::buildStateChange(unsigned int &list, SPtr<StateProperties> pr
     if (next_state->normalise) glEnable(GL_NORMALIZE);
     else glDisable(GL_NORMALIZE);
   }
-//  if ((next_state->alpha_function != previous_state->alpha_function) || (next_state->alpha_value != previous_state->alpha_value)) 
-  glAlphaFunc(next_state->alpha_function, next_state->alpha_value);
-  glBlendFunc(next_state->blend_src_function, next_state->blend_dest_function);
+  // Both states were fully applied at some point, so only emit the functions
+  // when they actually differ.
+  if ((next_state->alpha_function != previous_state->alpha_function) || (next_state->alpha_value != previous_state->alpha_value)) {
+    glAlphaFunc(next_state->alpha_function, next_state->alpha_value);
+  }
+  if ((next_state->blend_src_function != previous_state->blend_src_function) || (next_state->blend_dest_function != previous_state->blend_dest_function)) {
+    glBlendFunc(next_state->blend_src_function, next_state->blend_dest_function);
+  }
   glEndList();
 }
 
@@ -88,6 +88,30 @@ public:
   
   StateID getCurrentState() const { return m_current_state; }
 
+  /**
+   * Returns the properties of the given state, or an invalid pointer if the
+   * state has not been defined. Lets callers query the shadowed GL state
+   * instead of reading it back with glGet.
+   */
+  SPtr<StateProperties> getStateProperties(StateID state) const {
+    if (state < 0 || state >= (int)m_states.size()) return SPtr<StateProperties>();
+    return m_states[state];
+  }
+
+  /**
+   * Finish the per-frame statistics. The counts for the frame just rendered
+   * are kept until the next call.
+   */
+  void endFrame() {
+    m_last_frame_changes = m_frame_changes;
+    m_last_frame_redundant = m_frame_redundant;
+    m_frame_changes = 0;
+    m_frame_redundant = 0;
+  }
+
+  unsigned int getLastFrameChanges() const { return m_last_frame_changes; }
+  unsigned int getLastFrameRedundant() const { return m_last_frame_redundant; }
+
   void contextCreated();
   void contextDestroyed(bool check);
 
@@ -108,6 +132,11 @@ private:
 
   StateID m_current_state;
   unsigned int m_state_counter;
+
+  unsigned int m_frame_changes; ///< State transitions this frame
+  unsigned int m_frame_redundant; ///< Requests for the current state this frame
+  unsigned int m_last_frame_changes;
+  unsigned int m_last_frame_redundant;
   std::list<std::string> m_state_configs;
 };
 
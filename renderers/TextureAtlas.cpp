@@ -0,0 +1,261 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cassert>
+#include <cstring>
+
+#include <SDL/SDL.h>
+
+#include "TextureAtlas.h"
+
+namespace Sear {
+
+TextureAtlas::TextureAtlas(int page_size, int padding) :
+  m_page_size(page_size),
+  m_padding(padding),
+  m_uploads(0)
+{
+}
+
+TextureAtlas::~TextureAtlas() {
+  // Texture objects are removed by contextDestroyed
+  for (size_t i = 0; i < m_pages.size(); ++i) {
+    delete m_pages[i];
+  }
+}
+
+bool TextureAtlas::place(Page &page, int width, int height, int &x, int &y) {
+  // Use the shortest shelf the image fits on, so that tall shelves are
+  // kept for tall images.
+  Shelf *best = 0;
+  for (size_t i = 0; i < page.shelves.size(); ++i) {
+    Shelf &shelf = page.shelves[i];
+    if (shelf.height < height) continue;
+    if (shelf.x + width > m_page_size) continue;
+    if (best == 0 || shelf.height < best->height) best = &shelf;
+  }
+
+  if (best == 0) {
+    // Start a new shelf below the last one
+    int top = 0;
+    if (!page.shelves.empty()) {
+      const Shelf &last = page.shelves.back();
+      top = last.y + last.height;
+    }
+    if (top + height > m_page_size) return false;
+
+    Shelf shelf;
+    shelf.y = top;
+    shelf.height = height;
+    shelf.x = 0;
+    page.shelves.push_back(shelf);
+    best = &page.shelves.back();
+  }
+
+  x = best->x;
+  y = best->y;
+  best->x += width;
+  return true;
+}
+
+void TextureAtlas::copyImage(Page &page, int x, int y,
+                             const unsigned char *pixels,
+                             int width, int height, int pitch) {
+  // x and y give the top left of the padded rectangle. The padding is
+  // filled with copies of the nearest edge pixel.
+  const int row_bytes = width * 4;
+  for (int j = -m_padding; j < height + m_padding; ++j) {
+    const int src_j = (j < 0) ? 0 : ((j >= height) ? height - 1 : j);
+    const unsigned char *src = pixels + src_j * pitch;
+    unsigned char *dst = &page.pixels[((y + m_padding + j) * m_page_size + x) * 4];
+
+    for (int i = 0; i < m_padding; ++i) {
+      memcpy(dst + i * 4, src, 4);
+    }
+    memcpy(dst + m_padding * 4, src, row_bytes);
+    for (int i = 0; i < m_padding; ++i) {
+      memcpy(dst + (m_padding + width + i) * 4, src + row_bytes - 4, 4);
+    }
+  }
+  page.dirty = true;
+}
+
+void TextureAtlas::reserveWhite(Page &page) {
+  static const unsigned char white[] = { 255, 255, 255, 255 };
+  int x = 0, y = 0;
+  bool placed = place(page, 1 + 2 * m_padding, 1 + 2 * m_padding, x, y);
+  assert(placed);
+  (void)placed;
+  copyImage(page, x, y, white, 1, 1, 4);
+
+  const float scale = 1.0f / (float)m_page_size;
+  page.white_s = (x + m_padding + 0.5f) * scale;
+  page.white_t = (y + m_padding + 0.5f) * scale;
+}
+
+void TextureAtlas::getWhiteTexel(int p, float &s, float &t) const {
+  assert(p >= 0 && p < (int)m_pages.size());
+  s = m_pages[p]->white_s;
+  t = m_pages[p]->white_t;
+}
+
+bool TextureAtlas::add(const unsigned char *pixels, int width, int height,
+                       int pitch, Region &region) {
+  assert(pixels != 0);
+  region.page = -1;
+
+  const int padded_w = width + 2 * m_padding;
+  const int padded_h = height + 2 * m_padding;
+  if (width <= 0 || height <= 0) return false;
+  if (padded_w > m_page_size || padded_h > m_page_size) return false;
+
+  int x = 0, y = 0;
+  size_t p = 0;
+  for (; p < m_pages.size(); ++p) {
+    if (place(*m_pages[p], padded_w, padded_h, x, y)) break;
+  }
+
+  if (p == m_pages.size()) {
+    Page *page = new Page();
+    page->pixels.resize(m_page_size * m_page_size * 4, 0);
+    page->texture = 0;
+    page->dirty = true;
+    page->images = 0;
+    page->used = 0;
+    reserveWhite(*page);
+    m_pages.push_back(page);
+
+    bool placed = place(*page, padded_w, padded_h, x, y);
+    assert(placed);
+    (void)placed;
+  }
+
+  Page &page = *m_pages[p];
+  copyImage(page, x, y, pixels, width, height, pitch);
+  ++page.images;
+  page.used += padded_w * padded_h;
+
+  const float scale = 1.0f / (float)m_page_size;
+  region.page = p;
+  region.x = x + m_padding;
+  region.y = y + m_padding;
+  region.width = width;
+  region.height = height;
+  region.s0 = region.x * scale;
+  region.t0 = region.y * scale;
+  region.s1 = (region.x + width) * scale;
+  region.t1 = (region.y + height) * scale;
+  return true;
+}
+
+bool TextureAtlas::add(SDL_Surface *surface, Region &region) {
+  assert(surface != 0);
+  region.page = -1;
+
+  SDL_Surface *rgba = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w,
+                                           surface->h, 32,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+        0x000000FF,
+        0x0000FF00,
+        0x00FF0000,
+        0xFF000000
+#else
+        0xFF000000,
+        0x00FF0000,
+        0x0000FF00,
+        0x000000FF
+#endif
+        );
+  if (rgba == NULL) return false;
+
+  // Copy the alpha channel rather than blending with it
+  const Uint32 alpha_flags = surface->flags & SDL_SRCALPHA;
+  const Uint8 alpha = surface->format->alpha;
+  SDL_SetAlpha(surface, 0, 0);
+  SDL_BlitSurface(surface, NULL, rgba, NULL);
+  if (alpha_flags) SDL_SetAlpha(surface, alpha_flags, alpha);
+
+  SDL_LockSurface(rgba);
+  bool success = add((const unsigned char*)rgba->pixels, rgba->w, rgba->h,
+                     rgba->pitch, region);
+  SDL_UnlockSurface(rgba);
+  SDL_FreeSurface(rgba);
+
+  return success;
+}
+
+void TextureAtlas::update(const Region &region, const unsigned char *pixels,
+                          int pitch) {
+  assert(region.page >= 0 && region.page < (int)m_pages.size());
+  copyImage(*m_pages[region.page], region.x - m_padding,
+            region.y - m_padding, pixels, region.width, region.height, pitch);
+}
+
+void TextureAtlas::release(Region &region) {
+  if (region.page < 0) return;
+  assert(region.page < (int)m_pages.size());
+
+  Page &page = *m_pages[region.page];
+  assert(page.images > 0);
+  page.used -= (region.width + 2 * m_padding) * (region.height + 2 * m_padding);
+  if (--page.images == 0) {
+    // Nothing left on the page, so all of it can be reused.
+    page.shelves.clear();
+    page.used = 0;
+    reserveWhite(page);
+  }
+  region.page = -1;
+}
+
+void TextureAtlas::bindPage(int p) {
+  assert(p >= 0 && p < (int)m_pages.size());
+  Page &page = *m_pages[p];
+
+  if (page.texture == 0) {
+    glGenTextures(1, &page.texture);
+    page.dirty = true;
+  }
+  glBindTexture(GL_TEXTURE_2D, page.texture);
+
+  if (page.dirty) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_page_size, m_page_size, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, &page.pixels[0]);
+    page.dirty = false;
+    ++m_uploads;
+  }
+}
+
+unsigned int TextureAtlas::getNumImages() const {
+  unsigned int images = 0;
+  for (size_t i = 0; i < m_pages.size(); ++i) {
+    images += m_pages[i]->images;
+  }
+  return images;
+}
+
+float TextureAtlas::getUsage() const {
+  if (m_pages.empty()) return 0.0f;
+  double used = 0.0;
+  for (size_t i = 0; i < m_pages.size(); ++i) {
+    used += m_pages[i]->used;
+  }
+  return used / ((double)m_page_size * m_page_size * m_pages.size());
+}
+
+void TextureAtlas::contextDestroyed(bool check) {
+  for (size_t i = 0; i < m_pages.size(); ++i) {
+    Page &page = *m_pages[i];
+    if (check && page.texture != 0 && glIsTexture(page.texture)) {
+      glDeleteTextures(1, &page.texture);
+    }
+    page.texture = 0;
+    page.dirty = true;
+  }
+}
+
+} /* namespace Sear */
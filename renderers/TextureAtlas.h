@@ -0,0 +1,135 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_RENDER_TEXTUREATLAS_H
+#define SEAR_RENDER_TEXTUREATLAS_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <sage/sage.h>
+#include <sage/GL.h>
+
+struct SDL_Surface;
+
+namespace Sear {
+
+/**
+ * The TextureAtlas packs small images, such as sprites, GUI images and font
+ * glyph sheets, into a few large texture pages so that they can be drawn
+ * with one bind per page. Images are placed on shelves, each surrounded by a
+ * border of copies of its edge pixels so that linear filtering never picks
+ * up a neighbouring image.
+ *
+ * Every page holds a small white block, so untextured primitives can be
+ * drawn in the same batch as images by using its texture coordinates.
+ *
+ * Page pixels are kept in memory and a page is uploaded the next time it is
+ * bound after it changes. This also restores the pages after the context is
+ * lost. Space is reclaimed a page at a time, once every image on a page has
+ * been released.
+ */
+class TextureAtlas {
+public:
+  typedef struct {
+    int page; ///< Page index, -1 if the image is not in the atlas
+    int x, y, width, height; ///< Image rectangle in the page, without padding
+    float s0, t0, s1, t1; ///< Texture coordinates of the rectangle
+  } Region;
+
+  TextureAtlas(int page_size = 512, int padding = 1);
+  ~TextureAtlas();
+
+  /**
+   * Copy an image into the atlas. Pixels are 32 bit RGBA, in byte order.
+   * @param pitch Bytes from one row to the next
+   * @return False if the image will not fit on a page
+   */
+  bool add(const unsigned char *pixels, int width, int height, int pitch,
+           Region &region);
+
+  /**
+   * Copy an SDL surface of any format into the atlas.
+   */
+  bool add(SDL_Surface *surface, Region &region);
+
+  /**
+   * Replace the pixels of an image already in the atlas.
+   */
+  void update(const Region &region, const unsigned char *pixels, int pitch);
+
+  /**
+   * Give up an image's space. The region must not be used afterwards.
+   */
+  void release(Region &region);
+
+  /**
+   * Whether an image of this size should go into the atlas. Images larger
+   * than half a page would leave most of a page unused.
+   */
+  bool fits(int width, int height) const {
+    return (width + 2 * m_padding) <= m_page_size / 2 &&
+           (height + 2 * m_padding) <= m_page_size / 2;
+  }
+
+  /**
+   * Bind a page to the active texture unit, uploading it first if it has
+   * changed. This bypasses the TextureManager, so its record of the bound
+   * texture must be cleared afterwards.
+   */
+  void bindPage(int page);
+
+  /**
+   * Texture coordinates of a white texel on a page.
+   */
+  void getWhiteTexel(int page, float &s, float &t) const;
+
+  int getPageSize() const { return m_page_size; }
+  size_t getNumPages() const { return m_pages.size(); }
+  unsigned int getNumImages() const;
+  unsigned int getNumUploads() const { return m_uploads; }
+
+  /**
+   * Fraction of page area holding images, including padding.
+   */
+  float getUsage() const;
+
+  void contextCreated() {}
+  void contextDestroyed(bool check);
+
+private:
+  typedef struct {
+    int y; ///< Top of the shelf
+    int height;
+    int x; ///< Start of the free space
+  } Shelf;
+
+  typedef struct {
+    std::vector<unsigned char> pixels;
+    std::vector<Shelf> shelves;
+    GLuint texture;
+    bool dirty; ///< Pixels have changed since the last upload
+    unsigned int images;
+    int used; ///< Pixels covered by images
+    float white_s, white_t; ///< Centre of the white block
+  } Page;
+
+  bool place(Page &page, int width, int height, int &x, int &y);
+  void reserveWhite(Page &page);
+  void copyImage(Page &page, int x, int y, const unsigned char *pixels,
+                 int width, int height, int pitch);
+
+  std::vector<Page*> m_pages;
+  int m_page_size;
+  int m_padding;
+  unsigned int m_uploads;
+
+  // Not copyable, pages own texture objects
+  TextureAtlas(const TextureAtlas&);
+  TextureAtlas &operator=(const TextureAtlas&);
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_RENDER_TEXTUREATLAS_H */
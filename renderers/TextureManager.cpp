@@ -4,6 +4,8 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <sigc++/object_slot.h>
 
 #include <sage/sage.h>
@@ -53,6 +55,9 @@ namespace Sear {
   static const std::string SECTION_texture = "textures";
   static const std::string KEY_max_texture_size = "max_texture_size";
   static const int DEFAULT_max_texture_size = -1;
+  static const std::string KEY_texture_budget = "texture_budget";
+  // Megabytes
+  static const int DEFAULT_texture_budget = 128;
 
 // Find the next largest power of 2 to i, but no bigger than the max texture
 // size we are allowed
@@ -108,6 +113,14 @@ static const std::string CMD_SET_TEXTURE_BASE_LEVEL = "set_texture_detail";
 static const std::string CMD_dump_reference_count = "dump_reference_count";
 static const std::string CMD_reload_config_textures = "reload_config_textures";
 static const std::string CMD_reload_config_sprites = "reload_config_sprites";
+static const std::string CMD_texture_budget = "texture_budget";
+static const std::string CMD_texture_residency = "texture_residency";
+static const std::string CMD_texture_atlas = "texture_atlas";
+
+// Textures bound within this many frames are never evicted
+static const unsigned int MIN_idle_frames = 30;
+// Number of textures listed by the residency report
+static const unsigned int RESIDENCY_report_size = 10;
 
 // Format strings
 static const std::string ALPHA = "alpha";
@@ -159,13 +172,61 @@ bool use_sgis_generate_mipmap = false;
 bool use_arb_texture_border_clamp = false;
 bool use_ext_texture_filter_anisotropic = false;
 
+// Estimate the bytes per texel a driver uses for an internal format
+static size_t bytesPerTexel(GLint fmt) {
+  switch (fmt) {
+    case GL_ALPHA4:
+    case GL_ALPHA8:
+    case GL_LUMINANCE4:
+    case GL_LUMINANCE8:
+    case GL_LUMINANCE4_ALPHA4:
+    case GL_LUMINANCE6_ALPHA2:
+    case GL_INTENSITY4:
+    case GL_INTENSITY8:
+    case GL_R3_G3_B2:
+    case GL_RGBA2:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_INTENSITY:
+      return 1;
+    case GL_ALPHA12:
+    case GL_ALPHA16:
+    case GL_LUMINANCE12:
+    case GL_LUMINANCE16:
+    case GL_LUMINANCE_ALPHA:
+    case GL_LUMINANCE8_ALPHA8:
+    case GL_INTENSITY12:
+    case GL_INTENSITY16:
+    case GL_RGB4:
+    case GL_RGB5:
+    case GL_RGBA4:
+    case GL_RGB5_A1:
+      return 2;
+    case GL_RGB12:
+    case GL_RGB16:
+    case GL_RGBA12:
+    case GL_RGBA16:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
 TextureManager::TextureManager() :
   m_initialised(false),
   m_initGL(false),
   m_texture_counter(1),
   m_texture_units(1),
   m_baseMipmapLevel(0),
-  m_max_texture_size(-1)
+  m_max_texture_size(-1),
+  m_frame_binds(0),
+  m_frame_redundant(0),
+  m_last_frame_binds(0),
+  m_last_frame_redundant(0),
+  m_frame(0),
+  m_texture_bytes(0),
+  m_texture_budget(DEFAULT_texture_budget * 1024 * 1024),
+  m_textures_evicted(0)
 {  
   varconf::Config &cfg = System::instance()->getGeneral();
   cfg.sigsv.connect(sigc::mem_fun(this, &TextureManager::generalConfigChanged));
@@ -183,6 +244,7 @@ void TextureManager::init()
   m_texture_counter = 1;
   m_textures.resize(1); // we need to leave texture ID zero free
   m_names.resize(1); // ditto
+  m_last_used.resize(1);
   // Set some values to help with debugging!
   m_names[0] = "null_texture";
   m_textures[0] = 0;
@@ -263,13 +325,15 @@ void TextureManager::shutdown()
     m_sprites.erase(m_sprites.begin());
   }
 
+  releaseAtlasRegions();
+
   m_last_textures.clear();
   m_initialised = false;
 }
 
 void TextureManager::readTextureConfig(const std::string &filename) {
   assert((m_initialised == true) && "TextureManager not initialised");
-  m_texture_config.readFromFile(filename);
+  System::instance()->getFileHandler()->readConfigFile(m_texture_config, filename);
 }
 
 GLuint TextureManager::loadTexture(const std::string &texture_name) {
@@ -286,12 +350,12 @@ GLuint TextureManager::loadTexture(const std::string &texture_name) {
   m_texture_config.clean(clean_name);
   // Check texture is defined
   if (!m_texture_config.find(clean_name)) {
-    fprintf(stderr, "Texture %s (%s) not defined.\n", texture_name.c_str(), clean_name.c_str());
+    SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_WARNING, "Texture " + texture_name + " (" + clean_name + ") not defined.");
     return 0;
   }
  
   if (!m_texture_config.findItem(clean_name, KEY_filename)) {
-    fprintf(stderr, "Texture %s has no filename(clean name).\n", clean_name.c_str());
+    SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_WARNING, "Texture " + clean_name + " has no filename(clean name).");
     return 0;
   }
 
@@ -303,15 +367,15 @@ GLuint TextureManager::loadTexture(const std::string &texture_name) {
   switch (status) {
     case MediaManager::STATUS_OK:
     {
-      printf("Local file is up-to-date: %s\n", filename.c_str());
+      SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "Local file is up-to-date: " + filename);
       break;
     }
     case MediaManager::STATUS_USE_OLD:
     case MediaManager::STATUS_USE_DEFAULT:
     {
-      printf("File is being updated, using existing version for now\n");
+      SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "File is being updated, using existing version for now");
       if (m_pending_updates.find(filename) == m_pending_updates.end()) {
-        printf("Adding to pending update: %s\n", fname.c_str());
+        SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "Adding to pending update: " + fname);
         m_pending_updates[filename] = 0;
       }
       // Return default texture
@@ -321,10 +385,10 @@ GLuint TextureManager::loadTexture(const std::string &texture_name) {
     case MediaManager::STATUS_UNKNOWN_FILE:    
     default:
     {
-      printf("Status default or unknown file\n");
+      SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "Status default or unknown file");
     }
   }
-  printf(">>>>>>>>> %s\n", texture_name.c_str());
+  SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "Loading " + texture_name);
 #endif
   // Perhaps this stage should be in a different function?
   System::instance()->getFileHandler()->getFilePath(filename);
@@ -541,11 +605,113 @@ GLuint TextureManager::loadTexture(const std::string &name, SDL_Surface *surface
     glPrioritizeTextures(1, &texture_id, &priority);
   }
   
+  // Estimate the memory used for the residency budget. A full mipmap chain
+  // adds a third to the size of the top level.
+  size_t bytes;
+  if (mipmap) {
+    const size_t w = std::max(surface->w >> m_baseMipmapLevel, 1);
+    const size_t h = std::max(surface->h >> m_baseMipmapLevel, 1);
+    bytes = w * h * bytesPerTexel(fmt) * 4 / 3;
+  } else {
+    bytes = surface->w * surface->h * bytesPerTexel(fmt);
+  }
+  m_texture_sizes[texture_id] = bytes;
+  m_texture_bytes += bytes;
+
   if (free_surface) SDL_FreeSurface(surface);
   return texture_id;
 }
 
 
+bool TextureManager::readImageRow(const std::string &texture_name, int row, std::vector<Color_4> &colours)
+{
+  assert((m_initialised == true) && "TextureManager not initialised");
+  colours.clear();
+
+  std::string clean_name(texture_name);
+  m_texture_config.clean(clean_name);
+  if (!m_texture_config.findItem(clean_name, KEY_filename)) {
+    fprintf(stderr, "Texture %s has no filename.\n", clean_name.c_str());
+    return false;
+  }
+
+  std::string filename = (std::string)m_texture_config.getItem(clean_name, KEY_filename);
+  System::instance()->getFileHandler()->getFilePath(filename);
+  SDL_Surface *image = loadImageFromPath(filename);
+  if (!image) return false;
+
+  if (row < 0 || row >= image->h) {
+    SDL_FreeSurface(image);
+    return false;
+  }
+
+  SDL_LockSurface(image);
+  const int bpp = image->format->BytesPerPixel;
+  const Uint8 *pixel = (const Uint8*)image->pixels + row * image->pitch;
+  for (int x = 0; x < image->w; ++x, pixel += bpp) {
+    Uint32 value = 0;
+    switch (bpp) {
+      case 1: value = *pixel; break;
+      case 2: value = *(const Uint16*)pixel; break;
+      case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+        value = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+#else
+        value = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+#endif
+        break;
+      default: value = *(const Uint32*)pixel; break;
+    }
+    Color_4 c;
+    SDL_GetRGBA(value, image->format, &c.r, &c.g, &c.b, &c.a);
+    colours.push_back(c);
+  }
+  SDL_UnlockSurface(image);
+
+  SDL_FreeSurface(image);
+  return true;
+}
+
+bool TextureManager::getAtlasRegion(const std::string &texture_name, TextureAtlas::Region &region)
+{
+  assert((m_initialised == true) && "TextureManager not initialised");
+
+  AtlasRegionMap::const_iterator I = m_atlas_regions.find(texture_name);
+  if (I != m_atlas_regions.end()) {
+    region = I->second;
+    return region.page >= 0;
+  }
+
+  // Failures are remembered too, so the image is only loaded once
+  region.page = -1;
+
+  std::string clean_name(texture_name);
+  m_texture_config.clean(clean_name);
+  if (m_texture_config.findItem(clean_name, KEY_filename)) {
+    std::string filename = (std::string)m_texture_config.getItem(clean_name, KEY_filename);
+    System::instance()->getFileHandler()->getFilePath(filename);
+    SDL_Surface *image = loadImageFromPath(filename);
+    if (image != NULL) {
+      if (m_atlas.fits(image->w, image->h)) {
+        m_atlas.add(image, region);
+      }
+      SDL_FreeSurface(image);
+    }
+  }
+
+  m_atlas_regions[texture_name] = region;
+  return region.page >= 0;
+}
+
+void TextureManager::releaseAtlasRegions()
+{
+  AtlasRegionMap::iterator I = m_atlas_regions.begin();
+  for (; I != m_atlas_regions.end(); ++I) {
+    m_atlas.release(I->second);
+  }
+  m_atlas_regions.clear();
+}
+
 void TextureManager::unloadTexture(const std::string &texture_name)
 {
   assert((m_initialised == true) && "TextureManager not initialised");
@@ -558,12 +724,42 @@ void TextureManager::unloadTexture(const std::string &texture_name)
 void TextureManager::unloadTexture(GLuint texture_id) {
   assert((m_initialised == true) && "TextureManager not initialised");
   if (glIsTexture(texture_id)) glDeleteTextures(1, &texture_id);
+
+  TextureSizeMap::iterator I = m_texture_sizes.find(texture_id);
+  if (I != m_texture_sizes.end()) {
+    m_texture_bytes -= I->second;
+    m_texture_sizes.erase(I);
+  }
 }
 
-void TextureManager::switchTexture(TextureID texture_id) {
-  assert((m_initialised == true) && "TextureManager not initialised");
-  // Don't try and reload texture if it is the current texture.
-  if (texture_id == m_last_textures[0]) return;
+void TextureManager::evictTextures() {
+  // Find the textures that can be unloaded, oldest first
+  typedef std::pair<unsigned int, TextureID> Candidate;
+  std::vector<Candidate> candidates;
+  for (size_t i = 1; i < m_textures.size(); ++i) {
+    if (m_textures[i] == 0) continue;
+    if (m_last_used[i] + MIN_idle_frames >= m_frame) continue;
+    // Default textures are not in the size map and could not be reloaded
+    if (m_texture_sizes.find(m_textures[i]) == m_texture_sizes.end()) continue;
+    candidates.push_back(Candidate(m_last_used[i], i));
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<Candidate>::const_iterator I = candidates.begin();
+  for (; I != candidates.end() && m_texture_bytes > m_texture_budget; ++I) {
+    const TextureID id = I->second;
+    SEAR_LOG(Log::CAT_TEXTURE, Log::LOG_DEBUG, "Evicting " + m_names[id]);
+    unloadTexture(m_textures[id]);
+    m_textures[id] = 0;
+    // The texture object may be reused, so forget it was bound
+    for (size_t u = 0; u < m_last_textures.size(); ++u) {
+      if (m_last_textures[u] == id) m_last_textures[u] = -1;
+    }
+    ++m_textures_evicted;
+  }
+}
+
+GLuint TextureManager::getLoadedTextureObject(TextureID texture_id) {
   GLuint to = m_textures[texture_id];
   if (to == 0) {
     const std::string &tex_name = m_names[texture_id];
@@ -575,42 +771,47 @@ void TextureManager::switchTexture(TextureID texture_id) {
 #endif
       to = loadTexture(tex_name);
       if (to == 0) {
-        fprintf(stderr,"Cannot find %s ID %d\n", tex_name.c_str(), texture_id);
+        Log::writeLog(Log::CAT_TEXTURE, Log::LOG_WARNING, "Cannot find texture",
+                      LogFields().add("name", tex_name).add("id", texture_id));
         to = m_textures[m_default_texture];
       }
       m_textures[texture_id] = to;
+      // Loading binds the new texture object to the active unit
+      m_last_textures[0] = -1;
 #ifdef WFUT_TEST
     }
 #endif
   }
+  return to;
+}
+
+void TextureManager::switchTexture(TextureID texture_id) {
+  assert((m_initialised == true) && "TextureManager not initialised");
+  m_last_used[texture_id] = m_frame;
+  // Don't try and reload texture if it is the current texture.
+  if (texture_id == m_last_textures[0]) {
+    ++m_frame_redundant;
+    return;
+  }
+  GLuint to = getLoadedTextureObject(texture_id);
   glBindTexture(GL_TEXTURE_2D, to);
+  ++m_frame_binds;
   m_last_textures[0] = texture_id;  
 }
 
 void TextureManager::switchTexture(unsigned int texture_unit, TextureID texture_id) {
   assert((m_initialised == true) && "TextureManager not initialised");
-  if (texture_id == m_last_textures[texture_unit]) return;
-//  if (texture_id == NO_TEXTURE_ID) texture_id = m_default_texture;
-  if (!use_arb_multitexture) return switchTexture(texture_id);
+  if (!use_arb_multitexture || texture_unit == 0) return switchTexture(texture_id);
   if ((int)texture_unit >= m_texture_units) return; // Check we have enough texture units
+  m_last_used[texture_id] = m_frame;
+//  if (texture_id == NO_TEXTURE_ID) texture_id = m_default_texture;
+  // Units other than zero are also bound directly by the terrain and model
+  // code, so there is no reliable shadow for them and we always bind.
+  // Load before switching units as loading binds the new texture object.
+  GLuint to = getLoadedTextureObject(texture_id);
   glActiveTextureARB(GL_TEXTURE0_ARB + texture_unit);
-  // TODO: There is a problem if the texture is the same as the one loaded in texture unit 0
-  //       switchTexture will just return....
-  switchTexture(texture_id);
-/*
-  GLuint to = (texture_id == NO_TEXTURE_ID) ? (m_textures[m_default_texture]) : (m_textures[texture_id]);
-  if (to == 0) {
-    to = loadTexture(m_names[texture_id]);
-    if (to == 0) {
-      std::cerr << "Cannot find " << m_names[texture_id] << std::endl;
-      to = m_textures[m_default_texture];
-    }
-    m_textures[texture_id] = to;
-  }
   glBindTexture(GL_TEXTURE_2D, to);
-  m_last_textures[texture_unit] = to;
-
-*/
+  ++m_frame_binds;
   // Make sure we are at texture unit 0
   glActiveTextureARB(GL_TEXTURE0_ARB);
 }
@@ -793,6 +994,9 @@ void TextureManager::registerCommands(Console *console) {
   console->registerCommand(CMD_dump_reference_count, this);
   console->registerCommand(CMD_reload_config_textures, this);
   console->registerCommand(CMD_reload_config_sprites, this);
+  console->registerCommand(CMD_texture_budget, this);
+  console->registerCommand(CMD_texture_residency, this);
+  console->registerCommand(CMD_texture_atlas, this);
 }
 
 void TextureManager::runCommand(const std::string &command, const std::string &arguments) {
@@ -809,7 +1013,7 @@ void TextureManager::runCommand(const std::string &command, const std::string &a
     m_sprite_configs.push_back(a);
     System::instance()->getFileHandler()->getFilePath(a);
     if (debug) std::cout << "reading sprite config at " << a << std::endl;
-    m_spriteConfig.readFromFile(a);
+    System::instance()->getFileHandler()->readConfigFile(m_spriteConfig, a);
   }
   
   else 
@@ -835,6 +1039,7 @@ void TextureManager::runCommand(const std::string &command, const std::string &a
   else 
   if (command == CMD_reload_config_textures) {
     contextDestroyed(true);
+    releaseAtlasRegions();
     m_texture_config = varconf::Config();
     m_texture_config.sige.connect(sigc::mem_fun(this, &TextureManager::varconf_error_callback));
     std::list<std::string>::const_iterator I = m_texture_configs.begin();
@@ -842,7 +1047,7 @@ void TextureManager::runCommand(const std::string &command, const std::string &a
     while (I != Iend) {
       std::string a = *I++;
       System::instance()->getFileHandler()->getFilePath(a);
-      m_texture_config.readFromFile(a);
+      System::instance()->getFileHandler()->readConfigFile(m_texture_config, a);
     }
     contextCreated();
   }
@@ -855,10 +1060,51 @@ void TextureManager::runCommand(const std::string &command, const std::string &a
     while (I != Iend) {
       std::string a = *I++;
       System::instance()->getFileHandler()->getFilePath(a);
-      m_spriteConfig.readFromFile(a);
+      System::instance()->getFileHandler()->readConfigFile(m_spriteConfig, a);
     }
     contextCreated();
   }
+  else
+  if (command == CMD_texture_budget) {
+    if (arguments.empty()) {
+      printf("Texture budget: %luMB\n", (unsigned long)(m_texture_budget / (1024 * 1024)));
+    } else {
+      int mb = strtol(arguments.c_str(), NULL, 0);
+      if (mb < 0) {
+        printf("Usage: %s <megabytes> (0 for no limit)\n", CMD_texture_budget.c_str());
+        return;
+      }
+      setTextureBudget(mb * 1024 * 1024);
+    }
+  }
+  else
+  if (command == CMD_texture_residency) {
+    typedef std::pair<size_t, TextureID> Resident;
+    std::vector<Resident> resident;
+    for (size_t i = 1; i < m_textures.size(); ++i) {
+      TextureSizeMap::const_iterator I = m_texture_sizes.find(m_textures[i]);
+      if (m_textures[i] == 0 || I == m_texture_sizes.end()) continue;
+      resident.push_back(Resident(I->second, i));
+    }
+    printf("Textures - Loaded: %lu Memory: %luKB of %luKB Evicted: %u\n",
+           (unsigned long)resident.size(), (unsigned long)(m_texture_bytes / 1024),
+           (unsigned long)(m_texture_budget / 1024), m_textures_evicted);
+
+    // Largest first
+    std::sort(resident.rbegin(), resident.rend());
+    for (size_t i = 0; i < resident.size() && i < RESIDENCY_report_size; ++i) {
+      const TextureID id = resident[i].second;
+      printf("  %s %luKB Last used: %u frames ago\n", m_names[id].c_str(),
+             (unsigned long)(resident[i].first / 1024), m_frame - m_last_used[id]);
+    }
+  }
+  else
+  if (command == CMD_texture_atlas) {
+    printf("Texture atlas - Pages: %lu (%dx%d) Images: %u Used: %.0f%% Uploads: %u\n",
+           (unsigned long)m_atlas.getNumPages(), m_atlas.getPageSize(),
+           m_atlas.getPageSize(), m_atlas.getNumImages(),
+           m_atlas.getUsage() * 100.0f, m_atlas.getNumUploads());
+  }
 }
 
 void TextureManager::contextDestroyed(bool check)
@@ -891,6 +1137,11 @@ void TextureManager::contextDestroyed(bool check)
     }
     m_textures[i] = 0;
   }
+  m_texture_sizes.clear();
+  m_texture_bytes = 0;
+
+  // The atlas keeps its pixels and uploads them again when next used
+  m_atlas.contextDestroyed(check);
 
   SpriteInstanceMap::iterator S = m_sprites.begin();
   SpriteInstanceMap::const_iterator Send = m_sprites.end();
@@ -974,10 +1225,12 @@ void TextureManager::varconf_error_callback(const char *error) {
 
 void TextureManager::readConfig(const varconf::Config &config) {
   m_max_texture_size = readIntValue(config, SECTION_texture, KEY_max_texture_size, DEFAULT_max_texture_size);
+  m_texture_budget = readIntValue(config, SECTION_texture, KEY_texture_budget, DEFAULT_texture_budget) * 1024 * 1024;
 }
 
 void TextureManager::writeConfig(varconf::Config &config) const {
   config.setItem(SECTION_texture, KEY_max_texture_size, m_max_texture_size);
+  config.setItem(SECTION_texture, KEY_texture_budget, (int)(m_texture_budget / (1024 * 1024)));
 }
 
 } /* namespace Sear */
@@ -20,6 +20,8 @@
 #include <varconf/config.h>
 
 #include "RenderTypes.h"
+#include "TextureAtlas.h"
+#include "common/types.h"
 
 struct SDL_Surface;
 /*
@@ -54,6 +56,7 @@ public:
   typedef std::vector<GLuint> TextureVector;
   typedef std::vector<std::string> NameVector;
   typedef std::map<TextureID, int> ReferenceCounter;
+  typedef std::map<GLuint, size_t> TextureSizeMap;
  
   /**
    * Default constructor
@@ -101,6 +104,7 @@ public:
       m_texture_map[name] = texId;
       m_names.push_back(name);
       m_textures.push_back(0);
+      m_last_used.push_back(0);
     } else {
       // Return existing id
       texId = I->second;
@@ -188,6 +192,32 @@ public:
     { return m_spriteConfig; }
     
     void clearLastTexture(unsigned int index);
+
+  /**
+   * Finish the per-frame bind statistics. The counts for the frame just
+   * rendered are kept until the next call. If the loaded textures are over
+   * the memory budget, those not used recently are unloaded.
+   */
+  void endFrame() {
+    m_last_frame_binds = m_frame_binds;
+    m_last_frame_redundant = m_frame_redundant;
+    m_frame_binds = 0;
+    m_frame_redundant = 0;
+    ++m_frame;
+    if (m_texture_budget > 0 && m_texture_bytes > m_texture_budget) {
+      evictTextures();
+    }
+  }
+
+  /**
+   * Set the memory budget for loaded textures.
+   * @param bytes Budget in bytes, or zero for no limit
+   */
+  void setTextureBudget(size_t bytes) { m_texture_budget = bytes; }
+  size_t getTextureBudget() const { return m_texture_budget; }
+
+  unsigned int getLastFrameBinds() const { return m_last_frame_binds; }
+  unsigned int getLastFrameRedundant() const { return m_last_frame_redundant; }
     
   void readConfig(const varconf::Config &config);
   void writeConfig(varconf::Config &config) const;
@@ -196,6 +226,32 @@ public:
   GLuint getTextureObject(TextureID id) const {
     return m_textures[id];
   }
+
+  /**
+   * Read one row of a texture's source image into memory as RGBA colours.
+   * The image is loaded from disk, so no GL context is needed and nothing
+   * is read back from the GPU. Rows are in GL order, row 0 being the first
+   * row uploaded to the texture.
+   * @param texture_name Name of the texture in the texture config
+   * @param row Row of the image to read
+   * @param colours Filled in with one colour per pixel
+   * @return True if the row was read
+   */
+  bool readImageRow(const std::string &texture_name, int row, std::vector<Color_4> &colours);
+
+  /**
+   * The atlas shared by sprites and GUI images.
+   */
+  TextureAtlas &getTextureAtlas() { return m_atlas; }
+
+  /**
+   * Get the place of a texture from the texture config in the atlas, adding
+   * it on first use. Only textures small enough to share a page are added;
+   * the rest should be drawn with switchTexture. Rows are in GL order, as for
+   * loaded textures, so t0 is the bottom of the image.
+   * @return False if the texture is not in the atlas
+   */
+  bool getAtlasRegion(const std::string &texture_name, TextureAtlas::Region &region);
 private:
 
   /** 
@@ -208,6 +264,21 @@ private:
   GLuint loadTexture(const std::string &texture_name);
   GLuint loadTexture(const std::string &texture_name, struct SDL_Surface *surface, bool mask);
 
+  /**
+   * Returns the texture object for the given ID, loading it on first use.
+   */
+  GLuint getLoadedTextureObject(TextureID texture_id);
+
+  /**
+   * Unload the least recently used textures until the estimated memory use
+   * is within budget. Textures used in the last few frames and those not
+   * loaded from the texture config are kept. Unloaded textures are loaded
+   * again on their next use.
+   */
+  void evictTextures();
+
+  void releaseAtlasRegions();
+
   bool m_initialised; ///< Flag indicating whether object has had init called
   bool m_initGL; ///< flag indicating if initGL has been done or not
   int m_texture_counter;
@@ -217,7 +288,7 @@ private:
   TextureMap m_texture_map; ///< Mapping between texture name and its TextureID
   TextureVector m_textures; ///< Used to translate a TextureID to a TextureObject
   NameVector m_names; 
-  std::vector<TextureID> m_last_textures;
+  std::vector<TextureID> m_last_textures; ///< Shadow of the bound texture per unit
   int m_texture_units;
   TextureID m_default_texture;
   TextureID m_default_font;
@@ -225,6 +296,22 @@ private:
 
   int m_baseMipmapLevel;
   int m_max_texture_size;
+
+  unsigned int m_frame_binds; ///< glBindTexture calls this frame
+  unsigned int m_frame_redundant; ///< Binds skipped by the shadow this frame
+  unsigned int m_last_frame_binds;
+  unsigned int m_last_frame_redundant;
+
+  unsigned int m_frame; ///< Count of frames rendered
+  std::vector<unsigned int> m_last_used; ///< Frame each TextureID was last bound
+  TextureSizeMap m_texture_sizes; ///< Estimated size of each loaded texture object
+  size_t m_texture_bytes; ///< Total of m_texture_sizes
+  size_t m_texture_budget; ///< Bytes, zero for no limit
+  unsigned int m_textures_evicted;
+
+  TextureAtlas m_atlas;
+  typedef std::map<std::string, TextureAtlas::Region> AtlasRegionMap;
+  AtlasRegionMap m_atlas_regions; ///< Atlas place of each texture, page -1 if not added
   
   void generalConfigChanged(const std::string &section, const std::string &key, varconf::Config &config);  
 
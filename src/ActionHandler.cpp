@@ -14,6 +14,7 @@
 
 #include "src/System.h"
 #include "src/Console.h"
+#include "src/FileHandler.h"
 #include "src/ScriptEngine.h"
 #include "src/WorldEntity.h"
 
@@ -69,7 +70,7 @@ void ActionHandler::loadConfiguration(const std::string &file_name) {
   // Connect callback to catch errors
   config.sige.connect(sigc::mem_fun(this, &ActionHandler::varconf_error_callback));
   // Read the file
-  config.readFromFile(file_name);
+  System::instance()->getFileHandler()->readConfigFile(config, file_name);
 }
   
 void ActionHandler::handleAction(const std::string &action, WorldEntity *entity) {
@@ -12,8 +12,12 @@
 #include "common/Log.h"
 
 #include "Bindings.h"
+#include "Console.h"
+#include "FileHandler.h"
+#include "System.h"
 
 #include <cassert>
+#include <vector>
 
 #ifdef DEBUG
   static const bool debug = true;
@@ -22,6 +26,11 @@
 #endif
 
 static const std::string KEY_key_bindings = "key_bindings";
+static const std::string KEY_gui_key_bindings = "gui_key_bindings";
+
+static const std::string PREFIX_shift = "shift_";
+static const std::string PREFIX_alt = "alt_";
+static const std::string PREFIX_ctrl = "ctrl_";
 
 namespace Sear {
 
@@ -29,9 +38,135 @@ namespace Sear {
 std::map<int, std::string> Bindings::m_keymap = std::map<int, std::string>();
 varconf::Config *Bindings::m_bindings = NULL;
 
+// Modifier bits of a compiled binding
+static const unsigned int MOD_SHIFT = 1;
+static const unsigned int MOD_ALT = 2;
+static const unsigned int MOD_CTRL = 4;
+static const unsigned int NUM_MODS = 8;
+
+typedef struct {
+  bool has_press; // False for a key bound to nothing
+  bool has_release; // True for "+command" bindings
+  Console::ParsedCommand press;
+  Console::ParsedCommand release;
+} CompiledBinding;
+
+// Each binding set is compiled from its config section into a table with an
+// entry for every keysym and modifier combination, holding an index into
+// s_compiled or -1. Keysyms are small, so the table is indexed directly.
+static std::vector<CompiledBinding> s_compiled;
+static std::vector<int> s_tables[Bindings::NUM_CONTEXTS];
+static bool s_dirty = true;
+
+// Keysyms by their name as cleaned by varconf. Some names clean to the
+// same string, so a name can belong to more than one keysym.
+static std::map<std::string, std::vector<int> > s_keynames;
+
+// Keys taken by keyDown and not yet released, with the release command of
+// the binding that ran. Release uses this rather than looking the key up
+// again, as the modifiers or the binding set may have changed since.
+typedef struct {
+  bool has_release;
+  Console::ParsedCommand release;
+} HeldKey;
+
+static std::map<int, HeldKey> s_held;
+
+// Set by setConsole, otherwise the System's console is used
+static Console *s_console = NULL;
+
+static Console *getConsole() {
+  return (s_console != NULL) ? s_console : System::instance()->getConsole();
+}
+
+static const std::string &contextSection(Bindings::Context context) {
+  return (context == Bindings::CONTEXT_GUI) ? KEY_gui_key_bindings : KEY_key_bindings;
+}
+
+static unsigned int modMask(SDLMod mod) {
+  unsigned int mask = 0;
+  if (mod & KMOD_SHIFT) mask |= MOD_SHIFT;
+  if (mod & KMOD_ALT) mask |= MOD_ALT;
+  if (mod & KMOD_CTRL) mask |= MOD_CTRL;
+  return mask;
+}
+
+// Split a binding name such as "alt_shift_up" into its keysyms and
+// modifiers. The modifiers can be given in any order.
+static bool parseKeyName(std::string name, const std::vector<int> *&syms, unsigned int &mask) {
+  mask = 0;
+  while (true) {
+    std::map<std::string, std::vector<int> >::const_iterator I = s_keynames.find(name);
+    if (I != s_keynames.end()) {
+      syms = &I->second;
+      return true;
+    }
+    if (name.compare(0, PREFIX_shift.size(), PREFIX_shift) == 0) {
+      mask |= MOD_SHIFT;
+      name.erase(0, PREFIX_shift.size());
+    } else if (name.compare(0, PREFIX_alt.size(), PREFIX_alt) == 0) {
+      mask |= MOD_ALT;
+      name.erase(0, PREFIX_alt.size());
+    } else if (name.compare(0, PREFIX_ctrl.size(), PREFIX_ctrl) == 0) {
+      mask |= MOD_CTRL;
+      name.erase(0, PREFIX_ctrl.size());
+    } else {
+      return false;
+    }
+  }
+}
+
+static void compileBindings(varconf::Config &config) {
+  Console *console = getConsole();
+  assert(console != NULL);
+
+  s_compiled.clear();
+  for (int c = 0; c < Bindings::NUM_CONTEXTS; ++c) {
+    std::vector<int> &table = s_tables[c];
+    table.assign(SDLK_LAST * NUM_MODS, -1);
+
+    const std::string &section = contextSection((Bindings::Context)c);
+    if (!config.findSection(section)) continue;
+
+    const varconf::sec_map &sec = config.getSection(section);
+    for (varconf::sec_map::const_iterator I = sec.begin(); I != sec.end(); ++I) {
+      const std::vector<int> *syms = NULL;
+      unsigned int mask = 0;
+      if (!parseKeyName(I->first, syms, mask)) {
+        if (debug) Log::writeLog(std::string("Unknown key in bindings: ") + I->first, Log::LOG_WARNING);
+        continue;
+      }
+
+      const std::string command = (std::string)I->second;
+      CompiledBinding binding;
+      binding.has_press = console->parseCommand(command, binding.press);
+      binding.has_release = (!command.empty() && command[0] == '+') &&
+                 console->parseCommand("-" + command.substr(1), binding.release);
+      s_compiled.push_back(binding);
+
+      for (unsigned int i = 0; i < syms->size(); ++i) {
+        table[(*syms)[i] * NUM_MODS + mask] = s_compiled.size() - 1;
+      }
+    }
+  }
+  s_dirty = false;
+}
+
+static const CompiledBinding *findBinding(varconf::Config &config, const SDL_keysym &key, Bindings::Context context) {
+  if (key.sym <= 0 || key.sym >= SDLK_LAST) return NULL;
+  if (s_dirty) compileBindings(config);
+
+  const std::vector<int> &table = s_tables[context];
+  int index = table[key.sym * NUM_MODS + modMask(key.mod)];
+  // Fall back to the key without modifiers
+  if (index < 0) index = table[key.sym * NUM_MODS];
+  return (index < 0) ? NULL : &s_compiled[index];
+}
+
 void Bindings::init() {
   m_bindings = new varconf::Config(); // Create a new config object to store data in
   initKeyMap(); // Initilise key mappings
+  s_dirty = true;
 }
 
 void Bindings::initKeyMap() {
@@ -172,6 +307,14 @@ void Bindings::initKeyMap() {
   m_keymap[SDLK_MENU] = "menu";
   m_keymap[SDLK_POWER] = "power";
   m_keymap[SDLK_EURO] = "euro";
+
+  // Reverse mapping for compiling bindings
+  s_keynames.clear();
+  for (std::map<int, std::string>::const_iterator I = m_keymap.begin(); I != m_keymap.end(); ++I) {
+    std::string name = I->second;
+    m_bindings->clean(name);
+    s_keynames[name].push_back(I->first);
+  }
 }
 
 void Bindings::shutdown() {
@@ -181,13 +324,19 @@ void Bindings::shutdown() {
   }
 
   m_keymap.clear();
+  s_keynames.clear();
+  s_held.clear();
+  s_compiled.clear();
+  for (int c = 0; c < NUM_CONTEXTS; ++c) s_tables[c].clear();
+  s_dirty = true;
 }
 
 void Bindings::loadBindings(const std::string &file_name, bool user) {
   assert((m_bindings != NULL) && "Bindings config is NULL");
   // Merges key bindings file, file_name with existing contents
-  if (!m_bindings->readFromFile(file_name, (user) ? (varconf::USER) : (varconf::GLOBAL))) 
+  if (!System::instance()->getFileHandler()->readConfigFile(*m_bindings, file_name, (user) ? (varconf::USER) : (varconf::GLOBAL)))
     Log::writeLog(std::string("Error processing ") + file_name, Log::LOG_ERROR);
+  s_dirty = true;
 }
 
 void Bindings::saveBindings(const std::string &file_name) {
@@ -196,10 +345,11 @@ void Bindings::saveBindings(const std::string &file_name) {
   m_bindings->writeToFile(file_name, varconf::USER);
 }
 
-void Bindings::bind(std::string key, std::string command) {
+void Bindings::bind(std::string key, std::string command, Context context) {
   assert((m_bindings != NULL) && "Bindings config is NULL");
   if (key.empty()) return; // Check we were sent a key
-  m_bindings->setItem(KEY_key_bindings, key, command, varconf::USER); // Store new binding
+  m_bindings->setItem(contextSection(context), key, command, varconf::USER); // Store new binding
+  s_dirty = true;
 }
 
 std::string Bindings::idToString(int key) {
@@ -249,5 +399,36 @@ std::string Bindings::getBindingForKeysym(const SDL_keysym& key) {
 //  std::cout << "no binding specified for key " << decoratedName << std::endl;
   return "";
 }
+
+bool Bindings::keyDown(const SDL_keysym &key, Context context) {
+  assert((m_bindings != NULL) && "Bindings config is NULL");
+  const CompiledBinding *binding = findBinding(*m_bindings, key, context);
+  if (binding == NULL) return false;
+
+  HeldKey &held = s_held[key.sym];
+  held.has_release = binding->has_release;
+  if (binding->has_release) held.release = binding->release;
+
+  if (binding->has_press) getConsole()->runCommand(binding->press);
+  return true;
+}
+
+bool Bindings::keyUp(const SDL_keysym &key) {
+  std::map<int, HeldKey>::iterator I = s_held.find(key.sym);
+  if (I == s_held.end()) return false;
+  // Copied out, as the command may press or release keys itself
+  const HeldKey held = I->second;
+  s_held.erase(I);
+  if (held.has_release) getConsole()->runCommand(held.release);
+  return true;
+}
+
+void Bindings::setConsole(Console *console) {
+  s_console = console;
+  // Release commands of held keys belong to the old console
+  s_held.clear();
+  // Commands are looked up on the console when compiled
+  s_dirty = true;
+}
   
 }
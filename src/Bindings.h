@@ -27,11 +27,25 @@ namespace varconf {
  */ 
 namespace Sear {
 
+class Console;
+
 /**
  * This class maintains the mappings between keys and functions.
+ * A binding is for one key, optionally with shift, alt and ctrl. Chords of
+ * several ordinary keys are not supported, as pressing keys together
+ * already runs each of their bindings, which movement relies on.
  */ 
 class Bindings {
 public:
+  /**
+   * Which set of bindings a key event is looked up in.
+   */
+  typedef enum {
+    CONTEXT_WORLD = 0, ///< key_bindings, used in game
+    CONTEXT_GUI,       ///< gui_key_bindings, used while the console or a widget has the keyboard
+    NUM_CONTEXTS
+  } Context;
+
   /**
    * Resets key bindings back to initial conditions
    */ 	
@@ -59,8 +73,9 @@ public:
    * Assigns command to the key key_id
    * @param key_id Key identifier string
    * @param command Command string
+   * @param context Binding set to add the binding to
    */ 
-  static void bind(std::string key_id, std::string command);
+  static void bind(std::string key_id, std::string command, Context context = CONTEXT_WORLD);
 
   /*
    * Returns the string representation from given SDL key id
@@ -79,6 +94,33 @@ public:
     /** returns the string bound to a given SDL keysym */
   static std::string getBindingForKeysym(const SDL_keysym& sym);
 
+  /**
+   * Run the command bound to a key press. The binding for the key with its
+   * shift, alt and ctrl modifiers is used, or the binding for the key alone
+   * if there is none.
+   * @param key Key pressed
+   * @param context Binding set to use
+   * @return True if the key is bound in the set, even to nothing
+   */
+  static bool keyDown(const SDL_keysym &key, Context context);
+
+  /**
+   * Run the release command for a key whose press ran a "+command", which
+   * is the same command starting with "-". The binding used is the one
+   * that ran when the key was pressed, whatever the modifiers and binding
+   * set are now.
+   * @param key Key released
+   * @return True if the key was taken when it was pressed
+   */
+  static bool keyUp(const SDL_keysym &key);
+
+  /**
+   * Run bound commands on the given console instead of the System's, so
+   * key handling can be checked without starting the client. NULL goes
+   * back to the System's console.
+   */
+  static void setConsole(Console *console);
+
   /*
    * Return the pointer to the varconf object storing all the bindings.
    * @return Varconf pointer
@@ -1,21 +1,27 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2001 - 2006 Simon Goodall
+// Copyright (C) 2001 - 2009 Simon Goodall
 
 // $Id: CacheManager.cpp,v 1.6 2006-04-26 14:39:00 simon Exp $
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <cassert>
+#include <algorithm>
 
-#ifdef __WIN32__
-  #include <direct.h>
-#endif
+#include <dirent.h>
+
+#include <sigc++/object_slot.h>
+#include <varconf/varconf.h>
+#include <zlib.h>
 
 #include "src/System.h"
+#include "src/Console.h"
 #include "src/FileHandler.h"
+#include "common/MutexLock.h"
 
 #include "CacheManager.h"
-#include "CacheObject.h"
 
 #ifdef DEBUG
   static const bool debug = true;
@@ -25,13 +31,83 @@
 
 namespace Sear {
 
-static const std::string KEY_CACHE = "cache";
 static const std::string CACHE_PATH = "/cache/";
 static const std::string CACHE_FILE = "cache.vconf";
 
+static const std::string SECTION_cache = "cache";
+static const std::string SECTION_settings = "settings";
+static const std::string KEY_size_limit = "size_limit";
+static const std::string KEY_use_counter = "use_counter";
+
+static const std::string ENTRY_EXT = ".bin";
+static const std::string TEMP_EXT = ".tmp";
+
+// Default size limit in MB
+static const int DEFAULT_size_limit = 64;
+
+static const std::string CMD_cache_stats = "cache_stats";
+static const std::string CMD_cache_clear = "cache_clear";
+static const std::string CMD_cache_limit = "cache_limit";
+
+static const char ENTRY_MAGIC[8] = { 'S', 'E', 'A', 'R', 'C', 'A', 'C', 'H' };
+static const uint32_t ENTRY_FORMAT = 1;
+
+typedef struct {
+  char magic[8];
+  uint32_t format;
+  uint32_t crc;  ///< crc32 of the data
+  uint64_t key;
+  uint64_t size; ///< Size of the data following the header
+} EntryHeader;
+
+static std::string keyToString(CacheManager::Key key) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)key);
+  return buf;
+}
+
+static bool stringToKey(const std::string &str, CacheManager::Key &key) {
+  if (str.size() != 16) return false;
+  char *end = NULL;
+  key = strtoull(str.c_str(), &end, 16);
+  return (end != NULL && *end == '\0');
+}
+
+static bool hasSuffix(const std::string &str, const std::string &suffix) {
+  return str.size() > suffix.size()
+      && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool renameFile(const std::string &from, const std::string &to) {
+#ifdef __WIN32__
+  // rename will not replace an existing file on Win32
+  ::remove(to.c_str());
+#endif
+  return (rename(from.c_str(), to.c_str()) == 0);
+}
+
 CacheManager CacheManager::m_instance;
 
+CacheManager::CacheManager() :
+  m_initialised(false),
+  m_mutex(SDL_CreateMutex()),
+  m_size(0),
+  m_size_limit((uint64_t)DEFAULT_size_limit * 1024 * 1024),
+  m_use_counter(0),
+  m_hits(0),
+  m_misses(0),
+  m_writes(0),
+  m_evictions(0),
+  m_corrupt(0)
+{}
+
+CacheManager::~CacheManager() {
+  if (m_initialised) shutdown();
+  SDL_DestroyMutex(m_mutex);
+}
+
 int CacheManager::init() {
+  MutexLock lock(m_mutex);
   assert(m_initialised == false);
 
   FileHandler *fh = System::instance()->getFileHandler();
@@ -39,20 +115,19 @@ int CacheManager::init() {
   assert(fh != NULL);
 
   // Cache path name
-  std::string c_path = fh->getUserDataPath() + CACHE_PATH;
+  m_path = fh->getUserDataPath() + CACHE_PATH;
 
   // Check if path exists
-  if (!fh->exists(c_path)) {
+  if (!fh->exists(m_path)) {
     printf("Creating Cache Directory.\n");
-    fh->mkdir(c_path);
+    fh->mkdir(m_path);
   }
 
-  // Load cache data file
-  if (fh->exists(c_path + CACHE_FILE)) {
-    if (!m_cache.readFromFile(c_path + CACHE_FILE)) {
-      fprintf(stderr, "Error reading cache config file.\n");
-    }
-  }
+  readIndex();
+  removeOrphans();
+  evict();
+
+  if (debug) printf("[CacheManager] %lu entries using %lu bytes\n", (unsigned long)m_entries.size(), (unsigned long)m_size);
 
   m_initialised = true;
 
@@ -60,129 +135,334 @@ int CacheManager::init() {
 }
 
 int CacheManager::shutdown() {
+  MutexLock lock(m_mutex);
   assert(m_initialised == true);
 
-  std::string c_path = System::instance()->getFileHandler()->getUserDataPath()
-                       + CACHE_PATH;
-  // Save cache data file
-  m_cache.writeToFile(c_path + CACHE_FILE);
+  writeIndex();
 
-  // Clean up types list
-  while (!m_types.empty()) {
-    assert( m_types.begin()->second != NULL);
-    delete m_types.begin()->second;
-    m_types.erase(m_types.begin());
-  }
+  m_entries.clear();
+  m_size = 0;
 
   m_initialised = false;
 
   return 0;
 }
 
-/** 
- * Check to see if filename is in cache
- */ 
-bool CacheManager::inCache(const std::string &filename) {
-  assert(m_initialised == true);
+bool CacheManager::isInitialised() const {
+  MutexLock lock(m_mutex);
+  return m_initialised;
+}
 
-  return m_cache.findItem(KEY_CACHE, filename);
+uint64_t CacheManager::getSizeLimit() const {
+  MutexLock lock(m_mutex);
+  return m_size_limit;
 }
 
-/**
- * Load object from cache
- */
-CacheObject* CacheManager::loadObject(const std::string &filename) {
-  assert(m_initialised == true);
-  // Check to see if object is in cache
-  if (!inCache(filename)) {
-    fprintf(stderr, "Object not in cache (%s).\n", filename.c_str());
-    return NULL;
+uint64_t CacheManager::getSize() const {
+  MutexLock lock(m_mutex);
+  return m_size;
+}
+
+CacheManager::Key CacheManager::makeKey(const std::string &kind, unsigned int version) {
+  // 64 bit FNV-1a offset basis
+  Key key = 14695981039346656037ULL;
+  key = addToKey(key, kind.data(), kind.size());
+  key = addToKey(key, &version, sizeof(version));
+  return key;
+}
+
+CacheManager::Key CacheManager::addToKey(Key key, const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    key ^= p[i];
+    key *= 1099511628211ULL;
   }
-  // Get filename of cached object
-  std::string cache_name = m_cache.getItem(KEY_CACHE, filename);
+  return key;
+}
+
+bool CacheManager::addFileToKey(Key &key, const std::string &filename) {
+  std::vector<char> data;
+  if (!System::instance()->getFileHandler()->readFile(filename, data)) return false;
+  // Mix in the size too, so moving bytes between files changes the key
+  const uint64_t size = data.size();
+  key = addToKey(key, &size, sizeof(size));
+  if (!data.empty()) key = addToKey(key, &data[0], data.size());
+  return true;
+}
+
+std::string CacheManager::entryFilename(Key key) const {
+  return m_path + keyToString(key) + ENTRY_EXT;
+}
 
-  // Read header info
-  int type = CacheObject::getTypeID(filename);
+bool CacheManager::get(Key key, std::vector<char> &data) {
+  // The entry file is read under the lock too, so it cannot be evicted
+  // part way through.
+  MutexLock lock(m_mutex);
+  if (!m_initialised) return false;
 
-  // Check loader exists
-  if (m_types.find(type) == m_types.end()) {
-    fprintf(stderr, "Unknown cache object type: %d\n", type);
-    return NULL;
+  EntryMap::iterator I = m_entries.find(key);
+  if (I == m_entries.end()) {
+    ++m_misses;
+    return false;
   }
 
-  // Create Cache Object of correct type
-  CacheObject *obj = m_types[type]->newInstance();
+  const std::string &filename = entryFilename(key);
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) {
+    // Removed behind our back
+    ++m_misses;
+    m_size -= I->second.size;
+    m_entries.erase(I);
+    return false;
+  }
 
-  assert(obj != NULL);
+  EntryHeader header;
+  bool ok = (fread(&header, sizeof(header), 1, fp) == 1)
+         && memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0
+         && header.format == ENTRY_FORMAT
+         && header.key == key
+         && header.size == I->second.size;
+  if (ok) {
+    data.resize(header.size);
+    if (header.size > 0) {
+      ok = (fread(&data[0], header.size, 1, fp) == 1);
+    }
+  }
+  if (ok) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    if (!data.empty()) {
+      crc = crc32(crc, reinterpret_cast<const Bytef*>(&data[0]), data.size());
+    }
+    ok = ((uint32_t)crc == header.crc);
+  }
+  fclose(fp);
+
+  if (!ok) {
+    fprintf(stderr, "[CacheManager] Removing corrupt entry %s\n", filename.c_str());
+    ++m_corrupt;
+    ++m_misses;
+    data.clear();
+    removeEntry(I);
+    return false;
+  }
+
+  ++m_hits;
+  I->second.last_used = ++m_use_counter;
+  return true;
+}
 
-  // Load object if possible
-  if (obj->load(cache_name)) {
-    fprintf(stderr, "Error loading cache object: %s\n", cache_name.c_str());
-    delete obj;
-    obj = NULL;
+bool CacheManager::put(Key key, const std::vector<char> &data) {
+  MutexLock lock(m_mutex);
+  if (!m_initialised) return false;
+
+  // Do not let one entry flush the whole cache
+  if (data.size() > m_size_limit / 4) return false;
+
+  EntryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+  header.format = ENTRY_FORMAT;
+  header.key = key;
+  header.size = data.size();
+  uLong crc = crc32(0L, Z_NULL, 0);
+  if (!data.empty()) {
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(&data[0]), data.size());
+  }
+  header.crc = crc;
+
+  // Write to a temporary file and rename it into place so a crash never
+  // leaves a partial entry under the real name.
+  const std::string &filename = entryFilename(key);
+  const std::string &tmp_filename = m_path + keyToString(key) + TEMP_EXT;
+  FILE *fp = fopen(tmp_filename.c_str(), "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "[CacheManager] Unable to create %s\n", tmp_filename.c_str());
+    return false;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+  if (ok && !data.empty()) {
+    ok = (fwrite(&data[0], data.size(), 1, fp) == 1);
+  }
+  if (fclose(fp) != 0) ok = false;
+  if (ok) ok = renameFile(tmp_filename, filename);
+  if (!ok) {
+    fprintf(stderr, "[CacheManager] Error writing %s\n", filename.c_str());
+    ::remove(tmp_filename.c_str());
+    return false;
   }
 
-  return obj;
+  EntryMap::iterator I = m_entries.find(key);
+  if (I != m_entries.end()) m_size -= I->second.size;
+
+  Entry &e = m_entries[key];
+  e.size = data.size();
+  e.last_used = ++m_use_counter;
+  m_size += e.size;
+  ++m_writes;
+
+  evict();
+  return true;
 }
 
-/**
- * Add object to cache
- */ 
-int CacheManager::add(CacheObject *obj, const std::string &filename) {
-  assert(m_initialised == true);
-  assert(System::instance()->getFileHandler() != NULL);
+void CacheManager::remove(Key key) {
+  MutexLock lock(m_mutex);
+  EntryMap::iterator I = m_entries.find(key);
+  if (I != m_entries.end()) removeEntry(I);
+}
 
-  std::string c_path = System::instance()->getFileHandler()->getUserDataPath()
-                       + CACHE_PATH;
+void CacheManager::removeEntry(EntryMap::iterator I) {
+  ::remove(entryFilename(I->first).c_str());
+  m_size -= I->second.size;
+  m_entries.erase(I);
+}
 
-  // Check if object is already in cache
-  if (inCache(filename)) {
-    fprintf(stderr, "Object already cached.\n");
-    return 1;
+void CacheManager::clear() {
+  MutexLock lock(m_mutex);
+  if (!m_initialised) return;
+  while (!m_entries.empty()) {
+    removeEntry(m_entries.begin());
   }
+  // Catch anything the index did not know about
+  removeOrphans();
+  writeIndex();
+}
 
-  // Get new cache name
-  std::string name = c_path + "objectXXXXXX";
+void CacheManager::setSizeLimit(uint64_t bytes) {
+  MutexLock lock(m_mutex);
+  m_size_limit = bytes;
+  evict();
+}
 
-  // Convert to character array for mktemp function
-  char cache_name[name.size()];
-  memcpy(cache_name, name.c_str(), name.size());
+void CacheManager::evict() {
+  if (m_size <= m_size_limit) return;
 
-#if(0)
-  // TODO Re-think this method so it is safe
-  // Currently disable as it is not used and generated warnings.
-  // Generate unique unused filename
-  if (!mktemp(cache_name)) {
-    fprintf(stderr, "Error generating cache name.\n");
-    return 1;
+  // Oldest first
+  std::vector<std::pair<unsigned int, Key> > order;
+  order.reserve(m_entries.size());
+  EntryMap::const_iterator I = m_entries.begin();
+  EntryMap::const_iterator Iend = m_entries.end();
+  for (; I != Iend; ++I) {
+    order.push_back(std::make_pair(I->second.last_used, I->first));
   }
-#endif
-  // Save object
-  if (obj->save(cache_name)) {
-    fprintf(stderr, "Error saving cache object.\n");
-    return 1;
+  std::sort(order.begin(), order.end());
+
+  for (size_t i = 0; i < order.size() && m_size > m_size_limit; ++i) {
+    removeEntry(m_entries.find(order[i].second));
+    ++m_evictions;
   }
+}
 
-  // Add record to cache
-  m_cache.setItem(KEY_CACHE, filename, cache_name);
+void CacheManager::readIndex() {
+  const std::string &filename = m_path + CACHE_FILE;
+  if (!System::instance()->getFileHandler()->exists(filename)) return;
 
-  return 0;
+  varconf::Config index;
+  index.sigsv.connect(sigc::mem_fun(this, &CacheManager::varconf_callback));
+  index.sige.connect(sigc::mem_fun(this, &CacheManager::varconf_error_callback));
+  if (!index.readFromFile(filename)) {
+    fprintf(stderr, "[CacheManager] Error reading cache index.\n");
+  }
 }
 
-int CacheManager::addType(CacheObject *obj) {
-  assert(m_initialised == true);
-  assert(obj != NULL);
-  // Add to types if it does not exist
-  // Creates new instance
-  // Error otherwise
-  if (m_types.find(obj->getType()) == m_types.end()) {
-    m_types[obj->getType()] = obj->newInstance();
-  } else {
-    fprintf(stderr, "CacheObject of type %d already exists.\n", obj->getType());
-    return 1;
+void CacheManager::varconf_callback(const std::string &section, const std::string &key, varconf::Config &config) {
+  if (section == SECTION_settings) {
+    if (key == KEY_size_limit) {
+      const int limit = (int)config.getItem(section, key);
+      if (limit > 0) m_size_limit = (uint64_t)limit * 1024 * 1024;
+    } else if (key == KEY_use_counter) {
+      m_use_counter = (int)config.getItem(section, key);
+    }
+  } else if (section == SECTION_cache) {
+    // Entries are stored as e<key> = "<size> <last used>"
+    Key k;
+    if (key.size() < 2 || !stringToKey(key.substr(1), k)) return;
+    unsigned long long size = 0;
+    unsigned int last_used = 0;
+    const std::string &value = (std::string)config.getItem(section, key);
+    if (sscanf(value.c_str(), "%llu %u", &size, &last_used) != 2) return;
+
+    // Make sure the entry is really there
+    if (!System::instance()->getFileHandler()->exists(entryFilename(k))) return;
+
+    EntryMap::iterator I = m_entries.find(k);
+    if (I != m_entries.end()) m_size -= I->second.size;
+    Entry &e = m_entries[k];
+    e.size = size;
+    e.last_used = last_used;
+    m_size += size;
   }
-  return 0;
 }
 
-} /* namespace Sear */
+void CacheManager::varconf_error_callback(const char *message) {
+  fprintf(stderr, "[CacheManager] %s\n", message);
+}
+
+void CacheManager::writeIndex() {
+  varconf::Config index;
+  index.setItem(SECTION_settings, KEY_size_limit, (int)(m_size_limit / (1024 * 1024)));
+  index.setItem(SECTION_settings, KEY_use_counter, (int)m_use_counter);
+
+  EntryMap::const_iterator I = m_entries.begin();
+  EntryMap::const_iterator Iend = m_entries.end();
+  for (; I != Iend; ++I) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%llu %u", (unsigned long long)I->second.size, I->second.last_used);
+    index.setItem(SECTION_cache, "e" + keyToString(I->first), std::string(buf));
+  }
+
+  const std::string &filename = m_path + CACHE_FILE;
+  const std::string &tmp_filename = filename + TEMP_EXT;
+  if (!index.writeToFile(tmp_filename) || !renameFile(tmp_filename, filename)) {
+    fprintf(stderr, "[CacheManager] Error writing cache index.\n");
+  }
+}
+
+void CacheManager::removeOrphans() {
+  // Remove partial writes, and entries missing from the index after a crash
+  DIR *dir = opendir(m_path.c_str());
+  if (dir == NULL) return;
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    const std::string name = de->d_name;
+    Key key;
+    if (hasSuffix(name, TEMP_EXT)) {
+      ::remove((m_path + name).c_str());
+    } else if (hasSuffix(name, ENTRY_EXT)
+            && stringToKey(name.substr(0, name.size() - ENTRY_EXT.size()), key)
+            && m_entries.find(key) == m_entries.end()) {
+      ::remove((m_path + name).c_str());
+    }
+  }
+  closedir(dir);
+}
+
+void CacheManager::registerCommands(Console *console) {
+  console->registerCommand(CMD_cache_stats, this);
+  console->registerCommand(CMD_cache_clear, this);
+  console->registerCommand(CMD_cache_limit, this);
+}
+
+void CacheManager::runCommand(const std::string &command, const std::string &args) {
+  if (command == CMD_cache_stats) {
+    MutexLock lock(m_mutex);
+    printf("Cache - Entries: %lu Size: %lu KB Limit: %lu KB\n",
+           (unsigned long)m_entries.size(),
+           (unsigned long)(m_size / 1024),
+           (unsigned long)(m_size_limit / 1024));
+    printf("Cache - Hits: %u Misses: %u Writes: %u Evictions: %u Corrupt: %u\n",
+           m_hits, m_misses, m_writes, m_evictions, m_corrupt);
+  }
+  else if (command == CMD_cache_clear) {
+    clear();
+  }
+  else if (command == CMD_cache_limit) {
+    const int limit = atoi(args.c_str());
+    if (limit > 0) {
+      setSizeLimit((uint64_t)limit * 1024 * 1024);
+    } else {
+      printf("Usage: %s <size in MB>\n", CMD_cache_limit.c_str());
+    }
+  }
+}
 
+} /* namespace Sear */
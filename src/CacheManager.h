@@ -1,61 +1,96 @@
 // This file may be redistributed and modified only under the terms of
 // the GNU General Public License (See COPYING for details).
-// Copyright (C) 2001 - 2006 Simon Goodall
+// Copyright (C) 2001 - 2009 Simon Goodall
 
 #ifndef SEAR_CACHEMANAGER_H
 #define SEAR_CACHEMANAGER_H 1
 
 #include <string>
 #include <map>
+#include <vector>
+#include <inttypes.h>
 
+#include <SDL/SDL.h>
+
+#include <sigc++/trackable.h>
 #include <varconf/config.h>
 
-namespace Sear {
+#include "interfaces/ConsoleObject.h"
 
-class CacheObject;
+namespace Sear {
 
-class CacheManager {
+class Console;
+
+/**
+ * The CacheManager stores derived data, such as decoded images and
+ * processed meshes, in the user's cache directory so it need not be rebuilt
+ * each run. Entries are keyed by a hash of everything they were built from,
+ * the source file contents and a processing version, so a changed source or
+ * a new version of the processing code misses the cache rather than
+ * returning stale data.
+ *
+ * Entries are written to a temporary file and renamed into place, and carry
+ * a checksum that is checked on every read. The cache is kept within a size
+ * limit by evicting the least recently used entries.
+ *
+ * All methods may be called from any thread.
+ */
+class CacheManager : public ConsoleObject, public sigc::trackable {
 public:
-  CacheManager() :
-    m_initialised(false)
-  {}
-  virtual ~CacheManager() {
-    if (m_initialised) shutdown();
-  }
+  typedef uint64_t Key;
+
+  CacheManager();
+  virtual ~CacheManager();
 
   int init();
   int shutdown();
+  bool isInitialised() const;
 
-  /** 
-   * Check to see if filename is in cache
-   * @param filename Filename o f cache object
-   * @return True if object is in cache
-   */ 
-  bool inCache(const std::string &filename);
+  /**
+   * Start a key for a type of data. Bump the version whenever the way the
+   * data is produced changes.
+   * @param kind Name of the type of data, e.g. "texture"
+   * @param version Processing version
+   */
+  static Key makeKey(const std::string &kind, unsigned int version);
 
   /**
-   * Load object from cache
-   * @param filenameFilename of Cache Object
-   * @return Pointer to Cache Object, NULL on error
+   * Mix some data into a key.
    */
-  CacheObject* loadObject(const std::string &filename);
+  static Key addToKey(Key key, const void *data, size_t size);
 
   /**
-   * Add object to cache
-   * @param obj Pointer to Cache Object
-   * @param filename Filename to index cache object by
-   * @return o on success, 1 on failure
-   */ 
-  int add(CacheObject *obj, const std::string &filename);
+   * Mix the contents of a file into a key. The file is read through the
+   * FileHandler, so archived files work.
+   * @return False if the file could not be read
+   */
+  static bool addFileToKey(Key &key, const std::string &filename);
 
   /**
-   * Add a new Cache Object to CacheManger. The Type number is matched against 
-   * the cacheobject header to determine how to load it. obj is copied using 
-   * obj->newInstance, so it can safely be deleted after adding
-   * @param obj Pointer to cache object
-   * @return 0 on success, 1 on failure
+   * Fetch an entry.
+   * @return True if the entry was found and passed its integrity check
    */
-  int addType(CacheObject *obj);
+  bool get(Key key, std::vector<char> &data);
+
+  /**
+   * Store an entry, replacing any existing one with the same key.
+   * @return True on success
+   */
+  bool put(Key key, const std::vector<char> &data);
+
+  void remove(Key key);
+
+  /**
+   * Remove all entries.
+   */
+  void clear();
+
+  void setSizeLimit(uint64_t bytes);
+  uint64_t getSizeLimit() const;
+  uint64_t getSize() const;
+
+  void registerCommands(Console *console);
+  void runCommand(const std::string &command, const std::string &args);
 
   /**
    * Get the singleton instance of this class
@@ -64,12 +99,34 @@ public:
   static CacheManager &getInstance() { return m_instance; }
 
 private:
+  typedef struct {
+    uint64_t size;
+    unsigned int last_used; ///< Value of m_use_counter when last used
+  } Entry;
+  typedef std::map<Key, Entry> EntryMap;
+
+  std::string entryFilename(Key key) const;
+  void removeEntry(EntryMap::iterator I);
+  void evict();
+  void readIndex();
+  void writeIndex();
+  void removeOrphans();
+
+  void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
+  void varconf_error_callback(const char *message);
+
   bool m_initialised; // Flag indication initialisation status
   static CacheManager m_instance; // Global instance of class
 
-  std::map<int, CacheObject *> m_types; // Storage for different cache object
-                                        // types
-  varconf::Config m_cache; // Varconf object storing cache data
+  SDL_mutex *m_mutex; ///< Protects everything below
+
+  std::string m_path; ///< Cache directory
+  EntryMap m_entries;
+  uint64_t m_size; ///< Total size of all entries
+  uint64_t m_size_limit;
+  unsigned int m_use_counter;
+
+  unsigned int m_hits, m_misses, m_writes, m_evictions, m_corrupt;
 };
 
 } /* namespace Sear */
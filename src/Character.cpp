@@ -57,6 +57,13 @@ static std::string getNameOrType(Sear::WorldEntity *we) {
 
 static const unsigned int server_update_interval = 500;
 
+// Corrections from the server are blended in over about this time (ms)
+static const float correction_time = 250.0f;
+// Corrections larger than this are applied at once
+static const float correction_snap_distance = 4.0f;
+// Once stopped within this distance of the server position we use it again
+static const float reconcile_distance = 0.05f;
+
 // Config section  names
 static const std::string SECTION_character = "character";
 // Config key names
@@ -89,6 +96,7 @@ Character::Character() :
   m_strafe_speed(0.0f),
   m_lastUpdate(SDL_GetTicks()),
   m_time(0),
+  m_has_pred_pos(false),
   m_run_modifier(false),
   m_initialised(false),
   m_refresh_orient(true)
@@ -222,7 +230,43 @@ void Character::updateLocals(bool send_to_server) {
   // Rotate velocity to current heading
   vel = vel.rotate(m_pred_orient);
 
-  dynamic_cast<WorldEntity*>(m_self.get())->setLocalOrient(m_pred_orient);
+  WorldEntity *self = dynamic_cast<WorldEntity*>(m_self.get());
+  self->setLocalOrient(m_pred_orient);
+
+  // Predict our own position from the velocity we are asking for, and
+  // blend in any correction from the server.
+  const bool moving = (x_mod_speed != 0.0f || y_mod_speed != 0.0f || m_up_speed != 0.0f);
+  if (!m_has_pred_pos) {
+    // Standing still, the server position is good enough
+    if (moving) {
+      m_pred_pos = self->getPredictedPos();
+      m_pred_error = WFMath::Vector<3>(0.0f, 0.0f, 0.0f);
+      m_moves.clear();
+      m_has_pred_pos = m_pred_pos.isValid();
+    }
+  } else {
+    const float dt = (ticks - m_time) / 1000.0f;
+    const float f = 1.0f - expf(-(float)(ticks - m_time) / correction_time);
+    m_pred_pos += vel * dt + m_pred_error * f;
+    m_pred_error *= (1.0f - f);
+  }
+  if (m_has_pred_pos) {
+    // Walk over the terrain rather than through it
+    self->clampToTerrain(m_pred_pos);
+
+    // Hand back to the server position once we have stopped and caught up
+    // with it. Height is left out as it comes from the terrain anyway.
+    const WFMath::Point<3> server_pos = self->getPredictedPos();
+    if (!moving && server_pos.isValid() &&
+        square(server_pos.x() - m_pred_pos.x()) + square(server_pos.y() - m_pred_pos.y())
+          < square(reconcile_distance)) {
+      m_has_pred_pos = false;
+      m_moves.clear();
+      self->clearLocalPos();
+    } else {
+      self->setLocalPos(m_pred_pos);
+    }
+  }
 
   // If there is anything to rotate, do so
   if (fabs(a) > 0.000001f) {
@@ -245,6 +289,7 @@ void Character::updateLocals(bool send_to_server) {
     if (send || send_to_server) {
 //      printf("MoveOp: %f, %f, %f\n", vel.x(), vel.y(), vel.z());
       updateMove(vel, m_pred_orient);
+      m_moves.addMove(ticks, vel);
       m_lastUpdate = ticks;
 
       oldOrient = m_pred_orient;
@@ -584,6 +629,9 @@ void Character::onLocationChanged(Eris::Entity *loc) {
   // Location changed, get the new orientation when the Moved
   // signal fires.
   m_refresh_orient = true;
+  // Our prediction is relative to the old location
+  m_has_pred_pos = false;
+  m_moves.clear();
 }
 
 void Character::onMoved() {
@@ -594,6 +642,26 @@ void Character::onMoved() {
     
     m_refresh_orient = false;
   }
+
+  // Reconcile our predicted position with where the server says we are.
+  // The server may not have acted on our latest requests yet, so they are
+  // replayed on top of its position, and only what is left over is
+  // treated as an error.
+  if (m_has_pred_pos) {
+    WorldEntity *we = dynamic_cast<WorldEntity*>(m_self.get());
+    WFMath::Point<3> server_pos = m_moves.reconcile(System::instance()->getTime(),
+                                   we->getPredictedPos(), we->getVelocity());
+    if (server_pos.isValid()) {
+      we->clampToTerrain(server_pos);
+      const WFMath::Vector<3> error = server_pos - m_pred_pos;
+      if (error.mag() > correction_snap_distance) {
+        m_pred_pos = server_pos;
+        m_pred_error = WFMath::Vector<3>(0.0f, 0.0f, 0.0f);
+      } else {
+        m_pred_error = error;
+      }
+    }
+  }
 }
 
 void Character::renameEntity(Eris::Entity *e, const std::string &name) {
@@ -10,6 +10,7 @@
 #include <wfmath/quaternion.h>
 #include <Eris/EntityRef.h>
 #include <sigc++/trackable.h>
+#include "MoveHistory.h"
 
 namespace Atlas {
   namespace Message {
@@ -143,7 +144,10 @@ private:
   float m_strafe_speed;
 
   WFMath::Quaternion m_pred_orient;
-  WFMath::Point<3> m_pred_pos;
+  WFMath::Point<3> m_pred_pos; ///< Locally predicted position
+  WFMath::Vector<3> m_pred_error; ///< Server correction still to be applied
+  MoveHistory m_moves; ///< Requests the server has not acted on yet
+  bool m_has_pred_pos;
 
   unsigned int m_lastUpdate;
 
@@ -0,0 +1,189 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cassert>
+
+#include "CommandTable.h"
+
+namespace Sear {
+
+static const size_t INITIAL_INDEX_SIZE = 256;
+
+const CommandTable::CommandID CommandTable::INVALID_COMMAND;
+
+CommandTable::CommandTable() {
+  clear();
+}
+
+unsigned int CommandTable::hash(const std::string &name) {
+  // FNV-1a
+  unsigned int h = 2166136261u;
+  for (std::string::size_type i = 0; i < name.size(); ++i) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void CommandTable::rehash(size_t size) {
+  m_index.assign(size, INVALID_COMMAND);
+  const size_t mask = size - 1;
+  for (size_t id = 0; id < m_commands.size(); ++id) {
+    size_t slot = m_commands[id].hash & mask;
+    while (m_index[slot] != INVALID_COMMAND) slot = (slot + 1) & mask;
+    m_index[slot] = id;
+  }
+}
+
+CommandTable::CommandID CommandTable::add(const std::string &name,
+                                          ConsoleObject *object) {
+  assert(!name.empty());
+  assert(find(name) == INVALID_COMMAND);
+
+  const CommandID id = m_commands.size();
+  Command command;
+  command.name = name;
+  command.object = object;
+  command.hash = hash(name);
+  m_commands.push_back(command);
+
+  // Keep the index at most half full so probe sequences stay short
+  if (m_commands.size() * 2 > m_index.size()) {
+    rehash(m_index.size() * 2);
+  } else {
+    const size_t mask = m_index.size() - 1;
+    size_t slot = command.hash & mask;
+    while (m_index[slot] != INVALID_COMMAND) slot = (slot + 1) & mask;
+    m_index[slot] = id;
+  }
+
+  // Add the name to the trie
+  int node = 0;
+  for (std::string::size_type i = 0; i <= name.size(); ++i) {
+    Node &n = m_nodes[node];
+    ++n.count;
+    if (n.first == INVALID_COMMAND || name < m_commands[n.first].name) {
+      n.first = id;
+    }
+    if (i == name.size()) {
+      n.command = id;
+      break;
+    }
+
+    // Find or insert the child for the next character, keeping the
+    // children sorted
+    const char c = name[i];
+    int *link = &m_nodes[node].child;
+    while (*link != -1 && m_nodes[*link].c < c) {
+      link = &m_nodes[*link].sibling;
+    }
+    if (*link == -1 || m_nodes[*link].c != c) {
+      Node child;
+      child.c = c;
+      child.child = -1;
+      child.sibling = *link;
+      child.count = 0;
+      child.command = INVALID_COMMAND;
+      child.first = INVALID_COMMAND;
+      // Adding the node may move the vector, so store the index first
+      const int index = m_nodes.size();
+      *link = index;
+      m_nodes.push_back(child);
+      node = index;
+    } else {
+      node = *link;
+    }
+  }
+
+  return id;
+}
+
+CommandTable::CommandID CommandTable::find(const std::string &name) const {
+  const unsigned int h = hash(name);
+  const size_t mask = m_index.size() - 1;
+  size_t slot = h & mask;
+  while (m_index[slot] != INVALID_COMMAND) {
+    const Command &command = m_commands[m_index[slot]];
+    if (command.hash == h && command.name == name) return m_index[slot];
+    slot = (slot + 1) & mask;
+  }
+  return INVALID_COMMAND;
+}
+
+int CommandTable::findNode(const std::string &prefix) const {
+  int node = 0;
+  for (std::string::size_type i = 0; i < prefix.size(); ++i) {
+    const char c = prefix[i];
+    node = m_nodes[node].child;
+    while (node != -1 && m_nodes[node].c < c) node = m_nodes[node].sibling;
+    if (node == -1 || m_nodes[node].c != c) return -1;
+  }
+  return node;
+}
+
+CommandTable::CommandID CommandTable::resolve(const std::string &name,
+                                              unsigned int &matches) const {
+  const int node = findNode(name);
+  if (node == -1) {
+    matches = 0;
+    return INVALID_COMMAND;
+  }
+  const Node &n = m_nodes[node];
+  matches = n.count;
+  if (n.command != INVALID_COMMAND) return n.command;
+  if (n.count == 1) return n.first;
+  return INVALID_COMMAND;
+}
+
+unsigned int CommandTable::countPrefix(const std::string &prefix) const {
+  const int node = findNode(prefix);
+  return (node == -1) ? 0 : m_nodes[node].count;
+}
+
+void CommandTable::collect(int node, std::vector<CommandID> &ids) const {
+  const Node &n = m_nodes[node];
+  // A command ending here sorts before the longer ones below it
+  if (n.command != INVALID_COMMAND) ids.push_back(n.command);
+  for (int child = n.child; child != -1; child = m_nodes[child].sibling) {
+    collect(child, ids);
+  }
+}
+
+void CommandTable::findPrefix(const std::string &prefix,
+                              std::vector<CommandID> &ids) const {
+  const int node = findNode(prefix);
+  if (node != -1) collect(node, ids);
+}
+
+std::string CommandTable::completePrefix(const std::string &prefix) const {
+  int node = findNode(prefix);
+  if (node == -1) return prefix;
+
+  std::string completion = prefix;
+  // Follow the trie while there is only one way to go
+  while (m_nodes[node].command == INVALID_COMMAND) {
+    const int child = m_nodes[node].child;
+    if (child == -1 || m_nodes[child].sibling != -1) break;
+    completion += m_nodes[child].c;
+    node = child;
+  }
+  return completion;
+}
+
+void CommandTable::clear() {
+  m_commands.clear();
+  m_index.assign(INITIAL_INDEX_SIZE, INVALID_COMMAND);
+
+  Node root;
+  root.c = 0;
+  root.child = -1;
+  root.sibling = -1;
+  root.count = 0;
+  root.command = INVALID_COMMAND;
+  root.first = INVALID_COMMAND;
+  m_nodes.clear();
+  m_nodes.push_back(root);
+}
+
+} /* namespace Sear */
@@ -0,0 +1,96 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_COMMANDTABLE_H
+#define SEAR_COMMANDTABLE_H 1
+
+#include <string>
+#include <vector>
+
+namespace Sear {
+
+class ConsoleObject;
+
+/**
+ * The CommandTable holds the console commands. Each command is given an
+ * integer ID when it is added, which stays valid until the table is
+ * cleared. Names are found through a hash index, and a trie of the names
+ * answers the prefix queries needed for abbreviations and tab completion.
+ */
+class CommandTable {
+public:
+  typedef int CommandID;
+  static const CommandID INVALID_COMMAND = -1;
+
+  CommandTable();
+  ~CommandTable() {}
+
+  /**
+   * Add a command. The name must not already be in the table.
+   */
+  CommandID add(const std::string &name, ConsoleObject *object);
+
+  /**
+   * Find a command by its full name.
+   */
+  CommandID find(const std::string &name) const;
+
+  /**
+   * Find a command by its full name or by an abbreviation that matches only
+   * one command.
+   * @param matches Set to the number of commands starting with name
+   */
+  CommandID resolve(const std::string &name, unsigned int &matches) const;
+
+  /**
+   * Number of commands starting with prefix.
+   */
+  unsigned int countPrefix(const std::string &prefix) const;
+
+  /**
+   * All commands starting with prefix, in alphabetical order.
+   */
+  void findPrefix(const std::string &prefix, std::vector<CommandID> &ids) const;
+
+  /**
+   * The longest string starting with prefix that every command starting
+   * with prefix also starts with.
+   */
+  std::string completePrefix(const std::string &prefix) const;
+
+  const std::string &getName(CommandID id) const { return m_commands[id].name; }
+  ConsoleObject *getObject(CommandID id) const { return m_commands[id].object; }
+  size_t size() const { return m_commands.size(); }
+
+  void clear();
+
+private:
+  typedef struct {
+    std::string name;
+    ConsoleObject *object;
+    unsigned int hash;
+  } Command;
+
+  typedef struct {
+    char c;
+    int child; ///< First child, children are sorted by character
+    int sibling; ///< Next child of the same parent
+    unsigned int count; ///< Commands in this subtree
+    CommandID command; ///< Command ending at this node
+    CommandID first; ///< Alphabetically first command in this subtree
+  } Node;
+
+  static unsigned int hash(const std::string &name);
+  void rehash(size_t size);
+  int findNode(const std::string &prefix) const;
+  void collect(int node, std::vector<CommandID> &ids) const;
+
+  std::vector<Command> m_commands;
+  std::vector<CommandID> m_index; ///< Open addressed hash index of m_commands
+  std::vector<Node> m_nodes; ///< Trie of command names, the root is node 0
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_COMMANDTABLE_H */
@@ -0,0 +1,106 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <string.h>
+#include <inttypes.h>
+
+#include <sigc++/object_slot.h>
+
+#include "CompiledConfig.h"
+
+namespace Sear {
+
+static void writeUInt32(std::vector<char> &data, uint32_t n) {
+  const char *p = reinterpret_cast<const char*>(&n);
+  data.insert(data.end(), p, p + sizeof(n));
+}
+
+static void writeString(std::vector<char> &data, const std::string &str) {
+  writeUInt32(data, str.size());
+  data.insert(data.end(), str.begin(), str.end());
+}
+
+static bool readUInt32(const std::vector<char> &data, size_t &pos, uint32_t &n) {
+  if (data.size() - pos < sizeof(n)) return false;
+  memcpy(&n, &data[pos], sizeof(n));
+  pos += sizeof(n);
+  return true;
+}
+
+static bool readString(const std::vector<char> &data, size_t &pos, std::string &str) {
+  uint32_t len;
+  if (!readUInt32(data, pos, len)) return false;
+  if (data.size() - pos < len) return false;
+  str.assign(data.begin() + pos, data.begin() + pos + len);
+  pos += len;
+  return true;
+}
+
+bool CompiledConfig::parse(std::istream &is, varconf::Config &errors) {
+  m_items.clear();
+  varconf::Config config;
+  config.sigsv.connect(sigc::mem_fun(this, &CompiledConfig::varconf_callback));
+  config.sige.connect(errors.sige.make_slot());
+  try {
+    config.parseStream(is, varconf::GLOBAL);
+  } catch (const varconf::ParseError &) {
+    return false;
+  }
+  return true;
+}
+
+bool CompiledConfig::parseFile(const std::string &filename, varconf::Config &errors) {
+  m_items.clear();
+  varconf::Config config;
+  config.sigsv.connect(sigc::mem_fun(this, &CompiledConfig::varconf_callback));
+  config.sige.connect(errors.sige.make_slot());
+  return config.readFromFile(filename);
+}
+
+void CompiledConfig::apply(varconf::Config &config, varconf::Scope scope) const {
+  for (ItemList::const_iterator I = m_items.begin(); I != m_items.end(); ++I) {
+    config.setItem(I->section, I->key, I->value, scope);
+  }
+}
+
+void CompiledConfig::serialise(std::vector<char> &data) const {
+  data.clear();
+  writeUInt32(data, m_items.size());
+  for (ItemList::const_iterator I = m_items.begin(); I != m_items.end(); ++I) {
+    writeString(data, I->section);
+    writeString(data, I->key);
+    writeString(data, I->value);
+  }
+}
+
+bool CompiledConfig::deserialise(const std::vector<char> &data) {
+  m_items.clear();
+  size_t pos = 0;
+  uint32_t num_items;
+  if (!readUInt32(data, pos, num_items)) return false;
+  // Each item takes at least 12 bytes, which guards against a bad count
+  if (num_items > (data.size() - pos) / 12) return false;
+
+  m_items.resize(num_items);
+  for (uint32_t i = 0; i < num_items; ++i) {
+    Item &item = m_items[i];
+    if (!readString(data, pos, item.section)
+     || !readString(data, pos, item.key)
+     || !readString(data, pos, item.value)) {
+      m_items.clear();
+      return false;
+    }
+  }
+  return pos == data.size();
+}
+
+void CompiledConfig::varconf_callback(const std::string &section, const std::string &key, varconf::Config &config) {
+  Item item;
+  item.section = section;
+  item.key = key;
+  item.value = (std::string)config.getItem(section, key);
+  m_items.push_back(item);
+}
+
+} /* namespace Sear */
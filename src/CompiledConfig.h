@@ -0,0 +1,64 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_COMPILEDCONFIG_H
+#define SEAR_COMPILEDCONFIG_H 1
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <varconf/config.h>
+
+namespace Sear {
+
+/**
+ * The parsed form of a varconf file, stored in the CacheManager so the text
+ * need not be tokenised again. The items are kept in the order the parser
+ * produced them, so applying them fires the same varconf callbacks, in the
+ * same order, as parsing the file would.
+ */
+class CompiledConfig {
+public:
+  CompiledConfig() {}
+  ~CompiledConfig() {}
+
+  /**
+   * Parse varconf text. Parse errors are reported through the sige signal
+   * of errors. The items read before an error are kept.
+   * @return True if the whole stream was parsed
+   */
+  bool parse(std::istream &is, varconf::Config &errors);
+
+  /**
+   * As parse, but reads the named file.
+   */
+  bool parseFile(const std::string &filename, varconf::Config &errors);
+
+  /**
+   * Set each item in config, in file order.
+   */
+  void apply(varconf::Config &config, varconf::Scope scope) const;
+
+  void serialise(std::vector<char> &data) const;
+  bool deserialise(const std::vector<char> &data);
+
+  size_t getNumItems() const { return m_items.size(); }
+
+private:
+  void varconf_callback(const std::string &section, const std::string &key, varconf::Config &config);
+
+  typedef struct {
+    std::string section;
+    std::string key;
+    std::string value;
+  } Item;
+  typedef std::vector<Item> ItemList;
+
+  ItemList m_items;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_COMPILEDCONFIG_H */
@@ -20,18 +20,20 @@
   static const bool debug = false;
 #endif
 
+#include <cstdio>
 #include <fstream>
 
 namespace Sear {
 	
 static const std::string TOGGLE_CONSOLE = "toggle_console";
 static const std::string LIST_CONSOLE_COMMANDS = "list_commands";
+static const std::string BENCHMARK_COMMANDS = "benchmark_commands";
+static const std::string BENCHMARK_NOP = "benchmark_nop";
 
 static const std::string PANEL = "panel";
 static const std::string FONT = "font";
 
 static const std::string SAY = "say";
-static const std::string CMD_SAY = "/say ";
 
 std::ostream &operator<<(std::ostream &OStream, const std::list< std::string > &List) {
   std::list< std::string >::const_iterator iItem = List.begin();
@@ -87,6 +89,7 @@ Console::Console(System *system) :
   m_panel_state(-1),
   m_font_state(-1),
   m_system(system),
+  m_toggle_console_id(CommandTable::INVALID_COMMAND),
   m_CaretPosition(0),
   m_bTabOnce(false),
   m_initialised(false)
@@ -104,6 +107,9 @@ bool Console::init() {
   // Register console commands
   registerCommand(TOGGLE_CONSOLE, this);
   registerCommand(LIST_CONSOLE_COMMANDS, this);
+  registerCommand(BENCHMARK_COMMANDS, this);
+  registerCommand(BENCHMARK_NOP, this);
+  m_toggle_console_id = m_commands.find(TOGGLE_CONSOLE);
   //Makes sure at least one key is bound to the console
   Bindings::bind("backquote", "/" + std::string(TOGGLE_CONSOLE));
   
@@ -130,8 +136,8 @@ void Console::shutdown() {
   HistoryFile << m_CommandHistory;
   m_CommandHistory.clear();
   m_CommandHistoryIterator = m_CommandHistory.end();
-  m_registered_commands.clear();
-  m_CommandStarts.clear();
+  m_commands.clear();
+  m_toggle_console_id = CommandTable::INVALID_COMMAND;
   m_console_messages.clear();
   m_screen_messages.clear();
   m_initialised = false;
@@ -361,25 +367,23 @@ void Console::vHandleInput(const SDLKey &KeySym, const Uint16 &UnicodeCharacter)
   } else if(KeySym == SDLK_TAB) {
     if((m_Command.length() > 1) && (m_Command[0] == '/') && (m_Command.find(' ') == std::string::npos)) {
       std::string sCommandStart(m_Command.substr(1));
-      std::multimap< std::string, std::string >::size_type Count = m_CommandStarts.count(sCommandStart);
+      unsigned int Count = m_commands.countPrefix(sCommandStart);
       
       if(Count == 0) {
         pushMessage("No command match.", CONSOLE_MESSAGE, 0);
       } else if(Count == 1) {
-        m_Command = '/' + m_CommandStarts.find(sCommandStart)->second + ' ';
+        unsigned int Matches;
+        m_Command = '/' + m_commands.getName(m_commands.resolve(sCommandStart, Matches)) + ' ';
         m_CaretPosition = m_Command.length();
       } else {
-        typedef std::multimap< std::string, std::string >::iterator MI;
-        std::pair< MI, MI > Range(m_CommandStarts.equal_range(sCommandStart));
-        MI iCommand(Range.first);
-        std::string sCommand(iCommand->second);
-        
         if(m_bTabOnce == true) {
-          std::string sPossibilies(sCommand);
+          std::vector< CommandTable::CommandID > Commands;
+          m_commands.findPrefix(sCommandStart, Commands);
+          std::string sPossibilies(m_commands.getName(Commands[0]));
           
-          while(++iCommand != Range.second) {
+          for(size_t i = 1; i < Commands.size(); ++i) {
             sPossibilies += ", ";
-            sPossibilies += iCommand->second;
+            sPossibilies += m_commands.getName(Commands[i]);
           }
           pushMessage(sPossibilies, CONSOLE_MESSAGE, 0);
           m_bTabOnce = false;
@@ -387,11 +391,7 @@ void Console::vHandleInput(const SDLKey &KeySym, const Uint16 &UnicodeCharacter)
           m_bTabOnce = true;
         }
         
-        std::string::size_type i = sCommandStart.length();
-        while((i <= sCommand.length()) && (Count == m_CommandStarts.count(sCommand.substr(0, i)))) {
-          ++i;
-        }
-        m_Command = '/' + sCommand.substr(0, i - 1);
+        m_Command = '/' + m_commands.completePrefix(sCommandStart);
         m_CaretPosition = m_Command.length();
       }
     }
@@ -407,66 +407,137 @@ void Console::vHandleInput(const SDLKey &KeySym, const Uint16 &UnicodeCharacter)
 void Console::registerCommand(const std::string &command, ConsoleObject *object) {
 //  if (debug) Log::writeLog(std::string("Registering: ") + command, Log::LOG_INFO);
   // Assign the ConsoleObject to the command
-  assert(m_registered_commands.find(command) == m_registered_commands.end());
-  m_registered_commands[command] = object;
-  // Prepare the command starts = a multimap that assigns the command start to the full commands.
-  for(std::string::size_type i = 1; i <= command.length(); ++i) {
-    m_CommandStarts.insert(std::make_pair(command.substr(0, i), command));
-  }
+  m_commands.add(command, object);
 }
 
-void Console::runCommand(const std::string &comd) {
-  assert ((m_initialised == true) && "Console not initialised");
-  if (comd.empty()) return; // Ignore empty string
-  std::string command = comd;
+bool Console::parseCommand(const std::string &command, ParsedCommand &parsed) const {
+  if (command.empty()) return false; // Ignore empty string
   // Grab first character of command string
-  char c = command.c_str()[0];
+  char c = command[0];
   // Check to see if command is a command, or a speech string
   if ((c != '/' && c != '+' && c != '-')) {
     // Its a speech string, so SAY it
-    // FIXME /say is not always available!
-    if (m_registered_commands[SAY]) {
-      runCommand(std::string(CMD_SAY) + command);
-    } else {
-      if (debug) Log::writeLog(std::string("Cannot SAY, not in game yet: ") + command, Log::LOG_ERROR);
-      pushMessage("Cannot SAY, not it game yet" , CONSOLE_MESSAGE, 0);
-    }
-    return; 
+    parsed.name = SAY;
+    parsed.args = command;
+    parsed.text = SAY + " " + command;
+    parsed.id = m_commands.find(SAY);
+    return true;
   }
 
   // If command has a leading /, remove it
-  std::string command_string = (c == '/')? command.substr(1) : command;
+  parsed.text = (c == '/')? command.substr(1) : command;
   // Split string into command / arguments pair
   Tokeniser tokeniser = Tokeniser();
-  tokeniser.initTokens(command_string);
-  std::string cmd = tokeniser.nextToken();
-  const std::string &args = tokeniser.remainingTokens();
-  
+  tokeniser.initTokens(parsed.text);
+  parsed.name = tokeniser.nextToken();
+  parsed.args = tokeniser.remainingTokens();
+
   // This allows command abbreviation
-  std::multimap< std::string, std::string >::size_type Count = m_CommandStarts.count(cmd);
-  
-  if(Count == 0) {
-    if (debug) Log::writeLog(std::string("Unknown command: ") + command, Log::LOG_ERROR);
-    pushMessage("Unknown command: " + cmd, CONSOLE_MESSAGE, 0);
-  } else if(Count == 1) {
-    cmd = m_CommandStarts.find(cmd)->second;
-  } else if (m_registered_commands.find(cmd) == m_registered_commands.end()) {
-    // the above checks for commands that are abbrevs of others 'get' <=> 'get_time'
-    pushMessage("Ambigious command: " + cmd, CONSOLE_MESSAGE, 0);
-  }
+  unsigned int matches;
+  parsed.id = m_commands.resolve(parsed.name, matches);
+  return true;
+}
 
+void Console::runCommand(const std::string &command) {
+  assert ((m_initialised == true) && "Console not initialised");
+  ParsedCommand parsed;
+  if (parseCommand(command, parsed)) runCommand(parsed);
+}
 
-  // Print all commands apart form toggle console to the console
-  if (cmd != TOGGLE_CONSOLE) pushMessage(command_string, CONSOLE_MESSAGE, 0);
+void Console::runCommand(const ParsedCommand &parsed) {
+  assert ((m_initialised == true) && "Console not initialised");
+  CommandTable::CommandID id = parsed.id;
+  if (id == CommandTable::INVALID_COMMAND) {
+    // The command may have been registered since the line was parsed
+    unsigned int Count;
+    id = m_commands.resolve(parsed.name, Count);
+
+    if (parsed.name == SAY && id == CommandTable::INVALID_COMMAND) {
+      // FIXME /say is not always available!
+      if (debug) Log::writeLog(std::string("Cannot SAY, not in game yet: ") + parsed.args, Log::LOG_ERROR);
+      pushMessage("Cannot SAY, not it game yet" , CONSOLE_MESSAGE, 0);
+      return;
+    } else if(Count == 0) {
+      if (debug) Log::writeLog(std::string("Unknown command: ") + parsed.text, Log::LOG_ERROR);
+      pushMessage("Unknown command: " + parsed.name, CONSOLE_MESSAGE, 0);
+    } else if (id == CommandTable::INVALID_COMMAND) {
+      // More than one command starts with the name, and none is called it
+      pushMessage("Ambigious command: " + parsed.name, CONSOLE_MESSAGE, 0);
+    }
+  }
 
-  // Find the registered handler
-  std::map<std::string, ConsoleObject*>::iterator I = m_registered_commands.find(cmd);
+  // Print all commands apart form toggle console to the console
+  if (id != m_toggle_console_id) pushMessage(parsed.text, CONSOLE_MESSAGE, 0);
 
-  if (I != m_registered_commands.end()) {
-    ConsoleObject* con_obj = I->second;
+  if (id != CommandTable::INVALID_COMMAND) {
+    ConsoleObject* con_obj = m_commands.getObject(id);
     // If object exists, run the command
-    if (con_obj) con_obj->runCommand(cmd, args);
+    if (con_obj) con_obj->runCommand(m_commands.getName(id), parsed.args);
+  }
+}
+
+void Console::benchmarkCommands(int iterations) {
+  // Build a line for each command, and parse each line once
+  std::vector<CommandTable::CommandID> ids;
+  m_commands.findPrefix("", ids);
+  std::vector<std::string> lines;
+  std::vector<ParsedCommand> parsed(ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    lines.push_back("/" + m_commands.getName(ids[i]) + " an argument");
+    parseCommand(lines.back(), parsed[i]);
+  }
+  if (lines.empty() || iterations <= 0) return;
+
+  // Lines from scripts and the console are parsed each time they run
+  unsigned int found = 0;
+  unsigned int start = SDL_GetTicks();
+  for (int n = 0; n < iterations; ++n) {
+    for (size_t i = 0; i < lines.size(); ++i) {
+      ParsedCommand p;
+      parseCommand(lines[i], p);
+      if (p.id != CommandTable::INVALID_COMMAND && m_commands.getObject(p.id) != 0) ++found;
+    }
   }
+  const unsigned int line_time = SDL_GetTicks() - start;
+
+  // Key bindings keep the parsed form
+  start = SDL_GetTicks();
+  for (int n = 0; n < iterations; ++n) {
+    for (size_t i = 0; i < parsed.size(); ++i) {
+      if (parsed[i].id != CommandTable::INVALID_COMMAND && m_commands.getObject(parsed[i].id) != 0) ++found;
+    }
+  }
+  const unsigned int parsed_time = SDL_GetTicks() - start;
+
+  // Run a command that does nothing all the way through: look up, echo to
+  // the console and call the handler. Scripts and the console run lines,
+  // key bindings run their parsed form.
+  const std::list<std::string> messages = m_console_messages;
+  const std::string &nop_line = "/" + BENCHMARK_NOP + " an argument";
+  const int runs = iterations * lines.size();
+  start = SDL_GetTicks();
+  for (int n = 0; n < runs; ++n) {
+    runCommand(nop_line);
+  }
+  const unsigned int script_time = SDL_GetTicks() - start;
+
+  ParsedCommand nop;
+  parseCommand(nop_line, nop);
+  start = SDL_GetTicks();
+  for (int n = 0; n < runs; ++n) {
+    runCommand(nop);
+  }
+  const unsigned int bound_time = SDL_GetTicks() - start;
+  // Put back the history the echoes pushed out
+  m_console_messages = messages;
+
+  const double count = (double)iterations * lines.size();
+  printf("Looked up %u commands %d times each (%u found)\n",
+         (unsigned int)lines.size(), iterations, found);
+  printf("Lookup from command line: %.3f us per command\n", line_time * 1000.0 / count);
+  printf("Lookup from parsed command: %.3f us per command\n", parsed_time * 1000.0 / count);
+  printf("Dispatch from script line: %.3f us per command\n", script_time * 1000.0 / count);
+  printf("Dispatch from key binding: %.3f us per command\n", bound_time * 1000.0 / count);
 }
 
 void Console::runCommand(const std::string &command, const std::string &args) {
@@ -477,12 +548,22 @@ void Console::runCommand(const std::string &command, const std::string &args) {
   }
   // This commands prints all currently registers commands to the Log File
   else if (command == LIST_CONSOLE_COMMANDS) {
-    for (std::map<std::string, ConsoleObject*>::const_iterator I = m_registered_commands.begin(); I != m_registered_commands.end(); ++I) {
-      // TODO - should we check to see if I->second is valid?
+    std::vector<CommandTable::CommandID> ids;
+    m_commands.findPrefix("", ids);
+    for (size_t i = 0; i < ids.size(); ++i) {
+      // TODO - should we check to see if the object is valid?
 //      if (debug)
-	      Log::writeLog(I->first, Log::LOG_INFO);
+	      Log::writeLog(m_commands.getName(ids[i]), Log::LOG_INFO);
     }
   }
+  else if (command == BENCHMARK_COMMANDS) {
+    int iterations = 1000;
+    if (!args.empty()) cast_stream(args, iterations);
+    benchmarkCommands(iterations);
+  }
+  else if (command == BENCHMARK_NOP) {
+    // Does nothing, benchmark_commands times running it
+  }
 }
 
 } /* namespace Sear */
@@ -15,6 +15,8 @@
 
 #include "interfaces/ConsoleObject.h"
 
+#include "CommandTable.h"
+
 #include "renderers/RenderTypes.h"
 
 
@@ -44,6 +46,18 @@ class System;
  */ 
 class Console : public ConsoleObject {
 public:
+  /**
+   * A command line split into its command and arguments, with the command
+   * looked up. Callers that run the same line many times, such as key
+   * bindings, can keep one of these rather than the string.
+   */
+  typedef struct {
+    std::string text; ///< Command line without the leading /, as echoed
+    std::string name; ///< Command name as given, possibly abbreviated
+    std::string args;
+    CommandTable::CommandID id; ///< INVALID_COMMAND if not yet known
+  } ParsedCommand;
+
   Console(System *system);
   ~Console();
   
@@ -88,6 +102,19 @@ public:
    */ 
   void runCommand(const std::string &command);
 
+  /**
+   * Split a command line and look up its command. Speech is turned into a
+   * say command. A command that is not registered yet is looked up again
+   * each time the line is run.
+   * @return False if the line is empty
+   */
+  bool parseCommand(const std::string &command, ParsedCommand &parsed) const;
+
+  /**
+   * Run a command line from parseCommand.
+   */
+  void runCommand(const ParsedCommand &parsed);
+
   /**
    * This is the ConsoleObject method.
    * command is the command to run
@@ -107,6 +134,14 @@ protected:
    */ 
   void renderScreenMessages();
 
+  /**
+   * Time looking up every registered command, from a command line and from
+   * a ParsedCommand, then time running a command that does nothing from a
+   * line, as scripts do, and from a ParsedCommand, as key bindings do.
+   * Print the cost of each.
+   */
+  void benchmarkCommands(int iterations);
+
   bool m_animateConsole; // Flag determining whether console is moving
   bool m_showConsole; // flag to say whether console is visible/useable or not
   int m_consoleHeight; // the height of the console. determined by number of messages allowed
@@ -117,8 +152,9 @@ protected:
   StateID m_font_state;
   System *m_system;
 
-  // Mapping of registered commands to assoicated object
-  std::map<std::string, ConsoleObject*> m_registered_commands;
+  // Registered commands and their assoicated objects
+  CommandTable m_commands;
+  CommandTable::CommandID m_toggle_console_id;
   
   /// Storage of the least recent commands in reverse order
   std::list< std::string > m_CommandHistory;
@@ -130,9 +166,6 @@ protected:
   /// The current caret position, 0-based.
   unsigned int m_CaretPosition;
   
-  /// A map identifying valid token starts and referencing those
-  std::multimap< std::string, std::string > m_CommandStarts;
-  
   /// Whether the tab key was the last key pressed once.
   bool m_bTabOnce;
  
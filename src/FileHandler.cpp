@@ -10,12 +10,21 @@
 
 #include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
+#include <sstream>
 #include <errno.h>
 
+#include <varconf/varconf.h>
+
 #include "FileHandler.h"
+#include "MediaArchive.h"
+#include "CacheManager.h"
+#include "CompiledConfig.h"
 #include "Console.h"
 #include "System.h"
+#include "common/MutexLock.h"
 #include "common/Utility.h"
 
 #include "binreloc.h"
@@ -23,6 +32,7 @@
 #ifdef __WIN32__
     #include <io.h> // for _access, Win32 version of stat()
     #include <direct.h> // for _mkdir
+    #include <sys/stat.h>
 #else
     #include <sys/stat.h>
 #endif
@@ -97,8 +107,37 @@ namespace Sear {
   static const std::string CMD_GET_VARIABLE = "get_variable";
   static const std::string CMD_SET_VARIABLE = "set_variable";
   static const std::string CMD_DELETE_VARIABLE = "delete_variable";
+  static const std::string CMD_FILE_CACHE_STATS = "file_cache_stats";
+  static const std::string CMD_FILE_CACHE_CLEAR = "file_cache_clear";
+  static const std::string CMD_MOUNT_ARCHIVE = "mount_archive";
+  static const std::string CMD_UNMOUNT_ARCHIVE = "unmount_archive";
+  static const std::string CMD_CONFIG_CACHE_STATS = "config_cache_stats";
+
+// Bump when the CompiledConfig format changes
+static const unsigned int CONFIG_CACHE_VERSION = 1;
+
+// RWops close function for archive entries that had to be decompressed
+// into a buffer of their own.
+static int SDLCALL closeOwnedMem(SDL_RWops *context) {
+  if (context) {
+    free(context->hidden.mem.base);
+    SDL_FreeRW(context);
+  }
+  return 0;
+}
 	
-FileHandler::FileHandler() {
+FileHandler::FileHandler() :
+  m_mutex(SDL_CreateMutex()),
+  m_stat_calls(0),
+  m_cache_hits(0),
+  m_cache_misses(0),
+  m_stat_calls_saved(0),
+  m_config_hits(0),
+  m_config_misses(0),
+  m_config_time(0),
+  m_parsed_mutex(SDL_CreateMutex()),
+  m_config_preparsed(0)
+{
   const std::string &installBase = getInstallBasePath();
 
   addSearchPath(getUserDataPath());
@@ -121,6 +160,18 @@ FileHandler::FileHandler() {
   }
 }
 
+FileHandler::~FileHandler() {
+  clearParsedConfigs();
+  SDL_DestroyMutex(m_parsed_mutex);
+
+  while (!m_archives.empty()) {
+    delete m_archives.front().archive;
+    m_archives.pop_front();
+  }
+
+  SDL_DestroyMutex(m_mutex);
+}
+
 std::string FileHandler::getInstallBasePath() const
 {
 #ifdef __APPLE__
@@ -167,12 +218,34 @@ std::string FileHandler::getUserDataPath() const
 }
 
 
+void FileHandler::setVariable(const std::string &var, const std::string &value) {
+  MutexLock lock(m_mutex);
+  m_varMap[var] = value;
+  invalidateCache();
+}
+
+std::string FileHandler::getVariable(const std::string &var) {
+  MutexLock lock(m_mutex);
+  return m_varMap[var];
+}
+
+void FileHandler::deleteVariable(const std::string &var) {
+  MutexLock lock(m_mutex);
+  VarMap::iterator I = m_varMap.find(var);
+  if (I != m_varMap.end()) m_varMap.erase(I);
+  invalidateCache();
+}
+
 void FileHandler::insertFilePath(const std::string &var, const std::string &path) {
+  MutexLock lock(m_mutex);
   m_file_map[var].push_front(path);
+  invalidateCache();
 }
 
 void FileHandler::appendFilePath(const std::string &var, const std::string &path) {
+  MutexLock lock(m_mutex);
   m_file_map[var].push_back(path);
+  invalidateCache();
 }
 
 void FileHandler::removeFilePath(const std::string &var, const std::string &path) {
@@ -181,18 +254,38 @@ void FileHandler::removeFilePath(const std::string &var, const std::string &path
 }
 
 void FileHandler::clearFilePath(const std::string &var) {
+  MutexLock lock(m_mutex);
   StringListMap::iterator I = m_file_map.find(var);
   if (I != m_file_map.end()) m_file_map.erase(I);
+  invalidateCache();
+}
+
+void FileHandler::invalidateCache() {
+  MutexLock lock(m_mutex);
+  m_path_cache.clear();
+  m_find_cache.clear();
 }
 
 FileHandler::FileList FileHandler::getFilePaths(const std::string &str) {
-  FileList fl;
+  MutexLock lock(m_mutex);
+  PathCache::const_iterator C = m_path_cache.find(str);
+  if (C != m_path_cache.end()) {
+    ++m_cache_hits;
+    m_stat_calls_saved += C->second.stat_calls;
+    return C->second.paths;
+  }
+  ++m_cache_misses;
+  const unsigned int stat_calls = m_stat_calls;
+
+  CachedPaths &cached = m_path_cache[str];
+  FileList &fl = cached.paths;
   // First pass at string expansion
   std::string cpy = str;
   expandString(cpy);
   // No point doing any further expansion if the string is already a real path.
   if (exists(cpy)) {
     fl.push_back(cpy);
+    cached.stat_calls = m_stat_calls - stat_calls;
     return fl;
   }
 
@@ -223,6 +316,7 @@ FileHandler::FileList FileHandler::getFilePaths(const std::string &str) {
     }
     ++I;
   }
+  cached.stat_calls = m_stat_calls - stat_calls;
   return fl;
 }
 
@@ -237,27 +331,46 @@ void FileHandler::getFilePath(std::string &cpy) {
 
 
 void FileHandler::addSearchPath(const std::string &searchpath) {
+  MutexLock lock(m_mutex);
   m_searchpaths.insert(searchpath);
+  invalidateCache();
 }
 void FileHandler::removeSearchPath(const std::string &searchpath) {
+  MutexLock lock(m_mutex);
   FileSet::iterator I = m_searchpaths.find(searchpath);
   if (I != m_searchpaths.end()) {
     m_searchpaths.erase(I);
+    invalidateCache();
   }
 }
 
 std::string FileHandler::findFile(const std::string &filename) {
+  MutexLock lock(m_mutex);
+  PathCache::const_iterator C = m_find_cache.find(filename);
+  if (C != m_find_cache.end()) {
+    ++m_cache_hits;
+    m_stat_calls_saved += C->second.stat_calls;
+    return (C->second.paths.empty()) ? ("") : (C->second.paths.front());
+  }
+  ++m_cache_misses;
+  const unsigned int stat_calls = m_stat_calls;
+
+  CachedPaths &cached = m_find_cache[filename];
   FileSet::const_iterator I = m_searchpaths.begin();
   FileSet::const_iterator Iend = m_searchpaths.end();
   for (;I != Iend; ++I) {
     const std::string &filepath = *I + "/" + filename;
-    if (exists(filepath))
-        return filepath;
+    if (exists(filepath)) {
+      cached.paths.push_back(filepath);
+      break;
+    }
   }
-  return "";
+  cached.stat_calls = m_stat_calls - stat_calls;
+  return (cached.paths.empty()) ? ("") : (cached.paths.front());
 }
 
 FileHandler::FileSet FileHandler::getAllinSearchPaths(const std::string &filename) {
+  MutexLock lock(m_mutex);
   FileSet l;
   FileSet::const_iterator I = m_searchpaths.begin();
   FileSet::const_iterator Iend = m_searchpaths.end();
@@ -282,6 +395,11 @@ void FileHandler::registerCommands(Console *console) {
   console->registerCommand(REMOVE_FILE_PATH, this);
   console->registerCommand(CLEAR_FILE_PATH, this);
   console->registerCommand(GET_FILE_PATH, this);
+  console->registerCommand(CMD_FILE_CACHE_STATS, this);
+  console->registerCommand(CMD_FILE_CACHE_CLEAR, this);
+  console->registerCommand(CMD_MOUNT_ARCHIVE, this);
+  console->registerCommand(CMD_UNMOUNT_ARCHIVE, this);
+  console->registerCommand(CMD_CONFIG_CACHE_STATS, this);
 }
 
 void FileHandler::runCommand(const std::string &command, const std::string &args) {
@@ -328,9 +446,38 @@ void FileHandler::runCommand(const std::string &command, const std::string &args
     getFilePath(f);
     System::instance()->pushMessage(f, CONSOLE_MESSAGE);    
   }
+  else if (command == CMD_FILE_CACHE_STATS) {
+    MutexLock lock(m_mutex);
+    printf("File cache - Entries: %lu Hits: %u Misses: %u Stat calls: %u Saved: %u\n",
+           (unsigned long)(m_path_cache.size() + m_find_cache.size()),
+           m_cache_hits, m_cache_misses, m_stat_calls, m_stat_calls_saved);
+  }
+  else if (command == CMD_FILE_CACHE_CLEAR) {
+    invalidateCache();
+  }
+  else if (command == CMD_MOUNT_ARCHIVE) {
+    std::string archive = tokeniser.nextToken();
+    const std::string &mount_point = tokeniser.remainingTokens();
+    getFilePath(archive);
+    if (!mountArchive(archive, mount_point)) {
+      System::instance()->pushMessage("Unable to mount " + archive, CONSOLE_MESSAGE);
+    }
+  }
+  else if (command == CMD_UNMOUNT_ARCHIVE) {
+    std::string archive = args;
+    getFilePath(archive);
+    unmountArchive(archive);
+  }
+  else if (command == CMD_CONFIG_CACHE_STATS) {
+    MutexLock lock(m_mutex);
+    printf("Config files - Read: %lu From cache: %u Parsed: %u Prepared ahead: %u Time: %ums\n",
+           (unsigned long)m_config_files.size(), m_config_hits, m_config_misses,
+           m_config_preparsed, m_config_time);
+  }
 }
 
 void FileHandler::expandString(std::string &str) {
+  MutexLock lock(m_mutex);
   bool changed = true;
   while (changed) {
     changed = false;
@@ -352,6 +499,11 @@ void FileHandler::expandString(std::string &str) {
 
 bool FileHandler::exists(const std::string& file) const
 {
+  MutexLock lock(m_mutex);
+    std::string name;
+    if (findArchive(file, name) != NULL) return true;
+
+    ++m_stat_calls;
 #ifdef __WIN32__
     int ret = _access(file.c_str(), 0x04); // read access
     return (ret == 0);
@@ -382,4 +534,245 @@ int err = 0;
 
 }
 
+bool FileHandler::mountArchive(const std::string &archive, const std::string &mount_point) {
+  MutexLock lock(m_mutex);
+  MediaArchive *ma = new MediaArchive();
+  if (!ma->open(archive)) {
+    delete ma;
+    return false;
+  }
+
+  std::string mp = mount_point;
+  expandString(mp);
+  mp = MediaArchive::normalisePath(mp);
+  if (!mp.empty() && mp[mp.size() - 1] != '/') mp += '/';
+
+  MountedArchive mounted;
+  mounted.mount_point = mp;
+  mounted.archive = ma;
+  m_archives.push_front(mounted);
+
+  if (debug) printf("[FileHandler] Mounted %s on %s with %u entries\n", archive.c_str(), mp.c_str(), ma->getNumEntries());
+
+  invalidateCache();
+  return true;
+}
+
+void FileHandler::unmountArchive(const std::string &archive) {
+  MutexLock lock(m_mutex);
+  ArchiveList::iterator I = m_archives.begin();
+  while (I != m_archives.end()) {
+    if (I->archive->getFilename() == archive) {
+      delete I->archive;
+      I = m_archives.erase(I);
+    } else {
+      ++I;
+    }
+  }
+  invalidateCache();
+}
+
+const MediaArchive *FileHandler::findArchive(const std::string &filename, std::string &name) const {
+  MutexLock lock(m_mutex);
+  if (m_archives.empty()) return NULL;
+
+  const std::string &path = MediaArchive::normalisePath(filename);
+  ArchiveList::const_iterator I = m_archives.begin();
+  ArchiveList::const_iterator Iend = m_archives.end();
+  for (; I != Iend; ++I) {
+    const std::string &mp = I->mount_point;
+    if (path.compare(0, mp.size(), mp) != 0) continue;
+    name = path.substr(mp.size());
+    if (I->archive->contains(name)) return I->archive;
+  }
+  return NULL;
+}
+
+SDL_RWops *FileHandler::openRW(const std::string &filename) const {
+  std::string name;
+  const MediaArchive *archive = findArchive(filename, name);
+  if (archive == NULL) return SDL_RWFromFile(filename.c_str(), "rb");
+
+  // Uncompressed entries are read straight from the mapped archive
+  size_t size = 0;
+  const char *data = archive->getData(name, size);
+  if (data != NULL) return SDL_RWFromConstMem(data, size);
+
+  std::vector<char> buffer;
+  if (!archive->read(name, buffer)) return NULL;
+  void *mem = malloc(buffer.size() + 1);
+  if (!buffer.empty()) memcpy(mem, &buffer[0], buffer.size());
+  SDL_RWops *rw = SDL_RWFromConstMem(mem, buffer.size());
+  if (rw == NULL) {
+    free(mem);
+    return NULL;
+  }
+  rw->close = closeOwnedMem;
+  return rw;
+}
+
+FILE *FileHandler::openFile(const std::string &filename) const {
+  std::string name;
+  const MediaArchive *archive = findArchive(filename, name);
+  if (archive == NULL) return fopen(filename.c_str(), "rb");
+
+#ifdef __GLIBC__
+  size_t size = 0;
+  const char *data = archive->getData(name, size);
+  // fmemopen does not accept an empty buffer
+  if (data != NULL && size > 0) {
+    return fmemopen(const_cast<char*>(data), size, "rb");
+  }
+#endif
+
+  // Compressed entries are unpacked into a temporary file
+  std::vector<char> buffer;
+  if (!archive->read(name, buffer)) return NULL;
+  FILE *fp = tmpfile();
+  if (fp == NULL) return NULL;
+  if (!buffer.empty() && fwrite(&buffer[0], buffer.size(), 1, fp) != 1) {
+    fclose(fp);
+    return NULL;
+  }
+  rewind(fp);
+  return fp;
+}
+
+bool FileHandler::readFile(const std::string &filename, std::vector<char> &data) const {
+  std::string name;
+  const MediaArchive *archive = findArchive(filename, name);
+  if (archive != NULL) return archive->read(name, data);
+
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) return false;
+  data.clear();
+  char buf[8192];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  const bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// Key a config file on its contents. Reading a small text file costs far
+// less than parsing it, and unlike a modification time the key changes
+// with every edit.
+static CacheManager::Key configKey(const std::vector<char> &text) {
+  CacheManager::Key key = CacheManager::makeKey("config", CONFIG_CACHE_VERSION);
+  const uint64_t size = text.size();
+  key = CacheManager::addToKey(key, &size, sizeof(size));
+  if (!text.empty()) key = CacheManager::addToKey(key, &text[0], text.size());
+  return key;
+}
+
+bool FileHandler::readConfigFile(varconf::Config &config, const std::string &filename, varconf::Scope scope) const {
+  const unsigned int start = SDL_GetTicks();
+
+  std::vector<char> text;
+  if (!readFile(filename, text)) {
+    const std::string &msg = "Could not open " + filename + " for input!";
+    config.sige.emit(msg.c_str());
+    return false;
+  }
+  const CacheManager::Key key = configKey(text);
+
+  // Use the copy made by preparseConfigFile if the text still matches
+  CompiledConfig *parsed = NULL;
+  SDL_LockMutex(m_parsed_mutex);
+  ParsedConfigMap::iterator I = m_parsed_configs.find(filename);
+  if (I != m_parsed_configs.end()) {
+    if (I->second.key == key) parsed = I->second.compiled;
+    else delete I->second.compiled;
+    m_parsed_configs.erase(I);
+  }
+  SDL_UnlockMutex(m_parsed_mutex);
+
+  CompiledConfig compiled;
+  bool success = true;
+  bool loaded = false;
+  const bool preparsed = (parsed != NULL);
+  if (preparsed) {
+    compiled = *parsed;
+    delete parsed;
+  } else {
+    CacheManager &cache = CacheManager::getInstance();
+    const bool use_cache = cache.isInitialised();
+    std::vector<char> data;
+    if (use_cache && cache.get(key, data)) {
+      loaded = compiled.deserialise(data);
+      if (!loaded) cache.remove(key);
+    }
+
+    if (!loaded) {
+      std::istringstream is(std::string(text.begin(), text.end()));
+      success = compiled.parse(is, config);
+      if (!success) {
+        fprintf(stderr, "[FileHandler] Error parsing %s\n", filename.c_str());
+      }
+      // Only files that parsed cleanly are cached, so errors are reported
+      // every time the file is read.
+      if (success && use_cache) {
+        compiled.serialise(data);
+        cache.put(key, data);
+      }
+    }
+  }
+
+  // Items read before a parse error are still applied, as varconf does
+  compiled.apply(config, scope);
+
+  MutexLock lock(m_mutex);
+  if (preparsed) ++m_config_preparsed;
+  else if (loaded) ++m_config_hits;
+  else ++m_config_misses;
+  m_config_files.insert(filename);
+  m_config_time += SDL_GetTicks() - start;
+  return success;
+}
+
+bool FileHandler::preparseConfigFile(const std::string &filename) {
+  std::vector<char> text;
+  if (!readFile(filename, text)) return false;
+  const CacheManager::Key key = configKey(text);
+
+  CompiledConfig compiled;
+  CacheManager &cache = CacheManager::getInstance();
+  const bool use_cache = cache.isInitialised();
+  std::vector<char> data;
+  bool loaded = false;
+  // Nothing to parse if the cache has it
+  if (use_cache && cache.get(key, data)) {
+    loaded = compiled.deserialise(data);
+    if (!loaded) cache.remove(key);
+  }
+  if (!loaded) {
+    varconf::Config errors;
+    std::istringstream is(std::string(text.begin(), text.end()));
+    if (!compiled.parse(is, errors)) return false;
+    if (use_cache) {
+      compiled.serialise(data);
+      cache.put(key, data);
+    }
+  }
+
+  SDL_LockMutex(m_parsed_mutex);
+  ParsedConfig &parsed = m_parsed_configs[filename];
+  delete parsed.compiled;
+  parsed.key = key;
+  parsed.compiled = new CompiledConfig(compiled);
+  SDL_UnlockMutex(m_parsed_mutex);
+  return true;
+}
+
+void FileHandler::clearParsedConfigs() {
+  SDL_LockMutex(m_parsed_mutex);
+  for (ParsedConfigMap::iterator I = m_parsed_configs.begin(); I != m_parsed_configs.end(); ++I) {
+    delete I->second.compiled;
+  }
+  m_parsed_configs.clear();
+  SDL_UnlockMutex(m_parsed_mutex);
+}
+
 } /* namespace Sear */
@@ -9,27 +9,38 @@
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <SDL/SDL.h>
+#include <varconf/config.h>
 
 #include "interfaces/ConsoleObject.h"
 
 
 /*
- * Currently returns file names from a list of search paths
- * TODO
- * This class will be used for all file handling issues.
- * Aim is to link in a virtual file system for easy media packaging
- * this could be from a zip file, or a custom format.
- * It would also be good to be able to use file-memory mapping if possible/appropriate.
+ * Returns file names from a list of search paths and file path variables.
+ * Media archives can be mounted over a directory. Files inside a mounted
+ * archive are found before loose files, and can be opened through
+ * openRW, openFile and readConfigFile as if they were on disk.
+ *
+ * Lookups may be made from any thread, such as startup workers and loader
+ * threads. The search paths, variables, lookup caches and archive list are
+ * guarded by one mutex. Archives must not be unmounted while files from
+ * them are still being read.
  */ 
 
 namespace Sear {
 
+class CompiledConfig;
 class Console;
+class MediaArchive;
 	
 class FileHandler : public ConsoleObject {
 public:	
   FileHandler();
-  ~FileHandler() {}
+  ~FileHandler();
 
   typedef std::set<std::string> FileSet;
   typedef std::list<std::string> FileList;
@@ -43,18 +54,9 @@ public:
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
   
-  void setVariable(const std::string &var, const std::string &value) {
-    m_varMap[var] = value;
-  }
-
-  std::string getVariable(const std::string &var) {
-    return m_varMap[var];
-  }
-
-  void deleteVariable(const std::string &var) {
-    VarMap::iterator I = m_varMap.find(var);
-    if (I != m_varMap.end()) m_varMap.erase(I);
-  }
+  void setVariable(const std::string &var, const std::string &value);
+  std::string getVariable(const std::string &var);
+  void deleteVariable(const std::string &var);
 
   void expandString(std::string &str);
 
@@ -83,6 +85,67 @@ public:
   // expand string into the first path that this file exists in
   void getFilePath(std::string &str);
 
+  /**
+   * Forget all cached lookups. This is done automatically when search
+   * paths or variables change, but must be called when new files are
+   * written into the search paths.
+   */
+  void invalidateCache();
+
+  /**
+   * Mount a media archive so its files appear under mount_point. Variables
+   * in the mount point are expanded when it is mounted. Archives mounted
+   * later are searched first.
+   * @return True if the archive could be opened
+   */
+  bool mountArchive(const std::string &archive, const std::string &mount_point);
+  void unmountArchive(const std::string &archive);
+
+  /**
+   * Open a file for reading through SDL, from a mounted archive if it is in
+   * one or else from disk.
+   * @return The RWops, which the caller must close, or NULL on error
+   */
+  SDL_RWops *openRW(const std::string &filename) const;
+
+  /**
+   * As openRW, but returns a read only stdio stream for fread based loaders.
+   * @return The stream, which the caller must fclose, or NULL on error
+   */
+  FILE *openFile(const std::string &filename) const;
+
+  /**
+   * Read the whole of a file, from a mounted archive if it is in one.
+   * @return True on success
+   */
+  bool readFile(const std::string &filename, std::vector<char> &data) const;
+
+  /**
+   * Read a varconf file, from a mounted archive if it is in one. The parsed
+   * file is kept in the CacheManager, keyed by a hash of its text, and
+   * later reads apply the cached items instead of parsing the text again.
+   * The text file is always authoritative; any change to it means the
+   * cached copy is no longer found.
+   * @return True on success
+   */
+  bool readConfigFile(varconf::Config &config, const std::string &filename,
+                      varconf::Scope scope = varconf::GLOBAL) const;
+
+  /**
+   * Get a config file ready ahead of time, such as on a startup worker
+   * thread. The compiled form is taken from the CacheManager, or parsed
+   * and added to it, and held until readConfigFile uses it once. It is
+   * only used if the text has not changed in the meantime. Files with
+   * parse errors are left for readConfigFile to report.
+   * @return False if the file could not be read or parsed
+   */
+  bool preparseConfigFile(const std::string &filename);
+
+  /**
+   * Drop prepared configs that were never read.
+   */
+  void clearParsedConfigs();
+
 
 protected:
   FileSet  m_searchpaths;
@@ -94,6 +157,53 @@ private:
   typedef std::map<std::string, std::string> VarMap; 
   VarMap m_varMap; 
   StringListMap m_file_map;
+
+  /**
+   * A cached lookup. An empty result records a file that was not found.
+   * stat_calls is the number of stat calls the lookup took, which are
+   * saved each time the entry is used.
+   */
+  typedef struct {
+    FileList paths;
+    unsigned int stat_calls;
+  } CachedPaths;
+  typedef std::map<std::string, CachedPaths> PathCache;
+
+  PathCache m_path_cache; ///< Cache for getFilePaths
+  PathCache m_find_cache; ///< Cache for findFile
+
+  typedef struct {
+    std::string mount_point; ///< Expanded and normalised, with a trailing slash
+    MediaArchive *archive;
+  } MountedArchive;
+  typedef std::list<MountedArchive> ArchiveList;
+
+  /**
+   * Find the mounted archive containing a file.
+   * @param name Set to the name of the file within the archive
+   * @return The archive, or NULL if the file is not in one
+   */
+  const MediaArchive *findArchive(const std::string &filename, std::string &name) const;
+
+  ArchiveList m_archives;
+
+  SDL_mutex *m_mutex; ///< Protects everything but m_parsed_configs
+
+  mutable unsigned int m_stat_calls;
+  unsigned int m_cache_hits, m_cache_misses, m_stat_calls_saved;
+
+  mutable FileSet m_config_files; ///< Every config file read
+  mutable unsigned int m_config_hits, m_config_misses;
+  mutable unsigned int m_config_time; ///< Milliseconds spent reading configs
+
+  typedef struct {
+    uint64_t key; ///< CacheManager key of the text it came from
+    CompiledConfig *compiled;
+  } ParsedConfig;
+  typedef std::map<std::string, ParsedConfig> ParsedConfigMap;
+  mutable ParsedConfigMap m_parsed_configs; ///< From preparseConfigFile
+  SDL_mutex *m_parsed_mutex; ///< Protects m_parsed_configs
+  mutable unsigned int m_config_preparsed;
 };
 
 } /* namespace Sear */
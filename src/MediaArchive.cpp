@@ -0,0 +1,323 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#ifdef __WIN32__
+  #include <sys/stat.h>
+#else
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "MediaArchive.h"
+
+#ifdef DEBUG
+  static const bool debug = true;
+#else
+  static const bool debug = false;
+#endif
+
+namespace Sear {
+
+static const char ARCHIVE_MAGIC[8] = { 'S', 'E', 'A', 'R', 'P', 'A', 'K', '\0' };
+
+// Only keep compressed data if it saves at least this fraction of the size
+static const float MIN_COMPRESSION_SAVING = 0.1f;
+
+static bool entryHashLess(const MediaArchive::Entry &e, uint64_t hash) {
+  return e.hash < hash;
+}
+
+static bool entrySortLess(const MediaArchive::Entry &a, const MediaArchive::Entry &b) {
+  return a.hash < b.hash;
+}
+
+MediaArchive::MediaArchive() :
+  m_data(NULL),
+  m_size(0),
+  m_mapped(false),
+  m_index(NULL),
+  m_names(NULL),
+  m_num_entries(0)
+{}
+
+MediaArchive::~MediaArchive() {
+  if (isOpen()) close();
+}
+
+bool MediaArchive::open(const std::string &filename) {
+  if (isOpen()) close();
+
+#ifdef __WIN32__
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "[MediaArchive] Unable to open %s\n", filename.c_str());
+    return false;
+  }
+  fseek(fp, 0, SEEK_END);
+  m_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  m_data = new char[m_size];
+  if (fread(m_data, 1, m_size, fp) != m_size) {
+    fprintf(stderr, "[MediaArchive] Error reading %s\n", filename.c_str());
+    delete [] m_data;
+    m_data = NULL;
+    fclose(fp);
+    return false;
+  }
+  fclose(fp);
+  m_mapped = false;
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "[MediaArchive] Unable to open %s\n", filename.c_str());
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header)) {
+    fprintf(stderr, "[MediaArchive] %s is not a media archive\n", filename.c_str());
+    ::close(fd);
+    return false;
+  }
+  m_size = info.st_size;
+  void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "[MediaArchive] Unable to map %s\n", filename.c_str());
+    m_size = 0;
+    return false;
+  }
+  m_data = static_cast<char*>(data);
+  m_mapped = true;
+#endif
+
+  // Check the header and that the tables lie inside the file
+  const Header *header = reinterpret_cast<const Header*>(m_data);
+  if (m_size < sizeof(Header)
+   || memcmp(header->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0
+   || header->version != VERSION
+   || header->index_offset > m_size
+   || header->index_offset % 8 != 0
+   || (m_size - header->index_offset) / sizeof(Entry) < header->num_entries
+   || header->names_offset > m_size) {
+    fprintf(stderr, "[MediaArchive] %s is not a valid media archive\n", filename.c_str());
+    close();
+    return false;
+  }
+
+  m_index = reinterpret_cast<const Entry*>(m_data + header->index_offset);
+  m_names = m_data + header->names_offset;
+  m_num_entries = header->num_entries;
+  m_filename = filename;
+
+  if (debug) printf("[MediaArchive] Opened %s with %u entries\n", filename.c_str(), m_num_entries);
+  return true;
+}
+
+void MediaArchive::close() {
+  if (m_data != NULL) {
+#ifdef __WIN32__
+    delete [] m_data;
+#else
+    if (m_mapped) munmap(m_data, m_size);
+    else delete [] m_data;
+#endif
+  }
+  m_data = NULL;
+  m_size = 0;
+  m_mapped = false;
+  m_index = NULL;
+  m_names = NULL;
+  m_num_entries = 0;
+  m_filename = "";
+}
+
+std::string MediaArchive::normalisePath(const std::string &path) {
+  std::string str;
+  str.reserve(path.size());
+  for (std::string::size_type i = 0; i < path.size(); ++i) {
+    const char c = (path[i] == '\\') ? ('/') : (path[i]);
+    // Drop repeated slashes
+    if (c == '/' && !str.empty() && str[str.size() - 1] == '/') continue;
+    str += c;
+  }
+  // Drop any leading "./" and "/"
+  while (true) {
+    if (str.compare(0, 2, "./") == 0) str.erase(0, 2);
+    else if (!str.empty() && str[0] == '/') str.erase(0, 1);
+    else break;
+  }
+  return str;
+}
+
+uint64_t MediaArchive::hashPath(const std::string &path) {
+  // 64 bit FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (std::string::size_type i = 0; i < path.size(); ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+const MediaArchive::Entry *MediaArchive::findEntry(const std::string &path) const {
+  if (!isOpen()) return NULL;
+
+  const std::string &name = normalisePath(path);
+  const uint64_t hash = hashPath(name);
+
+  const Entry *end = m_index + m_num_entries;
+  for (const Entry *e = std::lower_bound(m_index, end, hash, entryHashLess);
+       e != end && e->hash == hash; ++e) {
+    // Hashes can collide, so check the name too
+    if (e->name_length != name.size()) continue;
+    if (m_names + e->name_offset + e->name_length > m_data + m_size) continue;
+    if (name.compare(0, name.size(), m_names + e->name_offset, e->name_length) != 0) continue;
+    if (e->offset > m_size || m_size - e->offset < e->stored_size) {
+      fprintf(stderr, "[MediaArchive] Entry %s in %s is truncated\n", name.c_str(), m_filename.c_str());
+      return NULL;
+    }
+    return e;
+  }
+  return NULL;
+}
+
+const char *MediaArchive::getData(const std::string &path, size_t &size) const {
+  const Entry *e = findEntry(path);
+  if (e == NULL || (e->flags & FLAG_COMPRESSED)) return NULL;
+  size = e->size;
+  return m_data + e->offset;
+}
+
+bool MediaArchive::read(const std::string &path, std::vector<char> &data) const {
+  const Entry *e = findEntry(path);
+  if (e == NULL) return false;
+
+  const char *src = m_data + e->offset;
+  data.resize(e->size);
+  if (e->size == 0) return true;
+
+  if (!(e->flags & FLAG_COMPRESSED)) {
+    memcpy(&data[0], src, e->size);
+    return true;
+  }
+
+  uLongf len = e->size;
+  if (uncompress(reinterpret_cast<Bytef*>(&data[0]), &len,
+                 reinterpret_cast<const Bytef*>(src), e->stored_size) != Z_OK
+   || len != e->size) {
+    fprintf(stderr, "[MediaArchive] Error decompressing %s from %s\n", path.c_str(), m_filename.c_str());
+    data.clear();
+    return false;
+  }
+  return true;
+}
+
+void MediaArchiveWriter::addFile(const std::string &path, const std::vector<char> &data, bool compress) {
+  PendingFile file;
+  file.path = MediaArchive::normalisePath(path);
+  file.size = data.size();
+  file.flags = 0;
+
+  if (compress && !data.empty()) {
+    uLongf len = compressBound(data.size());
+    file.data.resize(len);
+    if (compress2(reinterpret_cast<Bytef*>(&file.data[0]), &len,
+                  reinterpret_cast<const Bytef*>(&data[0]), data.size(),
+                  Z_BEST_COMPRESSION) == Z_OK
+     && (float)len < (float)data.size() * (1.0f - MIN_COMPRESSION_SAVING)) {
+      file.data.resize(len);
+      file.flags |= MediaArchive::FLAG_COMPRESSED;
+    }
+  }
+  if (!(file.flags & MediaArchive::FLAG_COMPRESSED)) {
+    file.data = data;
+  }
+
+  m_files.push_back(file);
+}
+
+bool MediaArchiveWriter::write(const std::string &filename) const {
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "[MediaArchive] Unable to create %s\n", filename.c_str());
+    return false;
+  }
+
+  MediaArchive::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+  header.version = MediaArchive::VERSION;
+  header.num_entries = m_files.size();
+
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+  uint64_t offset = sizeof(header);
+
+  std::vector<MediaArchive::Entry> entries;
+  std::string names;
+  for (size_t i = 0; ok && i < m_files.size(); ++i) {
+    const PendingFile &file = m_files[i];
+    MediaArchive::Entry e;
+    e.hash = MediaArchive::hashPath(file.path);
+    e.offset = offset;
+    e.size = file.size;
+    e.stored_size = file.data.size();
+    e.name_offset = names.size();
+    e.name_length = file.path.size();
+    e.flags = file.flags;
+    entries.push_back(e);
+    names += file.path;
+
+    if (!file.data.empty()) {
+      ok = (fwrite(&file.data[0], file.data.size(), 1, fp) == 1);
+    }
+    offset += file.data.size();
+  }
+
+  // Align the index so it can be used in place
+  static const char padding[8] = { 0 };
+  if (ok && offset % 8 != 0) {
+    const size_t pad = 8 - offset % 8;
+    ok = (fwrite(padding, pad, 1, fp) == 1);
+    offset += pad;
+  }
+
+  std::stable_sort(entries.begin(), entries.end(), entrySortLess);
+  header.index_offset = offset;
+  if (ok && !entries.empty()) {
+    ok = (fwrite(&entries[0], sizeof(MediaArchive::Entry), entries.size(), fp) == entries.size());
+  }
+  offset += entries.size() * sizeof(MediaArchive::Entry);
+
+  header.names_offset = offset;
+  if (ok && !names.empty()) {
+    ok = (fwrite(names.data(), names.size(), 1, fp) == 1);
+  }
+
+  // Fill in the table offsets
+  if (ok) ok = (fseek(fp, 0, SEEK_SET) == 0);
+  if (ok) ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+  if (fclose(fp) != 0) ok = false;
+  if (!ok) {
+    fprintf(stderr, "[MediaArchive] Error writing %s\n", filename.c_str());
+    remove(filename.c_str());
+  }
+  return ok;
+}
+
+} /* namespace Sear */
@@ -0,0 +1,140 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_MEDIAARCHIVE_H
+#define SEAR_MEDIAARCHIVE_H 1
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+namespace Sear {
+
+/**
+ * A MediaArchive packs many small media files into one file. The archive
+ * starts with a fixed header, followed by the file data, an index sorted by
+ * path hash and a table of path names. Archives are memory mapped where
+ * possible so uncompressed entries can be used in place. Entries may be
+ * stored zlib compressed.
+ *
+ * Values are stored in native byte order, so an archive built on a machine
+ * of the other endianness fails the version check rather than misreading.
+ *
+ *   Header: magic[8] "SEARPAK", version, num_entries, index_offset,
+ *           names_offset
+ *   Entry:  hash, offset, size, stored_size, name_offset, name_length, flags
+ */
+class MediaArchive {
+public:
+  static const uint32_t VERSION = 1;
+
+  /// Entry is zlib compressed, stored_size bytes expanding to size bytes
+  static const uint16_t FLAG_COMPRESSED = 0x1;
+
+  typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t index_offset;
+    uint64_t names_offset;
+  } Header;
+
+  typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t name_offset;
+    uint16_t name_length;
+    uint16_t flags;
+  } Entry;
+
+  MediaArchive();
+  ~MediaArchive();
+
+  /**
+   * Open and map an archive.
+   * @return True on success
+   */
+  bool open(const std::string &filename);
+  void close();
+  bool isOpen() const { return m_data != NULL; }
+
+  const std::string &getFilename() const { return m_filename; }
+  uint32_t getNumEntries() const { return m_num_entries; }
+
+  bool contains(const std::string &path) const { return findEntry(path) != NULL; }
+
+  /**
+   * Get a pointer to an uncompressed entry inside the mapped archive. The
+   * pointer is valid until the archive is closed.
+   * @return Pointer to the data, or NULL if missing or compressed
+   */
+  const char *getData(const std::string &path, size_t &size) const;
+
+  /**
+   * Copy an entry into the buffer, decompressing if needed.
+   * @return True if the entry exists and could be read
+   */
+  bool read(const std::string &path, std::vector<char> &data) const;
+
+  /**
+   * Paths are stored with forward slashes, without a leading "./" and
+   * without repeated slashes.
+   */
+  static std::string normalisePath(const std::string &path);
+  static uint64_t hashPath(const std::string &path);
+
+private:
+  const Entry *findEntry(const std::string &path) const;
+
+  std::string m_filename;
+  char *m_data;
+  size_t m_size;
+  bool m_mapped; ///< Memory mapped, rather than read into memory
+
+  const Entry *m_index;
+  const char *m_names;
+  uint32_t m_num_entries;
+};
+
+/**
+ * Builds a MediaArchive. Files are added in any order and written out
+ * with a sorted index.
+ */
+class MediaArchiveWriter {
+public:
+  MediaArchiveWriter() {}
+  ~MediaArchiveWriter() {}
+
+  /**
+   * Add a file to the archive.
+   * @param path Path of the file within the archive
+   * @param data File contents
+   * @param compress Store compressed, if it makes the entry smaller
+   */
+  void addFile(const std::string &path, const std::vector<char> &data, bool compress);
+
+  /**
+   * Write the archive to disk.
+   * @return True on success
+   */
+  bool write(const std::string &filename) const;
+
+  size_t getNumFiles() const { return m_files.size(); }
+
+private:
+  typedef struct {
+    std::string path;
+    uint32_t size;
+    uint16_t flags;
+    std::vector<char> data;
+  } PendingFile;
+
+  std::vector<PendingFile> m_files;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_MEDIAARCHIVE_H */
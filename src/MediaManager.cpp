@@ -328,6 +328,8 @@ int MediaManager::checkForUpdates() {
 
 void MediaManager::onDownloadComplete(const std::string &url, const std::string &filename) {
   printf("DownloadComplete: %s\n", filename.c_str());
+  // A new file may now exist where lookups previously failed
+  System::instance()->getFileHandler()->invalidateCache();
   DownloadComplete.emit(url, filename);
 }
 
@@ -0,0 +1,101 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cmath>
+
+#include "MotionSmoother.h"
+
+namespace Sear {
+
+const float MotionSmoother::SNAP_DISTANCE = 5.0f;
+
+static const WFMath::Vector<3> vector_zero(0.0f, 0.0f, 0.0f);
+
+MotionSmoother::MotionSmoother() :
+  m_first(0),
+  m_count(0),
+  m_error(vector_zero),
+  m_last_time(0),
+  m_has_last(false)
+{}
+
+void MotionSmoother::reset() {
+  m_first = 0;
+  m_count = 0;
+  m_error = vector_zero;
+  m_has_last = false;
+}
+
+void MotionSmoother::addUpdate(unsigned int time, const WFMath::Point<3> &pos, const WFMath::Vector<3> &vel) {
+  if (!pos.isValid()) return;
+
+  Update u;
+  u.time = time;
+  u.pos = pos;
+  u.vel = (vel.isValid()) ? (vel) : (vector_zero);
+
+  if (m_count > 0 && time <= get(m_count - 1).time) {
+    // Several updates in one tick, keep the newest
+    u.time = get(m_count - 1).time;
+    m_updates[(m_first + m_count - 1) % BUFFER_SIZE] = u;
+  } else if (m_count == BUFFER_SIZE) {
+    m_updates[m_first] = u;
+    m_first = (m_first + 1) % BUFFER_SIZE;
+  } else {
+    m_updates[(m_first + m_count) % BUFFER_SIZE] = u;
+    ++m_count;
+  }
+
+  // Work out how far the new update moves what was last shown, and blend
+  // that difference out rather than jumping.
+  if (m_has_last) {
+    const unsigned int render_time = (m_last_time > INTERPOLATION_DELAY) ? (m_last_time - INTERPOLATION_DELAY) : (0);
+    const WFMath::Vector<3> error = m_last_pos - sample(render_time);
+    if (error.mag() > SNAP_DISTANCE) {
+      m_error = vector_zero;
+    } else {
+      m_error = error;
+    }
+  }
+}
+
+WFMath::Point<3> MotionSmoother::sample(unsigned int time) const {
+  const Update &first = get(0);
+  if (time <= first.time) return first.pos;
+
+  // Interpolate between the updates either side
+  for (unsigned int i = 0; i + 1 < m_count; ++i) {
+    const Update &a = get(i);
+    const Update &b = get(i + 1);
+    if (time < b.time) {
+      const float t = (float)(time - a.time) / (float)(b.time - a.time);
+      return a.pos + (b.pos - a.pos) * t;
+    }
+  }
+
+  // Past the newest update, extrapolate for a limited time
+  const Update &last = get(m_count - 1);
+  unsigned int dt = time - last.time;
+  if (dt > MAX_EXTRAPOLATION) dt = MAX_EXTRAPOLATION;
+  return last.pos + last.vel * ((float)dt / 1000.0f);
+}
+
+WFMath::Point<3> MotionSmoother::getPosition(unsigned int time) {
+  if (m_count == 0) return WFMath::Point<3>(0.0f, 0.0f, 0.0f);
+
+  // Decay the blended error
+  if (m_has_last && time > m_last_time) {
+    // Roughly 95% of the error is gone after BLEND_TIME
+    const float f = expf(-3.0f * (float)(time - m_last_time) / (float)BLEND_TIME);
+    m_error = m_error * f;
+  }
+
+  const unsigned int render_time = (time > INTERPOLATION_DELAY) ? (time - INTERPOLATION_DELAY) : (0);
+  m_last_pos = sample(render_time) + m_error;
+  m_last_time = time;
+  m_has_last = true;
+  return m_last_pos;
+}
+
+} /* namespace Sear */
@@ -0,0 +1,92 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_MOTIONSMOOTHER_H
+#define SEAR_MOTIONSMOOTHER_H 1
+
+#include <wfmath/point.h>
+#include <wfmath/vector.h>
+
+namespace Sear {
+
+/**
+ * The MotionSmoother turns the irregular position updates received from
+ * the server into smooth motion. Updates are buffered and the entity is
+ * drawn a short delay behind the newest one, interpolating between the
+ * surrounding updates. When updates run out the last one is extrapolated
+ * along its velocity for a limited time. If a new update disagrees with
+ * what was being shown, the difference is blended out over a short time
+ * rather than snapping, unless it is too large to hide.
+ *
+ * It knows nothing about entities or the network, so it can be driven by
+ * synthetic update streams.
+ */
+class MotionSmoother {
+public:
+  MotionSmoother();
+  ~MotionSmoother() {}
+
+  /**
+   * Forget all updates. The next update is used as is.
+   */
+  void reset();
+
+  /**
+   * Add a position update.
+   * @param time Time the update was received, in milliseconds
+   * @param pos Position in the update
+   * @param vel Velocity in the update, in units per second
+   */
+  void addUpdate(unsigned int time, const WFMath::Point<3> &pos, const WFMath::Vector<3> &vel);
+
+  /**
+   * Get the position to show at the given time. Times should not go
+   * backwards between calls.
+   */
+  WFMath::Point<3> getPosition(unsigned int time);
+
+  bool isValid() const { return m_count > 0; }
+
+  /**
+   * Distance between the shown position and the newest update in the
+   * last call to getPosition that is still being blended out.
+   */
+  float getError() const { return m_error.isValid() ? m_error.mag() : 0.0f; }
+
+  static const unsigned int BUFFER_SIZE = 8;
+
+  /// How far behind the newest update entities are drawn
+  static const unsigned int INTERPOLATION_DELAY = 100;
+  /// Longest time to extrapolate past the newest update
+  static const unsigned int MAX_EXTRAPOLATION = 250;
+  /// Time for an error to be mostly blended out
+  static const unsigned int BLEND_TIME = 200;
+  /// Errors larger than this are snapped rather than blended
+  static const float SNAP_DISTANCE;
+
+private:
+  typedef struct {
+    unsigned int time;
+    WFMath::Point<3> pos;
+    WFMath::Vector<3> vel;
+  } Update;
+
+  const Update &get(unsigned int i) const {
+    return m_updates[(m_first + i) % BUFFER_SIZE];
+  }
+
+  WFMath::Point<3> sample(unsigned int time) const;
+
+  Update m_updates[BUFFER_SIZE];
+  unsigned int m_first, m_count;
+
+  WFMath::Point<3> m_last_pos; ///< Last position returned
+  WFMath::Vector<3> m_error; ///< Remaining error being blended out
+  unsigned int m_last_time;
+  bool m_has_last;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_MOTIONSMOOTHER_H */
@@ -0,0 +1,67 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cmath>
+
+#include "MoveHistory.h"
+
+namespace Sear {
+
+static const WFMath::Vector<3> vector_zero(0.0f, 0.0f, 0.0f);
+
+// Horizontal speeds below this count as standing still
+static const float still_speed = 0.01f;
+// Directions closer than about 5 degrees count as the same
+static const float same_direction = 0.995f;
+
+bool MoveHistory::sameVelocity(const WFMath::Vector<3> &a, const WFMath::Vector<3> &b) {
+  // Height is left out, as the server follows the terrain. Speed is left
+  // out too, as the server may limit it.
+  const float a_speed = sqrtf(a.x() * a.x() + a.y() * a.y());
+  const float b_speed = sqrtf(b.x() * b.x() + b.y() * b.y());
+  if (a_speed < still_speed || b_speed < still_speed) {
+    return (a_speed < still_speed && b_speed < still_speed);
+  }
+  return (a.x() * b.x() + a.y() * b.y()) / (a_speed * b_speed) > same_direction;
+}
+
+void MoveHistory::addMove(unsigned int time, const WFMath::Vector<3> &vel) {
+  Move m;
+  m.time = (!m_moves.empty() && time < m_moves.back().time) ? (m_moves.back().time) : (time);
+  m.vel = (vel.isValid()) ? (vel) : (vector_zero);
+  m_moves.push_back(m);
+
+  while (m_moves.size() > MAX_MOVES) m_moves.pop_front();
+}
+
+WFMath::Point<3> MoveHistory::reconcile(unsigned int time, const WFMath::Point<3> &pos, const WFMath::Vector<3> &vel) {
+  if (!pos.isValid()) return pos;
+  const WFMath::Vector<3> server_vel = (vel.isValid()) ? (vel) : (vector_zero);
+
+  while (!m_moves.empty() && time > m_moves.front().time + MAX_AGE) {
+    m_moves.pop_front();
+  }
+
+  // Drop the requests the server has reached
+  for (MoveList::iterator I = m_moves.begin(); I != m_moves.end(); ++I) {
+    if (sameVelocity(I->vel, server_vel)) {
+      m_moves.erase(m_moves.begin(), I + 1);
+      break;
+    }
+  }
+
+  // Replay the rest. The server moved the avatar with its own velocity
+  // while they were on their way, so only the difference is added.
+  WFMath::Point<3> result = pos;
+  for (size_t i = 0; i < m_moves.size(); ++i) {
+    const unsigned int start = m_moves[i].time;
+    unsigned int end = (i + 1 < m_moves.size()) ? (m_moves[i + 1].time) : (time);
+    if (end > time) end = time;
+    if (start >= end) continue;
+    result += (m_moves[i].vel - server_vel) * ((float)(end - start) / 1000.0f);
+  }
+  return result;
+}
+
+} /* namespace Sear */
@@ -0,0 +1,83 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_MOVEHISTORY_H
+#define SEAR_MOVEHISTORY_H 1
+
+#include <deque>
+
+#include <wfmath/point.h>
+#include <wfmath/vector.h>
+
+namespace Sear {
+
+/**
+ * The MoveHistory keeps the movement requests sent for the avatar that the
+ * server has not acted on yet, so a position update from the server can be
+ * brought up to date with them rather than pulling the avatar back.
+ *
+ * Each request is tagged with the time it was sent. Move ops carry no
+ * serial number back, but the server reports the velocity it is moving
+ * the avatar with, so the oldest request with that velocity is taken as
+ * the one it has reached. The server handles requests in order, so that
+ * request and all older ones are dropped.
+ *
+ * It knows nothing about entities or the network, so it can be driven by
+ * synthetic update streams.
+ */
+class MoveHistory {
+public:
+  MoveHistory() {}
+  ~MoveHistory() {}
+
+  /**
+   * Forget all requests.
+   */
+  void clear() { m_moves.clear(); }
+
+  /**
+   * Add a movement request.
+   * @param time Time the request was sent, in milliseconds
+   * @param vel Velocity requested, in units per second
+   */
+  void addMove(unsigned int time, const WFMath::Vector<3> &vel);
+
+  /**
+   * Apply a position update from the server. Requests the update shows
+   * the server has acted on are dropped. The rest are replayed on top of
+   * the server position: over the time each was in force, the server
+   * velocity is replaced by the requested one.
+   * @param time Time the update is for, in milliseconds
+   * @param pos Position in the update
+   * @param vel Velocity in the update, in units per second
+   * @return The server position with the outstanding requests applied
+   */
+  WFMath::Point<3> reconcile(unsigned int time, const WFMath::Point<3> &pos, const WFMath::Vector<3> &vel);
+
+  /**
+   * Number of requests the server has not acted on.
+   */
+  size_t size() const { return m_moves.size(); }
+
+  /// Requests older than this are dropped even if never matched, in case
+  /// the server changed the velocity it was asked for
+  static const unsigned int MAX_AGE = 2000;
+  /// Most requests kept
+  static const unsigned int MAX_MOVES = 32;
+
+private:
+  typedef struct {
+    unsigned int time;
+    WFMath::Vector<3> vel;
+  } Move;
+
+  static bool sameVelocity(const WFMath::Vector<3> &a, const WFMath::Vector<3> &b);
+
+  typedef std::deque<Move> MoveList;
+  MoveList m_moves;
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_MOVEHISTORY_H */
@@ -4,10 +4,18 @@
 
 #include "Sound.h"
 #include "Console.h"
+#include "WorldEntity.h"
+#include "System.h"
+#include "FileHandler.h"
 #include "common/Log.h"
 #include <SDL/SDL.h>
 #include <unistd.h>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <functional>
 
 // $Id: Sound.cpp,v 1.21 2007-05-02 20:47:55 simon Exp $
 
@@ -26,15 +34,52 @@ namespace Sear {
   static const std::string PLAY_MUSIC = "play_music";
   static const std::string STOP_MUSIC = "stop_music";
   static const std::string ENABLE_SOUND = "enable_sound";
-  
+  static const std::string SOUND_CACHE_BUDGET = "sound_cache_budget";
+  static const std::string SOUND_CACHE_STATS = "sound_cache_stats";
+  static const std::string SOUND_VOICES = "sound_voices";
+
+  // Default memory budget for decoded samples
+  static const size_t DEFAULT_cache_budget = 16 * 1024 * 1024;
+  // Sounds that take longer than this to load are dropped rather than played late
+  static const unsigned int MAX_play_delay = 500;
+  // Limit on the number of failed files remembered
+  static const size_t MAX_failed = 256;
+
+  static const int CHANNEL_sound = 1;
+  static const int CHANNEL_loop = 2;
+
+  // Mixer channels. The first few are kept for non-positional sounds.
+  static const int NUM_channels = 16;
+  static const int NUM_reserved = 3;
+
+  // Emitters play at full volume up to the reference distance, then fall
+  // off with the inverse of distance. They are silent beyond max distance.
+  static const float REFERENCE_distance = 2.0f;
+  static const float MAX_distance = 60.0f;
+
 Sound::Sound() :
+  m_cache_bytes(0),
+  m_cache_budget(DEFAULT_cache_budget),
+  m_emitter_counter(0),
+  m_num_voices(NUM_channels - NUM_reserved),
+  m_listener_pos(0.0f, 0.0f, 0.0f),
+  m_listener_right(0.0f, -1.0f, 0.0f),
+  m_voices_stolen(0),
+  m_thread(NULL),
+  m_mutex(NULL),
+  m_cond(NULL),
+  m_quit(false),
+  m_hits(0),
+  m_misses(0),
+  m_dropped(0),
+  m_evicted(0),
   m_initialised(false)
 {}
 
 Sound::~Sound() {
  if (m_initialised) shutdown();
 }
-	
+
 int Sound::init() {
   assert(m_initialised == false);
   if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
@@ -45,80 +90,452 @@ int Sound::init() {
     Log::writeLog(std::string("Error init SDL_mixer: ") + Mix_GetError(), Log::LOG_ERROR);
     return 1;
   }
+
+  // Positional sounds are only played on channels we hand out
+  Mix_AllocateChannels(NUM_channels);
+  Mix_ReserveChannels(NUM_channels);
+  m_free_channels.clear();
+  for (int i = NUM_channels - 1; i >= NUM_reserved; --i) {
+    m_free_channels.push_back(i);
+  }
+
+  m_mutex = SDL_CreateMutex();
+  m_cond = SDL_CreateCond();
+  m_quit = false;
+  m_thread = SDL_CreateThread(&Sound::loaderThread, this);
+  if (m_thread == NULL) {
+    Log::writeLog(std::string("Error creating sound loader thread: ") + SDL_GetError(), Log::LOG_ERROR);
+    SDL_DestroyCond(m_cond);
+    SDL_DestroyMutex(m_mutex);
+    m_cond = NULL;
+    m_mutex = NULL;
+    Mix_CloseAudio();
+    return 1;
+  }
+
   m_initialised = true;
   return 0;
 }
 
 void Sound::shutdown() {
   assert(m_initialised == true);
+
+  // Stop the loader thread
+  SDL_LockMutex(m_mutex);
+  m_quit = true;
+  m_load_queue.clear();
+  SDL_CondSignal(m_cond);
+  SDL_UnlockMutex(m_mutex);
+  SDL_WaitThread(m_thread, NULL);
+  m_thread = NULL;
+
+  m_emitters.clear();
+  m_free_channels.clear();
+
   Mix_CloseAudio();
-  while(!m_sound_map.empty()) {
-    Mix_Chunk *sample = (m_sound_map.begin())->second;
-    if (sample) Mix_FreeChunk(sample);
-    m_sound_map.erase(m_sound_map.begin());
+
+  // Free samples that were never collected
+  while (!m_loaded.empty()) {
+    if (m_loaded.front().second) Mix_FreeChunk(m_loaded.front().second);
+    m_loaded.pop_front();
+  }
+
+  SampleCache::iterator I = m_sample_cache.begin();
+  SampleCache::iterator Iend = m_sample_cache.end();
+  for (; I != Iend; ++I) {
+    Mix_FreeChunk(I->second.chunk);
   }
+  m_sample_cache.clear();
+  m_lru.clear();
+  m_cache_bytes = 0;
+
+  m_failed.clear();
+  m_loading.clear();
+  m_pending.clear();
+
   while(!m_music_map.empty()) {
     Mix_Music *music = (m_music_map.begin())->second;
     if (music) Mix_FreeMusic(music);
     m_music_map.erase(m_music_map.begin());
   }
+
+  SDL_DestroyCond(m_cond);
+  SDL_DestroyMutex(m_mutex);
+  m_cond = NULL;
+  m_mutex = NULL;
+
   SDL_QuitSubSystem(SDL_INIT_AUDIO);
   m_initialised = false;
 }
 
+int Sound::loaderThread(void *data) {
+  static_cast<Sound*>(data)->loaderLoop();
+  return 0;
+}
+
+void Sound::loaderLoop() {
+  SDL_LockMutex(m_mutex);
+  while (!m_quit) {
+    if (m_load_queue.empty()) {
+      SDL_CondWait(m_cond, m_mutex);
+      continue;
+    }
+    std::string file_name = m_load_queue.front();
+    m_load_queue.pop_front();
+
+    // Decode without holding the lock
+    SDL_UnlockMutex(m_mutex);
+    // Without a System, as in tools/sound_test, read the file directly
+    System *system = System::instance();
+    SDL_RWops *rw = (system) ? (system->getFileHandler()->openRW(file_name))
+                             : (SDL_RWFromFile(file_name.c_str(), "rb"));
+    Mix_Chunk *sample = (rw) ? (Mix_LoadWAV_RW(rw, 1)) : (NULL);
+    if (!sample) {
+      Log::writeLog(std::string("Mix_LoadWAV_RW: ") + Mix_GetError(), Log::LOG_ERROR);
+    }
+    SDL_LockMutex(m_mutex);
+
+    m_loaded.push_back(LoadedSample(file_name, sample));
+  }
+  SDL_UnlockMutex(m_mutex);
+}
+
+void Sound::update() {
+  if (!m_initialised) return;
+
+  // Collect finished samples
+  std::deque<LoadedSample> loaded;
+  SDL_LockMutex(m_mutex);
+  loaded.swap(m_loaded);
+  SDL_UnlockMutex(m_mutex);
+
+  while (!loaded.empty()) {
+    const LoadedSample &ls = loaded.front();
+    m_loading.erase(ls.first);
+    if (ls.second) {
+      cacheSample(ls.first, ls.second);
+    } else {
+      addFailed(ls.first);
+    }
+    loaded.pop_front();
+  }
+
+  // Start or drop sounds that were waiting for a sample
+  const unsigned int now = SDL_GetTicks();
+  PendingList::iterator I = m_pending.begin();
+  while (I != m_pending.end()) {
+    if (m_loading.find(I->file_name) != m_loading.end()) {
+      ++I;
+      continue;
+    }
+    SampleCache::iterator J = m_sample_cache.find(I->file_name);
+    // Loops are worth starting late, one-off sounds are not
+    if (J != m_sample_cache.end() &&
+        (I->loops != 0 || now - I->requested <= MAX_play_delay)) {
+      Mix_PlayChannel(I->channel, J->second.chunk, I->loops);
+    } else {
+      ++m_dropped;
+    }
+    m_pending.erase(I++);
+  }
+
+  updateEmitters();
+
+  evictSamples();
+}
+
+Sound::EmitterID Sound::addEmitter(WorldEntity *we, const std::string &file_name, bool loop, float volume) {
+  assert(we != NULL);
+  Emitter e;
+  e.entity = Eris::EntityRef(we);
+  e.fixed = false;
+  e.file_name = file_name;
+  e.loop = loop;
+  e.volume = volume;
+  return addEmitter(e);
+}
+
+Sound::EmitterID Sound::addEmitter(const WFMath::Point<3> &pos, const std::string &file_name, bool loop, float volume) {
+  Emitter e;
+  e.fixed = true;
+  e.pos = pos;
+  e.file_name = file_name;
+  e.loop = loop;
+  e.volume = volume;
+  return addEmitter(e);
+}
+
+Sound::EmitterID Sound::addEmitter(const Emitter &emitter) {
+  const EmitterID id = ++m_emitter_counter;
+  Emitter &e = m_emitters[id];
+  e = emitter;
+  e.gain = 0.0f;
+  e.pan = 0.0f;
+  e.channel = -1;
+  e.started = false;
+
+  // Start decoding now so it is ready when the emitter gets a voice
+  getSample(e.file_name);
+  return id;
+}
+
+void Sound::removeEmitter(EmitterID id) {
+  EmitterMap::iterator I = m_emitters.find(id);
+  if (I == m_emitters.end()) return;
+  stopEmitter(I->second);
+  m_emitters.erase(I);
+}
+
+bool Sound::getEmitterMix(EmitterID id, float &gain, float &pan, bool &voice) const {
+  EmitterMap::const_iterator I = m_emitters.find(id);
+  if (I == m_emitters.end()) return false;
+  gain = I->second.gain;
+  pan = I->second.pan;
+  voice = (I->second.channel != -1);
+  return true;
+}
+
+void Sound::setListener(const WFMath::Point<3> &pos, const WFMath::Vector<3> &forward, const WFMath::Vector<3> &up) {
+  m_listener_pos = pos;
+  // Keep the old right vector if the directions are unusable
+  const WFMath::Vector<3> right = WFMath::Cross(forward, up);
+  const float mag = right.mag();
+  if (mag > 0.0001f) {
+    m_listener_right = WFMath::Vector<3>(right.x() / mag, right.y() / mag, right.z() / mag);
+  }
+}
+
+void Sound::stopEmitter(Emitter &emitter) {
+  if (emitter.channel == -1) return;
+  Mix_HaltChannel(emitter.channel);
+  m_free_channels.push_back(emitter.channel);
+  emitter.channel = -1;
+}
+
+void Sound::updateEmitters() {
+  // Attenuate each emitter and drop the ones that are finished
+  m_priorities.clear();
+  EmitterMap::iterator I = m_emitters.begin();
+  while (I != m_emitters.end()) {
+    Emitter &e = I->second;
+    const bool finished = !e.loop && e.started && (e.channel == -1 || !Mix_Playing(e.channel));
+    if ((!e.fixed && !e.entity) || finished || m_failed.find(e.file_name) != m_failed.end()) {
+      stopEmitter(e);
+      m_emitters.erase(I++);
+      continue;
+    }
+
+    WFMath::Vector<3> offset;
+    if (e.fixed) {
+      offset = e.pos - m_listener_pos;
+    } else {
+      WorldEntity *we = dynamic_cast<WorldEntity*>(e.entity.get());
+      assert(we != NULL);
+      offset = we->getAbsPos() - m_listener_pos;
+    }
+    const float dist = offset.mag();
+    if (dist >= MAX_distance) {
+      e.gain = 0.0f;
+    } else if (dist <= REFERENCE_distance) {
+      e.gain = e.volume;
+    } else {
+      e.gain = e.volume * REFERENCE_distance / dist;
+    }
+    e.pan = (dist > 0.001f) ? (WFMath::Dot(offset, m_listener_right) / dist) : (0.0f);
+
+    if (e.gain > 0.0f) {
+      m_priorities.push_back(EmitterPriority(e.gain, I->first));
+    } else if (!e.loop) {
+      // One-shots out of earshot are not worth keeping
+      stopEmitter(e);
+      m_emitters.erase(I++);
+      continue;
+    } else {
+      stopEmitter(e);
+    }
+    ++I;
+  }
+
+  // Loudest first. Emitters beyond the voice limit lose their channel.
+  std::sort(m_priorities.begin(), m_priorities.end(), std::greater<EmitterPriority>());
+  const size_t voices = std::min((size_t)m_num_voices, m_priorities.size());
+  for (size_t i = voices; i < m_priorities.size(); ++i) {
+    EmitterMap::iterator J = m_emitters.find(m_priorities[i].second);
+    Emitter &e = J->second;
+    if (e.channel != -1) {
+      stopEmitter(e);
+      ++m_voices_stolen;
+    }
+    if (!e.loop) m_emitters.erase(J);
+  }
+
+  // Start the winners that have no voice and update their mix
+  for (size_t i = 0; i < voices; ++i) {
+    Emitter &e = m_emitters[m_priorities[i].second];
+    if (e.channel == -1) {
+      Mix_Chunk *sample = getSample(e.file_name);
+      // Still loading, try again next frame
+      if (sample == NULL) continue;
+      assert(!m_free_channels.empty());
+      e.channel = m_free_channels.back();
+      m_free_channels.pop_back();
+      Mix_PlayChannel(e.channel, sample, (e.loop) ? (-1) : (0));
+      e.started = true;
+    }
+
+    // Equal power panning
+    const float angle = (e.pan + 1.0f) * (float)M_PI / 4.0f;
+    Mix_SetPanning(e.channel, (Uint8)(255.0f * cosf(angle)), (Uint8)(255.0f * sinf(angle)));
+    Mix_Volume(e.channel, (int)(e.gain * MIX_MAX_VOLUME));
+  }
+}
+
+void Sound::cacheSample(const std::string &file_name, Mix_Chunk *chunk) {
+  assert(m_sample_cache.find(file_name) == m_sample_cache.end());
+  CachedSample cs;
+  cs.chunk = chunk;
+  cs.size = sizeof(Mix_Chunk) + chunk->alen;
+  m_lru.push_front(file_name);
+  cs.lru = m_lru.begin();
+  m_sample_cache[file_name] = cs;
+  m_cache_bytes += cs.size;
+}
+
+bool Sound::isPlaying(Mix_Chunk *chunk) const {
+  const int channels = Mix_AllocateChannels(-1);
+  for (int i = 0; i < channels; ++i) {
+    if (Mix_Playing(i) && Mix_GetChunk(i) == chunk) return true;
+  }
+  return false;
+}
+
+void Sound::evictSamples() {
+  // Walk from the least recently used end, skipping samples still playing
+  LRUList::iterator I = m_lru.end();
+  while (m_cache_bytes > m_cache_budget && I != m_lru.begin()) {
+    --I;
+    SampleCache::iterator J = m_sample_cache.find(*I);
+    assert(J != m_sample_cache.end());
+    if (isPlaying(J->second.chunk)) continue;
+
+    if (debug) printf("[Sound] Evicting %s\n", I->c_str());
+    Mix_FreeChunk(J->second.chunk);
+    m_cache_bytes -= J->second.size;
+    m_sample_cache.erase(J);
+    I = m_lru.erase(I);
+    ++m_evicted;
+  }
+}
+
+void Sound::addFailed(const std::string &file_name) {
+  // Keep the negative cache bounded, files can always be retried later
+  if (m_failed.size() >= MAX_failed) m_failed.clear();
+  m_failed.insert(file_name);
+}
+
 Mix_Chunk *Sound::getSample(const std::string &file_name) {
-  Mix_Chunk *sample = NULL;
-  sample = m_sound_map[file_name];
-  if (sample) return sample;
-  sample=Mix_LoadWAV(file_name.c_str());
-  if (sample) {
-    m_sound_map[file_name] = sample;
-    return sample;
+  SampleCache::iterator I = m_sample_cache.find(file_name);
+  if (I != m_sample_cache.end()) {
+    ++m_hits;
+    // Move to the front of the LRU list
+    m_lru.splice(m_lru.begin(), m_lru, I->second.lru);
+    return I->second.chunk;
   }
-  Log::writeLog(std::string("Mix_LoadWAV: ") + Mix_GetError(), Log::LOG_ERROR);
+
+  if (m_failed.find(file_name) != m_failed.end()) return NULL;
+
+  ++m_misses;
+  queueSample(file_name);
   return NULL;
 }
 
+void Sound::queueSample(const std::string &file_name) {
+  if (m_loading.find(file_name) != m_loading.end()) return;
+  m_loading.insert(file_name);
+  SDL_LockMutex(m_mutex);
+  m_load_queue.push_back(file_name);
+  SDL_CondSignal(m_cond);
+  SDL_UnlockMutex(m_mutex);
+}
+
+void Sound::preloadSample(const std::string &file_name) {
+  if (!m_initialised) return;
+  if (m_sample_cache.find(file_name) != m_sample_cache.end()) return;
+  if (m_failed.find(file_name) != m_failed.end()) return;
+  queueSample(file_name);
+}
+
 Mix_Music *Sound::getMusic(const std::string &file_name) {
-  Mix_Music *music = NULL;
-  music = m_music_map[file_name];
-  if (music) return music;
-  music=Mix_LoadMUS(file_name.c_str());
+  // Music is streamed, so opening it is cheap enough to do here
+  std::map<std::string, Mix_Music*>::const_iterator I = m_music_map.find(file_name);
+  if (I != m_music_map.end()) return I->second;
+  if (m_failed.find(file_name) != m_failed.end()) return NULL;
+
+  Mix_Music *music = Mix_LoadMUS(file_name.c_str());
   if (music) {
     m_music_map[file_name] = music;
     return music;
   }
   Log::writeLog(std::string("Mix_LoadMUS: ") + Mix_GetError(), Log::LOG_ERROR);
+  addFailed(file_name);
   return NULL;
 }
 
+void Sound::playSample(const std::string &file_name, int channel, int loops) {
+  if (!m_initialised) return;
+  Mix_Chunk *sample = getSample(file_name);
+  if (sample) {
+    Mix_PlayChannel(channel, sample, loops);
+  } else if (m_loading.find(file_name) != m_loading.end()) {
+    // Replace anything else waiting for this channel
+    PendingList::iterator I = m_pending.begin();
+    while (I != m_pending.end()) {
+      if (I->channel == channel) m_pending.erase(I++);
+      else ++I;
+    }
+    PendingPlay pp;
+    pp.file_name = file_name;
+    pp.channel = channel;
+    pp.loops = loops;
+    pp.requested = SDL_GetTicks();
+    m_pending.push_back(pp);
+  }
+}
+
 void Sound::playSound(const std::string &file_name) {
-  // load sample.wav in to sample
- Mix_Chunk *sample = getSample(file_name);
- Mix_PlayChannel(1, sample, 0);
+  playSample(file_name, CHANNEL_sound, 0);
 }
 
 void Sound::playSoundLoop(const std::string &file_name) {
-  // load sample.wav in to sample
- Mix_Chunk *sample = getSample(file_name);
- Mix_PlayChannel(2, sample, -1);
+  playSample(file_name, CHANNEL_loop, -1);
 }
 
 void Sound::stopSoundLoop() {
-  Mix_HaltChannel(2);
+  // Don't start a loop that is still loading
+  PendingList::iterator I = m_pending.begin();
+  while (I != m_pending.end()) {
+    if (I->channel == CHANNEL_loop) m_pending.erase(I++);
+    else ++I;
+  }
+  Mix_HaltChannel(CHANNEL_loop);
 }
 
 void Sound::playMusic(const std::string &file_name) {
-  // load sample.wav in to sample
  Mix_Music *music = getMusic(file_name);
- Mix_PlayMusic(music, 0);
+ if (music) Mix_PlayMusic(music, 0);
 }
 
 void Sound::stopMusic() {
   Mix_FadeOutMusic(100);
   Mix_RewindMusic();
-  
+
 }
+
+void Sound::setCacheBudget(size_t bytes) {
+  m_cache_budget = bytes;
+  evictSamples();
+}
+
 void Sound::registerCommands(Console *console) {
   console->registerCommand(PLAY_SOUND, this);
   console->registerCommand(PLAY_SOUND_LOOP, this);
@@ -126,6 +543,9 @@ void Sound::registerCommands(Console *console) {
   console->registerCommand(PLAY_MUSIC, this);
   console->registerCommand(STOP_MUSIC, this);
   console->registerCommand(ENABLE_SOUND, this);
+  console->registerCommand(SOUND_CACHE_BUDGET, this);
+  console->registerCommand(SOUND_CACHE_STATS, this);
+  console->registerCommand(SOUND_VOICES, this);
 }
 
 void Sound::runCommand(const std::string &command, const std::string &args) {
@@ -138,6 +558,28 @@ void Sound::runCommand(const std::string &command, const std::string &args) {
   {
     //setEnabled(args == "1");
   }
+  else if (command == SOUND_CACHE_BUDGET) {
+    // Budget is given in kilobytes
+    if (!args.empty()) setCacheBudget((size_t)atoi(args.c_str()) * 1024);
+    printf("Sound cache budget: %lu KB\n", (unsigned long)(m_cache_budget / 1024));
+  }
+  else if (command == SOUND_CACHE_STATS) {
+    printf("Samples: %lu Size: %lu KB Budget: %lu KB\n",
+           (unsigned long)m_sample_cache.size(),
+           (unsigned long)(m_cache_bytes / 1024),
+           (unsigned long)(m_cache_budget / 1024));
+    printf("Hits: %u Misses: %u Dropped: %u Evicted: %u Failed: %lu Loading: %lu\n",
+           m_hits, m_misses, m_dropped, m_evicted,
+           (unsigned long)m_failed.size(), (unsigned long)m_loading.size());
+  }
+  else if (command == SOUND_VOICES) {
+    if (!args.empty()) {
+      m_num_voices = std::max(0, std::min(atoi(args.c_str()), NUM_channels - NUM_reserved));
+    }
+    const int playing = NUM_channels - NUM_reserved - (int)m_free_channels.size();
+    printf("Emitters: %lu Voices: %d/%d Stolen: %u\n",
+           (unsigned long)m_emitters.size(), playing, m_num_voices, m_voices_stolen);
+  }
 }
 
 } /* namespace Sear */
@@ -9,19 +9,43 @@
 
 #include <string>
 #include <map>
+#include <set>
+#include <list>
+#include <deque>
+#include <vector>
+
+#include <wfmath/point.h>
+#include <wfmath/vector.h>
+#include <Eris/EntityRef.h>
 
 #include "interfaces/ConsoleObject.h"
 
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
 #ifdef __APPLE__
     #include <SDL_mixer/SDL_mixer.h>
 #else
     #include <SDL/SDL_mixer.h>
 #endif
-    
+
 namespace Sear {
 
 class Console;
-	
+class WorldEntity;
+
+/**
+ * Sound plays samples and music through SDL_mixer. Samples are decoded on
+ * a background thread the first time they are requested and played once
+ * ready, unless they arrive too late to be useful. Decoded samples are kept
+ * in an LRU cache limited to a memory budget, and files that fail to load
+ * are remembered so they are not retried.
+ *
+ * Positional sounds are played through emitters attached to world entities
+ * or fixed points. Each frame the emitters are attenuated and panned
+ * relative to the listener, and the loudest of them are given the available
+ * mixer voices.
+ */
 class Sound : public ConsoleObject {
 public:
   Sound();
@@ -30,25 +54,171 @@ public:
   void shutdown();
   bool isInitialised() const { return m_initialised; }
 
+  /**
+   * Collect samples decoded by the loader thread and start any sounds that
+   * were waiting for them. Should be called once a frame.
+   */
+  void update();
+
   void playSound(const std::string &);
   void playSoundLoop(const std::string &);
   void stopSoundLoop();
-  
+
   void playMusic(const std::string &);
   void stopMusic();
-  
+
+  /**
+   * Queue a sample for the loader thread so it is ready when first
+   * played. Samples already cached, loading or known to be missing are
+   * left alone.
+   */
+  void preloadSample(const std::string &file_name);
+
+  /**
+   * Set the memory budget for decoded samples in bytes. Samples are evicted
+   * least recently used first until the cache fits.
+   */
+  void setCacheBudget(size_t bytes);
+  size_t getCacheBudget() const { return m_cache_budget; }
+  size_t getCacheSize() const { return m_cache_bytes; }
+  size_t getNumSamples() const { return m_sample_cache.size(); }
+  unsigned int getCacheHits() const { return m_hits; }
+  unsigned int getCacheMisses() const { return m_misses; }
+
+  /**
+   * Whether any samples are queued for, or being decoded by, the loader
+   * thread and not yet collected by update.
+   */
+  bool isLoading() const { return !m_loading.empty(); }
+
+  typedef unsigned int EmitterID;
+
+  /**
+   * Attach a sound to an entity. Looping emitters play until removed or
+   * the entity goes away. One-shot emitters are removed once they finish,
+   * or if they do not get a voice.
+   * @param we Entity the sound comes from
+   * @param file_name Sample to play
+   * @param loop True to loop the sample
+   * @param volume Volume at the reference distance, 0.0 to 1.0
+   * @return ID of the new emitter
+   */
+  EmitterID addEmitter(WorldEntity *we, const std::string &file_name, bool loop, float volume = 1.0f);
+
+  /**
+   * Attach a sound to a fixed point in the world.
+   */
+  EmitterID addEmitter(const WFMath::Point<3> &pos, const std::string &file_name, bool loop, float volume = 1.0f);
+  void removeEmitter(EmitterID id);
+
+  /**
+   * Get the mix of an emitter from the last update.
+   * @param gain Volume after distance attenuation
+   * @param pan -1.0 for left to 1.0 for right
+   * @param voice True if the emitter has a mixer voice
+   * @return False if there is no such emitter
+   */
+  bool getEmitterMix(EmitterID id, float &gain, float &pan, bool &voice) const;
+
+  /**
+   * Set the listener position and direction, normally the camera.
+   * @param pos Listener position
+   * @param forward Direction the listener faces
+   * @param up Up direction of the listener
+   */
+  void setListener(const WFMath::Point<3> &pos, const WFMath::Vector<3> &forward, const WFMath::Vector<3> &up);
+
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
 private:
+  typedef std::list<std::string> LRUList;
 
+  typedef struct {
+    Eris::EntityRef entity;
+    bool fixed; ///< True if the emitter stays at pos rather than following entity
+    WFMath::Point<3> pos;
+    std::string file_name;
+    bool loop;
+    float volume;
+    float gain; ///< Volume after distance attenuation this frame
+    float pan; ///< -1.0 for left to 1.0 for right
+    int channel; ///< Mixer channel, or -1 when it has no voice
+    bool started; ///< Whether a one-shot has been played
+  } Emitter;
+  typedef std::map<EmitterID, Emitter> EmitterMap;
+  typedef std::pair<float, EmitterID> EmitterPriority;
+
+  typedef struct {
+    Mix_Chunk *chunk;
+    size_t size;
+    LRUList::iterator lru;
+  } CachedSample;
+  typedef std::map<std::string, CachedSample> SampleCache;
+
+  typedef struct {
+    std::string file_name;
+    int channel;
+    int loops;
+    unsigned int requested;
+  } PendingPlay;
+  typedef std::list<PendingPlay> PendingList;
+
+  typedef std::pair<std::string, Mix_Chunk*> LoadedSample;
+
+  static int loaderThread(void *data);
+  void loaderLoop();
+
+  /**
+   * Returns the sample if it is in the cache. Otherwise queues it for
+   * loading, unless it is known to be missing, and returns NULL.
+   */
   Mix_Chunk *getSample(const std::string &file_name);
   Mix_Music *getMusic(const std::string &file_name);
+  void queueSample(const std::string &file_name);
+
+  void playSample(const std::string &file_name, int channel, int loops);
+  void cacheSample(const std::string &file_name, Mix_Chunk *chunk);
+  void evictSamples();
+  bool isPlaying(Mix_Chunk *chunk) const;
+  void addFailed(const std::string &file_name);
+
+  EmitterID addEmitter(const Emitter &emitter);
+  void updateEmitters();
+  void stopEmitter(Emitter &emitter);
+
+  SampleCache m_sample_cache;
+  LRUList m_lru; ///< Most recently used at the front
+  size_t m_cache_bytes;
+  size_t m_cache_budget;
+
+  std::set<std::string> m_failed; ///< Files that could not be loaded
+  std::set<std::string> m_loading; ///< Files queued or being decoded
+  PendingList m_pending;
 
-  std::map<std::string, Mix_Chunk*> m_sound_map;
   std::map<std::string, Mix_Music*> m_music_map;
+
+  EmitterMap m_emitters;
+  EmitterID m_emitter_counter;
+  std::vector<EmitterPriority> m_priorities;
+  std::vector<int> m_free_channels;
+  int m_num_voices;
+  WFMath::Point<3> m_listener_pos;
+  WFMath::Vector<3> m_listener_right;
+  unsigned int m_voices_stolen;
+
+  // Shared with the loader thread, protected by m_mutex
+  SDL_Thread *m_thread;
+  SDL_mutex *m_mutex;
+  SDL_cond *m_cond;
+  std::deque<std::string> m_load_queue;
+  std::deque<LoadedSample> m_loaded;
+  bool m_quit;
+
+  unsigned int m_hits, m_misses, m_dropped, m_evicted;
+
   bool m_initialised;
 };
-  
+
 } /* namespace Sear */
 
 #endif /* SEAR_SOUND_H */
@@ -0,0 +1,226 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+
+#include "common/Log.h"
+
+#include "StartupGraph.h"
+
+namespace Sear {
+
+StartupGraph::StartupGraph() :
+  m_run_time(0),
+  m_mutex(NULL),
+  m_cond(NULL),
+  m_running(0),
+  m_done(0),
+  m_failed(false),
+  m_quit(false),
+  m_start_ticks(0)
+{
+}
+
+StartupGraph::~StartupGraph() {
+  assert(m_mutex == NULL);
+}
+
+StartupGraph::TaskID StartupGraph::addTask(const std::string &name, const Step &step, bool main_thread) {
+  Task task;
+  task.name = name;
+  task.step = step;
+  task.main_thread = main_thread;
+  task.waiting = 0;
+  task.done = false;
+  task.succeeded = false;
+  task.on_worker = false;
+  task.start = task.end = 0;
+  m_tasks.push_back(task);
+  return m_tasks.size() - 1;
+}
+
+void StartupGraph::addDependency(TaskID task, TaskID dependency) {
+  // Dependencies must already exist, so there can be no cycles
+  assert(dependency < task);
+  m_tasks[task].dependencies.push_back(dependency);
+  m_tasks[dependency].dependents.push_back(task);
+}
+
+bool StartupGraph::finished() const {
+  return m_done == m_tasks.size() || (m_failed && m_running == 0);
+}
+
+bool StartupGraph::run(unsigned int workers) {
+  m_start_ticks = SDL_GetTicks();
+  m_main_queue.clear();
+  m_worker_queue.clear();
+  m_running = 0;
+  m_done = 0;
+  m_failed = false;
+  m_quit = false;
+
+  for (size_t i = 0; i < m_tasks.size(); ++i) {
+    Task &task = m_tasks[i];
+    task.waiting = task.dependencies.size();
+    task.done = false;
+    task.succeeded = false;
+    if (task.waiting == 0) {
+      if (task.main_thread) m_main_queue.push_back(i);
+      else m_worker_queue.push_back(i);
+    }
+  }
+
+  m_mutex = SDL_CreateMutex();
+  m_cond = SDL_CreateCond();
+
+  std::vector<SDL_Thread*> threads;
+  for (unsigned int i = 0; i < workers; ++i) {
+    SDL_Thread *thread = SDL_CreateThread(&StartupGraph::workerThread, this);
+    if (thread == NULL) {
+      Log::writeLog(std::string("Error creating startup thread: ") + SDL_GetError(), Log::LOG_ERROR);
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  SDL_LockMutex(m_mutex);
+  while (!finished()) {
+    TaskID id = -1;
+    if (!m_failed) {
+      if (!m_main_queue.empty()) {
+        id = m_main_queue.front();
+        m_main_queue.pop_front();
+      } else if (threads.empty() && !m_worker_queue.empty()) {
+        // No workers, so do their steps too
+        id = m_worker_queue.front();
+        m_worker_queue.pop_front();
+      }
+    }
+    if (id == -1) {
+      SDL_CondWait(m_cond, m_mutex);
+      continue;
+    }
+    execute(id, false);
+  }
+  m_quit = true;
+  SDL_CondBroadcast(m_cond);
+  SDL_UnlockMutex(m_mutex);
+
+  for (size_t i = 0; i < threads.size(); ++i) {
+    SDL_WaitThread(threads[i], NULL);
+  }
+
+  SDL_DestroyCond(m_cond);
+  SDL_DestroyMutex(m_mutex);
+  m_cond = NULL;
+  m_mutex = NULL;
+
+  m_run_time = SDL_GetTicks() - m_start_ticks;
+  return !m_failed;
+}
+
+int StartupGraph::workerThread(void *data) {
+  static_cast<StartupGraph*>(data)->workerLoop();
+  return 0;
+}
+
+void StartupGraph::workerLoop() {
+  SDL_LockMutex(m_mutex);
+  while (!m_quit) {
+    if (m_failed || m_worker_queue.empty()) {
+      SDL_CondWait(m_cond, m_mutex);
+      continue;
+    }
+    TaskID id = m_worker_queue.front();
+    m_worker_queue.pop_front();
+    execute(id, true);
+  }
+  SDL_UnlockMutex(m_mutex);
+}
+
+void StartupGraph::execute(TaskID id, bool on_worker) {
+  // Called with m_mutex locked. The step itself runs without it.
+  Task &task = m_tasks[id];
+  ++m_running;
+  task.on_worker = on_worker;
+  task.start = SDL_GetTicks() - m_start_ticks;
+  SDL_UnlockMutex(m_mutex);
+
+  bool succeeded = false;
+  try {
+    succeeded = task.step();
+  } catch (...) {
+    Log::writeLog("Startup step " + task.name + " threw an exception", Log::LOG_ERROR);
+  }
+
+  SDL_LockMutex(m_mutex);
+  task.end = SDL_GetTicks() - m_start_ticks;
+  task.done = true;
+  task.succeeded = succeeded;
+  --m_running;
+  ++m_done;
+
+  if (!succeeded) {
+    Log::writeLog("Startup step failed: " + task.name, Log::LOG_ERROR);
+    m_failed = true;
+  } else {
+    for (size_t i = 0; i < task.dependents.size(); ++i) {
+      Task &dependent = m_tasks[task.dependents[i]];
+      if (--dependent.waiting == 0) {
+        if (dependent.main_thread) m_main_queue.push_back(task.dependents[i]);
+        else m_worker_queue.push_back(task.dependents[i]);
+      }
+    }
+  }
+  SDL_CondBroadcast(m_cond);
+}
+
+void StartupGraph::printReport() const {
+  printf("Startup took %u ms\n", m_run_time);
+
+  unsigned int total = 0;
+  TaskID last = -1;
+  for (size_t i = 0; i < m_tasks.size(); ++i) {
+    const Task &task = m_tasks[i];
+    if (!task.done) {
+      printf("  %-20s not run\n", task.name.c_str());
+      continue;
+    }
+    printf("  %-20s %-6s %5u - %5u ms (%u ms)%s\n", task.name.c_str(),
+           task.on_worker ? "worker" : "main", task.start, task.end,
+           task.end - task.start, task.succeeded ? "" : " failed");
+    total += task.end - task.start;
+    if (last == -1 || task.end >= m_tasks[last].end) last = i;
+  }
+  printf("Time in steps: %u ms\n", total);
+  if (last == -1) return;
+
+  // Follow the last dependency to finish back from the last step to
+  // finish. Gaps between steps on the path were spent waiting for the
+  // main thread.
+  std::vector<TaskID> path;
+  for (TaskID id = last; id != -1; ) {
+    path.push_back(id);
+    const Task &task = m_tasks[id];
+    TaskID next = -1;
+    for (size_t i = 0; i < task.dependencies.size(); ++i) {
+      const TaskID dep = task.dependencies[i];
+      if (next == -1 || m_tasks[dep].end > m_tasks[next].end) next = dep;
+    }
+    id = next;
+  }
+  std::reverse(path.begin(), path.end());
+
+  printf("Critical path:");
+  for (size_t i = 0; i < path.size(); ++i) {
+    const Task &task = m_tasks[path[i]];
+    printf("%s %s (%u ms)", (i == 0) ? "" : " ->", task.name.c_str(),
+           task.end - task.start);
+  }
+  printf("\n");
+}
+
+} /* namespace Sear */
@@ -0,0 +1,99 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_STARTUPGRAPH_H
+#define SEAR_STARTUPGRAPH_H 1
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <SDL/SDL.h>
+#include <sigc++/slot.h>
+
+namespace Sear {
+
+/**
+ * The StartupGraph runs the steps of starting up in dependency order. Steps
+ * that only use their own data can run on a pool of worker threads while the
+ * main thread carries on with the rest, such as anything using OpenGL, SDL
+ * video or the console. Each step is timed, and the report shows the chain
+ * of steps that decided how long startup took.
+ */
+class StartupGraph {
+public:
+  typedef sigc::slot<bool> Step; ///< Returns false if startup should stop
+  typedef int TaskID;
+
+  StartupGraph();
+  ~StartupGraph();
+
+  /**
+   * Add a step.
+   * @param main_thread True if the step must run on the main thread
+   * @return ID used to make other steps depend on this one
+   */
+  TaskID addTask(const std::string &name, const Step &step, bool main_thread);
+
+  /**
+   * Make a step wait until another has finished. The other step must have
+   * been added first.
+   */
+  void addDependency(TaskID task, TaskID dependency);
+
+  /**
+   * Run all steps. If a step fails no more steps are started, and the
+   * running ones are waited for.
+   * @param workers Number of worker threads. With none, worker steps run on
+   *                the main thread.
+   * @return True if every step succeeded
+   */
+  bool run(unsigned int workers);
+
+  /**
+   * Print the timing of each step and the critical path.
+   */
+  void printReport() const;
+
+private:
+  typedef struct {
+    std::string name;
+    Step step;
+    bool main_thread;
+    std::vector<TaskID> dependencies;
+    std::vector<TaskID> dependents;
+    unsigned int waiting; ///< Dependencies not yet finished
+    bool done;
+    bool succeeded;
+    bool on_worker; ///< Ran on a worker thread
+    unsigned int start, end; ///< Milliseconds since the start of run
+  } Task;
+
+  static int workerThread(void *data);
+  void workerLoop();
+  void execute(TaskID id, bool on_worker);
+  bool finished() const;
+
+  std::vector<Task> m_tasks;
+  unsigned int m_run_time;
+
+  // Shared with the worker threads, protected by m_mutex
+  SDL_mutex *m_mutex;
+  SDL_cond *m_cond;
+  std::deque<TaskID> m_main_queue;
+  std::deque<TaskID> m_worker_queue;
+  unsigned int m_running;
+  unsigned int m_done;
+  bool m_failed;
+  bool m_quit;
+  unsigned int m_start_ticks;
+
+  // Not copyable, owns threads while running
+  StartupGraph(const StartupGraph&);
+  StartupGraph &operator=(const StartupGraph&);
+};
+
+} /* namespace Sear */
+
+#endif /* SEAR_STARTUPGRAPH_H */
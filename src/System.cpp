@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <fstream>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sigc++/object_slot.h>
@@ -29,6 +30,7 @@
 #include "renderers/RenderSystem.h"
 #include "environment/Environment.h"
 #include "loaders/ModelSystem.h"
+#include "loaders/ModelHandler.h"
 
 #include "ActionHandler.h"
 #include "Bindings.h"
@@ -38,7 +40,7 @@
 #include "client.h"
 #include "Console.h"
 #include "FileHandler.h"
-//#include "Sound.h"
+#include "Sound.h"
 #include "ScriptEngine.h"
 #include "swig/lua/LuaScriptEngine.h"
 #include "MediaManager.h"
@@ -46,6 +48,7 @@
 #include "WorldEntity.h"
 #include "Editor.h"
 #include "CacheManager.h"
+#include "StartupGraph.h"
 #include "Eris/Localserver.h"
 
 #ifdef DEBUG
@@ -61,6 +64,15 @@ namespace Sear {
   static const std::string SCRIPTS_DIR = "scripts";
   static const std::string STARTUP_SCRIPT = "startup.script";
   static const std::string SHUTDOWN_SCRIPT = "shutdown.script";
+  static const std::string RUN_SCRIPT = "run_script";
+  static const std::string LOAD_PREFIX = "load_";
+  static const std::string PLAY_SOUND = "play_sound";
+  static const std::string PLAY_SOUND_LOOP = "play_sound_loop";
+
+  // Worker threads used during startup
+  static const unsigned int NUM_startup_workers = 2;
+  // How deeply startup scripts are followed when looking for config files
+  static const int MAX_script_depth = 8;
 
   // Console commands
   static const std::string CMD_EXIT = "exit";
@@ -76,12 +88,17 @@ namespace Sear {
   static const std::string CMD_SAVE_KEY_BINDINGS = "save_bindings";
   static const std::string CMD_READ_CONFIG = "read_config";
   static const std::string CMD_BIND_KEY = "bind";
+  static const std::string CMD_BIND_GUI_KEY = "bind_gui";
   static const std::string CMD_KEY_PRESS = "keypress";
   static const std::string CMD_TOGGLE_MLOOK = "toggle_mlook";
   static const std::string CMD_ADD_EVENT = "event";
   static const std::string CMD_IDENTIFY_ENTITY = "identify";
   static const std::string CMD_DUMP_ATTRIBUTES = "dump_attributes";
   static const std::string CMD_reload_configs = "reload_configs";
+  static const std::string CMD_startup_report = "startup_report";
+  static const std::string CMD_log_level = "log_level";
+  static const std::string CMD_log_file = "log_file";
+  static const std::string CMD_log_stats = "log_stats";
 
   // Config key values  
   static const std::string KEY_mouse_move_select = "mouse_move_select";
@@ -159,104 +176,82 @@ System::~System() {
 bool System::init(int argc, char *argv[]) {
   assert (m_initialised == false);
 
-  if (!initVideo()) return false;
+  // Write log messages from their own thread from now on
+  Log::start();
 
-  m_script_engine = std::auto_ptr<ScriptEngine>(new ScriptEngine());
-  m_script_engine->init();
+  // SDL is started first, as it also starts the clock used to time the
+  // steps below.
+  if (!initVideo()) {
+    // Write out the queued errors before main exits
+    Log::stop();
+    return false;
+  }
 
-  m_lua_script_engine = std::auto_ptr<LuaScriptEngine>(new LuaScriptEngine());
-  m_lua_script_engine->init();
+  // Startup is run as a graph of steps. Steps that only read files and
+  // fill in their own data run on worker threads, the rest, including
+  // anything touching SDL video, OpenGL or the console, on this thread.
+  // The FileHandler and CacheManager may be used from any thread.
+  m_startup_graph = std::auto_ptr<StartupGraph>(new StartupGraph());
+  StartupGraph &graph = *m_startup_graph;
+  typedef StartupGraph::TaskID TaskID;
 
-  // Pass client name and version when creating a connection
-  m_client = std::auto_ptr<Client>(new Client(this, PACKAGE_VERSION));
-  if (!m_client->init()) {
-    Log::writeLog("Error initializing Eris", Log::LOG_ERROR);
+  const TaskID cache = graph.addTask("cache", sigc::mem_fun(this, &System::initCache), false);
 
-    m_client.reset(0);
-    m_script_engine.reset(0);
-    m_lua_script_engine.reset(0);
+  const TaskID index = graph.addTask("index_configs", sigc::mem_fun(this, &System::indexStartupConfigs), true);
+  // Configs already in the cache are read from it rather than parsed
+  const TaskID parse = graph.addTask("parse_configs", sigc::mem_fun(this, &System::parseStartupConfigs), false);
+  graph.addDependency(parse, index);
+  graph.addDependency(parse, cache);
 
-    return false;
-  }
-  
-  m_action_handler = std::auto_ptr<ActionHandler>(new ActionHandler(this));
-  m_action_handler->init();
+  const TaskID scripting = graph.addTask("scripting", sigc::mem_fun(this, &System::initScripting), false);
 
-  m_character_manager = std::auto_ptr<CharacterManager>(new CharacterManager());
-  m_character_manager->init();
+  const TaskID client = graph.addTask("client", sigc::mem_fun(this, &System::initClient), true);
 
-  m_calendar = std::auto_ptr<Calendar>(new Calendar());
-  m_calendar->init();
+  const TaskID managers = graph.addTask("managers", sigc::mem_fun(this, &System::initManagers), true);
+  graph.addDependency(managers, client);
 
-  m_media_manager = std::auto_ptr<MediaManager>(new MediaManager());
-  m_media_manager->init();
+  const TaskID console = graph.addTask("console", sigc::mem_fun(this, &System::initConsole), true);
+  graph.addDependency(console, scripting);
+  graph.addDependency(console, managers);
 
-  m_local_server = std::auto_ptr<Localserver>(new Localserver());
-  m_local_server->init();
- 
-  // Connect signals for record processing 
-//  m_general.sigsv.connect(sigc::mem_fun(this, &System::varconf_callback));
-  
-  // Connect signals for error messages
-  m_general.sige.connect(sigc::mem_fun(this, &System::varconf_error_callback));
-  
-  Bindings::init();
+  // Opening the audio device and decoding the samples the startup scripts
+  // play is left to a worker and the sound loader thread. Only the
+  // commands are registered here.
+  const TaskID sound = graph.addTask("sound", sigc::mem_fun(this, &System::initSound), false);
+  graph.addDependency(sound, index);
 
-  Bindings::bind("backquote", "/toggle_console");
-  Bindings::bind("caret", "/toggle_console");
-  
-  m_console = std::auto_ptr<Console>(new Console(this));
-  m_console->init();
-  registerCommands(m_console.get());
+  const TaskID sound_commands = graph.addTask("sound_commands", sigc::mem_fun(this, &System::registerSoundCommands), true);
+  graph.addDependency(sound_commands, sound);
+  graph.addDependency(sound_commands, console);
 
-  m_client->registerCommands(m_console.get());
-  m_script_engine->registerCommands(m_console.get());
-  m_lua_script_engine->registerCommands(m_console.get());
-  m_action_handler->registerCommands(m_console.get());
-  m_file_handler->registerCommands(m_console.get());
-  m_calendar->registerCommands(m_console.get());
-  m_media_manager->registerCommands(m_console.get());
-  m_local_server->registerCommands(m_console.get());
+  // Needs to be ready before any textures or models are loaded
+  const TaskID render = graph.addTask("render_system", sigc::mem_fun(this, &System::initRenderSystem), true);
+  graph.addDependency(render, cache);
+  graph.addDependency(render, console);
 
-  m_character_manager->registerCommands(m_console.get());
+  const TaskID models = graph.addTask("model_system", sigc::mem_fun(this, &System::initModelSystem), true);
+  graph.addDependency(models, render);
 
-  m_editor = std::auto_ptr<Editor>(new Editor());
-  m_editor->registerCommands(m_console.get());
+  const TaskID environment = graph.addTask("environment", sigc::mem_fun(this, &System::initEnvironment), true);
+  graph.addDependency(environment, models);
 
-  m_workarea = std::auto_ptr<Workarea>(new Workarea(this));
+  const TaskID scripts = graph.addTask("startup_scripts", sigc::mem_fun(this, &System::runStartupScripts), true);
+  graph.addDependency(scripts, environment);
+  graph.addDependency(scripts, sound_commands);
 
-#if 0
-  m_sound = std::auto_ptr<Sound>(new Sound());
-  if (m_sound->init()) {
-    m_sound.reset(0);
-  } else { 
-    m_sound->registerCommands(m_console.get());
-  }
-#else
- // #warning Sound Disabled
-#endif
-  RenderSystem::getInstance().init();
-  RenderSystem::getInstance().registerCommands(m_console.get());
-  ModelSystem::getInstance().init();
-  ModelSystem::getInstance().registerCommands(m_console.get());
-//  CacheManager::getInstance().init();
-
-  // Register StaticObject with CacheManager
-//  StaticObject *so = new StaticObject();
-//  CacheManager::getInstance().addType(so);
-//  delete so;
-  
- 
-  Environment::getInstance().init();
-  Environment::getInstance().registerCommands(m_console.get());
+  const bool success = graph.run(NUM_startup_workers);
+  // Parsed configs the scripts did not read are not needed
+  m_file_handler->clearParsedConfigs();
+  if (debug) graph.printReport();
 
-  if (debug) Log::writeLog("Running startup scripts", Log::LOG_INFO);
+  if (!success) {
+    m_sound.reset(0);
+    m_client.reset(0);
+    m_script_engine.reset(0);
+    m_lua_script_engine.reset(0);
 
-  FileHandler::FileSet startup_scripts = m_file_handler->getAllinSearchPaths(STARTUP_SCRIPT);
-  FileHandler::FileSet::const_iterator I = startup_scripts.begin();
-  FileHandler::FileSet::const_iterator Iend = startup_scripts.end();
-  for (; I != Iend; ++I) {
-    m_script_engine->runScript(*I);
+    Log::stop();
+    return false;
   }
 
   // Pass command line into general varconf object for processing
@@ -328,7 +323,7 @@ bool System::init(int argc, char *argv[]) {
     m_workarea.reset(0);
     m_character_manager.reset(0);
     m_media_manager.reset(0);
-    //m_sound.reset(0);
+    m_sound.reset(0);
 
     Bindings::shutdown();
 
@@ -340,6 +335,7 @@ bool System::init(int argc, char *argv[]) {
 
     Eris::execDeleteLaters();
 
+    Log::stop();
     return false;
   }
 
@@ -408,16 +404,20 @@ void System::shutdown() {
   m_lua_script_engine.reset(0);
   m_script_engine.reset(0);
 
+  if (CacheManager::getInstance().isInitialised()) {
+    CacheManager::getInstance().shutdown();
+  }
+
+  // The sound loader thread reads through the file handler
+  m_sound.reset(0);
+
   m_file_handler.reset(0);
 
   // TODO: Release does not delete object! 
   m_console.reset(0);
  
-  //m_sound.reset(0);
-  //
   m_workarea.reset(0);
 
-//  CacheManager::getInstance().shutdown();
   ModelSystem::getInstance().shutdown(); 
   Environment::getInstance().shutdown();
   RenderSystem::getInstance().destroyWindow();
@@ -437,16 +437,201 @@ void System::shutdown() {
 
   m_initialised = false;
   printf("[System] Finished Shutdown\n");
+
+  Log::stop();
+}
+
+bool System::indexStartupConfigs() {
+  m_startup_configs.clear();
+  m_startup_samples.clear();
+  FileHandler::FileSet startup_scripts = m_file_handler->getAllinSearchPaths(STARTUP_SCRIPT);
+  FileHandler::FileSet::const_iterator I = startup_scripts.begin();
+  FileHandler::FileSet::const_iterator Iend = startup_scripts.end();
+  for (; I != Iend; ++I) {
+    indexScript(*I, 0);
+  }
+  return true;
+}
+
+void System::indexScript(const std::string &file_name, int depth) {
+  // Guard against scripts that run themselves
+  if (depth > MAX_script_depth) return;
+
+  std::string script = file_name;
+  m_file_handler->getFilePath(script);
+  std::ifstream script_file(script.c_str());
+
+  // Find the files given to load commands, the samples played, and the
+  // scripts they run. The paths are worked out now, which may not match
+  // what the commands see if the scripts change variables, in which case a
+  // parsed file is not used.
+  std::string line;
+  while (std::getline(script_file, line)) {
+    line = line.substr(0, line.find_first_of("#\r"));
+    Tokeniser tokeniser;
+    tokeniser.initTokens(line);
+    std::string command = tokeniser.nextToken();
+    std::string args = tokeniser.remainingTokens();
+    if (command.empty() || args.empty()) continue;
+    if (command[0] == '/') command = command.substr(1);
+
+    if (command == RUN_SCRIPT) {
+      indexScript(args, depth + 1);
+    } else if (command.compare(0, LOAD_PREFIX.size(), LOAD_PREFIX) == 0) {
+      m_file_handler->getFilePath(args);
+      m_startup_configs.push_back(args);
+    } else if (command == PLAY_SOUND || command == PLAY_SOUND_LOOP) {
+      // Sound looks samples up by the name it is given
+      m_startup_samples.push_back(args);
+    }
+  }
+}
+
+bool System::parseStartupConfigs() {
+  // Runs on a worker thread. Only the file names found by
+  // indexStartupConfigs are used, and results are held by the FileHandler
+  // until the startup scripts read the files.
+  for (size_t i = 0; i < m_startup_configs.size(); ++i) {
+    m_file_handler->preparseConfigFile(m_startup_configs[i]);
+  }
+  return true;
+}
+
+bool System::initScripting() {
+  m_script_engine = std::auto_ptr<ScriptEngine>(new ScriptEngine());
+  m_script_engine->init();
+
+  m_lua_script_engine = std::auto_ptr<LuaScriptEngine>(new LuaScriptEngine());
+  m_lua_script_engine->init();
+  return true;
+}
+
+bool System::initCache() {
+  CacheManager::getInstance().init();
+  return true;
+}
+
+bool System::initClient() {
+  // Pass client name and version when creating a connection
+  m_client = std::auto_ptr<Client>(new Client(this, PACKAGE_VERSION));
+  if (!m_client->init()) {
+    Log::writeLog("Error initializing Eris", Log::LOG_ERROR);
+    return false;
+  }
+  return true;
+}
+
+bool System::initManagers() {
+  m_action_handler = std::auto_ptr<ActionHandler>(new ActionHandler(this));
+  m_action_handler->init();
+
+  m_character_manager = std::auto_ptr<CharacterManager>(new CharacterManager());
+  m_character_manager->init();
+
+  m_calendar = std::auto_ptr<Calendar>(new Calendar());
+  m_calendar->init();
+
+  m_media_manager = std::auto_ptr<MediaManager>(new MediaManager());
+  m_media_manager->init();
+
+  m_local_server = std::auto_ptr<Localserver>(new Localserver());
+  m_local_server->init();
+ 
+  // Connect signals for record processing 
+//  m_general.sigsv.connect(sigc::mem_fun(this, &System::varconf_callback));
+  
+  // Connect signals for error messages
+  m_general.sige.connect(sigc::mem_fun(this, &System::varconf_error_callback));
+  
+  Bindings::init();
+
+  Bindings::bind("backquote", "/toggle_console");
+  Bindings::bind("caret", "/toggle_console");
+  return true;
+}
+
+bool System::initConsole() {
+  m_console = std::auto_ptr<Console>(new Console(this));
+  m_console->init();
+  registerCommands(m_console.get());
+
+  m_client->registerCommands(m_console.get());
+  m_script_engine->registerCommands(m_console.get());
+  m_lua_script_engine->registerCommands(m_console.get());
+  m_action_handler->registerCommands(m_console.get());
+  m_file_handler->registerCommands(m_console.get());
+  m_calendar->registerCommands(m_console.get());
+  m_media_manager->registerCommands(m_console.get());
+  m_local_server->registerCommands(m_console.get());
+
+  m_character_manager->registerCommands(m_console.get());
+
+  m_editor = std::auto_ptr<Editor>(new Editor());
+  m_editor->registerCommands(m_console.get());
+
+  m_workarea = std::auto_ptr<Workarea>(new Workarea(this));
+  return true;
+}
+
+bool System::initSound() {
+  // Runs on a worker thread. SDL itself was started by initVideo.
+  // Carry on without sound if there is no audio device.
+  m_sound = std::auto_ptr<Sound>(new Sound());
+  if (m_sound->init()) {
+    m_sound.reset(0);
+    return true;
+  }
+  for (size_t i = 0; i < m_startup_samples.size(); ++i) {
+    m_sound->preloadSample(m_startup_samples[i]);
+  }
+  return true;
+}
+
+bool System::registerSoundCommands() {
+  if (m_sound.get()) m_sound->registerCommands(m_console.get());
+  return true;
+}
+
+bool System::initRenderSystem() {
+  CacheManager::getInstance().registerCommands(m_console.get());
+
+  RenderSystem::getInstance().init();
+  RenderSystem::getInstance().registerCommands(m_console.get());
+  return true;
+}
+
+bool System::initModelSystem() {
+  ModelSystem::getInstance().init();
+  ModelSystem::getInstance().registerCommands(m_console.get());
+  return true;
+}
+
+bool System::initEnvironment() {
+  Environment::getInstance().init();
+  Environment::getInstance().registerCommands(m_console.get());
+  return true;
+}
+
+bool System::runStartupScripts() {
+  if (debug) Log::writeLog("Running startup scripts", Log::LOG_INFO);
+
+  FileHandler::FileSet startup_scripts = m_file_handler->getAllinSearchPaths(STARTUP_SCRIPT);
+  FileHandler::FileSet::const_iterator I = startup_scripts.begin();
+  FileHandler::FileSet::const_iterator Iend = startup_scripts.end();
+  for (; I != Iend; ++I) {
+    m_script_engine->runScript(*I);
+  }
+  return true;
 }
 
 bool System::initVideo() {
   if (debug) Log::writeLog("Initialising Video", Log::LOG_INFO);
 #ifdef DEBUG
   // NOPARACHUTE means SDL doesn't handle any errors allowing us to catch them in a debugger. However, this can cause other problems!
-  if (SDL_Init(SDL_INIT_JOYSTICK | SDL_INIT_NOPARACHUTE) < 0 ) {
+  if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_JOYSTICK | SDL_INIT_NOPARACHUTE) < 0 ) {
 #else
   // We want release versions to die quietly
-  if (SDL_Init(SDL_INIT_JOYSTICK) < 0 ) {
+  if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_JOYSTICK) < 0 ) {
 #endif
     Log::writeLog(std::string("Unable to init SDL: ") + string_fmt(SDL_GetError()), Log::LOG_ERROR);
     return false;
@@ -489,8 +674,24 @@ void System::mainLoop() {
       if (checkState(SYS_IN_WORLD)) {
         m_calendar->update();
       }
+      // Load some of the models queued while drawing the last frame
+      ModelHandler *model_handler = ModelSystem::getInstance().getModelHandler();
+      model_handler->loadPendingModels();
+      // Unload models not drawn recently if over the memory budget
+      model_handler->checkMemoryBudget();
       // draw scene
       RenderSystem::getInstance().drawScene(false, m_elapsed);
+      if (m_sound.get()) {
+        // Hear the world from the camera drawn this frame
+        if (checkState(SYS_IN_WORLD)) {
+          WFMath::Point<3> pos;
+          WFMath::Vector<3> forward, up;
+          RenderSystem::getInstance().getGraphics()->getCameraFrame(pos, forward, up);
+          m_sound->setListener(pos, forward, up);
+        }
+        // Start sounds whose samples have finished loading
+        m_sound->update();
+      }
     } catch (Eris::InvalidOperation io) {
       Log::writeLog(io._msg, Log::LOG_ERROR);
       pushMessage(io._msg, CONSOLE_MESSAGE);
@@ -509,6 +710,12 @@ void System::handleEvents(const SDL_Event &event) {
   if (!m_console->consoleStatus()) {
     try {
       if (m_workarea->handleEvent(event)) {
+        // A widget has the keyboard, so only the GUI bindings apply
+        if (event.type == SDL_KEYDOWN) {
+          Bindings::keyDown(event.key.keysym, Bindings::CONTEXT_GUI);
+        } else if (event.type == SDL_KEYUP) {
+          Bindings::keyUp(event.key.keysym);
+        }
         return;
       }
     } catch (gcn::Exception &e) {
@@ -604,22 +811,20 @@ void System::handleEvents(const SDL_Event &event) {
             (event.key.keysym.sym == SDLK_F15) ||
             (event.key.keysym.sym == SDLK_ESCAPE))
         {
-          runCommand(Bindings::getBinding(Bindings::idToString((int)event.key.keysym.sym)));
-        } else {
+          if (!Bindings::keyDown(event.key.keysym, Bindings::CONTEXT_GUI)) {
+            Bindings::keyDown(event.key.keysym, Bindings::CONTEXT_WORLD);
+          }
+        } else if (!Bindings::keyDown(event.key.keysym, Bindings::CONTEXT_GUI)) {
           m_console->vHandleInput(event.key.keysym.sym, event.key.keysym.unicode);
         }
       } else {
-        runCommand(Bindings::getBindingForKeysym(event.key.keysym));
+        Bindings::keyDown(event.key.keysym, Bindings::CONTEXT_WORLD);
       }
       break;
     }
     case SDL_KEYUP: {
-      if (!m_console->consoleStatus()) {
-        char *binding = (char *) Bindings::getBindingForKeysym(event.key.keysym).c_str();
-        if (binding[0] == '+') {
-          runCommand("-" + std::string(++binding));
-        }
-      }
+      // Released with whichever binding the key was pressed with
+      Bindings::keyUp(event.key.keysym);
       break;
     }
     
@@ -915,12 +1120,17 @@ void System::registerCommands(Console *console) {
   console->registerCommand(CMD_SAVE_KEY_BINDINGS, this);
   console->registerCommand(CMD_READ_CONFIG, this);
   console->registerCommand(CMD_BIND_KEY, this);
+  console->registerCommand(CMD_BIND_GUI_KEY, this);
   console->registerCommand(CMD_KEY_PRESS, this);
   console->registerCommand(CMD_TOGGLE_MLOOK, this);
   console->registerCommand(CMD_ADD_EVENT, this);
   console->registerCommand(CMD_IDENTIFY_ENTITY, this);
   console->registerCommand(CMD_DUMP_ATTRIBUTES, this);
   console->registerCommand(CMD_reload_configs, this);
+  console->registerCommand(CMD_startup_report, this);
+  console->registerCommand(CMD_log_level, this);
+  console->registerCommand(CMD_log_file, this);
+  console->registerCommand(CMD_log_stats, this);
 
   console->registerCommand("reinit", this);
 }
@@ -949,7 +1159,7 @@ void System::runCommand(const std::string &command, const std::string &args_t) {
   }
   else if (command == CMD_LOAD_GENERAL_CONFIG) {
     System::instance()->getFileHandler()->expandString(args);
-    m_general.readFromFile(args);
+    System::instance()->getFileHandler()->readConfigFile(m_general, args);
   }
   else if (command == CMD_LOAD_KEY_BINDINGS_USER) {
     System::instance()->getFileHandler()->expandString(args);
@@ -976,6 +1186,11 @@ void System::runCommand(const std::string &command, const std::string &args_t) {
     std::string value = tokeniser.remainingTokens();
     Bindings::bind(key, value);
   }
+  else if (command == CMD_BIND_GUI_KEY) {
+    std::string key = tokeniser.nextToken();
+    std::string value = tokeniser.remainingTokens();
+    Bindings::bind(key, value, Bindings::CONTEXT_GUI);
+  }
   else if (command == CMD_KEY_PRESS) {
     runCommand(Bindings::getBinding(args));
   }
@@ -997,6 +1212,43 @@ void System::runCommand(const std::string &command, const std::string &args_t) {
     runCommand("/reload_config_models");
     runCommand("/reload_config_states");
   } 
+  else if (command == CMD_startup_report) {
+    if (m_startup_graph.get() != 0) m_startup_graph->printReport();
+  }
+  else if (command == CMD_log_level) {
+    // log_level <category|all> <error|warning|default|info|debug>
+    const std::string category_name = tokeniser.nextToken();
+    const std::string level_name = tokeniser.nextToken();
+    Log::LogCategory category = Log::CAT_GENERAL;
+    Log::LogLevel level = Log::LOG_DEFAULT;
+    if ((category_name != "all" && !Log::findCategory(category_name, category))
+        || !Log::findLevel(level_name, level)) {
+      printf("Usage: %s <category|all> <error|warning|default|info|debug>\n", CMD_log_level.c_str());
+    } else if (category_name == "all") {
+      for (int i = 0; i < Log::NUM_CATEGORIES; ++i) {
+        Log::setLevel((Log::LogCategory)i, level);
+      }
+    } else {
+      Log::setLevel(category, level);
+    }
+  }
+  else if (command == CMD_log_file) {
+    // log_file <filename> [max kilobytes] [old files to keep], or no
+    // arguments to stop writing to a file
+    const std::string filename = tokeniser.nextToken();
+    if (filename.empty()) {
+      Log::closeLogFile();
+    } else {
+      const std::string max_kb = tokeniser.nextToken();
+      const std::string max_files = tokeniser.nextToken();
+      Log::setLogFile(filename,
+                      max_kb.empty() ? 1024 * 1024 : strtoul(max_kb.c_str(), NULL, 10) * 1024,
+                      max_files.empty() ? 3 : strtoul(max_files.c_str(), NULL, 10));
+    }
+  }
+  else if (command == CMD_log_stats) {
+    Log::printStats();
+  }
   else if (command == "reinit") reinit();
   else fprintf(stderr, "[System] Command not found: %s\n", command.c_str());
 }
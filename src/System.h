@@ -8,6 +8,7 @@
 #include <memory>
 #include <string>
 #include <list>
+#include <vector>
 #include <SDL/SDL.h>
 
 #include <sigc++/trackable.h>
@@ -29,9 +30,10 @@ class LuaScriptEngine;
 class Console;
 class Workarea;
 class CharacterManager;
-//class Sound;
+class Sound;
 class Editor;
 class Localserver;
+class StartupGraph;
 
 typedef enum {
   SYS_UNKNOWN = 0,
@@ -188,6 +190,7 @@ public:
   Client *getClient() { return m_client.get(); }
   MediaManager *getMediaManager() { return m_media_manager.get(); }
   Localserver *getLocalserver() { return m_local_server.get(); }
+  Sound *getSound() { return m_sound.get(); } ///< NULL if audio is unavailable
   
   static System *instance() { return m_instance; }
 
@@ -202,7 +205,22 @@ public:
   int getWidth() const { return m_width; }
   int getHeight() const { return m_height; }
 protected:
+  // Startup steps, run by a StartupGraph
+  bool indexStartupConfigs();
+  void indexScript(const std::string &file_name, int depth);
+  bool parseStartupConfigs();
   bool initVideo();
+  bool initScripting();
+  bool initCache();
+  bool initClient();
+  bool initManagers();
+  bool initConsole();
+  bool initSound();
+  bool registerSoundCommands();
+  bool initRenderSystem();
+  bool initModelSystem();
+  bool initEnvironment();
+  bool runStartupScripts();
   
   void handleEvents(const SDL_Event &);
   void handleAnalogueControllers();
@@ -237,6 +255,10 @@ protected:
   std::auto_ptr<CharacterManager> m_character_manager;
   std::auto_ptr<MediaManager> m_media_manager;
   std::auto_ptr<Localserver> m_local_server;
+
+  std::auto_ptr<StartupGraph> m_startup_graph; ///< Kept for its timing report
+  std::vector<std::string> m_startup_configs; ///< Config files named by startup scripts
+  std::vector<std::string> m_startup_samples; ///< Samples played by startup scripts
    
   varconf::Config m_general;
 
@@ -251,7 +273,7 @@ protected:
   double m_elapsed;
   unsigned int m_current_ticks;
 
-  //std::auto_ptr<Sound> m_sound;
+  std::auto_ptr<Sound> m_sound;
   
   typedef enum {
     AXIS_STRAFE,
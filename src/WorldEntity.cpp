@@ -37,6 +37,8 @@
 
 #include "ActionHandler.h"
 #include "Console.h"
+#include "FileHandler.h"
+#include "Sound.h"
 #include "System.h"
 
 
@@ -54,6 +56,7 @@ static const std::string ATTR_mode = "mode";
 static const std::string ATTR_outfit = "outfit";
 static const std::string ATTR_right_hand_wield = "right_hand_wield";
 static const std::string ATTR_say = "say";
+static const std::string ATTR_sound = "sound";
 static const std::string ATTR_status = "status";
 static const std::string ATTR_terrain = "terrain";
 static const std::string ATTR_velocity = "velocity";
@@ -86,13 +89,16 @@ WorldEntity::WorldEntity(const std::string &id, Eris::TypeInfo *ty, Eris::View *
    m_fading(false),
    m_fade_in(false),
    m_fade(1.0f),
-   m_view_id(id + "-" + view->getAvatar()->getId())
+   m_view_id(id + "-" + view->getAvatar()->getId()),
+   m_sound_emitter(0),
+   m_object_record_generation(0)
 {
   Acted.connect(sigc::mem_fun(this, &WorldEntity::onAction));
   LocationChanged.connect(sigc::mem_fun(this, &WorldEntity::locationChanged));
   ChildAdded.connect(sigc::mem_fun(this, &WorldEntity::onChildEntityAdded));
   ChildRemoved.connect(sigc::mem_fun(this, &WorldEntity::onChildEntityRemoved));
   BeingDeleted.connect(sigc::mem_fun(this, &WorldEntity::onBeingDeleted));
+  Moved.connect(sigc::mem_fun(this, &WorldEntity::onMove));
 
   // Get type and parent type name
   Eris::TypeInfo *ti = getType();
@@ -107,8 +113,13 @@ WorldEntity::WorldEntity(const std::string &id, Eris::TypeInfo *ty, Eris::View *
   m_local_orient.identity();
 }
 
+WorldEntity::~WorldEntity() {
+}
+
 void WorldEntity::onMove() {
   rotateBBox(getEntityOrientation());
+  // Feed the server position into the smoother
+  m_smoother.addUpdate(System::instance()->getTime(), getPosition(), getVelocity());
 }
 
 void WorldEntity::onTalk(const Atlas::Objects::Operation::RootOperation &talk)
@@ -178,6 +189,10 @@ void WorldEntity::updateAbsOrient() {
 
 //const WFMath::Point<3> &WorldEntity::getAbsPos() {
 void WorldEntity::updateAbsPosition() {
+  if (m_smoother.isValid()) {
+    m_smoothed_pos = m_smoother.getPosition(System::instance()->getTime());
+  }
+
   WFMath::Point<3> absPos(point_zero);
   WorldEntity *loc = this;
   
@@ -200,39 +215,7 @@ void WorldEntity::updateAbsPosition() {
 
     // Do lots of hackish stuff to set the Z value
     if (loc_loc) {
-      bool needTerrainHeight = false;
-      bool setHeight = false;
-      bool clampHeight = false;
-      // Get the terrain height for x,y pos, but don't set it yet as the mode
-      // needs to have a say first.
-      if (loc->hasAttr(ATTR_mode)) {
-        const std::string &mode = loc->valueOfAttr(ATTR_mode).asString();
-        if (mode == MODE_swimming) {
-          // Make sure height is > terrain height
-          needTerrainHeight = clampHeight = true;
-        } else if (mode == MODE_floating) {
-          // Do nothing at all.
-          // Should we do something here?
-          // E.g. set to water height?
-        } else if (mode == MODE_fixed) {
-          // Do nothing at all.
-        } else {
-          needTerrainHeight = setHeight = true;
-        }
-      } else {
-        needTerrainHeight = setHeight = true;
-      }
-      if (!loc_loc->hasAttr(ATTR_terrain)) {
-        needTerrainHeight = false;
-      }
-      if (needTerrainHeight) {
-        float h = Environment::getInstance().getHeight(lpos.x(), lpos.y());
-        if (setHeight) {
-          lpos.z() = h;
-        } else if (clampHeight) {
-          if (lpos.z() < h) lpos.z() = h;
-        }
-      }
+      loc->clampToTerrain(lpos);
 
       // Hack for clamping entity height to jetty objects.
       // This should be handled better, perhaps by checking an attribute.
@@ -266,6 +249,26 @@ void WorldEntity::updateAbsPosition() {
   m_abs_position = absPos;
 }
 
+void WorldEntity::clampToTerrain(WFMath::Point<3> &pos) const {
+  WorldEntity *loc = dynamic_cast<WorldEntity*>(getLocation());
+  if (loc == NULL || !loc->hasAttr(ATTR_terrain)) return;
+
+  // The mode decides whether we stand on the terrain or just stay above it
+  bool clampHeight = false;
+  if (hasAttr(ATTR_mode)) {
+    const std::string &mode = valueOfAttr(ATTR_mode).asString();
+    if (mode == MODE_swimming) {
+      clampHeight = true;
+    } else if (mode == MODE_floating || mode == MODE_fixed) {
+      // Should floating be set to water height?
+      return;
+    }
+  }
+
+  const float h = Environment::getInstance().getHeight(pos.x(), pos.y());
+  if (!clampHeight || pos.z() < h) pos.z() = h;
+}
+
 void WorldEntity::displayInfo() {
   std::string msg_name = getName() + " - id: " + getId();
   System::instance()->pushMessage(msg_name, CONSOLE_MESSAGE | SCREEN_MESSAGE);
@@ -311,6 +314,9 @@ void WorldEntity::displayInfo() {
 }
 
 void WorldEntity::onAttrChanged(const std::string& str, const Atlas::Message::Element& v) {
+  // The entity mapper may choose a different record now
+  ModelSystem::getInstance().entityAttributeChanged(this, str);
+
   if (str == ATTR_mode) {
     /*
     // This is now obsolete. We need to check velocity to determine animation.
@@ -366,6 +372,8 @@ void WorldEntity::onAttrChanged(const std::string& str, const Atlas::Message::El
     }
   } else if (str == ATTR_status) {
     m_status = v.asNum();
+  } else if (str == ATTR_sound) {
+    setSound(v);
   } else if (str == ATTR_outfit) {
     SPtr<ObjectRecord> record = ModelSystem::getInstance().getObjectRecord(this); 
     if (!record) return;
@@ -395,6 +403,22 @@ void WorldEntity::onAttrChanged(const std::string& str, const Atlas::Message::El
   }
 }
 
+void WorldEntity::setSound(const Atlas::Message::Element &v) {
+  Sound *sound = System::instance()->getSound();
+  if (sound == NULL) return;
+
+  if (m_sound_emitter != 0) {
+    sound->removeEmitter(m_sound_emitter);
+    m_sound_emitter = 0;
+  }
+
+  // The attribute names a looping sample in the media sounds directory
+  if (!v.isString() || v.asString().empty()) return;
+  std::string file_name = "${SEAR_MEDIA}/sounds/" + v.asString();
+  System::instance()->getFileHandler()->getFilePath(file_name);
+  m_sound_emitter = sound->addEmitter(this, file_name, true);
+}
+
 void WorldEntity::onSightOutfit(Eris::Entity *ent, std::string where) {
   SPtr<ObjectRecord> record = ModelSystem::getInstance().getObjectRecord(this); 
   WorldEntity *we = dynamic_cast<WorldEntity*>(ent);
@@ -430,6 +454,8 @@ void WorldEntity::onAction(const Atlas::Objects::Operation::RootOperation &actio
 
 void WorldEntity::locationChanged(Eris::Entity *loc) {
   resetLocalPO();
+  // Old updates are relative to the previous location
+  m_smoother.reset();
   updateAbsOrient();
   updateAbsPosition();
 }
@@ -445,6 +471,14 @@ void WorldEntity::onChildEntityRemoved(Eris::Entity *e) {
 }
 
 void WorldEntity::onBeingDeleted() {
+  ModelSystem::getInstance().entityDeleted(this);
+
+  Sound *sound = System::instance()->getSound();
+  if (sound != NULL && m_sound_emitter != 0) {
+    sound->removeEmitter(m_sound_emitter);
+    m_sound_emitter = 0;
+  }
+
   // Detach callbacks..
   // This may detach more than we really want. E.g. other onDeleted callback
   // handlers.
@@ -15,6 +15,8 @@
 #include <Eris/EntityRef.h>
 #include <Eris/Types.h>
 #include "common/types.h"
+#include "common/SPtr.h"
+#include "MotionSmoother.h"
 
 namespace Eris {
   class View;
@@ -30,10 +32,12 @@ namespace Sear {
 
 typedef std::pair<std::string, unsigned int> message;
 
+class ObjectRecord;
+
 class WorldEntity : public Eris::ViewEntity {
 public:
   WorldEntity(const std::string &id, Eris::TypeInfo *ty, Eris::View *view);
-  virtual ~WorldEntity() {}
+  virtual ~WorldEntity();
   
   void onMove();
   void onTalk(const Atlas::Objects::Operation::RootOperation &talk);
@@ -77,6 +81,17 @@ public:
     m_has_local_orient = true;
   }
 
+  void clearLocalPos() {
+    m_has_local_pos = false;
+  }
+
+  /**
+   * Move a position in this entity's location onto the terrain, or above it
+   * when swimming. Positions are left alone if the location has no terrain,
+   * or the entity is floating or fixed.
+   */
+  void clampToTerrain(WFMath::Point<3> &pos) const;
+
   void resetLocalPO() {
     m_has_local_orient = false;
     m_has_local_pos = false;
@@ -118,6 +133,7 @@ public:
 protected:
   WFMath::Point<3> getEntityPosition() const {
     if (m_has_local_pos) return m_local_pos;
+    else if (m_smoother.isValid()) return m_smoothed_pos;
     else return getPredictedPos();
   }
 
@@ -144,8 +160,10 @@ protected:
   void onChildEntityAdded(Eris::Entity*);
   void onChildEntityRemoved(Eris::Entity*);
   void onBeingDeleted();
+  void setSound(const Atlas::Message::Element &v);
   
   friend class Character;
+  friend class ModelSystem;
 
   OrientBBox m_orientBBox;
   AttachmentMap m_attached;
@@ -158,11 +176,21 @@ protected:
   WFMath::Quaternion m_local_orient, m_abs_orient;
   WFMath::Point<3> m_local_pos, m_abs_position;
 
+  MotionSmoother m_smoother; ///< Smooths server position updates
+  WFMath::Point<3> m_smoothed_pos;
+
   bool m_selected;
 
   bool m_fading, m_fade_in;
   float m_fade;
   const std::string m_view_id;
+
+  unsigned int m_sound_emitter; ///< Sound::EmitterID of the "sound" attribute, or 0
+
+  // Record found by ModelSystem::getObjectRecord. Only valid while the
+  // generation matches the ModelSystem's.
+  SPtr<ObjectRecord> m_object_record;
+  unsigned int m_object_record_generation;
 };
 
 } /* namespace Sear */
@@ -2,6 +2,11 @@
 // the GNU General Public License (See COPYING for details).
 // Copyright (C) 2009 Simon Goodall
 
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
 #include "LuaScriptEngine.h"
 
 // include Lua libs and tolua++
@@ -15,11 +20,62 @@ extern "C" {
   extern int luaopen_Eris(lua_State* L); // declare the wrapped module
 }
 
+#include <sys/time.h>
+
 #include "src/Console.h"
+#include "src/FileHandler.h"
+#include "src/System.h"
 
 
 namespace Sear {
 
+static const std::string CMD_lua = "lua";
+static const std::string CMD_lua_file = "lua_file";
+static const std::string CMD_lua_stats = "lua_stats";
+static const std::string CMD_lua_cache_clear = "lua_cache_clear";
+
+// Bump this if the way chunks are compiled or stored changes
+static const unsigned int LUA_CACHE_VERSION = 1;
+
+// Compiled chunks kept in the registry before the cache is emptied
+static const size_t MAX_CHUNKS = 512;
+
+static const char *ENGINE_KEY = "sear_lua_script_engine";
+
+// Most loads and calls take well under a millisecond, so SDL_GetTicks
+// would count them as nothing
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static int chunk_writer(lua_State *L, const void *p, size_t size, void *ud) {
+  std::vector<char> *data = static_cast<std::vector<char>*>(ud);
+  const char *bytes = static_cast<const char*>(p);
+  data->insert(data->end(), bytes, bytes + size);
+  return 0;
+}
+
+// Replacement for the standard dofile that uses the chunk cache.
+static int cached_dofile(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, ENGINE_KEY);
+  LuaScriptEngine *engine = static_cast<LuaScriptEngine*>(lua_touserdata(L, -1));
+  lua_pop(L, 1);
+  assert(engine != 0);
+
+  // The chunk is loaded onto the main thread, so move it if this is a
+  // coroutine
+  lua_State *S = engine->getState();
+  const int n = lua_gettop(L);
+  const int error = engine->loadFile(filename);
+  if (L != S) lua_xmove(S, L, 1);
+  if (error != 0) return lua_error(L);
+  lua_call(L, 0, LUA_MULTRET);
+  return lua_gettop(L) - n;
+}
+
 void LuaScriptEngine::printLuaError(int error) {
   std::string message;
   switch (error) {
@@ -65,19 +121,27 @@ int LuaScriptEngine::stackDump (lua_State *L) {
 }
 
 
-LuaScriptEngine::LuaScriptEngine()
+LuaScriptEngine::LuaScriptEngine() :
+  m_initialised(false),
+  m_state(0),
+  m_runs(0),
+  m_hits(0),
+  m_disk_hits(0),
+  m_compiles(0),
+  m_load_time(0.0),
+  m_run_time(0.0)
 {
 }
 
 
 LuaScriptEngine::~LuaScriptEngine()
 {
-	printf("Shutting down lua environment.\n");
-	lua_close(m_state);
+  if (m_initialised) shutdown();
 }
 
 
 int LuaScriptEngine::init() {
+  assert(m_initialised == false);
 
   m_state = lua_open();
 
@@ -89,32 +153,161 @@ int LuaScriptEngine::init() {
   luaopen_Eris(m_state);
   luaopen_Sear(m_state);
 
+  // Route dofile through the chunk cache
+  lua_pushlightuserdata(m_state, this);
+  lua_setfield(m_state, LUA_REGISTRYINDEX, ENGINE_KEY);
+  lua_register(m_state, "dofile", cached_dofile);
+
+  m_initialised = true;
   return 0;
 }
 
 void LuaScriptEngine::shutdown() {
+  assert(m_initialised == true);
+  printf("Shutting down lua environment.\n");
+  // Registry references go with the state
+  m_chunks.clear();
+  lua_close(m_state);
+  m_state = 0;
+  m_initialised = false;
 }
 
-
-void LuaScriptEngine::registerCommands(Console *console) {
-  console->registerCommand("lua", this);
+void LuaScriptEngine::releaseChunks() {
+  for (ChunkMap::const_iterator I = m_chunks.begin(); I != m_chunks.end(); ++I) {
+    luaL_unref(m_state, LUA_REGISTRYINDEX, I->second);
+  }
+  m_chunks.clear();
 }
 
-void LuaScriptEngine::runCommand(const std::string &command, const std::string &args) {
-  if (command == "lua") {
-    // Store current stack pos
-    int oldtop = lua_gettop(m_state);
+int LuaScriptEngine::loadChunk(const std::string &source, const std::string &name) {
+  assert(m_initialised == true);
+
+  // The chunk name is part of the compiled code, so it is part of the key
+  CacheManager::Key key = CacheManager::makeKey("lua", LUA_CACHE_VERSION);
+  key = CacheManager::addToKey(key, LUA_RELEASE, strlen(LUA_RELEASE));
+  key = CacheManager::addToKey(key, name.c_str(), name.size() + 1);
+  key = CacheManager::addToKey(key, source.data(), source.size());
 
-   int error = luaL_dostring(m_state, args.c_str());
-   if (error != 0) {
-      printf( "error running function `f': %s\n",
-                 lua_tostring(m_state, -1));
-      stackDump(m_state);  
+  ChunkMap::const_iterator I = m_chunks.find(key);
+  if (I != m_chunks.end()) {
+    ++m_hits;
+    lua_rawgeti(m_state, LUA_REGISTRYINDEX, I->second);
+    return 0;
+  }
 
-      printLuaError(error); // Print error messages
+  const double start = now();
+  CacheManager &cache = CacheManager::getInstance();
+
+  // Try bytecode from an earlier run. Bytecode that does not suit this
+  // build of Lua fails to load, and the source is compiled instead.
+  int error = LUA_ERRSYNTAX;
+  std::vector<char> data;
+  if (cache.isInitialised() && cache.get(key, data) && !data.empty()) {
+    error = luaL_loadbuffer(m_state, &data[0], data.size(), name.c_str());
+    if (error == 0) {
+      ++m_disk_hits;
+    } else {
+      lua_pop(m_state, 1);
+    }
+  }
+
+  if (error != 0) {
+    error = luaL_loadbuffer(m_state, source.data(), source.size(), name.c_str());
+    if (error != 0) return error;
+    ++m_compiles;
+
+    if (cache.isInitialised()) {
+      data.clear();
+      if (lua_dump(m_state, chunk_writer, &data) == 0 && !data.empty()) {
+        cache.put(key, data);
+      }
     }
-    // Restore stack top
-    lua_settop(m_state, oldtop);
+  }
+
+  m_load_time += now() - start;
+
+  if (m_chunks.size() >= MAX_CHUNKS) releaseChunks();
+  lua_pushvalue(m_state, -1);
+  m_chunks[key] = luaL_ref(m_state, LUA_REGISTRYINDEX);
+  return 0;
+}
+
+int LuaScriptEngine::loadFile(const std::string &filename) {
+  std::vector<char> data;
+  if (!System::instance()->getFileHandler()->readFile(filename, data)) {
+    lua_pushfstring(m_state, "cannot read %s", filename.c_str());
+    return LUA_ERRFILE;
+  }
+  std::string source(data.begin(), data.end());
+  // Comment out a #! line, as luaL_loadfile does, keeping the line count
+  if (!source.empty() && source[0] == '#') {
+    source.insert(0, "--");
+  }
+  return loadChunk(source, "@" + filename);
+}
+
+int LuaScriptEngine::call(int error) {
+  if (error == 0) {
+    const double start = now();
+    error = lua_pcall(m_state, 0, 0, 0);
+    m_run_time += now() - start;
+    ++m_runs;
+  }
+  if (error != 0) {
+    printf( "error running function `f': %s\n",
+               lua_tostring(m_state, -1));
+    stackDump(m_state);  
+
+    printLuaError(error); // Print error messages
+  }
+  return error;
+}
+
+int LuaScriptEngine::runString(const std::string &source) {
+  assert(m_initialised == true);
+  // Store current stack pos
+  int oldtop = lua_gettop(m_state);
+  int error = call(loadChunk(source, source));
+  // Restore stack top
+  lua_settop(m_state, oldtop);
+  return error;
+}
+
+int LuaScriptEngine::runFile(const std::string &filename) {
+  assert(m_initialised == true);
+  int oldtop = lua_gettop(m_state);
+  int error = call(loadFile(filename));
+  lua_settop(m_state, oldtop);
+  return error;
+}
+
+
+void LuaScriptEngine::registerCommands(Console *console) {
+  console->registerCommand(CMD_lua, this);
+  console->registerCommand(CMD_lua_file, this);
+  console->registerCommand(CMD_lua_stats, this);
+  console->registerCommand(CMD_lua_cache_clear, this);
+}
+
+void LuaScriptEngine::runCommand(const std::string &command, const std::string &args) {
+  if (command == CMD_lua) {
+    runString(args);
+  }
+  else if (command == CMD_lua_file) {
+    std::string filename = args;
+    System::instance()->getFileHandler()->expandString(filename);
+    runFile(filename);
+  }
+  else if (command == CMD_lua_stats) {
+    printf("Lua - Runs: %u Cached chunks: %u\n",
+           m_runs, (unsigned int)m_chunks.size());
+    printf("Lua - Memory hits: %u Bytecode cache hits: %u Compiles: %u\n",
+           m_hits, m_disk_hits, m_compiles);
+    printf("Lua - Load time: %.3f ms Run time: %.3f ms\n",
+           m_load_time / 1000.0, m_run_time / 1000.0);
+  }
+  else if (command == CMD_lua_cache_clear) {
+    releaseChunks();
   }
 }
 
@@ -5,7 +5,11 @@
 #ifndef SEAR_LUASCRIPTENGINE_H
 #define SEAR_LUASCRIPTENGINE_H 1
 
+#include <map>
+#include <string>
+
 #include "interfaces/ConsoleObject.h"
+#include "src/CacheManager.h"
 
 // include Lua libs
 extern "C" {
@@ -18,6 +22,14 @@ namespace Sear {
 
 class Console;
 
+/**
+ * The LuaScriptEngine runs Lua code from the console and from scripts.
+ * Compiled chunks are kept in the Lua registry, keyed by a hash of their
+ * source, so running the same code again only calls the cached function.
+ * The compiled bytecode is also stored in the CacheManager, so scripts
+ * need not be parsed again on the next run. The global dofile goes through
+ * the same cache.
+ */
 class LuaScriptEngine : public ConsoleObject {
 
 public:
@@ -27,16 +39,56 @@ public:
   int init();
   void shutdown();
   bool isInitialised() const { return m_initialised; }
+  lua_State *getState() const { return m_state; }
   
   void registerCommands(Console *console);
   void runCommand(const std::string &command, const std::string &args);
 
+  /**
+   * Run a string of Lua code.
+   * @return 0 on success, or a Lua error code
+   */
+  int runString(const std::string &source);
+
+  /**
+   * Run a Lua file.
+   * @return 0 on success, or a Lua error code
+   */
+  int runFile(const std::string &filename);
+
+  /**
+   * Push the compiled function for some source onto the stack, compiling
+   * it only if it is not already cached.
+   * @param name Chunk name used in error messages
+   * @return 0 on success, or a Lua error code with the message pushed
+   *         instead
+   */
+  int loadChunk(const std::string &source, const std::string &name);
+
+  /**
+   * As loadChunk, for the contents of a file.
+   */
+  int loadFile(const std::string &filename);
+
   static int stackDump(lua_State *L);
   static void printLuaError(int error);
 
 private:  
+  // tools/lua_test reads the cache counters
+  friend class LuaScriptEngineTest;
+
+  typedef std::map<CacheManager::Key, int> ChunkMap; ///< Source hash to registry reference
+
+  int call(int error);
+  void releaseChunks();
+
   bool m_initialised;
   lua_State *m_state;   
+
+  ChunkMap m_chunks;
+
+  unsigned int m_runs, m_hits, m_disk_hits, m_compiles;
+  double m_load_time, m_run_time; ///< Microseconds
 };
 
 } /* namespace Sear */
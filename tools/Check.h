@@ -0,0 +1,40 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+#ifndef SEAR_TOOLS_CHECK_H
+#define SEAR_TOOLS_CHECK_H 1
+
+/*
+ * Checks for the test programs in tools/. Each program is a single file,
+ * so the count of failed checks lives here.
+ */
+
+#include <stdio.h>
+
+static int s_failures = 0;
+
+/*
+ * Report a failed condition with where it is, and carry on
+ */
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    ++s_failures; \
+  } \
+} while (0)
+
+/*
+ * Print whether every check passed.
+ * @return The exit status for the program
+ */
+static int checkResult(const char *name) {
+  if (s_failures > 0) {
+    fprintf(stderr, "%s: %d checks failed\n", name, s_failures);
+    return 1;
+  }
+  printf("%s: all checks passed\n", name);
+  return 0;
+}
+
+#endif /* SEAR_TOOLS_CHECK_H */
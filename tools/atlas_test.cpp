@@ -0,0 +1,287 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * atlas_test packs made up images into a TextureAtlas and checks that:
+ *   - every image lies inside a page and keeps its padding clear of the
+ *     other images and of the white block
+ *   - an image goes on the shortest shelf it fits on, and a new shelf is
+ *     started below the last one when none will take it
+ *   - a new page is started when a page is full
+ *   - a page is reused once every image on it has been released
+ *   - texture coordinates match the image rectangle
+ *
+ * It also checks that SpriteBatch::equals, which decides whether a kept
+ * batch can be drawn again, notices any change to the primitives.
+ *
+ * Nothing is drawn, so no window is opened.
+ *
+ * Usage: atlas_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "renderers/TextureAtlas.h"
+#include "renderers/SpriteBatch.h"
+#include "tools/Check.h"
+
+using Sear::SpriteBatch;
+using Sear::TextureAtlas;
+
+typedef TextureAtlas::Region Region;
+
+static const int PAGE_size = 64;
+static const int PADDING = 1;
+
+// Large enough for any image added below
+static unsigned char s_pixels[PAGE_size * PAGE_size * 4];
+
+static bool addImage(TextureAtlas &atlas, int width, int height,
+                     Region &region) {
+  return atlas.add(s_pixels, width, height, width * 4, region);
+}
+
+// Whether two images, padding included, overlap
+static bool overlap(const Region &a, const Region &b) {
+  if (a.page != b.page) return false;
+  return a.x - PADDING < b.x + b.width + PADDING &&
+         b.x - PADDING < a.x + a.width + PADDING &&
+         a.y - PADDING < b.y + b.height + PADDING &&
+         b.y - PADDING < a.y + a.height + PADDING;
+}
+
+static bool inside(const Region &r) {
+  return r.x - PADDING >= 0 && r.y - PADDING >= 0 &&
+         r.x + r.width + PADDING <= PAGE_size &&
+         r.y + r.height + PADDING <= PAGE_size;
+}
+
+// The white block is the first thing on each page, at the top left
+static Region whiteBlock(int page) {
+  Region r;
+  r.page = page;
+  r.x = PADDING;
+  r.y = PADDING;
+  r.width = 1;
+  r.height = 1;
+  return r;
+}
+
+static void testShelves() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  Region a, b, c, d;
+
+  // The white block starts a 3 pixel shelf, too short for a
+  CHECK(addImage(atlas, 10, 10, a));
+  CHECK(a.page == 0);
+  CHECK(a.x == PADDING && a.y == 3 + PADDING);
+
+  // Starts a second shelf below a's
+  CHECK(addImage(atlas, 10, 20, b));
+  CHECK(b.page == 0);
+  CHECK(b.x == PADDING && b.y == 3 + 12 + PADDING);
+
+  // Fits on both, and goes on a's as it is shorter
+  CHECK(addImage(atlas, 10, 8, c));
+  CHECK(c.page == 0);
+  CHECK(c.x == 12 + PADDING && c.y == a.y);
+
+  // Fits on the white block's shelf
+  CHECK(addImage(atlas, 1, 1, d));
+  CHECK(d.page == 0);
+  CHECK(d.x == 3 + PADDING && d.y == PADDING);
+
+  CHECK(atlas.getNumPages() == 1);
+  CHECK(atlas.getNumImages() == 4);
+
+  // Images, padding included. The white block is not counted.
+  const float used = (12 * 12 + 12 * 22 + 12 * 10 + 3 * 3) /
+                     (float)(PAGE_size * PAGE_size);
+  CHECK(atlas.getUsage() > used - 0.001f && atlas.getUsage() < used + 0.001f);
+}
+
+static void testCoordinates() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  Region r;
+  CHECK(addImage(atlas, 16, 8, r));
+  CHECK(r.width == 16 && r.height == 8);
+  CHECK(r.s0 == r.x / (float)PAGE_size);
+  CHECK(r.t0 == r.y / (float)PAGE_size);
+  CHECK(r.s1 == (r.x + 16) / (float)PAGE_size);
+  CHECK(r.t1 == (r.y + 8) / (float)PAGE_size);
+
+  float s, t;
+  atlas.getWhiteTexel(0, s, t);
+  CHECK(s == (PADDING + 0.5f) / PAGE_size);
+  CHECK(t == (PADDING + 0.5f) / PAGE_size);
+}
+
+static void testTooLarge() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  Region r;
+  CHECK(!addImage(atlas, PAGE_size - 1, 4, r));
+  CHECK(r.page == -1);
+  CHECK(!addImage(atlas, 0, 4, r));
+  CHECK(atlas.getNumPages() == 0);
+
+  CHECK(atlas.fits(PAGE_size / 2 - 2 * PADDING, 4));
+  CHECK(!atlas.fits(PAGE_size / 2 - 2 * PADDING + 1, 4));
+}
+
+// Many images of random sizes, spread over several pages
+static void testRandom() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  std::vector<Region> regions;
+
+  srand(1);
+  for (int i = 0; i < 500; ++i) {
+    Region r;
+    CHECK(addImage(atlas, 1 + rand() % 20, 1 + rand() % 20, r));
+    regions.push_back(r);
+  }
+  CHECK(atlas.getNumPages() > 1);
+  CHECK(atlas.getNumImages() == regions.size());
+
+  for (size_t i = 0; i < regions.size(); ++i) {
+    const Region &r = regions[i];
+    CHECK(r.page >= 0 && r.page < (int)atlas.getNumPages());
+    CHECK(inside(r));
+    CHECK(!overlap(r, whiteBlock(r.page)));
+    for (size_t j = i + 1; j < regions.size(); ++j) {
+      CHECK(!overlap(r, regions[j]));
+    }
+  }
+
+  // A page is only started when an image will not fit on the others, so
+  // all but the last should be mostly full
+  CHECK(atlas.getUsage() > 0.5f);
+}
+
+static void testRelease() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  std::vector<Region> regions;
+
+  // Fill the first page with 12 pixel squares, which leaves no room for
+  // another on it
+  Region r;
+  while (addImage(atlas, 10, 10, r) && r.page == 0) {
+    regions.push_back(r);
+  }
+  CHECK(r.page == 1);
+  CHECK(atlas.getNumPages() == 2);
+
+  // Space is not reused while anything is left on the page
+  for (size_t i = 1; i < regions.size(); ++i) {
+    atlas.release(regions[i]);
+    CHECK(regions[i].page == -1);
+  }
+  Region again;
+  CHECK(addImage(atlas, 10, 10, again));
+  CHECK(again.page == 1);
+
+  // The last image goes, and the page starts again from the top
+  atlas.release(regions[0]);
+  CHECK(addImage(atlas, 10, 10, again));
+  CHECK(again.page == 0);
+  CHECK(again.x == PADDING && again.y == 3 + PADDING);
+  CHECK(atlas.getNumPages() == 2);
+  CHECK(atlas.getNumImages() == 3);
+
+  // Releasing twice does nothing
+  atlas.release(regions[1]);
+  CHECK(atlas.getNumImages() == 3);
+}
+
+// The primitives of a small window, with one thing changed
+static void fillBatch(SpriteBatch &batch, int change) {
+  const float corners[8] = { 0, 0,  4, 0,  4, 4,  0, 4 };
+  const float coords[8] = { 0, 0,  1, 0,  1, 1,  0, 1 };
+
+  batch.setColour(1.0f, 1.0f, 1.0f, 1.0f);
+  batch.addQuad(0, 10, 10, 20, 20, 0.1f, 0.1f, 0.2f, 0.2f);
+  batch.setColour((unsigned char)255, 0, 0, (change == 1) ? 128 : 255);
+  batch.addQuad(0, 20, 10, (change == 2) ? 31 : 30, 20, 0.1f, 0.1f, 0.2f, 0.2f);
+  if (change == 3) batch.setScissor(0, 0, 100, 100);
+  batch.addQuad((change == 4) ? 1 : 0, 0, 0, 5, 5, 0.3f, 0.3f, (change == 5) ? 0.5f : 0.4f, 0.4f);
+  batch.clearScissor();
+  batch.addQuad(-1, (change == 6) ? 7 : 6, corners, coords);
+  if (change == 7) {
+    batch.addQuad(-1, 0, corners, coords);
+  } else {
+    batch.addLine(-1, 0, 0, 0, 4, 4, 0, 0);
+  }
+  if (change == 8) batch.addLine(-1, 0, 0, 0, 4, 4, 0, 0);
+}
+
+static void testBatchEquals() {
+  TextureAtlas atlas(PAGE_size, PADDING);
+  SpriteBatch a(atlas), b(atlas);
+
+  CHECK(a.equals(b));
+  fillBatch(a, 0);
+  CHECK(!a.equals(b));
+  CHECK(!b.equals(a));
+  fillBatch(b, 0);
+  CHECK(a.equals(b));
+
+  // Colour, vertex, scissor, page, texture coordinate, texture object,
+  // primitive kind, and one more primitive
+  for (int change = 1; change <= 8; ++change) {
+    SpriteBatch c(atlas);
+    fillBatch(c, change);
+    CHECK(!a.equals(c));
+    CHECK(!c.equals(a));
+  }
+
+  // The same vertices, drawn differently
+  SpriteBatch plain(atlas), scissored(atlas), paged(atlas);
+  plain.addQuad(0, 0, 0, 1, 1, 0, 0, 1, 1);
+  scissored.setScissor(0, 0, 8, 8);
+  scissored.addQuad(0, 0, 0, 1, 1, 0, 0, 1, 1);
+  paged.addQuad(1, 0, 0, 1, 1, 0, 0, 1, 1);
+  CHECK(!plain.equals(scissored));
+  CHECK(!plain.equals(paged));
+
+  const float corners[8] = { 0, 0,  4, 4,  4, 0,  0, 4 };
+  const float coords[8] = { 0 };
+  SpriteBatch quad(atlas), lines(atlas);
+  quad.addQuad(-1, 0, corners, coords);
+  lines.addLine(-1, 0, 0, 0, 4, 4, 0, 0);
+  lines.addLine(-1, 0, 4, 0, 0, 4, 0, 0);
+  CHECK(!quad.equals(lines));
+
+  // The same primitives in another order
+  SpriteBatch d(atlas), e(atlas);
+  d.addQuad(0, 0, 0, 1, 1, 0, 0, 1, 1);
+  d.addQuad(0, 2, 2, 3, 3, 0, 0, 1, 1);
+  e.addQuad(0, 2, 2, 3, 3, 0, 0, 1, 1);
+  e.addQuad(0, 0, 0, 1, 1, 0, 0, 1, 1);
+  CHECK(!d.equals(e));
+
+  // Swapping exchanges the primitives
+  b.swap(d);
+  CHECK(!a.equals(b));
+  CHECK(a.equals(d));
+
+  SpriteBatch empty(atlas);
+  a.clear();
+  CHECK(a.empty());
+  CHECK(a.equals(empty));
+  CHECK(!a.equals(d));
+}
+
+int main(int argc, char **argv) {
+  testShelves();
+  testCoordinates();
+  testTooLarge();
+  testRandom();
+  testRelease();
+  testBatchEquals();
+
+  return checkResult("atlas_test");
+}
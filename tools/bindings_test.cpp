@@ -0,0 +1,262 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * bindings_test feeds made up SDL key events to Bindings, with a console
+ * that records the commands run instead of the client's, and checks that:
+ *   - modifiers in a binding name can be given in any order
+ *   - a key with modifiers and no binding of its own uses the binding for
+ *     the key alone
+ *   - a key bound to nothing is taken but runs nothing
+ *   - a "+command" binding runs "-command" when the key is released, from
+ *     the binding that ran on press even if the modifiers or the binding
+ *     set have changed since
+ *   - the GUI and world binding sets are kept apart
+ *   - a new binding replaces the old one straight away
+ *
+ * No window is opened and the client is not started.
+ *
+ * Usage: bindings_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <SDL/SDL.h>
+
+#include "interfaces/ConsoleObject.h"
+#include "src/Bindings.h"
+#include "src/Console.h"
+#include "src/System.h"
+#include "tools/Check.h"
+
+using Sear::Bindings;
+using Sear::Console;
+using Sear::ConsoleObject;
+using Sear::System;
+
+static const std::string CMD_record = "record";
+static const std::string CMD_walk_on = "+walk";
+static const std::string CMD_walk_off = "-walk";
+static const std::string CMD_run_on = "+run";
+static const std::string CMD_run_off = "-run";
+
+// Keeps every command it is asked to run
+class Recorder : public ConsoleObject {
+public:
+  void runCommand(const std::string &command, const std::string &args) {
+    m_commands.push_back(args.empty() ? command : command + " " + args);
+  }
+
+  // The only command run since the last call, or "" if there were none
+  // or more than one
+  std::string take() {
+    const std::string command = (m_commands.size() == 1) ? m_commands[0] : "";
+    m_commands.clear();
+    return command;
+  }
+
+  bool empty() const { return m_commands.empty(); }
+
+private:
+  std::vector<std::string> m_commands;
+};
+
+static Recorder s_recorder;
+
+static SDL_keysym makeKey(SDLKey sym, int mod) {
+  SDL_keysym key;
+  key.scancode = 0;
+  key.sym = sym;
+  key.mod = (SDLMod)mod;
+  key.unicode = 0;
+  return key;
+}
+
+static bool press(SDLKey sym, int mod, Bindings::Context context) {
+  return Bindings::keyDown(makeKey(sym, mod), context);
+}
+
+static bool release(SDLKey sym, int mod) {
+  return Bindings::keyUp(makeKey(sym, mod));
+}
+
+static const Bindings::Context WORLD = Bindings::CONTEXT_WORLD;
+static const Bindings::Context GUI = Bindings::CONTEXT_GUI;
+
+static void testModifierOrder() {
+  Bindings::bind("alt_shift_x", "/record alt_shift_x");
+  Bindings::bind("shift_alt_y", "/record shift_alt_y");
+  Bindings::bind("shift_ctrl_alt_z", "/record shift_ctrl_alt_z");
+
+  // Left, right and both of a modifier are the same
+  CHECK(press(SDLK_x, KMOD_LALT | KMOD_LSHIFT, WORLD));
+  CHECK(s_recorder.take() == "record alt_shift_x");
+  CHECK(press(SDLK_x, KMOD_RALT | KMOD_SHIFT, WORLD));
+  CHECK(s_recorder.take() == "record alt_shift_x");
+  CHECK(press(SDLK_y, KMOD_LSHIFT | KMOD_LALT, WORLD));
+  CHECK(s_recorder.take() == "record shift_alt_y");
+  CHECK(press(SDLK_z, KMOD_LCTRL | KMOD_LSHIFT | KMOD_RALT, WORLD));
+  CHECK(s_recorder.take() == "record shift_ctrl_alt_z");
+
+  // Modifiers that are not part of the binding do not match it
+  CHECK(!press(SDLK_x, KMOD_LSHIFT, WORLD));
+  CHECK(!press(SDLK_z, KMOD_LCTRL | KMOD_LSHIFT, WORLD));
+  CHECK(s_recorder.empty());
+
+  // Num lock and caps lock are not modifiers for bindings
+  CHECK(press(SDLK_y, KMOD_LSHIFT | KMOD_LALT | KMOD_NUM | KMOD_CAPS, WORLD));
+  CHECK(s_recorder.take() == "record shift_alt_y");
+}
+
+static void testFallback() {
+  Bindings::bind("f", "/record f");
+  Bindings::bind("ctrl_f", "/record ctrl_f");
+
+  CHECK(press(SDLK_f, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == "record f");
+  CHECK(press(SDLK_f, KMOD_LCTRL, WORLD));
+  CHECK(s_recorder.take() == "record ctrl_f");
+  // No shift_f or ctrl_shift_f binding
+  CHECK(press(SDLK_f, KMOD_LSHIFT, WORLD));
+  CHECK(s_recorder.take() == "record f");
+  CHECK(press(SDLK_f, KMOD_LCTRL | KMOD_LSHIFT, WORLD));
+  CHECK(s_recorder.take() == "record f");
+}
+
+static void testEmpty() {
+  Bindings::bind("q", "");
+
+  // Taken, so it goes no further, but nothing is run
+  CHECK(press(SDLK_q, KMOD_NONE, WORLD));
+  CHECK(release(SDLK_q, KMOD_NONE));
+  CHECK(s_recorder.empty());
+
+  // Not bound at all
+  CHECK(!press(SDLK_w, KMOD_NONE, WORLD));
+  CHECK(!release(SDLK_w, KMOD_NONE));
+  CHECK(s_recorder.empty());
+}
+
+static void testRelease() {
+  Bindings::bind("up", CMD_walk_on);
+
+  CHECK(press(SDLK_UP, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == CMD_walk_on);
+  CHECK(release(SDLK_UP, KMOD_NONE));
+  CHECK(s_recorder.take() == CMD_walk_off);
+
+  // Released once only
+  CHECK(!release(SDLK_UP, KMOD_NONE));
+  CHECK(s_recorder.empty());
+
+  // Other bindings run nothing on release
+  CHECK(press(SDLK_f, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == "record f");
+  CHECK(release(SDLK_f, KMOD_NONE));
+  CHECK(s_recorder.empty());
+}
+
+// Different "+" bindings on the plain and the modified key
+static void testReleaseModifiers() {
+  Bindings::bind("w", CMD_walk_on);
+  Bindings::bind("shift_w", CMD_run_on);
+
+  // Shift let go before w
+  CHECK(press(SDLK_w, KMOD_LSHIFT, WORLD));
+  CHECK(s_recorder.take() == CMD_run_on);
+  CHECK(release(SDLK_w, KMOD_NONE));
+  CHECK(s_recorder.take() == CMD_run_off);
+
+  // Shift pressed while w is held
+  CHECK(press(SDLK_w, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == CMD_walk_on);
+  CHECK(release(SDLK_w, KMOD_LSHIFT));
+  CHECK(s_recorder.take() == CMD_walk_off);
+}
+
+// The console or a widget takes the keyboard while a key is held
+static void testReleaseContext() {
+  Bindings::bind("e", CMD_walk_on, WORLD);
+  Bindings::bind("e", CMD_run_on, GUI);
+
+  CHECK(press(SDLK_e, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == CMD_walk_on);
+  CHECK(release(SDLK_e, KMOD_NONE));
+  CHECK(s_recorder.take() == CMD_walk_off);
+
+  CHECK(press(SDLK_e, KMOD_NONE, GUI));
+  CHECK(s_recorder.take() == CMD_run_on);
+  CHECK(release(SDLK_e, KMOD_NONE));
+  CHECK(s_recorder.take() == CMD_run_off);
+
+  // Rebinding a held key does not change what its release runs
+  CHECK(press(SDLK_e, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == CMD_walk_on);
+  Bindings::bind("e", "/record e", WORLD);
+  CHECK(release(SDLK_e, KMOD_NONE));
+  CHECK(s_recorder.take() == CMD_walk_off);
+}
+
+static void testContexts() {
+  Bindings::bind("g", "/record world_g", WORLD);
+  Bindings::bind("g", "/record gui_g", GUI);
+  Bindings::bind("h", "/record gui_h", GUI);
+
+  CHECK(press(SDLK_g, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == "record world_g");
+  CHECK(press(SDLK_g, KMOD_NONE, GUI));
+  CHECK(s_recorder.take() == "record gui_g");
+
+  CHECK(press(SDLK_h, KMOD_NONE, GUI));
+  CHECK(s_recorder.take() == "record gui_h");
+  CHECK(!press(SDLK_h, KMOD_NONE, WORLD));
+  // World bindings are not used for the GUI
+  CHECK(!press(SDLK_f, KMOD_NONE, GUI));
+  CHECK(s_recorder.empty());
+}
+
+static void testRebind() {
+  Bindings::bind("f", "/record new_f");
+  CHECK(press(SDLK_f, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == "record new_f");
+
+  Bindings::bind("up", "/record up");
+  CHECK(press(SDLK_UP, KMOD_NONE, WORLD));
+  CHECK(s_recorder.take() == "record up");
+  CHECK(release(SDLK_UP, KMOD_NONE));
+  CHECK(s_recorder.empty());
+}
+
+int main(int argc, char **argv) {
+  // The console needs a System, which is not started
+  System system;
+  Console console(&system);
+
+  Bindings::init();
+  console.init();
+  console.registerCommand(CMD_record, &s_recorder);
+  console.registerCommand(CMD_walk_on, &s_recorder);
+  console.registerCommand(CMD_walk_off, &s_recorder);
+  console.registerCommand(CMD_run_on, &s_recorder);
+  console.registerCommand(CMD_run_off, &s_recorder);
+  Bindings::setConsole(&console);
+
+  testModifierOrder();
+  testFallback();
+  testEmpty();
+  testRelease();
+  testReleaseModifiers();
+  testReleaseContext();
+  testContexts();
+  testRebind();
+
+  Bindings::setConsole(NULL);
+  Bindings::shutdown();
+
+  return checkResult("bindings_test");
+}
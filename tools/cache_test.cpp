@@ -0,0 +1,277 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * cache_test runs a CacheManager in a scratch directory and checks that:
+ *   - an entry reads back as it was written, and a replaced entry reads
+ *     back as the new data
+ *   - keys differ for different kinds, versions and data
+ *   - an entry whose file was damaged, cut short or given another entry's
+ *     contents fails its check, and is removed
+ *   - the least recently used entries are evicted to keep within the size
+ *     limit, and entries too large for the cache are refused
+ *   - entries and their order of use survive a restart, and partial
+ *     writes left by a crash are removed
+ *
+ * HOME is pointed at a new directory under /tmp, so the user's own cache is
+ * not touched. The directory is removed at the end if the checks pass.
+ *
+ * Usage: cache_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "src/CacheManager.h"
+#include "src/FileHandler.h"
+#include "src/System.h"
+#include "tools/Check.h"
+
+using Sear::CacheManager;
+using Sear::System;
+
+typedef CacheManager::Key Key;
+
+static std::string s_cache_path;
+
+static std::vector<char> makeData(size_t size, char fill) {
+  std::vector<char> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = fill + (char)(i % 7);
+  return data;
+}
+
+static Key makeKey(int n) {
+  const Key key = CacheManager::makeKey("cache_test", 1);
+  return CacheManager::addToKey(key, &n, sizeof(n));
+}
+
+// Same naming as CacheManager::entryFilename
+static std::string entryFile(Key key) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)key);
+  return s_cache_path + buf + ".bin";
+}
+
+static bool fileExists(const std::string &filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) return false;
+  fclose(fp);
+  return true;
+}
+
+static std::vector<char> readFile(const std::string &filename) {
+  std::vector<char> data;
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) return data;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+  return data;
+}
+
+static void writeFile(const std::string &filename, const std::vector<char> &data) {
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (fp == NULL) return;
+  if (!data.empty()) fwrite(&data[0], data.size(), 1, fp);
+  fclose(fp);
+}
+
+static bool hasEntry(CacheManager &cache, Key key, const std::vector<char> &expected) {
+  std::vector<char> data;
+  return cache.get(key, data) && data == expected;
+}
+
+static void testKeys() {
+  const Key a = CacheManager::makeKey("texture", 1);
+  CHECK(a != CacheManager::makeKey("texture", 2));
+  CHECK(a != CacheManager::makeKey("model", 1));
+  CHECK(a == CacheManager::makeKey("texture", 1));
+  CHECK(CacheManager::addToKey(a, "ab", 2) != CacheManager::addToKey(a, "ba", 2));
+  CHECK(CacheManager::addToKey(a, "ab", 2) == CacheManager::addToKey(a, "ab", 2));
+}
+
+static void testRoundTrip(CacheManager &cache) {
+  const std::vector<char> one = makeData(1000, 'a');
+  const std::vector<char> two = makeData(300, 'b');
+  const std::vector<char> none;
+  std::vector<char> data;
+
+  CHECK(!cache.get(makeKey(1), data));
+  CHECK(cache.put(makeKey(1), one));
+  CHECK(cache.put(makeKey(2), none));
+  CHECK(hasEntry(cache, makeKey(1), one));
+  CHECK(hasEntry(cache, makeKey(2), none));
+  CHECK(cache.getSize() == 1000);
+
+  // Replaced, and the size counted once
+  CHECK(cache.put(makeKey(1), two));
+  CHECK(hasEntry(cache, makeKey(1), two));
+  CHECK(cache.getSize() == 300);
+
+  cache.remove(makeKey(1));
+  CHECK(!cache.get(makeKey(1), data));
+  CHECK(!fileExists(entryFile(makeKey(1))));
+  CHECK(cache.getSize() == 0);
+
+  cache.clear();
+  CHECK(!cache.get(makeKey(2), data));
+}
+
+static void testCorrupt(CacheManager &cache) {
+  const std::vector<char> one = makeData(1000, 'c');
+  const std::vector<char> two = makeData(1000, 'd');
+  std::vector<char> data;
+
+  // One byte of the data changed
+  CHECK(cache.put(makeKey(10), one));
+  std::vector<char> file = readFile(entryFile(makeKey(10)));
+  CHECK(file.size() > one.size());
+  file[file.size() - 10] ^= 1;
+  writeFile(entryFile(makeKey(10)), file);
+  CHECK(!cache.get(makeKey(10), data));
+  CHECK(data.empty());
+  CHECK(!fileExists(entryFile(makeKey(10))));
+  CHECK(cache.getSize() == 0);
+  // Gone for good, not just failed once
+  CHECK(!cache.get(makeKey(10), data));
+
+  // Cut short
+  CHECK(cache.put(makeKey(11), one));
+  file = readFile(entryFile(makeKey(11)));
+  file.resize(file.size() - 1);
+  writeFile(entryFile(makeKey(11)), file);
+  CHECK(!cache.get(makeKey(11), data));
+  CHECK(!fileExists(entryFile(makeKey(11))));
+
+  // Another entry's file, which is sound in itself
+  CHECK(cache.put(makeKey(12), one));
+  CHECK(cache.put(makeKey(13), two));
+  writeFile(entryFile(makeKey(13)), readFile(entryFile(makeKey(12))));
+  CHECK(!cache.get(makeKey(13), data));
+  CHECK(hasEntry(cache, makeKey(12), one));
+
+  // Removed behind the cache's back
+  remove(entryFile(makeKey(12)).c_str());
+  CHECK(!cache.get(makeKey(12), data));
+  CHECK(cache.getSize() == 0);
+}
+
+static void testEvict(CacheManager &cache) {
+  const uint64_t old_limit = cache.getSizeLimit();
+  cache.setSizeLimit(4000);
+
+  // Too large, as it would push out most of the cache
+  CHECK(!cache.put(makeKey(20), makeData(1001, 'e')));
+  CHECK(cache.getSize() == 0);
+
+  for (int i = 0; i < 4; ++i) {
+    CHECK(cache.put(makeKey(20 + i), makeData(1000, 'f' + i)));
+  }
+  CHECK(cache.getSize() == 4000);
+
+  // Using the oldest makes the second oldest go first
+  CHECK(hasEntry(cache, makeKey(20), makeData(1000, 'f')));
+  CHECK(cache.put(makeKey(24), makeData(1000, 'j')));
+  CHECK(cache.getSize() == 4000);
+  std::vector<char> data;
+  CHECK(!cache.get(makeKey(21), data));
+  CHECK(!fileExists(entryFile(makeKey(21))));
+  CHECK(hasEntry(cache, makeKey(20), makeData(1000, 'f')));
+  CHECK(hasEntry(cache, makeKey(22), makeData(1000, 'h')));
+  CHECK(hasEntry(cache, makeKey(23), makeData(1000, 'i')));
+  CHECK(hasEntry(cache, makeKey(24), makeData(1000, 'j')));
+
+  // Lowering the limit evicts straight away, oldest first
+  cache.setSizeLimit(2500);
+  CHECK(cache.getSize() == 2000);
+  CHECK(!cache.get(makeKey(20), data));
+  CHECK(!cache.get(makeKey(22), data));
+  CHECK(hasEntry(cache, makeKey(23), makeData(1000, 'i')));
+  CHECK(hasEntry(cache, makeKey(24), makeData(1000, 'j')));
+
+  cache.setSizeLimit(old_limit);
+}
+
+static void testRestart() {
+  const uint64_t MB = 1024 * 1024;
+  std::vector<char> data;
+  {
+    CacheManager cache;
+    CHECK(cache.init() == 0);
+    cache.clear();
+    cache.setSizeLimit(4 * MB);
+    for (int i = 0; i < 4; ++i) {
+      CHECK(cache.put(makeKey(30 + i), makeData(MB, 'k' + i)));
+    }
+    CHECK(cache.get(makeKey(30), data));
+    cache.shutdown();
+  }
+
+  // A partial write and an entry the index does not know about, as a
+  // crash could leave behind
+  writeFile(s_cache_path + "0123456789abcdef.tmp", makeData(10, 'x'));
+  writeFile(entryFile(makeKey(39)), makeData(10, 'x'));
+
+  CacheManager cache;
+  CHECK(cache.init() == 0);
+  CHECK(cache.getSize() == 4 * MB);
+  CHECK(cache.getSizeLimit() == 4 * MB);
+  CHECK(!fileExists(s_cache_path + "0123456789abcdef.tmp"));
+  CHECK(!fileExists(entryFile(makeKey(39))));
+  CHECK(hasEntry(cache, makeKey(32), makeData(MB, 'm')));
+
+  // 30 was used after 31 before the restart, so 31 goes first
+  CHECK(cache.put(makeKey(34), makeData(1024, 'o')));
+  CHECK(cache.getSize() == 3 * MB + 1024);
+  CHECK(!cache.get(makeKey(31), data));
+  CHECK(hasEntry(cache, makeKey(30), makeData(MB, 'k')));
+  CHECK(hasEntry(cache, makeKey(33), makeData(MB, 'n')));
+
+  cache.clear();
+  cache.shutdown();
+}
+
+int main(int argc, char **argv) {
+  char home[] = "/tmp/cache_test.XXXXXX";
+  if (mkdtemp(home) == NULL) {
+    perror("cache_test: mkdtemp");
+    return 1;
+  }
+  setenv("HOME", home, 1);
+
+  // Makes the FileHandler, which creates the user data directory
+  System system;
+  s_cache_path = system.getFileHandler()->getUserDataPath() + "/cache/";
+
+  testKeys();
+
+  // Nothing is stored before init
+  CacheManager cache;
+  CHECK(!cache.put(makeKey(0), makeData(10, 'z')));
+
+  CHECK(cache.init() == 0);
+  testRoundTrip(cache);
+  testCorrupt(cache);
+  testEvict(cache);
+  cache.shutdown();
+
+  testRestart();
+
+  if (checkResult("cache_test") != 0) return 1;
+
+  // Only the index should be left
+  remove((s_cache_path + "cache.vconf").c_str());
+  rmdir(s_cache_path.c_str());
+  rmdir(system.getFileHandler()->getUserDataPath().c_str());
+  rmdir(home);
+  return 0;
+}
@@ -0,0 +1,190 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * command_table_test checks the CommandTable used by the console against a
+ * plain sorted map of the same names. Every full name, every prefix of
+ * every name and a set of names that are not in the table are looked up,
+ * and the exact lookup, abbreviation, prefix listing and tab completion
+ * results are compared. Enough names are added to make the hash index
+ * grow several times.
+ *
+ * It then times full name lookup against the std::map the console used
+ * before.
+ *
+ * Usage: command_table_test [rounds]
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include "src/CommandTable.h"
+#include "tools/Check.h"
+
+using Sear::CommandTable;
+
+typedef CommandTable::CommandID CommandID;
+typedef std::map<std::string, CommandID> NameMap;
+
+static const int DEFAULT_rounds = 200;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+// Names built from a few parts, so many share prefixes and some names are
+// prefixes of others, as with "say" and "say_to".
+static void makeNames(std::vector<std::string> &names) {
+  static const char *heads[] = { "get", "set", "toggle", "render", "r", "s", "cache", "model" };
+  static const char *parts[] = { "", "_a", "_ab", "_abc", "_b", "_state", "_stats", "_x", "_clear" };
+  static const char *tails[] = { "", "1", "2", "_list", "_limit" };
+  const size_t num_heads = sizeof(heads) / sizeof(heads[0]);
+  const size_t num_parts = sizeof(parts) / sizeof(parts[0]);
+  const size_t num_tails = sizeof(tails) / sizeof(tails[0]);
+  for (size_t h = 0; h < num_heads; ++h) {
+    for (size_t p = 0; p < num_parts; ++p) {
+      for (size_t t = 0; t < num_tails; ++t) {
+        names.push_back(std::string(heads[h]) + parts[p] + tails[t]);
+      }
+    }
+  }
+  // Shuffle so insertion order is not alphabetical
+  srand(1);
+  for (size_t i = names.size() - 1; i > 0; --i) {
+    const size_t j = rand() % (i + 1);
+    std::swap(names[i], names[j]);
+  }
+}
+
+static bool startsWith(const std::string &str, const std::string &prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Check every query on one prefix against the reference map
+static void checkPrefix(const CommandTable &table, const NameMap &ref, const std::string &prefix) {
+  std::vector<CommandID> expected;
+  for (NameMap::const_iterator I = ref.lower_bound(prefix); I != ref.end() && startsWith(I->first, prefix); ++I) {
+    expected.push_back(I->second);
+  }
+
+  CHECK(table.countPrefix(prefix) == expected.size());
+
+  std::vector<CommandID> ids;
+  table.findPrefix(prefix, ids);
+  CHECK(ids == expected);
+
+  unsigned int matches = 0;
+  const CommandID id = table.resolve(prefix, matches);
+  CHECK(matches == expected.size());
+  NameMap::const_iterator exact = ref.find(prefix);
+  if (exact != ref.end()) {
+    CHECK(id == exact->second);
+  } else if (expected.size() == 1) {
+    CHECK(id == expected[0]);
+  } else {
+    CHECK(id == CommandTable::INVALID_COMMAND);
+  }
+
+  // Completion extends the prefix as far as all matches agree, but stops
+  // at a complete name
+  std::string completion = prefix;
+  if (!expected.empty() && exact == ref.end()) {
+    const std::string &first = table.getName(expected.front());
+    const std::string &last = table.getName(expected.back());
+    std::string::size_type n = prefix.size();
+    while (n < first.size() && n < last.size() && first[n] == last[n]) {
+      completion += first[n];
+      ++n;
+      if (ref.find(completion) != ref.end()) break;
+    }
+  }
+  CHECK(table.completePrefix(prefix) == completion);
+}
+
+static void checkTable(const std::vector<std::string> &names) {
+  CommandTable table;
+  NameMap ref;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const CommandID id = table.add(names[i], NULL);
+    CHECK(id == (CommandID)i);
+    ref[names[i]] = id;
+  }
+  CHECK(table.size() == names.size());
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    CHECK(table.find(names[i]) == (CommandID)i);
+    CHECK(table.getName(i) == names[i]);
+    for (std::string::size_type n = 0; n <= names[i].size(); ++n) {
+      checkPrefix(table, ref, names[i].substr(0, n));
+    }
+  }
+
+  const char *missing[] = { "", "q", "get_", "setx", "toggle_stats_list_", "render_abc_limits", "GET" };
+  for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); ++i) {
+    if (ref.find(missing[i]) != ref.end()) continue;
+    CHECK(table.find(missing[i]) == CommandTable::INVALID_COMMAND);
+    checkPrefix(table, ref, missing[i]);
+  }
+
+  table.clear();
+  CHECK(table.size() == 0);
+  CHECK(table.find(names[0]) == CommandTable::INVALID_COMMAND);
+  CHECK(table.countPrefix("") == 0);
+  CHECK(table.add(names[0], NULL) == 0);
+  CHECK(table.find(names[0]) == 0);
+}
+
+static void benchmark(const std::vector<std::string> &names, int rounds) {
+  CommandTable table;
+  std::map<std::string, CommandID> map;
+  for (size_t i = 0; i < names.size(); ++i) {
+    map[names[i]] = table.add(names[i], NULL);
+  }
+
+  unsigned int found = 0;
+  double start = now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (table.find(names[i]) != CommandTable::INVALID_COMMAND) ++found;
+    }
+  }
+  const double table_time = now() - start;
+
+  start = now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (map.find(names[i]) != map.end()) ++found;
+    }
+  }
+  const double map_time = now() - start;
+
+  const double count = (double)rounds * names.size();
+  printf("%lu names, %u found\n", (unsigned long)names.size(), found);
+  printf("CommandTable::find: %.1f ns per lookup\n", table_time * 1000.0 / count);
+  printf("std::map::find:     %.1f ns per lookup\n", map_time * 1000.0 / count);
+}
+
+int main(int argc, char **argv) {
+  int rounds = DEFAULT_rounds;
+  if (argc > 1) rounds = atoi(argv[1]);
+  if (rounds < 1) rounds = 1;
+
+  std::vector<std::string> names;
+  makeNames(names);
+  checkTable(names);
+
+  if (checkResult("command_table_test") != 0) return 1;
+
+  benchmark(names, rounds);
+  return 0;
+}
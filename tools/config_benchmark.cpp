@@ -0,0 +1,169 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * config_benchmark compares reading varconf files as text with the
+ * compiled config cache used by FileHandler::readConfigFile.
+ *
+ *   text  varconf::Config::readFromFile, as before the cache
+ *   miss  read the file, hash it for the cache key, parse and serialise
+ *   hit   read the file, hash it, deserialise and apply the cached items
+ *
+ * Writing the cache entry to disk on a miss is not included. The configs
+ * have no callbacks attached, so only the parsing cost differs; subsystems
+ * see the same callbacks in the same order either way.
+ *
+ * Usage: config_benchmark [-r rounds] file...
+ * e.g.   config_benchmark -r 100 data/*.cfg
+ *
+ * Exits with a non-zero status if the cached items differ from a text parse.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <varconf/config.h>
+
+#include "src/CacheManager.h"
+#include "src/CompiledConfig.h"
+
+using Sear::CacheManager;
+using Sear::CompiledConfig;
+
+static const int DEFAULT_rounds = 50;
+
+// Same as FileHandler's config key
+static const unsigned int CONFIG_CACHE_VERSION = 1;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static bool readText(const std::string &file_name, std::vector<char> &text) {
+  FILE *fp = fopen(file_name.c_str(), "rb");
+  if (fp == NULL) return false;
+  text.clear();
+  char buf[8192];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    text.insert(text.end(), buf, buf + n);
+  }
+  const bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+static CacheManager::Key configKey(const std::vector<char> &text) {
+  CacheManager::Key key = CacheManager::makeKey("config", CONFIG_CACHE_VERSION);
+  const uint64_t size = text.size();
+  key = CacheManager::addToKey(key, &size, sizeof(size));
+  if (!text.empty()) key = CacheManager::addToKey(key, &text[0], text.size());
+  return key;
+}
+
+// Check every section of a against b, then the reverse
+static bool sameItems(varconf::Config &a, varconf::Config &b) {
+  const varconf::conf_map &sections = a.getSections();
+  for (varconf::conf_map::const_iterator I = sections.begin(); I != sections.end(); ++I) {
+    for (varconf::sec_map::const_iterator J = I->second.begin(); J != I->second.end(); ++J) {
+      if (!b.findItem(I->first, J->first)) return false;
+      if ((std::string)b.getItem(I->first, J->first) != (std::string)J->second) return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int rounds = DEFAULT_rounds;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+    rounds = atoi(argv[2]);
+    first = 3;
+  }
+  if (rounds < 1) rounds = 1;
+  if (first >= argc) {
+    fprintf(stderr, "Usage: %s [-r rounds] file...\n", argv[0]);
+    return 1;
+  }
+
+  bool ok = true;
+  double total_text = 0.0, total_miss = 0.0, total_hit = 0.0;
+  printf("%-30s %7s %12s %12s %12s\n", "file", "bytes", "text us", "miss us", "hit us");
+  for (int f = first; f < argc; ++f) {
+    const std::string file_name = argv[f];
+    std::vector<char> text;
+    if (!readText(file_name, text)) {
+      fprintf(stderr, "config_benchmark: unable to read %s\n", file_name.c_str());
+      ok = false;
+      continue;
+    }
+
+    double start = now();
+    for (int r = 0; r < rounds; ++r) {
+      varconf::Config config;
+      config.readFromFile(file_name);
+    }
+    const double text_time = (now() - start) / rounds;
+
+    std::vector<char> data;
+    start = now();
+    for (int r = 0; r < rounds; ++r) {
+      std::vector<char> buf;
+      readText(file_name, buf);
+      configKey(buf);
+      varconf::Config errors;
+      CompiledConfig compiled;
+      std::istringstream is(std::string(buf.begin(), buf.end()));
+      compiled.parse(is, errors);
+      compiled.serialise(data);
+      varconf::Config config;
+      compiled.apply(config, varconf::GLOBAL);
+    }
+    const double miss_time = (now() - start) / rounds;
+
+    start = now();
+    for (int r = 0; r < rounds; ++r) {
+      std::vector<char> buf;
+      readText(file_name, buf);
+      configKey(buf);
+      CompiledConfig compiled;
+      compiled.deserialise(data);
+      varconf::Config config;
+      compiled.apply(config, varconf::GLOBAL);
+    }
+    const double hit_time = (now() - start) / rounds;
+
+    // The cached items must match a plain parse exactly
+    varconf::Config parsed, cached;
+    parsed.readFromFile(file_name);
+    CompiledConfig compiled;
+    if (!compiled.deserialise(data)) {
+      fprintf(stderr, "config_benchmark: unable to deserialise %s\n", file_name.c_str());
+      ok = false;
+      continue;
+    }
+    compiled.apply(cached, varconf::GLOBAL);
+    if (!sameItems(parsed, cached) || !sameItems(cached, parsed)) {
+      fprintf(stderr, "config_benchmark: cached items differ for %s\n", file_name.c_str());
+      ok = false;
+    }
+
+    printf("%-30s %7lu %12.1f %12.1f %12.1f\n", file_name.c_str(),
+           (unsigned long)text.size(), text_time, miss_time, hit_time);
+    total_text += text_time;
+    total_miss += miss_time;
+    total_hit += hit_time;
+  }
+  printf("%-30s %7s %12.1f %12.1f %12.1f\n", "total", "", total_text, total_miss, total_hit);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * cull_benchmark compares the per volume frustum tests in Frustum with the
+ * batched FrustumCuller. Boxes and bounding spheres are scattered around a
+ * camera at the origin looking down -z, so about a third of them are
+ * visible.
+ *
+ * The batched time is split into filling the packed arrays, which the
+ * renderer does while gathering draw candidates, and the plane tests.
+ *
+ * Usage: cull_benchmark [rounds]
+ *
+ * Exits with a non-zero status if the two paths disagree on any volume.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <wfmath/axisbox.h>
+#include <wfmath/ball.h>
+#include <wfmath/point.h>
+
+#include "renderers/Frustum.h"
+#include "renderers/FrustumCuller.h"
+
+using Sear::Frustum;
+using Sear::FrustumCuller;
+
+static const int DEFAULT_rounds = 20;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static float randf(float lo, float hi) {
+  return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+// Same layout as glFrustum, with an identity model view matrix
+static void makeFrustum(float frustum[6][4]) {
+  const float n = 1.0f, f = 500.0f, w = 0.8f, h = 0.6f;
+  float proj[16] = { 0 };
+  proj[0] = n / w;
+  proj[5] = n / h;
+  proj[10] = -(f + n) / (f - n);
+  proj[11] = -1.0f;
+  proj[14] = -2.0f * f * n / (f - n);
+  float modl[16] = { 0 };
+  modl[0] = modl[5] = modl[10] = modl[15] = 1.0f;
+  Frustum::getFrustum(frustum, proj, modl);
+}
+
+typedef struct {
+  float l[3];
+  float h[3];
+} Box;
+
+static bool runBoxes(const float frustum[6][4], const std::vector<Box> &boxes, int rounds) {
+  const size_t num = boxes.size();
+  std::vector<WFMath::AxisBox<3> > wf_boxes(num);
+  for (size_t i = 0; i < num; ++i) {
+    const Box &b = boxes[i];
+    wf_boxes[i] = WFMath::AxisBox<3>(WFMath::Point<3>(b.l[0], b.l[1], b.l[2]),
+                                     WFMath::Point<3>(b.h[0], b.h[1], b.h[2]));
+  }
+
+  std::vector<bool> old_visible(num);
+  double start = now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < num; ++i) {
+      old_visible[i] = Frustum::axisBoxInFrustum(frustum, wf_boxes[i]) != 0;
+    }
+  }
+  const double old_time = (now() - start) / rounds;
+
+  // The batch is refilled every round, as the renderer does each frame
+  FrustumCuller culler;
+  culler.setFrustum(frustum);
+  double fill_time = 0.0, cull_time = 0.0;
+  for (int r = 0; r < rounds; ++r) {
+    start = now();
+    culler.clear();
+    for (size_t i = 0; i < num; ++i) {
+      const Box &b = boxes[i];
+      culler.addBox(b.l[0], b.l[1], b.l[2], b.h[0], b.h[1], b.h[2]);
+    }
+    const double mid = now();
+    culler.cull();
+    const double end = now();
+    fill_time += mid - start;
+    cull_time += end - mid;
+  }
+  fill_time /= rounds;
+  cull_time /= rounds;
+  const double new_time = fill_time + cull_time;
+
+  size_t visible = 0, mismatch = 0;
+  for (size_t i = 0; i < num; ++i) {
+    if (old_visible[i]) ++visible;
+    if (old_visible[i] != culler.isVisible(i)) ++mismatch;
+  }
+
+  printf("boxes   %7lu: axisBoxInFrustum %7.3f ms  FrustumCuller %7.3f ms (fill %7.3f, cull %7.3f)  x%.1f  visible %lu  mismatches %lu\n",
+         (unsigned long)num, old_time, new_time, fill_time, cull_time, old_time / new_time,
+         (unsigned long)visible, (unsigned long)mismatch);
+  return mismatch == 0;
+}
+
+static bool runSpheres(const float frustum[6][4], const std::vector<Box> &boxes, int rounds) {
+  const size_t num = boxes.size();
+  std::vector<WFMath::Ball<3> > balls(num);
+  for (size_t i = 0; i < num; ++i) {
+    const Box &b = boxes[i];
+    const float dx = b.h[0] - b.l[0], dy = b.h[1] - b.l[1], dz = b.h[2] - b.l[2];
+    balls[i] = WFMath::Ball<3>(WFMath::Point<3>((b.l[0] + b.h[0]) * 0.5f,
+                                                (b.l[1] + b.h[1]) * 0.5f,
+                                                (b.l[2] + b.h[2]) * 0.5f),
+                               0.5f * sqrtf(dx * dx + dy * dy + dz * dz));
+  }
+
+  std::vector<bool> old_visible(num);
+  double start = now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < num; ++i) {
+      old_visible[i] = Frustum::ballInFrustum(frustum, balls[i]);
+    }
+  }
+  const double old_time = (now() - start) / rounds;
+
+  FrustumCuller culler;
+  culler.setFrustum(frustum);
+  double fill_time = 0.0, cull_time = 0.0;
+  for (int r = 0; r < rounds; ++r) {
+    start = now();
+    culler.clear();
+    for (size_t i = 0; i < num; ++i) {
+      const WFMath::Ball<3> &b = balls[i];
+      culler.addSphere(b.getCenter().x(), b.getCenter().y(), b.getCenter().z(), b.radius());
+    }
+    const double mid = now();
+    culler.cull();
+    const double end = now();
+    fill_time += mid - start;
+    cull_time += end - mid;
+  }
+  fill_time /= rounds;
+  cull_time /= rounds;
+  const double new_time = fill_time + cull_time;
+
+  size_t visible = 0, mismatch = 0;
+  for (size_t i = 0; i < num; ++i) {
+    if (old_visible[i]) ++visible;
+    if (old_visible[i] != culler.isVisible(i)) ++mismatch;
+  }
+
+  printf("spheres %7lu: ballInFrustum    %7.3f ms  FrustumCuller %7.3f ms (fill %7.3f, cull %7.3f)  x%.1f  visible %lu  mismatches %lu\n",
+         (unsigned long)num, old_time, new_time, fill_time, cull_time, old_time / new_time,
+         (unsigned long)visible, (unsigned long)mismatch);
+  return mismatch == 0;
+}
+
+int main(int argc, char **argv) {
+  int rounds = DEFAULT_rounds;
+  if (argc > 1) rounds = atoi(argv[1]);
+  if (rounds < 1) rounds = 1;
+
+  float frustum[6][4];
+  makeFrustum(frustum);
+
+  srand(1);
+  bool ok = true;
+  const size_t sizes[] = { 10000, 50000, 100000 };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    std::vector<Box> boxes(sizes[s]);
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      Box &b = boxes[i];
+      const float x = randf(-300.0f, 300.0f);
+      const float y = randf(-300.0f, 300.0f);
+      const float z = randf(-500.0f, 100.0f);
+      const float size = randf(0.5f, 10.0f);
+      b.l[0] = x; b.l[1] = y; b.l[2] = z;
+      b.h[0] = x + size; b.h[1] = y + size; b.h[2] = z + randf(0.5f, 10.0f);
+    }
+    if (!runBoxes(frustum, boxes, rounds)) ok = false;
+    if (!runSpheres(frustum, boxes, rounds)) ok = false;
+  }
+
+  if (!ok) {
+    fprintf(stderr, "cull_benchmark: FrustumCuller disagrees with Frustum\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,229 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * entity_mapper_test feeds made up match rows to the EntityMapper, as if
+ * read from a mapping file, and chooses records for made up attribute
+ * values. It checks that:
+ *   - rows are tried in order of their number, not the order they were read
+ *   - only match_<number> keys are used as rows
+ *   - "attribute", "!attribute" and each comparison match as documented
+ *   - numbers are compared as numbers, and text only for equality
+ *   - a condition is split at its first operator
+ *   - rows that do not compile are dropped
+ *
+ * No entities are made, so the client is not started.
+ *
+ * Usage: entity_mapper_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+#include <varconf/config.h>
+
+#include "loaders/EntityMapper.h"
+#include "tools/Check.h"
+
+namespace Sear {
+
+// Reaches the mapper's tables, which are otherwise only filled from files
+// and read through entities
+class EntityMapperTest {
+public:
+  typedef std::map<std::string, std::string> Attributes;
+
+  EntityMapperTest() { m_mapper.init(); }
+
+  void set(const std::string &type, const std::string &key, const std::string &value) {
+    m_config.setItem(type, key, value);
+    m_mapper.varconf_callback(type, key, m_config);
+  }
+
+  void compile() { m_mapper.compileTables(); }
+
+  size_t numRows(const std::string &type) const {
+    EntityMapper::MatchTableMap::const_iterator T = m_mapper.m_match_tables.find(type);
+    return (T == m_mapper.m_match_tables.end()) ? 0 : T->second.rows.size();
+  }
+
+  std::string rowName(const std::string &type, size_t row) const {
+    return m_mapper.m_match_tables.find(type)->second.rows[row].name;
+  }
+
+  size_t numColumns(const std::string &type) const {
+    return m_mapper.m_match_tables.find(type)->second.columns.size();
+  }
+
+  // The mapping of the first matching row, or "" if none match. Values
+  // are read as EntityMapper::readAttributes reads string attributes.
+  std::string match(const std::string &type, const Attributes &attributes) const {
+    const EntityMapper::MatchTable &table = m_mapper.m_match_tables.find(type)->second;
+    EntityMapper::AttributeValueList values(table.columns.size());
+    for (size_t i = 0; i < table.columns.size(); ++i) {
+      EntityMapper::AttributeValue &value = values[i];
+      Attributes::const_iterator I = attributes.find(table.columns[i]);
+      value.present = (I != attributes.end());
+      value.text = value.present ? I->second : "";
+      char *end = 0;
+      value.number = strtod(value.text.c_str(), &end);
+      value.is_number = !value.text.empty() && *end == '\0';
+    }
+    const int row = EntityMapper::findMatch(table, values);
+    return (row >= 0) ? table.rows[row].mapping : "";
+  }
+
+private:
+  EntityMapper m_mapper;
+  varconf::Config m_config;
+};
+
+} /* namespace Sear */
+
+using Sear::EntityMapperTest;
+
+typedef EntityMapperTest::Attributes Attributes;
+
+static Attributes attrs(const char *name = 0, const char *value = 0,
+                        const char *name2 = 0, const char *value2 = 0) {
+  Attributes a;
+  if (name) a[name] = value;
+  if (name2) a[name2] = value2;
+  return a;
+}
+
+static void testOrder() {
+  EntityMapperTest t;
+  t.set("oak", "match_10", "size > 1 : oak_ten");
+  t.set("oak", "match_2", "size > 2 : oak_two");
+  t.set("oak", "match_1", "size > 3 : oak_one");
+  t.compile();
+
+  CHECK(t.numRows("oak") == 3);
+  CHECK(t.rowName("oak", 0) == "match_1");
+  CHECK(t.rowName("oak", 1) == "match_2");
+  CHECK(t.rowName("oak", 2) == "match_10");
+  // All three test the same attribute
+  CHECK(t.numColumns("oak") == 1);
+
+  CHECK(t.match("oak", attrs("size", "5")) == "oak_one");
+  CHECK(t.match("oak", attrs("size", "3")) == "oak_two");
+  CHECK(t.match("oak", attrs("size", "2")) == "oak_ten");
+  CHECK(t.match("oak", attrs("size", "1")) == "");
+  CHECK(t.match("oak", attrs()) == "");
+}
+
+static void testKeys() {
+  EntityMapperTest t;
+  t.set("pine", "match_3", ": pine_three");
+  t.set("pine", "match", ": pine_bare");
+  t.set("pine", "match_", ": pine_empty");
+  t.set("pine", "match_x", ": pine_x");
+  t.set("pine", "matches", ": pine_matches");
+  t.set("pine", "match_1x", ": pine_1x");
+  t.compile();
+
+  CHECK(t.numRows("pine") == 1);
+  CHECK(t.match("pine", attrs()) == "pine_three");
+
+  // Another key with the same number replaces the row, with a warning, as
+  // does the same key read again
+  t.set("pine", "match_03", ": pine_zero_three");
+  t.compile();
+  CHECK(t.numRows("pine") == 1);
+  CHECK(t.match("pine", attrs()) == "pine_zero_three");
+  t.set("pine", "match_03", ": pine_again");
+  t.compile();
+  CHECK(t.match("pine", attrs()) == "pine_again");
+}
+
+static void testExists() {
+  EntityMapperTest t;
+  t.set("chest", "match_1", "!owner : chest_free");
+  t.set("chest", "match_2", "owner && locked : chest_locked");
+  t.set("chest", "match_3", "owner : chest_owned");
+  t.compile();
+
+  CHECK(t.match("chest", attrs()) == "chest_free");
+  CHECK(t.match("chest", attrs("locked", "1")) == "chest_free");
+  CHECK(t.match("chest", attrs("owner", "bob")) == "chest_owned");
+  CHECK(t.match("chest", attrs("owner", "bob", "locked", "")) == "chest_locked");
+}
+
+static void testCompare() {
+  EntityMapperTest t;
+  t.set("wall", "match_1", "status < 0.25 : wall_ruin");
+  t.set("wall", "match_2", "status <= 0.5 : wall_damaged");
+  t.set("wall", "match_3", "status >= 2 : wall_strong");
+  t.set("wall", "match_4", "status > 1 : wall_good");
+  t.set("wall", "match_5", "status != 1 : wall_odd");
+  t.set("wall", "match_6", "status == 1 : wall_new");
+  t.compile();
+
+  CHECK(t.match("wall", attrs("status", "0.1")) == "wall_ruin");
+  CHECK(t.match("wall", attrs("status", "0.25")) == "wall_damaged");
+  CHECK(t.match("wall", attrs("status", "0.5")) == "wall_damaged");
+  CHECK(t.match("wall", attrs("status", "0.75")) == "wall_odd");
+  CHECK(t.match("wall", attrs("status", "1")) == "wall_new");
+  CHECK(t.match("wall", attrs("status", "1.5")) == "wall_good");
+  CHECK(t.match("wall", attrs("status", "2")) == "wall_strong");
+
+  // Numbers are compared as numbers, whatever their spelling
+  CHECK(t.match("wall", attrs("status", "1.0")) == "wall_new");
+  CHECK(t.match("wall", attrs("status", "2e0")) == "wall_strong");
+
+  // Text is never less or greater than anything, only unequal
+  CHECK(t.match("wall", attrs("status", "broken")) == "wall_odd");
+  CHECK(t.match("wall", attrs()) == "");
+}
+
+static void testText() {
+  EntityMapperTest t;
+  t.set("tree", "match_1", "mode == felled : tree_stump");
+  t.set("tree", "match_2", "name == 'big tree' : tree_big");
+  t.set("tree", "match_3", "name != a==b : tree_named");
+  t.set("tree", "match_4", ": tree");
+  t.compile();
+
+  CHECK(t.numRows("tree") == 4);
+  CHECK(t.match("tree", attrs("mode", "felled")) == "tree_stump");
+  CHECK(t.match("tree", attrs("mode", "Felled")) == "tree");
+  CHECK(t.match("tree", attrs("name", "big tree")) == "tree_big");
+
+  // Split at "!=", so the value is "a==b"
+  CHECK(t.match("tree", attrs("name", "a==b")) == "tree");
+  CHECK(t.match("tree", attrs("name", "a")) == "tree_named");
+  CHECK(t.numColumns("tree") == 2);
+}
+
+static void testBadRows() {
+  EntityMapperTest t;
+  t.set("rock", "match_1", "size > big : rock_text_order");
+  t.set("rock", "match_2", "size > 1");
+  t.set("rock", "match_3", "size > 1 :");
+  t.set("rock", "match_4", "== 1 : rock_no_attribute");
+  t.set("rock", "match_5", "size > 1 && : rock_empty_condition");
+  t.set("rock", "match_6", "size <= 1 : rock_small");
+  t.compile();
+
+  CHECK(t.numRows("rock") == 1);
+  CHECK(t.rowName("rock", 0) == "match_6");
+  CHECK(t.match("rock", attrs("size", "1")) == "rock_small");
+  CHECK(t.match("rock", attrs("size", "2")) == "");
+}
+
+int main(int argc, char **argv) {
+  testOrder();
+  testKeys();
+  testExists();
+  testCompare();
+  testText();
+  testBadRows();
+
+  return checkResult("entity_mapper_test");
+}
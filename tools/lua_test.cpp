@@ -0,0 +1,172 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * lua_test runs made up Lua code through the LuaScriptEngine and checks
+ * its chunk cache:
+ *   - running the same code again calls the cached function, without
+ *     compiling it again
+ *   - changed code, or the same code under another chunk name, is
+ *     compiled as a new chunk
+ *   - code that does not compile is not cached
+ *   - the cache is emptied once it holds 512 chunks, and chunks compiled
+ *     before that are compiled again when next used
+ *
+ * The CacheManager is not started, so no bytecode is written to disk and
+ * the client is not started.
+ *
+ * Usage: lua_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <string>
+
+#include "swig/lua/LuaScriptEngine.h"
+#include "tools/Check.h"
+
+// Kept in step with MAX_CHUNKS in LuaScriptEngine.cpp
+static const unsigned int MAX_CHUNKS = 512;
+
+namespace Sear {
+
+// Reads the engine's cache counters
+class LuaScriptEngineTest {
+public:
+  LuaScriptEngineTest() { m_engine.init(); }
+  ~LuaScriptEngineTest() { m_engine.shutdown(); }
+
+  LuaScriptEngine &engine() { return m_engine; }
+  unsigned int runs() const { return m_engine.m_runs; }
+  unsigned int hits() const { return m_engine.m_hits; }
+  unsigned int compiles() const { return m_engine.m_compiles; }
+  size_t chunks() const { return m_engine.m_chunks.size(); }
+
+  // The global n, which the test code adds to
+  double n() {
+    lua_State *L = m_engine.getState();
+    lua_getglobal(L, "n");
+    const double value = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return value;
+  }
+
+private:
+  LuaScriptEngine m_engine;
+};
+
+} /* namespace Sear */
+
+using Sear::LuaScriptEngineTest;
+
+// Code that adds a number to n
+static std::string add(int amount) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "n = (n or 0) + %d", amount);
+  return buf;
+}
+
+static void testHit() {
+  LuaScriptEngineTest t;
+
+  CHECK(t.engine().runString(add(1)) == 0);
+  CHECK(t.compiles() == 1 && t.hits() == 0 && t.chunks() == 1);
+  CHECK(t.n() == 1);
+
+  // The cached function still runs
+  CHECK(t.engine().runString(add(1)) == 0);
+  CHECK(t.compiles() == 1 && t.hits() == 1 && t.chunks() == 1);
+  CHECK(t.runs() == 2);
+  CHECK(t.n() == 2);
+}
+
+static void testChanged() {
+  LuaScriptEngineTest t;
+  lua_State *L = t.engine().getState();
+
+  CHECK(t.engine().runString(add(1)) == 0);
+  CHECK(t.engine().runString(add(10)) == 0);
+  CHECK(t.compiles() == 2 && t.hits() == 0 && t.chunks() == 2);
+  CHECK(t.n() == 11);
+
+  // The name is part of the compiled chunk
+  const int top = lua_gettop(L);
+  CHECK(t.engine().loadChunk(add(1), "first") == 0);
+  CHECK(t.engine().loadChunk(add(1), "second") == 0);
+  CHECK(t.engine().loadChunk(add(1), "first") == 0);
+  CHECK(lua_gettop(L) == top + 3);
+  CHECK(lua_isfunction(L, -1));
+  lua_settop(L, top);
+  CHECK(t.compiles() == 4 && t.hits() == 1 && t.chunks() == 4);
+
+  // Both old chunks are still used
+  CHECK(t.engine().runString(add(1)) == 0);
+  CHECK(t.engine().runString(add(10)) == 0);
+  CHECK(t.compiles() == 4 && t.hits() == 3);
+  CHECK(t.n() == 22);
+}
+
+static void testError() {
+  LuaScriptEngineTest t;
+  lua_State *L = t.engine().getState();
+
+  const int top = lua_gettop(L);
+  CHECK(t.engine().loadChunk("n = = 1", "bad") == LUA_ERRSYNTAX);
+  // The message replaces the function
+  CHECK(lua_gettop(L) == top + 1);
+  CHECK(lua_isstring(L, -1));
+  lua_settop(L, top);
+  CHECK(t.chunks() == 0);
+
+  CHECK(t.engine().runString("n = = 1") == LUA_ERRSYNTAX);
+  CHECK(lua_gettop(L) == top);
+
+  // Compiles, so it is cached, but fails when run
+  CHECK(t.engine().runString("error('stop')") == LUA_ERRRUN);
+  CHECK(t.chunks() == 1);
+  CHECK(lua_gettop(L) == top);
+}
+
+static void testLimit() {
+  LuaScriptEngineTest t;
+  lua_State *L = t.engine().getState();
+
+  for (unsigned int i = 0; i < MAX_CHUNKS; ++i) {
+    CHECK(t.engine().runString(add(i)) == 0);
+  }
+  CHECK(t.chunks() == MAX_CHUNKS);
+  CHECK(t.compiles() == MAX_CHUNKS);
+  CHECK(t.engine().runString(add(0)) == 0);
+  CHECK(t.hits() == 1);
+
+  // One more empties the cache, then is cached itself and still runs
+  const int top = lua_gettop(L);
+  CHECK(t.engine().loadChunk(add(1), "extra") == 0);
+  CHECK(t.chunks() == 1);
+  CHECK(t.compiles() == MAX_CHUNKS + 1);
+
+  const double before = t.n();
+  CHECK(lua_pcall(L, 0, 0, 0) == 0);
+  CHECK(t.n() == before + 1);
+  lua_settop(L, top);
+
+  // Compiled again after the cache was emptied
+  CHECK(t.engine().runString(add(0)) == 0);
+  CHECK(t.compiles() == MAX_CHUNKS + 2);
+  CHECK(t.hits() == 1 && t.chunks() == 2);
+
+  // The cache was emptied once only
+  CHECK(t.engine().runString(add(0)) == 0);
+  CHECK(t.hits() == 2 && t.chunks() == 2);
+}
+
+int main(int argc, char **argv) {
+  testHit();
+  testChanged();
+  testError();
+  testLimit();
+
+  return checkResult("lua_test");
+}
@@ -0,0 +1,237 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * matrix_test checks the Matrix used to build object transforms:
+ *   - the SSE and plain versions of every method give the same result for
+ *     random chains of transforms
+ *   - applyRotate turns points the same way as a WFMath::Quaternion of the
+ *     same axis and angle
+ *   - a transform built as GL::getObjectTransform does places points
+ *     where WFMath says the entity's points are
+ *
+ * It then times building that transform with both versions.
+ *
+ * When built without SSE both versions are the same code, and only the
+ * WFMath checks mean anything.
+ *
+ * Usage: matrix_test [count]
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <sys/time.h>
+
+#include <wfmath/quaternion.h>
+#include <wfmath/vector.h>
+#include <wfmath/point.h>
+
+#include "common/Utility.h"
+#include "common/Matrix.h"
+#include "tools/Check.h"
+
+// The same header again without SSE and under another name, so both
+// versions can be used side by side.
+#ifdef SEAR_MATRIX_SSE
+#define MATRIX_HAS_SSE 1
+#endif
+#undef SEAR_MATRIX_H
+#undef SEAR_MATRIX_SSE
+#define SEAR_NO_SSE 1
+#define Matrix ScalarMatrix
+#include "common/Matrix.h"
+#undef Matrix
+
+using Sear::Matrix;
+using Sear::ScalarMatrix;
+using Sear::QuatToMatrix;
+
+static const int DEFAULT_count = 1000000;
+
+// Number of random chains to compare
+static const int NUM_chains = 2000;
+
+// Allowed difference, relative to the size of the values compared
+static const float TOLERANCE = 1e-5f;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static float randomFloat(float range) {
+  return range * ((rand() % 2001) - 1000) / 1000.0f;
+}
+
+static bool closeTo(float a, float b) {
+  return fabs(a - b) <= TOLERANCE * (1.0f + fabs(a) + fabs(b));
+}
+
+static bool sameMatrix(const Matrix &a, const ScalarMatrix &b) {
+  for (int i = 0; i < 16; ++i) {
+    if (!closeTo(a.getMatrix()[i], b.getMatrix()[i])) return false;
+  }
+  return true;
+}
+
+static bool samePoint(const float a[3], float x, float y, float z) {
+  return closeTo(a[0], x) && closeTo(a[1], y) && closeTo(a[2], z);
+}
+
+// Apply the same random steps to both versions, checking after each one
+static void checkChain() {
+  Matrix a;
+  ScalarMatrix b;
+  a.identity();
+  b.identity();
+
+  for (int step = 0; step < 8; ++step) {
+    const float x = randomFloat(10.0f), y = randomFloat(10.0f), z = randomFloat(10.0f);
+    switch (rand() % 9) {
+      case 0: a.applyTranslate(x, y, z); b.applyTranslate(x, y, z); break;
+      case 1: a.applyScale(x / 5.0f, y / 5.0f, z / 5.0f); b.applyScale(x / 5.0f, y / 5.0f, z / 5.0f); break;
+      case 2: {
+        const float angle = randomFloat(180.0f);
+        a.applyRotate(angle, x, y, z);
+        b.applyRotate(angle, x, y, z);
+        break;
+      }
+      case 3: {
+        float m[4][4];
+        for (int i = 0; i < 16; ++i) m[i / 4][i % 4] = randomFloat(1.0f);
+        a.applyMatrix(m);
+        b.applyMatrix(m);
+        break;
+      }
+      case 4: {
+        float m[4][4];
+        for (int i = 0; i < 16; ++i) m[i / 4][i % 4] = randomFloat(1.0f);
+        a.multMatrix(m);
+        b.multMatrix(m);
+        break;
+      }
+      case 5: a.rotateX(x / 5.0f); b.rotateX(x / 5.0f); break;
+      case 6: a.rotateY(x / 5.0f); b.rotateY(x / 5.0f); break;
+      case 7: a.rotateZ(x / 5.0f); b.rotateZ(x / 5.0f); break;
+      case 8: a.translate(x, y, z); b.translate(x, y, z); break;
+    }
+    CHECK(sameMatrix(a, b));
+
+    const float in[3] = { randomFloat(5.0f), randomFloat(5.0f), randomFloat(5.0f) };
+    float out_a[3], out_b[3];
+    a.transformPoint(in, out_a);
+    b.transformPoint(in, out_b);
+    CHECK(samePoint(out_a, out_b[0], out_b[1], out_b[2]));
+  }
+}
+
+static void checkRotate() {
+  const WFMath::Vector<3> axis(randomFloat(1.0f), randomFloat(1.0f), randomFloat(1.0f) + 2.0f);
+  const float angle = randomFloat(180.0f);
+  const WFMath::Quaternion q(axis, angle * (M_PI / 180.0f));
+
+  Matrix mx;
+  mx.identity();
+  mx.applyRotate(angle, axis.x(), axis.y(), axis.z());
+
+  const float in[3] = { randomFloat(5.0f), randomFloat(5.0f), randomFloat(5.0f) };
+  float out[3];
+  mx.transformPoint(in, out);
+  WFMath::Vector<3> v(in[0], in[1], in[2]);
+  v.rotate(q);
+  CHECK(samePoint(out, v.x(), v.y(), v.z()));
+}
+
+// Build a transform as GL::getObjectTransform does for an entity at pos
+// with the given orientation, and a model scaled and offset in its record
+static void buildObject(Matrix &mx, const WFMath::Point<3> &pos,
+                        const WFMath::Quaternion &orient, float scale,
+                        const float offset[3]) {
+  float rotation[4][4];
+  QuatToMatrix(orient.inverse(), rotation);
+  mx.identity();
+  mx.applyTranslate(pos.x(), pos.y(), pos.z());
+  mx.applyMatrix(rotation);
+  mx.applyScale(scale, scale, scale);
+  mx.applyTranslate(offset[0], offset[1], offset[2]);
+}
+
+static void checkObject() {
+  const WFMath::Point<3> pos(randomFloat(100.0f), randomFloat(100.0f), randomFloat(10.0f));
+  const WFMath::Quaternion orient(WFMath::Vector<3>(randomFloat(1.0f), randomFloat(1.0f), 2.0f), randomFloat(3.0f));
+  const float scale = 0.5f + randomFloat(0.25f);
+  const float offset[3] = { randomFloat(1.0f), randomFloat(1.0f), randomFloat(1.0f) };
+
+  Matrix mx;
+  buildObject(mx, pos, orient, scale, offset);
+
+  // A point of the model, placed in the world by WFMath
+  const float in[3] = { randomFloat(2.0f), randomFloat(2.0f), randomFloat(2.0f) };
+  WFMath::Vector<3> v(in[0] + offset[0], in[1] + offset[1], in[2] + offset[2]);
+  v = v * scale;
+  v.rotate(orient);
+  const WFMath::Point<3> expected = pos + v;
+
+  float out[3];
+  mx.transformPoint(in, out);
+  CHECK(samePoint(out, expected.x(), expected.y(), expected.z()));
+}
+
+template <class M>
+static double timeObjects(int count, float &sum) {
+  float rotation[4][4];
+  QuatToMatrix(WFMath::Quaternion(WFMath::Vector<3>(0.0f, 0.0f, 1.0f), 0.5f), rotation);
+
+  M mx;
+  const double start = now();
+  for (int i = 0; i < count; ++i) {
+    mx.identity();
+    mx.applyTranslate(i, 2.0f * i, 0.5f);
+    mx.applyMatrix(rotation);
+    mx.applyScale(1.5f, 1.5f, 1.5f);
+    mx.applyTranslate(0.1f, 0.2f, 0.3f);
+    mx.applyRotate(30.0f, 0.0f, 0.0f, 1.0f);
+    sum += mx.getMatrix()[12];
+  }
+  return now() - start;
+}
+
+static void benchmark(int count) {
+  float sum = 0.0f;
+#ifdef MATRIX_HAS_SSE
+  const double sse_time = timeObjects<Matrix>(count, sum);
+#endif
+  const double scalar_time = timeObjects<ScalarMatrix>(count, sum);
+
+  printf("%d transforms (checksum %g)\n", count, sum);
+#ifdef MATRIX_HAS_SSE
+  printf("SSE:   %.1f ns per transform\n", sse_time * 1000.0 / count);
+#else
+  printf("SSE:   not built\n");
+#endif
+  printf("Plain: %.1f ns per transform\n", scalar_time * 1000.0 / count);
+}
+
+int main(int argc, char **argv) {
+  int count = DEFAULT_count;
+  if (argc > 1) count = atoi(argv[1]);
+  if (count < 1) count = 1;
+
+  srand(1);
+  for (int i = 0; i < NUM_chains; ++i) {
+    checkChain();
+    checkRotate();
+    checkObject();
+  }
+
+  if (checkResult("matrix_test") != 0) return 1;
+
+  benchmark(count);
+  return 0;
+}
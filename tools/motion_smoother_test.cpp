@@ -0,0 +1,239 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * motion_smoother_test feeds made up position updates to a MotionSmoother,
+ * sampling it every frame as the client does, and checks that:
+ *   - a steady stream is drawn 100ms behind, exactly on its path, and is
+ *     extrapolated for at most 250ms once it stops
+ *   - a dropped update is covered by extrapolation without any jump
+ *   - a sharp turn seen late is blended onto the new path rather than
+ *     snapped, and the error is mostly gone after 200ms
+ *   - a jump of more than 5 units is snapped
+ *
+ * It also checks that a MoveHistory drops the movement requests a server
+ * update shows were acted on, and replays the rest on top of the server
+ * position.
+ *
+ * Usage: motion_smoother_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "src/MotionSmoother.h"
+#include "src/MoveHistory.h"
+#include "tools/Check.h"
+
+using Sear::MotionSmoother;
+using Sear::MoveHistory;
+
+typedef WFMath::Point<3> Point;
+typedef WFMath::Vector<3> Vector;
+
+static const unsigned int FRAME = 20;
+static const unsigned int UPDATE = 100;
+static const float SPEED = 2.0f;
+
+static bool closeTo(const Point &a, const Point &b, float tolerance = 0.001f) {
+  return a.isValid() && b.isValid() && (a - b).mag() < tolerance;
+}
+
+// Moving along x from the origin, starting at time 1000
+static Point straight(unsigned int time) {
+  return Point(SPEED * (time - 1000) / 1000.0f, 0.0f, 0.0f);
+}
+
+// As straight until 1500, then along y
+static Point turned(unsigned int time) {
+  if (time <= 1500) return straight(time);
+  return Point(1.0f, SPEED * (time - 1500) / 1000.0f, 0.0f);
+}
+
+static void testSteady() {
+  MotionSmoother s;
+  const Vector vel(SPEED, 0.0f, 0.0f);
+
+  bool on_path = true;
+  for (unsigned int time = 1000; time <= 2000; time += FRAME) {
+    if (time % UPDATE == 0) s.addUpdate(time, straight(time), vel);
+    // Only the first update is known for the first 100ms
+    const unsigned int shown = (time < 1100) ? (1000) : (time - 100);
+    if (!closeTo(s.getPosition(time), straight(shown))) on_path = false;
+    if (s.getError() > 0.001f) on_path = false;
+  }
+  CHECK(on_path);
+
+  // Between two updates
+  CHECK(closeTo(s.getPosition(2050), straight(1950)));
+
+  // Past the last update, along the last velocity for 250ms only
+  CHECK(closeTo(s.getPosition(2200), straight(2100)));
+  CHECK(closeTo(s.getPosition(2350), straight(2250)));
+  CHECK(closeTo(s.getPosition(2600), straight(2250)));
+}
+
+static void testDropped() {
+  MotionSmoother s;
+  const Vector vel(SPEED, 0.0f, 0.0f);
+
+  bool on_path = true;
+  float largest_step = 0.0f;
+  Point last;
+  for (unsigned int time = 1000; time <= 2000; time += FRAME) {
+    // The 1300 update never arrives
+    if (time % UPDATE == 0 && time != 1300) s.addUpdate(time, straight(time), vel);
+    const Point pos = s.getPosition(time);
+    if (time >= 1100 && !closeTo(pos, straight(time - 100))) on_path = false;
+    if (last.isValid() && (pos - last).mag() > largest_step) largest_step = (pos - last).mag();
+    last = pos;
+  }
+  CHECK(on_path);
+  // No more than one frame's movement at a time
+  CHECK(largest_step < SPEED * FRAME / 1000.0f + 0.001f);
+}
+
+// Turns at 1500, but the 1500 update still gives the old velocity and the
+// 1600 update is lost, so the corner is overshot until 1700 arrives
+static void testTurn() {
+  MotionSmoother s;
+
+  float largest_step = 0.0f;
+  float error_at_1700 = 0.0f;
+  float error_at_1900 = 0.0f;
+  Point last;
+  for (unsigned int time = 1000; time <= 2200; time += FRAME) {
+    if (time % UPDATE == 0 && time != 1600) {
+      const Vector vel = (time < 1600) ? Vector(SPEED, 0.0f, 0.0f) : Vector(0.0f, SPEED, 0.0f);
+      s.addUpdate(time, turned(time), vel);
+    }
+    const Point pos = s.getPosition(time);
+
+    if (time == 1600) {
+      // Interpolated up to the corner
+      CHECK(closeTo(pos, Point(1.0f, 0.0f, 0.0f)));
+    } else if (time == 1680) {
+      // Extrapolated past it
+      CHECK(closeTo(pos, Point(1.16f, 0.0f, 0.0f)));
+    } else if (time == 1700) {
+      error_at_1700 = s.getError();
+      // Moved towards the new path, but not onto it
+      CHECK(pos.x() < 1.16f && pos.x() > 1.0f);
+      CHECK(!closeTo(pos, turned(1600), 0.01f));
+    } else if (time == 1900) {
+      error_at_1900 = s.getError();
+    }
+    if (last.isValid() && (pos - last).mag() > largest_step) largest_step = (pos - last).mag();
+    last = pos;
+  }
+
+  CHECK(error_at_1700 > 0.1f);
+  // About 95% is gone after 200ms
+  CHECK(error_at_1900 < error_at_1700 * 0.06f);
+  // The blend is spread over several frames
+  CHECK(largest_step < 0.1f);
+  CHECK(closeTo(s.getPosition(2220), turned(2120), 0.01f));
+}
+
+static void testSnap() {
+  MotionSmoother s;
+  const Vector still(0.0f, 0.0f, 0.0f);
+
+  s.addUpdate(1000, Point(0.0f, 0.0f, 0.0f), still);
+  s.addUpdate(1100, Point(0.0f, 0.0f, 0.0f), still);
+  CHECK(closeTo(s.getPosition(1300), Point(0.0f, 0.0f, 0.0f)));
+
+  // Teleported
+  s.addUpdate(1200, Point(50.0f, 0.0f, 0.0f), still);
+  CHECK(closeTo(s.getPosition(1300), Point(50.0f, 0.0f, 0.0f)));
+  CHECK(s.getError() == 0.0f);
+
+  // A short jump is blended
+  CHECK(closeTo(s.getPosition(1400), Point(50.0f, 0.0f, 0.0f)));
+  s.addUpdate(1300, Point(51.0f, 0.0f, 0.0f), still);
+  CHECK(closeTo(s.getPosition(1400), Point(50.0f, 0.0f, 0.0f)));
+  CHECK(s.getError() > 0.999f && s.getError() < 1.001f);
+
+  // Forgotten, so the next update is used as is
+  s.reset();
+  CHECK(!s.isValid());
+  s.addUpdate(1500, Point(3.0f, 0.0f, 0.0f), still);
+  CHECK(closeTo(s.getPosition(1510), Point(3.0f, 0.0f, 0.0f)));
+}
+
+static void testMoveHistory() {
+  MoveHistory h;
+  const Vector still(0.0f, 0.0f, 0.0f);
+  const Vector east(SPEED, 0.0f, 0.0f);
+  const Vector north(0.0f, SPEED, 0.0f);
+  const Point origin(0.0f, 0.0f, 0.0f);
+
+  // Not acted on yet, so the request is replayed from when it was sent
+  h.addMove(1000, east);
+  CHECK(closeTo(h.reconcile(1100, origin, still), Point(0.2f, 0.0f, 0.0f)));
+  CHECK(h.size() == 1);
+
+  // Acted on, so the server position is used as it is
+  CHECK(closeTo(h.reconcile(1200, Point(0.3f, 0.0f, 0.0f), east), Point(0.3f, 0.0f, 0.0f)));
+  CHECK(h.size() == 0);
+
+  // Stop, then turn, before the server has seen either. The server kept
+  // going east the whole time.
+  h.addMove(1300, still);
+  h.addMove(1400, north);
+  CHECK(closeTo(h.reconcile(1450, Point(0.9f, 0.0f, 0.0f), east), Point(0.6f, 0.1f, 0.0f)));
+  CHECK(h.size() == 2);
+
+  // Stopped, the turn is still outstanding
+  CHECK(closeTo(h.reconcile(1500, Point(0.6f, 0.0f, 0.0f), still), Point(0.6f, 0.2f, 0.0f)));
+  CHECK(h.size() == 1);
+
+  // The server may limit the speed, but the direction still matches
+  CHECK(closeTo(h.reconcile(1600, Point(0.6f, 0.1f, 0.0f), north * 0.5f), Point(0.6f, 0.1f, 0.0f)));
+  CHECK(h.size() == 0);
+
+  // Nor does a direction well away from the one asked for
+  h.addMove(1700, east);
+  h.reconcile(1800, origin, Vector(1.5f, 1.5f, 0.0f));
+  CHECK(h.size() == 1);
+  h.reconcile(1900, origin, east);
+  CHECK(h.size() == 0);
+
+  // The oldest matching request is taken, as the server goes in order
+  h.addMove(2000, east);
+  h.addMove(2100, still);
+  h.addMove(2200, east);
+  h.reconcile(2150, origin, east);
+  CHECK(h.size() == 2);
+
+  // Requests that never match are dropped in time
+  h.reconcile(2200 + MoveHistory::MAX_AGE + 1, origin, north);
+  CHECK(h.size() == 0);
+
+  // Sent times do not go backwards
+  h.addMove(3000, east);
+  h.addMove(2900, still);
+  CHECK(closeTo(h.reconcile(3100, origin, north), Point(0.0f, -0.2f, 0.0f)));
+
+  for (unsigned int i = 0; i < 2 * MoveHistory::MAX_MOVES; ++i) {
+    h.addMove(4000 + i, (i % 2) ? east : north);
+  }
+  CHECK(h.size() == MoveHistory::MAX_MOVES);
+
+  h.clear();
+  CHECK(h.size() == 0);
+  CHECK(!h.reconcile(5000, Point(), east).isValid());
+}
+
+int main(int argc, char **argv) {
+  testSteady();
+  testDropped();
+  testTurn();
+  testSnap();
+  testMoveHistory();
+
+  return checkResult("motion_smoother_test");
+}
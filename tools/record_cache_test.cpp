@@ -0,0 +1,163 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * record_cache_test checks that the object records cached for entities are
+ * dropped when they may no longer be right:
+ *   - reload_config_objects changes the ModelSystem generation, which makes
+ *     every entity look its record up again, and empties the type cache
+ *     and the records held by id
+ *   - the EntityMapper reports the attributes its match rows read, so
+ *     ModelSystem::entityAttributeChanged only maps an entity again when
+ *     one of them changes, and this follows the rows as they are reloaded
+ *
+ * A WorldEntity needs an Eris View with an Avatar, which needs a connected
+ * Account, so no entities are made. What entityAttributeChanged and
+ * getObjectRecord do with the results is not covered here.
+ *
+ * HOME is pointed at a new directory under /tmp, which is removed at the
+ * end if the checks pass.
+ *
+ * Usage: record_cache_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include <unistd.h>
+
+#include "common/SPtr.h"
+#include "loaders/EntityMapper.h"
+#include "loaders/ModelSystem.h"
+#include "loaders/ObjectHandler.h"
+#include "loaders/ObjectRecord.h"
+#include "src/FileHandler.h"
+#include "src/System.h"
+#include "tools/Check.h"
+
+using Sear::EntityMapper;
+using Sear::ModelSystem;
+using Sear::ObjectHandler;
+using Sear::ObjectRecord;
+using Sear::SPtr;
+using Sear::System;
+
+static const std::string CMD_reload_config_objects = "reload_config_objects";
+static const std::string CMD_load_entity_mappings = "load_entity_mappings";
+
+namespace Sear {
+
+// Reads the ModelSystem's caches
+class ModelSystemTest {
+public:
+  static unsigned int generation() { return ModelSystem::getInstance().m_generation; }
+  static size_t numTypeRecords() { return ModelSystem::getInstance().m_type_records.size(); }
+  static void setTypeRecord(const std::string &type, const std::string &record) {
+    ModelSystem::getInstance().m_type_records[type] = record;
+  }
+};
+
+} /* namespace Sear */
+
+using Sear::ModelSystemTest;
+
+static void testReload() {
+  ObjectHandler handler;
+  handler.init();
+
+  // As left by getObjectRecord for an entity of type oak
+  SPtr<ObjectRecord> record = handler.instantiateRecord("default", "oak_1");
+  CHECK(record);
+  CHECK(handler.getObjectRecord("oak_1").get() == record.get());
+  ModelSystemTest::setTypeRecord("oak", "default");
+  const unsigned int cached = ModelSystemTest::generation();
+
+  handler.runCommand(CMD_reload_config_objects, "");
+  CHECK(ModelSystemTest::generation() != cached);
+  CHECK(ModelSystemTest::numTypeRecords() == 0);
+  CHECK(!handler.getObjectRecord("oak_1"));
+  // The default record is made again
+  CHECK(handler.instantiateRecord("default", "oak_1"));
+
+  // Every reload changes it, so a record cached between two reloads is
+  // dropped by the second
+  const unsigned int between = ModelSystemTest::generation();
+  handler.runCommand(CMD_reload_config_objects, "");
+  CHECK(ModelSystemTest::generation() != between);
+  CHECK(ModelSystemTest::generation() != cached);
+
+  handler.shutdown();
+}
+
+static bool writeMappings(const std::string &filename, const char *text) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (fp == NULL) return false;
+  fputs(text, fp);
+  fclose(fp);
+  return true;
+}
+
+static void testMappedAttributes(const std::string &dir) {
+  EntityMapper mapper;
+  mapper.init();
+
+  const std::string first = dir + "/first.cfg";
+  const std::string second = dir + "/second.cfg";
+  CHECK(writeMappings(first,
+    "[oak]\n"
+    "match_1 = \"mode == felled : oak_stump\"\n"
+    "match_2 = \"size > 4 : oak_large\"\n"
+    "[pine]\n"
+    "rule = \"random\"\n"
+    "options = \"pine_1 pine_2\"\n"));
+  CHECK(writeMappings(second,
+    "[oak]\n"
+    "match_1 = \"status < 0.5 : oak_damaged\"\n"));
+
+  CHECK(!mapper.usesAttribute("oak", "mode"));
+  mapper.runCommand(CMD_load_entity_mappings, first);
+  CHECK(mapper.usesAttribute("oak", "mode"));
+  CHECK(mapper.usesAttribute("oak", "size"));
+  // The size is worked out from the bounding box
+  CHECK(mapper.usesAttribute("oak", "bbox"));
+  CHECK(!mapper.usesAttribute("oak", "status"));
+  CHECK(!mapper.usesAttribute("oak", "name"));
+  // A rule runs once, not again on attribute changes
+  CHECK(!mapper.usesAttribute("pine", "mode"));
+  CHECK(!mapper.usesAttribute("birch", "mode"));
+
+  // A later file replaces match_1 and keeps match_2
+  mapper.runCommand(CMD_load_entity_mappings, second);
+  CHECK(!mapper.usesAttribute("oak", "mode"));
+  CHECK(mapper.usesAttribute("oak", "status"));
+  CHECK(mapper.usesAttribute("oak", "bbox"));
+
+  remove(first.c_str());
+  remove(second.c_str());
+  mapper.shutdown();
+}
+
+int main(int argc, char **argv) {
+  char dir[] = "/tmp/record_cache_test.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("record_cache_test: mkdtemp");
+    return 1;
+  }
+  setenv("HOME", dir, 1);
+
+  // Makes the FileHandler the mapping files are read through
+  System system;
+
+  testReload();
+  testMappedAttributes(dir);
+
+  if (checkResult("record_cache_test") != 0) return 1;
+
+  rmdir(system.getFileHandler()->getUserDataPath().c_str());
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,105 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * sear-pack builds a media archive from a directory tree.
+ *
+ * Usage: sear-pack [-z] <archive> <media dir>
+ *
+ * Paths in the archive are relative to the media dir, so a packed copy of
+ * the media tree is mounted with
+ *   mount_archive <archive> ${SEAR_HOME}/sear-media-0.7/
+ * With -z entries are stored compressed where it saves space.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "src/MediaArchive.h"
+
+using Sear::MediaArchiveWriter;
+
+static bool readFile(const std::string &filename, std::vector<char> &data) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) return false;
+  data.clear();
+  char buf[8192];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  const bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+static bool addDirectory(MediaArchiveWriter &writer, const std::string &root,
+                         const std::string &rel, bool compress) {
+  const std::string &dirname = (rel.empty()) ? (root) : (root + "/" + rel);
+  DIR *dir = opendir(dirname.c_str());
+  if (dir == NULL) {
+    fprintf(stderr, "Unable to read directory %s\n", dirname.c_str());
+    return false;
+  }
+
+  bool ok = true;
+  struct dirent *de;
+  while (ok && (de = readdir(dir)) != NULL) {
+    const std::string name = de->d_name;
+    // Skip ., .. and hidden files such as CVS metadata
+    if (name.empty() || name[0] == '.') continue;
+    if (name == "CVS") continue;
+
+    const std::string &path = (rel.empty()) ? (name) : (rel + "/" + name);
+    const std::string &full = root + "/" + path;
+
+    struct stat info;
+    if (stat(full.c_str(), &info) != 0) continue;
+    if (S_ISDIR(info.st_mode)) {
+      ok = addDirectory(writer, root, path, compress);
+    } else if (S_ISREG(info.st_mode)) {
+      std::vector<char> data;
+      if (!readFile(full, data)) {
+        fprintf(stderr, "Unable to read %s\n", full.c_str());
+        ok = false;
+      } else {
+        writer.addFile(path, data, compress);
+      }
+    }
+  }
+  closedir(dir);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  bool compress = false;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-z") == 0) {
+    compress = true;
+    ++arg;
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr, "Usage: %s [-z] <archive> <media dir>\n", argv[0]);
+    return 1;
+  }
+
+  const std::string archive = argv[arg];
+  std::string root = argv[arg + 1];
+  while (root.size() > 1 && root[root.size() - 1] == '/') {
+    root.erase(root.size() - 1);
+  }
+
+  MediaArchiveWriter writer;
+  if (!addDirectory(writer, root, "", compress)) return 1;
+  if (!writer.write(archive)) return 1;
+
+  printf("Packed %lu files into %s\n", (unsigned long)writer.getNumFiles(), archive.c_str());
+  return 0;
+}
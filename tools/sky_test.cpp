@@ -0,0 +1,190 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * sky_test checks SkyDome::interpolateHorizonColor against the fog colour
+ * the sky dome worked out before, when it read the atmosphere texture back
+ * from GL. A made up sky gradient is laid out as glGetTexImage returned
+ * it, and the old code is kept here to work out the expected colours. It
+ * checks that:
+ *   - the colours match at midnight, dawn, noon, dusk and times between,
+ *     including either side of midnight where the gradient wraps
+ *   - the middle of each texel gives that texel's colour exactly
+ *   - times outside [0.0 .. 1.0) are treated as midnight, as before
+ *   - nothing is returned when there are no colours
+ *
+ * Reading the first row of the image from disk, which replaced the
+ * readback, needs SDL_image and the texture config, and is not checked.
+ *
+ * Usage: sky_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "environment/SkyDome.h"
+#include "tools/Check.h"
+
+using Sear::Color_4;
+using Sear::SkyDome;
+
+static const int WIDTH = 16;
+static const int HEIGHT = 4;
+
+// Night, sunrise, day and sunset across the first row. The rows below
+// are noise, which must not be used.
+static std::vector<unsigned char> makeTexels() {
+  static const unsigned char row[WIDTH][3] = {
+    {  10,  10,  40 }, {  12,  12,  50 }, {  20,  20,  70 }, {  60,  40,  90 },
+    { 200, 120,  60 }, { 230, 180, 120 }, { 150, 190, 230 }, { 120, 170, 240 },
+    { 110, 160, 250 }, { 120, 170, 240 }, { 150, 190, 230 }, { 240, 150,  80 },
+    { 180,  80,  60 }, {  60,  30,  70 }, {  20,  15,  55 }, {  12,  10,  45 }
+  };
+  std::vector<unsigned char> texels(WIDTH * HEIGHT * 4);
+  for (int x = 0; x < WIDTH; ++x) {
+    texels[x * 4 + 0] = row[x][0];
+    texels[x * 4 + 1] = row[x][1];
+    texels[x * 4 + 2] = row[x][2];
+    // The alpha is not used for the fog
+    texels[x * 4 + 3] = 200;
+  }
+  srand(1);
+  for (size_t i = WIDTH * 4; i < texels.size(); ++i) {
+    texels[i] = (unsigned char)(rand() % 256);
+  }
+  return texels;
+}
+
+// What SkyDome::getHorizonColors and updateFogColor did with the texels
+// read back by glGetTexImage, less the GL calls
+static void readbackColor(const std::vector<unsigned char> &texels, int width, float t, float color[4]) {
+  std::vector<Color_4> horizon_colors;
+  const unsigned char *texel = &texels[0];
+  for (int S = 0; S < width; ++S) {
+    Color_4 c;
+    c.r = *texel++;
+    c.g = *texel++;
+    c.b = *texel++;
+    c.a = *texel++;
+    horizon_colors.push_back(c);
+  }
+
+  if (t < 0.0f) t = 0.0f;
+  if (t >= 1.0f) t = 0.0f;
+
+  t *= horizon_colors.size();
+  t -= 0.5f;
+  if (t < 0.0) t += horizon_colors.size();
+
+  unsigned int I = static_cast<unsigned int>(t);
+  unsigned int J = (I == (horizon_colors.size() - 1) ? 0 : I + 1);
+
+  Color_4 lower = horizon_colors[I],
+      upper = horizon_colors[J];
+
+  const float interp = t - I,
+      invInterp = 1.0f - interp;
+
+  color[0] = ((lower.r * invInterp) + (upper.r * interp)) / 255.0f;
+  color[1] = ((lower.g * invInterp) + (upper.g * interp)) / 255.0f;
+  color[2] = ((lower.b * invInterp) + (upper.b * interp)) / 255.0f;
+  color[3] = 1.0f;
+}
+
+// The first row, as TextureManager::readImageRow gives it
+static std::vector<Color_4> firstRow(const std::vector<unsigned char> &texels, int width) {
+  std::vector<Color_4> colours;
+  for (int x = 0; x < width; ++x) {
+    Color_4 c;
+    c.r = texels[x * 4 + 0];
+    c.g = texels[x * 4 + 1];
+    c.b = texels[x * 4 + 2];
+    c.a = texels[x * 4 + 3];
+    colours.push_back(c);
+  }
+  return colours;
+}
+
+static bool sameColor(const float a[4], const float b[4]) {
+  for (int i = 0; i < 4; ++i) {
+    if (fabs(a[i] - b[i]) > 1e-6f) return false;
+  }
+  return true;
+}
+
+static bool matchesReadback(const std::vector<unsigned char> &texels, int width, float t) {
+  float expected[4], color[4];
+  readbackColor(texels, width, t, expected);
+  if (!SkyDome::interpolateHorizonColor(firstRow(texels, width), t, color)) return false;
+  return sameColor(color, expected);
+}
+
+static void testTimesOfDay() {
+  const std::vector<unsigned char> texels = makeTexels();
+
+  // Midnight, dawn, noon and dusk
+  CHECK(matchesReadback(texels, WIDTH, 0.0f));
+  CHECK(matchesReadback(texels, WIDTH, 0.25f));
+  CHECK(matchesReadback(texels, WIDTH, 0.5f));
+  CHECK(matchesReadback(texels, WIDTH, 0.75f));
+
+  // Either side of midnight, between the last texel and the first
+  CHECK(matchesReadback(texels, WIDTH, 0.01f));
+  CHECK(matchesReadback(texels, WIDTH, 0.99f));
+  CHECK(matchesReadback(texels, WIDTH, 0.9999f));
+
+  // Every minute of the day
+  bool all = true;
+  for (int minute = 0; minute < 24 * 60; ++minute) {
+    if (!matchesReadback(texels, WIDTH, minute / (24.0f * 60.0f))) all = false;
+  }
+  CHECK(all);
+
+  // Out of range, taken as midnight
+  CHECK(matchesReadback(texels, WIDTH, -0.25f));
+  CHECK(matchesReadback(texels, WIDTH, 1.0f));
+  CHECK(matchesReadback(texels, WIDTH, 1.5f));
+
+  // A gradient a single texel wide
+  CHECK(matchesReadback(texels, 1, 0.3f));
+}
+
+static void testTexelCentres() {
+  const std::vector<unsigned char> texels = makeTexels();
+  const std::vector<Color_4> colours = firstRow(texels, WIDTH);
+
+  for (int x = 0; x < WIDTH; ++x) {
+    float color[4];
+    CHECK(SkyDome::interpolateHorizonColor(colours, (x + 0.5f) / WIDTH, color));
+    CHECK(fabs(color[0] - colours[x].r / 255.0f) < 1e-6f);
+    CHECK(fabs(color[1] - colours[x].g / 255.0f) < 1e-6f);
+    CHECK(fabs(color[2] - colours[x].b / 255.0f) < 1e-6f);
+    CHECK(color[3] == 1.0f);
+  }
+
+  // Midnight is half way between the last texel and the first
+  float color[4];
+  CHECK(SkyDome::interpolateHorizonColor(colours, 0.0f, color));
+  CHECK(fabs(color[0] - (10 + 12) / 2.0f / 255.0f) < 1e-6f);
+  CHECK(fabs(color[2] - (40 + 45) / 2.0f / 255.0f) < 1e-6f);
+}
+
+static void testEmpty() {
+  const std::vector<Color_4> none;
+  float color[4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+  CHECK(!SkyDome::interpolateHorizonColor(none, 0.5f, color));
+  CHECK(color[0] == -1.0f);
+}
+
+int main(int argc, char **argv) {
+  testTimesOfDay();
+  testTexelCentres();
+  testEmpty();
+
+  return checkResult("sky_test");
+}
@@ -0,0 +1,293 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * sound_test runs Sound against SDL's dummy audio driver, so it needs no
+ * sound card. It checks that samples are decoded on the loader thread and
+ * cached, that files which fail to load are not retried, and that the
+ * sample cache evicts least recently used samples to fit its budget.
+ * Emitters are checked for distance attenuation, panning relative to the
+ * listener direction and the voice limit. Samples queued ahead of use, as
+ * the startup samples are, are checked to be played from the cache.
+ *
+ * Usage: sound_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+
+#include "src/Sound.h"
+#include "tools/Check.h"
+
+using Sear::Sound;
+
+typedef Sound::EmitterID EmitterID;
+
+// Samples are long enough to be real but finish playing quickly
+static const int SAMPLE_rate = 22050;
+static const int SAMPLE_length = SAMPLE_rate / 50;
+
+static const unsigned int WAIT_timeout = 2000;
+
+static void put16(FILE *fp, unsigned int v) {
+  fputc(v & 0xff, fp);
+  fputc((v >> 8) & 0xff, fp);
+}
+
+static void put32(FILE *fp, unsigned int v) {
+  put16(fp, v & 0xffff);
+  put16(fp, v >> 16);
+}
+
+// Write a 16 bit mono PCM wav file
+static bool writeWav(const std::string &file_name) {
+  FILE *fp = fopen(file_name.c_str(), "wb");
+  if (fp == NULL) return false;
+  const unsigned int data_size = SAMPLE_length * 2;
+  fwrite("RIFF", 1, 4, fp);
+  put32(fp, 36 + data_size);
+  fwrite("WAVEfmt ", 1, 8, fp);
+  put32(fp, 16);
+  put16(fp, 1); // PCM
+  put16(fp, 1); // Mono
+  put32(fp, SAMPLE_rate);
+  put32(fp, SAMPLE_rate * 2);
+  put16(fp, 2);
+  put16(fp, 16);
+  fwrite("data", 1, 4, fp);
+  put32(fp, data_size);
+  for (int i = 0; i < SAMPLE_length; ++i) {
+    // Quiet square wave
+    put16(fp, ((i / 25) & 1) ? 0x0400 : 0xfc00);
+  }
+  const bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// Run the frame update until the loader thread has caught up
+static bool waitForLoads(Sound &sound) {
+  const unsigned int start = SDL_GetTicks();
+  sound.update();
+  while (sound.isLoading()) {
+    if (SDL_GetTicks() - start > WAIT_timeout) return false;
+    SDL_Delay(5);
+    sound.update();
+  }
+  return true;
+}
+
+// Samples still playing are never evicted, so let them finish
+static bool waitForSilence(Sound &sound) {
+  const unsigned int start = SDL_GetTicks();
+  while (Mix_Playing(-1) > 0) {
+    if (SDL_GetTicks() - start > WAIT_timeout) return false;
+    SDL_Delay(5);
+    sound.update();
+  }
+  return true;
+}
+
+static void testLoader(Sound &sound, const std::string &a, const std::string &missing) {
+  // First request misses and is decoded in the background
+  sound.playSound(a);
+  CHECK(sound.getCacheMisses() == 1);
+  CHECK(sound.getNumSamples() == 0);
+  CHECK(waitForLoads(sound));
+  CHECK(sound.getNumSamples() == 1);
+  CHECK(sound.getCacheSize() > 0);
+
+  // Second request is served from the cache
+  sound.playSound(a);
+  CHECK(sound.getCacheHits() == 1);
+  CHECK(sound.getCacheMisses() == 1);
+
+  // A missing file is tried once, then remembered
+  sound.playSound(missing);
+  CHECK(sound.getCacheMisses() == 2);
+  CHECK(waitForLoads(sound));
+  CHECK(sound.getNumSamples() == 1);
+  sound.playSound(missing);
+  CHECK(sound.getCacheMisses() == 2);
+  CHECK(!sound.isLoading());
+}
+
+static void testEviction(Sound &sound, const std::string &a, const std::string &b, const std::string &c) {
+  sound.playSound(b);
+  sound.playSound(c);
+  CHECK(waitForLoads(sound));
+  CHECK(sound.getNumSamples() == 3);
+  const size_t sample_size = sound.getCacheSize() / 3;
+
+  // Use a again, leaving b as the least recently used
+  sound.playSound(a);
+  CHECK(waitForSilence(sound));
+
+  const unsigned int hits = sound.getCacheHits();
+  const unsigned int misses = sound.getCacheMisses();
+  sound.setCacheBudget(sample_size * 2);
+  CHECK(sound.getNumSamples() == 2);
+  CHECK(sound.getCacheSize() <= sample_size * 2);
+
+  sound.playSound(a);
+  sound.playSound(c);
+  CHECK(sound.getCacheHits() == hits + 2);
+  sound.playSound(b);
+  CHECK(sound.getCacheMisses() == misses + 1);
+  CHECK(waitForLoads(sound));
+  CHECK(waitForSilence(sound));
+}
+
+static bool nearlyEqual(float a, float b) {
+  return fabsf(a - b) < 0.01f;
+}
+
+static void testEmitters(Sound &sound, const std::string &a) {
+  const WFMath::Vector<3> up(0.0f, 0.0f, 1.0f);
+  sound.setListener(WFMath::Point<3>(0.0f, 0.0f, 0.0f), WFMath::Vector<3>(1.0f, 0.0f, 0.0f), up);
+
+  const EmitterID ahead = sound.addEmitter(WFMath::Point<3>(1.0f, 0.0f, 0.0f), a, true, 0.5f);
+  const EmitterID right = sound.addEmitter(WFMath::Point<3>(0.0f, -10.0f, 0.0f), a, true);
+  const EmitterID left = sound.addEmitter(WFMath::Point<3>(0.0f, 10.0f, 0.0f), a, true);
+  const EmitterID distant = sound.addEmitter(WFMath::Point<3>(100.0f, 0.0f, 0.0f), a, true);
+  CHECK(waitForLoads(sound));
+  sound.update();
+
+  float gain, pan;
+  bool voice;
+  // Full volume inside the reference distance
+  CHECK(sound.getEmitterMix(ahead, gain, pan, voice));
+  CHECK(nearlyEqual(gain, 0.5f));
+  CHECK(nearlyEqual(pan, 0.0f));
+  CHECK(voice);
+  // Inverse distance fall off, panned to the side it is on
+  CHECK(sound.getEmitterMix(right, gain, pan, voice));
+  CHECK(nearlyEqual(gain, 0.2f));
+  CHECK(nearlyEqual(pan, 1.0f));
+  CHECK(voice);
+  CHECK(sound.getEmitterMix(left, gain, pan, voice));
+  CHECK(nearlyEqual(pan, -1.0f));
+  // Out of earshot, but a loop is kept for when the listener comes back
+  CHECK(sound.getEmitterMix(distant, gain, pan, voice));
+  CHECK(gain == 0.0f);
+  CHECK(!voice);
+
+  // Turn to face +y, the sound on the old right is now behind
+  sound.setListener(WFMath::Point<3>(0.0f, 0.0f, 0.0f), WFMath::Vector<3>(0.0f, 1.0f, 0.0f), up);
+  sound.update();
+  CHECK(sound.getEmitterMix(right, gain, pan, voice));
+  CHECK(nearlyEqual(pan, 0.0f));
+  CHECK(sound.getEmitterMix(ahead, gain, pan, voice));
+  CHECK(nearlyEqual(pan, 1.0f));
+
+  // Walk up to the distant emitter
+  sound.setListener(WFMath::Point<3>(99.0f, 0.0f, 0.0f), WFMath::Vector<3>(1.0f, 0.0f, 0.0f), up);
+  sound.update();
+  CHECK(sound.getEmitterMix(distant, gain, pan, voice));
+  CHECK(nearlyEqual(gain, 1.0f));
+  CHECK(voice);
+  sound.removeEmitter(distant);
+  CHECK(!sound.getEmitterMix(distant, gain, pan, voice));
+
+  // With two voices only the loudest two play
+  sound.setListener(WFMath::Point<3>(0.0f, 0.0f, 0.0f), WFMath::Vector<3>(1.0f, 0.0f, 0.0f), up);
+  sound.runCommand("sound_voices", "2");
+  sound.update();
+  CHECK(sound.getEmitterMix(ahead, gain, pan, voice));
+  CHECK(voice);
+  int voices = 0;
+  if (sound.getEmitterMix(right, gain, pan, voice) && voice) ++voices;
+  if (sound.getEmitterMix(left, gain, pan, voice) && voice) ++voices;
+  CHECK(voices == 1);
+
+  sound.removeEmitter(ahead);
+  sound.removeEmitter(right);
+  sound.removeEmitter(left);
+  sound.update();
+  CHECK(Mix_Playing(-1) == 0);
+}
+
+static void testPreload(Sound &sound, const std::string &d, const std::string &missing) {
+  // Nothing is queued before init
+  Sound idle;
+  idle.preloadSample(d);
+  CHECK(!idle.isLoading());
+
+  sound.setCacheBudget(16 * 1024 * 1024);
+  const size_t samples = sound.getNumSamples();
+  const unsigned int hits = sound.getCacheHits();
+  const unsigned int misses = sound.getCacheMisses();
+
+  // Decoded ahead of use, without counting as a miss
+  sound.preloadSample(d);
+  CHECK(sound.isLoading());
+  CHECK(waitForLoads(sound));
+  CHECK(sound.getNumSamples() == samples + 1);
+  CHECK(sound.getCacheMisses() == misses);
+
+  // Then played straight from the cache
+  sound.playSound(d);
+  CHECK(sound.getCacheHits() == hits + 1);
+
+  // Cached and missing samples are left alone
+  sound.preloadSample(d);
+  sound.preloadSample(missing);
+  CHECK(!sound.isLoading());
+  CHECK(waitForSilence(sound));
+}
+
+int main(int argc, char **argv) {
+  // No sound card needed
+  putenv((char*)"SDL_AUDIODRIVER=dummy");
+  if (SDL_Init(SDL_INIT_NOPARACHUTE) != 0) {
+    fprintf(stderr, "sound_test: SDL_Init failed: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  char dir[] = "/tmp/sound_test.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("sound_test: mkdtemp");
+    return 1;
+  }
+  const std::string a = std::string(dir) + "/a.wav";
+  const std::string b = std::string(dir) + "/b.wav";
+  const std::string c = std::string(dir) + "/c.wav";
+  const std::string d = std::string(dir) + "/d.wav";
+  const std::string missing = std::string(dir) + "/missing.wav";
+  if (!writeWav(a) || !writeWav(b) || !writeWav(c) || !writeWav(d)) {
+    fprintf(stderr, "sound_test: unable to write samples to %s\n", dir);
+    return 1;
+  }
+
+  Sound sound;
+  if (sound.init() != 0) {
+    fprintf(stderr, "sound_test: Sound::init failed\n");
+    return 1;
+  }
+
+  testLoader(sound, a, missing);
+  testEviction(sound, a, b, c);
+  testEmitters(sound, a);
+  testPreload(sound, d, missing);
+
+  sound.shutdown();
+  SDL_Quit();
+
+  unlink(a.c_str());
+  unlink(b.c_str());
+  unlink(c.c_str());
+  unlink(d.c_str());
+  rmdir(dir);
+
+  return checkResult("sound_test");
+}
@@ -0,0 +1,204 @@
+// This file may be redistributed and modified only under the terms of
+// the GNU General Public License (See COPYING for details).
+// Copyright (C) 2009 Simon Goodall
+
+/*
+ * startup_graph_test runs small graphs through StartupGraph with real SDL
+ * threads and checks that:
+ *   - no step starts before the steps it depends on have finished
+ *   - main thread steps run on the thread that called run
+ *   - worker steps run at the same time as each other
+ *   - with no workers every step runs on the main thread, in order
+ *   - after a failed step nothing that depends on it runs, steps already
+ *     running are waited for, and run returns false
+ *
+ * Usage: startup_graph_test
+ *
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include <stdio.h>
+#include <vector>
+
+#include <SDL/SDL.h>
+#include <sigc++/bind.h>
+#include <sigc++/slot.h>
+
+#include "src/StartupGraph.h"
+#include "tools/Check.h"
+
+using Sear::StartupGraph;
+
+typedef StartupGraph::TaskID TaskID;
+
+// Longest a worker step waits for its partner
+static const unsigned int MEET_timeout = 2000;
+
+typedef struct {
+  bool ran;
+  bool succeed;
+  unsigned int delay;
+  unsigned int start, end; ///< Order of starting and finishing
+  Uint32 thread;
+} StepRecord;
+
+static SDL_mutex *s_mutex = NULL;
+static std::vector<StepRecord> s_steps;
+static unsigned int s_clock = 0;
+static Uint32 s_main_thread = 0;
+static int s_waiting = 0; ///< Steps waiting in meetStep
+
+static void resetSteps(size_t num) {
+  StepRecord step;
+  step.ran = false;
+  step.succeed = true;
+  step.delay = 5;
+  step.start = step.end = 0;
+  step.thread = 0;
+  s_steps.assign(num, step);
+  s_clock = 0;
+  s_waiting = 0;
+}
+
+static bool recordStep(int id) {
+  SDL_LockMutex(s_mutex);
+  StepRecord &step = s_steps[id];
+  step.ran = true;
+  step.start = ++s_clock;
+  step.thread = SDL_ThreadID();
+  const unsigned int delay = step.delay;
+  SDL_UnlockMutex(s_mutex);
+
+  SDL_Delay(delay);
+
+  SDL_LockMutex(s_mutex);
+  step.end = ++s_clock;
+  const bool succeed = step.succeed;
+  SDL_UnlockMutex(s_mutex);
+  return succeed;
+}
+
+// Succeeds only if another step reaches here while this one is waiting
+static bool meetStep(int id) {
+  recordStep(id);
+  SDL_LockMutex(s_mutex);
+  ++s_waiting;
+  SDL_UnlockMutex(s_mutex);
+
+  const unsigned int start = SDL_GetTicks();
+  while (SDL_GetTicks() - start < MEET_timeout) {
+    SDL_LockMutex(s_mutex);
+    const int waiting = s_waiting;
+    SDL_UnlockMutex(s_mutex);
+    if (waiting >= 2) return true;
+    SDL_Delay(1);
+  }
+  return false;
+}
+
+static TaskID addStep(StartupGraph &graph, const char *name, int id, bool main_thread) {
+  return graph.addTask(name, sigc::bind(sigc::ptr_fun(&recordStep), id), main_thread);
+}
+
+static void checkOrder(TaskID task, TaskID dependency) {
+  CHECK(s_steps[task].ran && s_steps[dependency].ran);
+  CHECK(s_steps[task].start > s_steps[dependency].end);
+}
+
+// The shape of System::init: main thread steps in a chain, with worker
+// steps joining it
+static void testOrder(unsigned int workers) {
+  resetSteps(8);
+  StartupGraph graph;
+  const TaskID index = addStep(graph, "index", 0, true);
+  const TaskID cache = addStep(graph, "cache", 1, false);
+  const TaskID parse = addStep(graph, "parse", 2, false);
+  graph.addDependency(parse, index);
+  graph.addDependency(parse, cache);
+  const TaskID client = addStep(graph, "client", 3, true);
+  const TaskID console = addStep(graph, "console", 4, true);
+  graph.addDependency(console, client);
+  // A worker step whose main thread half joins the chain
+  const TaskID sound = addStep(graph, "sound", 5, false);
+  graph.addDependency(sound, index);
+  const TaskID sound_commands = addStep(graph, "sound_commands", 6, true);
+  graph.addDependency(sound_commands, sound);
+  graph.addDependency(sound_commands, console);
+  const TaskID scripts = addStep(graph, "scripts", 7, true);
+  graph.addDependency(scripts, console);
+  graph.addDependency(scripts, parse);
+  graph.addDependency(scripts, sound_commands);
+
+  CHECK(graph.run(workers));
+  checkOrder(parse, index);
+  checkOrder(parse, cache);
+  checkOrder(console, client);
+  checkOrder(scripts, console);
+  checkOrder(scripts, parse);
+  checkOrder(sound, index);
+  checkOrder(sound_commands, sound);
+  checkOrder(sound_commands, console);
+  checkOrder(scripts, sound_commands);
+
+  for (size_t i = 0; i < s_steps.size(); ++i) {
+    const bool main_thread = (i != 1 && i != 2 && i != 5);
+    if (main_thread || workers == 0) {
+      CHECK(s_steps[i].thread == s_main_thread);
+    } else {
+      CHECK(s_steps[i].thread != s_main_thread);
+    }
+  }
+}
+
+static void testParallel() {
+  resetSteps(2);
+  StartupGraph graph;
+  graph.addTask("meet_a", sigc::bind(sigc::ptr_fun(&meetStep), 0), false);
+  graph.addTask("meet_b", sigc::bind(sigc::ptr_fun(&meetStep), 1), false);
+  CHECK(graph.run(2));
+  CHECK(s_steps[0].thread != s_steps[1].thread);
+}
+
+static void testFailure() {
+  resetSteps(4);
+  // A slow worker step is still running when the failure happens
+  s_steps[0].delay = 50;
+  s_steps[0].succeed = false;
+  s_steps[2].delay = 200;
+
+  StartupGraph graph;
+  const TaskID fail = addStep(graph, "fail", 0, true);
+  const TaskID after = addStep(graph, "after", 1, false);
+  graph.addDependency(after, fail);
+  const TaskID slow = addStep(graph, "slow", 2, false);
+  const TaskID after_slow = addStep(graph, "after_slow", 3, true);
+  graph.addDependency(after_slow, slow);
+  graph.addDependency(after_slow, fail);
+
+  CHECK(!graph.run(2));
+  CHECK(s_steps[fail].ran);
+  CHECK(!s_steps[after].ran);
+  CHECK(!s_steps[after_slow].ran);
+  // run waited for it to finish
+  CHECK(s_steps[slow].ran && s_steps[slow].end > 0);
+}
+
+int main(int argc, char **argv) {
+  // Starts the clock the steps are timed with
+  if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_NOPARACHUTE) != 0) {
+    fprintf(stderr, "startup_graph_test: SDL_Init failed: %s\n", SDL_GetError());
+    return 1;
+  }
+  s_mutex = SDL_CreateMutex();
+  s_main_thread = SDL_ThreadID();
+
+  testOrder(2);
+  testOrder(0);
+  testParallel();
+  testFailure();
+
+  SDL_DestroyMutex(s_mutex);
+  SDL_Quit();
+
+  return checkResult("startup_graph_test");
+}